@@ -0,0 +1,314 @@
+#include "cubic.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+/// goodput of an iwp like sender over a simulated lossy bottleneck, with
+/// every fragment sent as soon as it is queued like before and with a cubic
+/// congestion window holding them back
+/// the sender retransmits like iwp, on a 3 fragment selective ack hole or
+/// an rto checked every 100ms, backed off only with the window
+/// the receiver acks every fragment like got_frag does, or like older
+/// peers that only ack every numfrags / 2 + 1 fragments and on completion
+/// usage: cubic-bench [messages] [fragments per message]
+
+static const size_t FragSize = 1024;
+
+struct bench_link
+{
+  /// bytes per ms through the bottleneck
+  double rate;
+  /// one way delay past the bottleneck in ms
+  uint64_t delay;
+  /// bottleneck buffer in bytes, drop tail past it
+  size_t limit;
+  /// percent of frames and acks lost on the way
+  double loss;
+};
+
+struct bench_frag
+{
+  uint64_t msg;
+  size_t idx;
+  uint64_t arrive;
+};
+
+struct bench_ack
+{
+  uint64_t msg;
+  uint32_t mask;
+  uint64_t arrive;
+};
+
+struct bench_msg
+{
+  std::vector< uint64_t > sentAt, sentSeq;
+  std::vector< uint8_t > tries;
+  std::vector< bool > acked;
+  size_t next     = 0;
+  size_t numacked = 0;
+};
+
+struct bench_result
+{
+  uint64_t ms;
+  uint64_t sent;
+  uint64_t dropped;
+  uint64_t retransmits;
+  double cwnd;
+};
+
+static bool
+lost(double pct)
+{
+  return rand() < pct / 100.0 * RAND_MAX;
+}
+
+/// true if a receiver acking like older peers acks a message once it has
+/// count of numfrags fragments
+static bool
+bench_old_ack(size_t count, size_t numfrags)
+{
+  return count == numfrags || count % (1 + numfrags / 2) == 0;
+}
+
+static bench_result
+bench_run(const bench_link &link, bool windowed, bool oldAcks,
+          size_t nummsgs, size_t numfrags)
+{
+  udap::util::Cubic cc(FragSize);
+  std::vector< bench_msg > msgs(nummsgs);
+  for(auto &m : msgs)
+  {
+    m.sentAt.resize(numfrags);
+    m.sentSeq.resize(numfrags);
+    m.tries.resize(numfrags);
+    m.acked.resize(numfrags);
+  }
+  std::deque< bench_frag > queue, wire;
+  std::deque< bench_ack > acks;
+  std::vector< uint32_t > rxmask(nummsgs);
+  bench_result result = {0, 0, 0, 0, 0};
+  size_t queued = 0, inflight = 0, done = 0, pending = 0;
+  uint64_t seq = 0, timeoutSeq = 0, samples = 0;
+  double credit = 0, srtt = 0, rttvar = 0, rto = 1000, cwndSum = 0;
+
+  auto send = [&](uint64_t now, size_t msg, size_t idx) {
+    auto &m = msgs[msg];
+    if(m.tries[idx] == 0)
+      inflight += FragSize;
+    else
+      ++result.retransmits;
+    ++m.tries[idx];
+    m.sentAt[idx]  = now;
+    m.sentSeq[idx] = seq++;
+    ++result.sent;
+    if(queued + FragSize > link.limit)
+    {
+      ++result.dropped;
+      return;
+    }
+    queued += FragSize;
+    queue.push_back({msg, idx, 0});
+  };
+  auto timeout = [&](uint8_t tries) {
+    double t = rto;
+    if(!windowed)
+      tries = 1;
+    for(uint8_t n = 1; n < tries && t < 3000; ++n)
+      t *= 2;
+    return uint64_t(t < 3000 ? t : 3000);
+  };
+
+  uint64_t now = 0;
+  for(; done < nummsgs && now < 600000; ++now)
+  {
+    // bottleneck
+    credit += link.rate;
+    while(queue.size() && credit >= FragSize)
+    {
+      credit -= FragSize;
+      queued -= FragSize;
+      auto f = queue.front();
+      queue.pop_front();
+      if(!lost(link.loss))
+      {
+        f.arrive = now + link.delay;
+        wire.push_back(f);
+      }
+    }
+    if(queue.empty() && credit > FragSize)
+      credit = FragSize;
+    // receiver acks with the mask so far
+    while(wire.size() && wire.front().arrive <= now)
+    {
+      auto f = wire.front();
+      wire.pop_front();
+      rxmask[f.msg] |= 1U << f.idx;
+      if(oldAcks
+         && !bench_old_ack(__builtin_popcount(rxmask[f.msg]), numfrags))
+        continue;
+      if(!lost(link.loss))
+        acks.push_back({f.msg, rxmask[f.msg], now + link.delay});
+    }
+    // sender
+    while(acks.size() && acks.front().arrive <= now)
+    {
+      auto a = acks.front();
+      acks.pop_front();
+      auto &m       = msgs[a.msg];
+      size_t before = m.numacked;
+      for(size_t idx = 0; idx < numfrags; ++idx)
+      {
+        if(!(a.mask & (1U << idx)) || m.acked[idx])
+          continue;
+        m.acked[idx] = true;
+        ++m.numacked;
+        inflight -= FragSize;
+        if(m.tries[idx] == 1)
+        {
+          double r = now - m.sentAt[idx];
+          if(samples++ == 0)
+          {
+            srtt   = r;
+            rttvar = r / 2;
+          }
+          else
+          {
+            rttvar = 0.75 * rttvar + 0.25 * (srtt > r ? srtt - r : r - srtt);
+            srtt   = 0.875 * srtt + 0.125 * r;
+          }
+          rto = srtt + 4 * rttvar;
+          rto = rto < 200 ? 200 : rto > 3000 ? 3000 : rto;
+        }
+      }
+      if(m.numacked == before)
+        continue;
+      cc.OnAck((m.numacked - before) * FragSize, now, srtt);
+      if(m.numacked == numfrags)
+      {
+        ++done;
+        continue;
+      }
+      for(size_t idx = 0; idx < m.next; ++idx)
+      {
+        if(m.acked[idx])
+          continue;
+        size_t later = 0, ackedLater = 0;
+        for(size_t other = 0; other < m.next; ++other)
+        {
+          if(m.sentSeq[other] <= m.sentSeq[idx])
+            continue;
+          ++later;
+          if(m.acked[other])
+            ++ackedLater;
+        }
+        if(ackedLater >= 3 || (later && ackedLater == later))
+        {
+          if(windowed)
+            cc.OnLoss(m.sentSeq[idx], seq);
+          send(now, a.msg, idx);
+        }
+      }
+    }
+    // session tick
+    if(now % 100 == 0)
+    {
+      bool timedout = false;
+      auto firstSeq = seq;
+      // including the one the window holds part of
+      for(size_t msg = 0; msg <= pending && msg < nummsgs; ++msg)
+      {
+        auto &m = msgs[msg];
+        for(size_t idx = 0; idx < m.next; ++idx)
+        {
+          if(m.acked[idx] || now < m.sentAt[idx] + timeout(m.tries[idx]))
+            continue;
+          timedout |= m.sentSeq[idx] >= timeoutSeq;
+          send(now, msg, idx);
+        }
+      }
+      if(timedout && windowed)
+      {
+        timeoutSeq = firstSeq;
+        cc.OnTimeout(seq);
+      }
+      cwndSum += cc.Window();
+    }
+    // new fragments
+    while(pending < nummsgs)
+    {
+      auto &m = msgs[pending];
+      while(m.next < numfrags && (!windowed || inflight < cc.Window()))
+        send(now, pending, m.next++);
+      if(m.next < numfrags)
+        break;
+      ++pending;
+    }
+  }
+  result.ms   = now;
+  result.cwnd = windowed ? cwndSum / (now / 100 + 1) : 0;
+  return result;
+}
+
+static void
+bench_print(const char *name, const bench_result &r, size_t bytes)
+{
+  printf("  %-18s %7.1f KB/s goodput  %6lu ms  %7lu sent  %6.1f%% dropped"
+         "  %6lu retransmits",
+         name, r.ms ? bytes / 1024.0 / (r.ms / 1000.0) : 0.0, r.ms, r.sent,
+         r.sent ? 100.0 * r.dropped / r.sent : 0.0, r.retransmits);
+  if(r.cwnd)
+    printf("  avg cwnd %.0f KB", r.cwnd / 1024);
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  size_t nummsgs = 200, numfrags = 32;
+  if(argc > 1)
+    nummsgs = atol(argv[1]);
+  if(argc > 2)
+    numfrags = atol(argv[2]);
+  if(numfrags == 0 || numfrags > 32)
+  {
+    printf("fragments per message must be 1 to 32\n");
+    return 1;
+  }
+  size_t bytes = nummsgs * numfrags * FragSize;
+  printf("%lu messages of %lu KB\n", nummsgs, numfrags * FragSize / 1024);
+
+  const bench_link links[] = {
+      // 1MB/s uplink
+      {1024, 25, 64 * 1024, 0},
+      {1024, 25, 64 * 1024, 1},
+      {1024, 100, 64 * 1024, 1},
+      {1024, 25, 64 * 1024, 5},
+      // 250KB/s uplink with a deep buffer
+      {256, 50, 256 * 1024, 1},
+  };
+  for(const auto &link : links)
+  {
+    printf("%.0f KB/s bottleneck, %lu ms rtt, %lu KB buffer, %.0f%% loss\n",
+           link.rate * 1000 / 1024, link.delay * 2, link.limit / 1024,
+           link.loss);
+    srand(1);
+    bench_print("unlimited",
+                bench_run(link, false, false, nummsgs, numfrags), bytes);
+    srand(1);
+    bench_print("cubic", bench_run(link, true, false, nummsgs, numfrags),
+                bytes);
+    // what a session to an older peer does, and the window it can't use
+    srand(1);
+    bench_print("unlimited old acks",
+                bench_run(link, false, true, nummsgs, numfrags), bytes);
+    srand(1);
+    bench_print("cubic old acks",
+                bench_run(link, true, true, nummsgs, numfrags), bytes);
+  }
+  return 0;
+}
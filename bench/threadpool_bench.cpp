@@ -0,0 +1,105 @@
+#include <udap/threadpool.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+/// compare jobs/sec and queue wait of the shared and work stealing pools
+/// usage: threadpool-bench [workers] [producers] [jobs]
+
+typedef std::chrono::steady_clock bench_clock;
+
+struct bench_job
+{
+  bench_clock::time_point queued;
+  uint64_t wait_ns;
+  std::atomic< size_t > *left;
+};
+
+static void
+bench_work(void *user)
+{
+  bench_job *job = static_cast< bench_job * >(user);
+  job->wait_ns   = std::chrono::duration_cast< std::chrono::nanoseconds >(
+                     bench_clock::now() - job->queued)
+                     .count();
+  // simulate a small frame crypto job
+  volatile uint64_t x = 0;
+  for(int i = 0; i < 2000; ++i)
+    x += i * x + 1;
+  --*job->left;
+}
+
+static void
+run_bench(const char *name, udap_threadpool *pool, size_t producers,
+          size_t numjobs)
+{
+  std::vector< bench_job > jobs(numjobs);
+  std::atomic< size_t > left(numjobs);
+  for(auto &job : jobs)
+    job.left = &left;
+
+  auto start = bench_clock::now();
+  std::vector< std::thread > threads;
+  for(size_t p = 0; p < producers; ++p)
+  {
+    threads.emplace_back([&, p]() {
+      for(size_t idx = p; idx < numjobs; idx += producers)
+      {
+        jobs[idx].queued = bench_clock::now();
+        udap_threadpool_queue_job(pool, {&jobs[idx], &bench_work});
+      }
+    });
+  }
+  for(auto &t : threads)
+    t.join();
+  while(left)
+    std::this_thread::yield();
+  auto dlt = std::chrono::duration_cast< std::chrono::microseconds >(
+                 bench_clock::now() - start)
+                 .count();
+
+  std::vector< uint64_t > waits;
+  waits.reserve(numjobs);
+  for(const auto &job : jobs)
+    waits.push_back(job.wait_ns);
+  std::sort(waits.begin(), waits.end());
+  auto p50 = waits[waits.size() / 2];
+  auto p99 = waits[(waits.size() * 99) / 100];
+  udap_threadpool_stats stats;
+  udap_threadpool_get_stats(pool, &stats);
+  printf("%-14s %10.0f jobs/sec  p50 wait %8lu ns  p99 wait %8lu ns  %lu allocs\n",
+         name, (numjobs * 1000000.0) / (dlt ? dlt : 1), (unsigned long)p50,
+         (unsigned long)p99, (unsigned long)stats.allocations);
+
+  udap_threadpool_stop(pool);
+  udap_threadpool_join(pool);
+  udap_free_threadpool(&pool);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int workers      = 4;
+  size_t producers = 2;
+  size_t numjobs   = 1000000;
+  if(argc > 1)
+    workers = atoi(argv[1]);
+  if(argc > 2)
+    producers = atoi(argv[2]);
+  if(argc > 3)
+    numjobs = atoi(argv[3]);
+  printf("%d workers, %lu producers, %lu jobs\n", workers,
+         (unsigned long)producers, (unsigned long)numjobs);
+  run_bench("shared", udap_init_threadpool(workers, "bench-shared"),
+            producers, numjobs);
+  run_bench("work-stealing",
+            udap_init_work_stealing_threadpool(workers, "bench-steal"),
+            producers, numjobs);
+  return 0;
+}
@@ -0,0 +1,123 @@
+#include <udap/threadpool.h>
+#include <udap/time.h>
+#include <udap/timer.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/// cost of timer operations with many live timers
+/// usage: timer-bench [timers]
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double
+ns_since(bench_clock::time_point start)
+{
+  return std::chrono::duration_cast< std::chrono::nanoseconds >(
+             bench_clock::now() - start)
+      .count();
+}
+
+static size_t fired = 0;
+
+static void
+bench_handler(void *, uint64_t, uint64_t)
+{
+  ++fired;
+}
+
+/// what a tick cost before, walking every timer in a map
+struct old_timer
+{
+  uint64_t started;
+  uint64_t timeout;
+};
+
+static void
+bench_map_walk(size_t num)
+{
+  std::unordered_map< uint32_t, old_timer * > timers;
+  std::vector< old_timer > storage(num);
+  auto now = udap_time_now_ms();
+  for(size_t idx = 0; idx < num; ++idx)
+  {
+    storage[idx] = {now, 1000 + uint64_t(rand() % 120000)};
+    timers[idx]  = &storage[idx];
+  }
+  const size_t ticks = 100;
+  size_t hit         = 0;
+  auto start         = bench_clock::now();
+  for(size_t tick = 0; tick < ticks; ++tick)
+  {
+    now = udap_time_now_ms();
+    for(const auto &item : timers)
+      if(now - item.second->started >= item.second->timeout)
+        ++hit;
+  }
+  printf("map walk (old tick)  %10.0f ns/tick (%lu hit)\n",
+         ns_since(start) / ticks, hit);
+}
+
+int
+main(int argc, char *argv[])
+{
+  size_t num = 100000;
+  if(argc > 1)
+    num = atol(argv[1]);
+  printf("%lu live timers\n", num);
+
+  udap_threadpool *pool   = udap_init_same_process_threadpool();
+  udap_timer_context *ctx = udap_init_timer();
+  std::vector< uint32_t > ids(num);
+
+  // far out timers, nothing fires during the bench
+  auto start = bench_clock::now();
+  for(size_t idx = 0; idx < num; ++idx)
+    ids[idx] = udap_timer_call_later(
+        ctx, {1000 + uint64_t(rand() % 120000), nullptr, &bench_handler});
+  printf("call_later           %10.0f ns/op\n", ns_since(start) / num);
+
+  const size_t ticks = 1000;
+  start              = bench_clock::now();
+  for(size_t tick = 0; tick < ticks; ++tick)
+    udap_timer_tick_all(ctx, pool);
+  printf("tick                 %10.0f ns/tick\n", ns_since(start) / ticks);
+  bench_map_walk(num);
+
+  start = bench_clock::now();
+  for(size_t idx = 0; idx < num; idx += 2)
+    udap_timer_remove_job(ctx, ids[idx]);
+  printf("remove               %10.0f ns/op\n", ns_since(start) / (num / 2));
+
+  start = bench_clock::now();
+  for(size_t idx = 1; idx < num; idx += 2)
+    udap_timer_cancel_job(ctx, ids[idx]);
+  udap_timer_tick_all(ctx, pool);
+  udap_threadpool_tick(pool);
+  printf("cancel and call      %10.0f ns/op (%lu called)\n",
+         ns_since(start) / (num / 2), fired);
+
+  // timers spread over the next second, tick every ms until all fire
+  fired = 0;
+  for(size_t idx = 0; idx < num; ++idx)
+    udap_timer_call_later(ctx,
+                          {uint64_t(rand() % 1000), nullptr, &bench_handler});
+  start = bench_clock::now();
+  while(fired < num)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    udap_timer_tick_all(ctx, pool);
+    udap_threadpool_tick(pool);
+  }
+  printf("expire               %10.0f ns/timer incl sleeps\n",
+         ns_since(start) / num);
+
+  udap_timer_stop(ctx);
+  udap_free_timer(&ctx);
+  udap_free_threadpool(&pool);
+  return 0;
+}
@@ -0,0 +1,138 @@
+#include <udap/ev.h>
+#include "ev.hpp"
+
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+/// send trains of equal size frames over loopback and compare syscalls and
+/// cpu time with and without udp segmentation / receive offload, on epoll
+/// and on io_uring where the kernel has it
+/// usage: udp-bench [trains] [frames per train] [frame size]
+
+struct bench_sink
+{
+  size_t got = 0;
+
+  static void
+  recv_many(udap_udp_io *udp, const udap_udp_datagram *, size_t n)
+  {
+    static_cast< bench_sink * >(udp->user)->got += n;
+  }
+
+  static void
+  recv(udap_udp_io *udp, const sockaddr *, const void *, ssize_t)
+  {
+    static_cast< bench_sink * >(udp->user)->got++;
+  }
+};
+
+static double
+cpu_seconds()
+{
+  rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+      + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static bool
+listen(udap_ev_loop *loop, udap_udp_io *udp, bench_sink *sink,
+       sockaddr_in *bound)
+{
+  memset(udp, 0, sizeof(*udp));
+  udp->user          = sink;
+  udp->recvfrom      = &bench_sink::recv;
+  udp->recvfrom_many = &bench_sink::recv_many;
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if(udap_ev_add_udp(loop, udp, (const sockaddr *)&addr) == -1)
+    return false;
+  int fd         = static_cast< udap::ev_io * >(udp->impl)->fd;
+  socklen_t slen = sizeof(*bound);
+  return getsockname(fd, (sockaddr *)bound, &slen) == 0;
+}
+
+static void
+run_bench(const char *backend, bool offload, size_t trains, size_t frames,
+          size_t size)
+{
+  udap_ev_loop *loop = nullptr;
+  if(!udap_ev_loop_alloc_backend(&loop, backend))
+  {
+    printf("%-8s not available\n", backend);
+    return;
+  }
+  udap_ev_loop_set_udp_offload(loop, offload);
+  udap_ev_loop_set_send_batch(loop, 64, 4096);
+  udap_ev_loop_set_recv_batch(loop, 64);
+  bench_sink txsink, rxsink;
+  udap_udp_io tx, rx;
+  sockaddr_in txaddr, rxaddr;
+  if(!listen(loop, &tx, &txsink, &txaddr)
+     || !listen(loop, &rx, &rxsink, &rxaddr))
+  {
+    printf("failed to bind loopback\n");
+    exit(1);
+  }
+  std::vector< char > frame(size, 'x');
+
+  double cpu = cpu_seconds();
+  auto start = std::chrono::steady_clock::now();
+  size_t sent = 0;
+  for(size_t t = 0; t < trains; ++t)
+  {
+    for(size_t f = 0; f < frames; ++f)
+      if(udap_ev_udp_sendto(&tx, (const sockaddr *)&rxaddr, frame.data(),
+                             frame.size())
+         != -1)
+        ++sent;
+    // one loop iteration per train, flushes the train and reads what came in
+    loop->tick(0);
+  }
+  // drain what is still in flight
+  for(size_t idle = 0; idle < 10 && rxsink.got < sent; ++idle)
+    loop->tick(10);
+  double secs = std::chrono::duration< double >(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+  cpu = cpu_seconds() - cpu;
+
+  udap_udp_stats txs, rxs;
+  udap_ev_udp_get_stats(&tx, &txs);
+  udap_ev_udp_get_stats(&rx, &rxs);
+  printf(
+      "%-8s %-10s sent=%zu got=%zu send calls=%llu recv calls=%llu "
+      "segmented=%llu coalesced=%llu cpu=%.3fs wall=%.3fs %.0f frames/cpu-s\n",
+      backend, offload ? "offload" : "no-offload", sent, rxsink.got,
+      (unsigned long long)txs.send_calls, (unsigned long long)rxs.recv_calls,
+      (unsigned long long)txs.send_segmented,
+      (unsigned long long)rxs.recv_coalesced, cpu, secs,
+      cpu > 0 ? rxsink.got / cpu : 0);
+
+  udap_ev_close_udp(&tx);
+  udap_ev_close_udp(&rx);
+  udap_ev_loop_free(&loop);
+}
+
+int
+main(int argc, char *argv[])
+{
+  size_t trains = argc > 1 ? atoi(argv[1]) : 20000;
+  size_t frames = argc > 2 ? atoi(argv[2]) : 32;
+  size_t size   = argc > 3 ? atoi(argv[3]) : 1100;
+  printf("%zu trains of %zu frames of %zu bytes over loopback\n", trains,
+         frames, size);
+  for(const char *backend : {"epoll", "io_uring"})
+  {
+    run_bench(backend, false, trains, frames, size);
+    run_bench(backend, true, trains, frames, size);
+  }
+  return 0;
+}
@@ -25,6 +25,7 @@ main(int argc, char *argv[])
   if(ctx)
   {
     signal(SIGINT, handle_signal);
+    signal(SIGUSR1, handle_signal);
     code = udap_main_run(ctx);
     udap_main_free(ctx);
   }
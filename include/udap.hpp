@@ -15,7 +15,30 @@ namespace udap
     ~Context();
 
     int num_nethreads   = 1;
+    int num_workers     = 2;
+    bool workStealing   = false;
     bool singleThreaded = false;
+    /// most jobs waiting for the workers, 0 for no limit
+    size_t workerQueueLimit = 0;
+    /// cpus to pin threads to, empty for no pinning
+    std::vector< int > workerCPUs;
+    std::vector< int > netCPUs;
+    std::vector< int > diskCPUs;
+    int logicCPU = -1;
+    /// datagrams read per syscall by net threads
+    size_t netRecvBatch = UDAP_EV_DEFAULT_RECV_BATCH;
+    /// datagrams sent per syscall and most waiting per listener
+    size_t netSendBatch = UDAP_EV_DEFAULT_SEND_BATCH;
+    size_t netSendQueue = UDAP_EV_DEFAULT_SEND_QUEUE;
+    /// use UDP_SEGMENT / UDP_GRO where the kernel has them
+    bool netUDPOffload = true;
+    /// udp socket buffer bytes, 0 for the kernel default
+    size_t netRcvBuf = 0;
+    size_t netSndBuf = 0;
+    /// event loop backend by name, empty for the platform default
+    std::string netBackend;
+    /// keep crypto jobs on the worker nearest the submitting net thread
+    bool cryptoLocality = false;
     std::vector< std::thread > netio_threads;
     udap_crypto crypto;
     udap_router *router                  = nullptr;
@@ -51,10 +74,24 @@ namespace udap
     void
     HandleSignal(int sig);
 
+    /// log job latency stats for all thread pools
+    void
+    DumpStats();
+
    private:
     void
     SigINT();
 
+    /// reads what HandleSignal wrote and acts on it outside the handler
+    void
+    SignalLoop();
+
+    static void
+    handle_reload(void *user);
+
+    static void
+    handle_dump_stats(void *user);
+
     bool
     ReloadConfig();
 
@@ -67,6 +104,10 @@ namespace udap
 
     std::string configfile;
 
+    /// HandleSignal writes signal numbers in, SignalLoop reads them
+    int sigpipe[2] = {-1, -1};
+    std::thread sigThread;
+
     std::ostream &out;
   };
 }
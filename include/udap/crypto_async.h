@@ -160,6 +160,10 @@ iwp_call_async_verify_session_start(struct udap_async_iwp *iwp,
 
 struct iwp_async_frame;
 
+/// biggest iwp frame, the largest datagram the event loop sends or receives
+/// without offload, big enough for 9000 byte jumbo frames
+#define IWP_MAX_FRAME_SIZE 9216
+
 /// internal wire protocol frame request
 typedef void (*iwp_async_frame_hook)(struct iwp_async_frame *);
 
@@ -178,10 +182,19 @@ struct iwp_async_frame
   size_t sz;
   /// result handler
   iwp_async_frame_hook hook;
-  /// memory holding the entire frame
-  byte_t buf[1500];
+  /// called when the frame is freed, NULL for nothing
+  iwp_async_frame_hook release;
+  /// the entire frame, inside pkt
+  byte_t *buf;
+  /// packet the frame is encrypted or decrypted in place in, inbound the
+  /// one it was received in, outbound one sized for it
+  struct udap_pkt *pkt;
 };
 
+/// free a frame and drop its packet
+void
+iwp_free_frame(struct iwp_async_frame *frame);
+
 /// synchronously decrypt a frame
 bool
 iwp_decrypt_frame(struct iwp_async_frame *frame);
@@ -191,15 +204,30 @@ bool
 iwp_encrypt_frame(struct iwp_async_frame *frame);
 
 /// decrypt iwp frame asynchronously
-void
+/// returns false if the workers are full, the caller still owns frame
+bool
 iwp_call_async_frame_decrypt(struct udap_async_iwp *iwp,
                              struct iwp_async_frame *frame);
 
 /// encrypt iwp frame asynchronously
-void
+/// returns false if the workers are full, the caller still owns frame
+bool
 iwp_call_async_frame_encrypt(struct udap_async_iwp *iwp,
                              struct iwp_async_frame *frame);
 
+/// decrypt n iwp frames asynchronously, queued to the workers as one batch
+/// returns how many of the first frames were queued, the caller still owns
+/// the rest
+size_t
+iwp_call_async_frame_decrypt_many(struct udap_async_iwp *iwp,
+                                  struct iwp_async_frame **frames, size_t n);
+
+/// encrypt n iwp frames asynchronously, queued to the workers as one batch
+/// returns how many of the first frames were queued
+size_t
+iwp_call_async_frame_encrypt_many(struct udap_async_iwp *iwp,
+                                  struct iwp_async_frame **frames, size_t n);
+
 #ifdef __cplusplus
 }
 #endif
@@ -6,6 +6,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <sys/socket.h>
+#include <udap/pkt.h>
 
 /**
  * ev.h
@@ -27,6 +28,11 @@ struct udap_ev_loop;
 void
 udap_ev_loop_alloc(struct udap_ev_loop **ev);
 
+/// allocate a loop on a named backend: epoll, io_uring or kqueue
+/// returns false and sets *ev to NULL if it is not available here
+bool
+udap_ev_loop_alloc_backend(struct udap_ev_loop **ev, const char *backend);
+
 // deallocator
 void
 udap_ev_loop_free(struct udap_ev_loop **ev);
@@ -35,6 +41,17 @@ udap_ev_loop_free(struct udap_ev_loop **ev);
 int
 udap_ev_loop_run(struct udap_ev_loop *ev);
 
+/// give each of n net threads its own sockets and event queue, udp
+/// addresses added after this are bound once per thread with SO_REUSEPORT
+/// so the kernel spreads flows across them
+/// returns false if the platform can't, every thread then shares one queue
+bool
+udap_ev_loop_set_shards(struct udap_ev_loop *ev, size_t n);
+
+/// run the loop for net thread idx
+int
+udap_ev_loop_run_shard(struct udap_ev_loop *ev, size_t idx);
+
 void
 udap_ev_loop_run_single_process(struct udap_ev_loop *ev,
                                  struct udap_threadpool *tp,
@@ -44,6 +61,56 @@ udap_ev_loop_run_single_process(struct udap_ev_loop *ev,
 void
 udap_ev_loop_stop(struct udap_ev_loop *ev);
 
+/// default most datagrams read per syscall
+#define UDAP_EV_DEFAULT_RECV_BATCH 32
+
+/// set how many datagrams udp listeners read per syscall where the platform
+/// can read more than one, only affects listeners added after this
+void
+udap_ev_loop_set_recv_batch(struct udap_ev_loop *ev, size_t batch);
+
+/// default most datagrams sent per syscall
+#define UDAP_EV_DEFAULT_SEND_BATCH 32
+/// default most datagrams waiting to be sent per listener
+#define UDAP_EV_DEFAULT_SEND_QUEUE 1024
+
+/// set how many datagrams udp listeners send per syscall and how many can be
+/// waiting, where the platform queues sends, only affects listeners added
+/// after this
+void
+udap_ev_loop_set_send_batch(struct udap_ev_loop *ev, size_t batch,
+                             size_t queue);
+
+/// let udp listeners added after this hand trains of equal size datagrams
+/// to the kernel in one send and take coalesced trains back (UDP_SEGMENT and
+/// UDP_GRO), on by default where the kernel supports it
+void
+udap_ev_loop_set_udp_offload(struct udap_ev_loop *ev, bool enable);
+
+/// ask for rcvbuf and sndbuf byte socket buffers (SO_RCVBUF, SO_SNDBUF) on
+/// udp sockets bound after this, 0 keeps the kernel default
+void
+udap_ev_loop_set_socket_buffers(struct udap_ev_loop *ev, size_t rcvbuf,
+                                 size_t sndbuf);
+
+/// log per listener counters
+void
+udap_ev_loop_dump_stats(struct udap_ev_loop *ev);
+
+/// one received datagram
+struct udap_udp_datagram
+{
+  const struct sockaddr *from;
+  const void *buf;
+  size_t sz;
+  /// packet buf was read into, udap_pkt_ref it to keep buf after the
+  /// callback, NULL if the backend reads into memory it reuses
+  struct udap_pkt *pkt;
+  /// when the kernel received it on the udap_time_now_ns clock, 0 if the
+  /// backend can't tell
+  uint64_t recv_ns;
+};
+
 /// UDP handling configuration
 struct udap_udp_io
 {
@@ -54,14 +121,59 @@ struct udap_udp_io
   void (*tick)(struct udap_udp_io *);
   void (*recvfrom)(struct udap_udp_io *, const struct sockaddr *, const void *,
                    ssize_t);
+  /// if set called once per batch of datagrams read together instead of
+  /// calling recvfrom for each one, buffers are only valid during the call
+  /// unless their packet is referenced
+  void (*recvfrom_many)(struct udap_udp_io *, const struct udap_udp_datagram *,
+                        size_t);
+};
+
+struct udap_udp_stats
+{
+  /// syscalls that returned datagrams
+  uint64_t recv_calls;
+  uint64_t recv_datagrams;
+  /// calls that filled the whole batch
+  uint64_t recv_full_batches;
+  /// most datagrams read by one call
+  uint64_t recv_max_batch;
+  /// datagrams that arrived coalesced into trains
+  uint64_t recv_coalesced;
+  uint64_t recv_bytes;
+  /// datagrams the kernel dropped because the socket buffer was full
+  uint64_t recv_kernel_drops;
+  /// datagrams that came with a kernel receive timestamp
+  uint64_t recv_stamped;
+  /// nanoseconds from the kernel receiving a datagram to us reading it
+  uint64_t recv_latency_p50;
+  uint64_t recv_latency_p99;
+  uint64_t recv_latency_max;
+  /// syscalls that sent datagrams
+  uint64_t send_calls;
+  uint64_t send_datagrams;
+  /// calls that sent a whole batch
+  uint64_t send_full_batches;
+  /// datagrams sent as part of a train
+  uint64_t send_segmented;
+  /// times the socket buffer was full
+  uint64_t send_blocked;
+  /// sends refused with EAGAIN because the queue was full
+  uint64_t send_rejected;
+  uint64_t send_bytes;
+  /// datagrams dropped because the kernel failed to send them
+  uint64_t send_errors;
 };
 
+void
+udap_ev_udp_get_stats(struct udap_udp_io *udp, struct udap_udp_stats *stats);
+
 /// add UDP handler
 int
 udap_ev_add_udp(struct udap_ev_loop *ev, struct udap_udp_io *udp,
                  const struct sockaddr *src);
 
 /// schedule UDP packet
+/// returns -1 with errno EAGAIN if too many packets are waiting to be sent
 int
 udap_ev_udp_sendto(struct udap_udp_io *udp, const struct sockaddr *to,
                     const void *data, size_t sz);
@@ -92,6 +92,8 @@ struct udap_link
   bool (*has_session_to)(struct udap_link *, const byte_t *);
   void (*mark_session_active)(struct udap_link *, struct udap_link_session *);
   void (*free_impl)(struct udap_link *);
+  /// log stats about the link and its sessions
+  void (*dump_stats)(struct udap_link *);
 };
 
 /** checks if all members are initialized */
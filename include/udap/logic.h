@@ -37,6 +37,42 @@ udap_logic_remove_call(struct udap_logic* logic, uint32_t id);
 void
 udap_logic_stop(struct udap_logic* logic);
 
+/// make udap_logic_mainloop return, timers no longer fire but queued jobs
+/// still run until udap_logic_stop
+void
+udap_logic_stop_mainloop(struct udap_logic* logic);
+
+/// fd readable when logic timers are due, -1 if not supported
+int
+udap_logic_timer_fd(struct udap_logic* logic);
+
+struct udap_logic_stats
+{
+  /// jobs queued with udap_logic_queue_job
+  uint64_t jobs;
+  /// batches drained by the logic thread
+  uint64_t drains;
+  /// jobs run per drain
+  uint64_t drain_p50;
+  uint64_t drain_p99;
+  uint64_t drain_max;
+  /// time jobs spent queued
+  uint64_t wait_p50_ns;
+  uint64_t wait_p99_ns;
+  uint64_t wait_max_ns;
+};
+
+void
+udap_logic_get_stats(struct udap_logic* logic, struct udap_logic_stats* stats);
+
+/// log latency stats for jobs run on the logic thread
+void
+udap_logic_dump_stats(struct udap_logic* logic);
+
+/// pin the logic thread to cpu
+bool
+udap_logic_set_affinity(struct udap_logic* logic, int cpu);
+
 void
 udap_logic_mainloop(struct udap_logic* logic);
 
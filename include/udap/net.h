@@ -14,6 +14,10 @@ extern "C" {
 bool
 udap_getifaddr(const char* ifname, int af, struct sockaddr* addr);
 
+/// mtu of a network interface, 0 if it can't be found
+int
+udap_getifmtu(const char* ifname);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,23 @@
+#ifndef UDAP_PKT_H
+#define UDAP_PKT_H
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// pooled, refcounted memory a datagram was read into
+struct udap_pkt;
+
+/// keep the packet's memory past the callback that handed it to us
+void
+udap_pkt_ref(struct udap_pkt *pkt);
+
+/// drop a reference, the last one gives the packet back to its pool
+void
+udap_pkt_unref(struct udap_pkt *pkt);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -1,5 +1,8 @@
 #ifndef UDAP_THREADPOOL_H
 #define UDAP_THREADPOOL_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -9,6 +12,10 @@ struct udap_threadpool;
 struct udap_threadpool *
 udap_init_threadpool(int workers, const char *name);
 
+/// each worker gets its own job queue, idle workers steal from busy ones
+struct udap_threadpool *
+udap_init_work_stealing_threadpool(int workers, const char *name);
+
 /// for single process mode
 struct udap_threadpool *
 udap_init_same_process_threadpool();
@@ -18,6 +25,15 @@ udap_free_threadpool(struct udap_threadpool **tp);
 
 typedef void (*udap_thread_work_func)(void *);
 
+/// job priority classes, lower values run first
+/// latency sensitive work like session handshakes
+#define UDAP_JOB_PRIO_HIGH 0
+/// bulk work like frame crypto, the default
+#define UDAP_JOB_PRIO_NORMAL 1
+/// background work like disk io
+#define UDAP_JOB_PRIO_LOW 2
+#define UDAP_JOB_NUM_PRIO 3
+
 /** job to be done in worker thread */
 struct udap_thread_job
 {
@@ -25,14 +41,22 @@ struct udap_thread_job
   void *user;
   /** called in threadpool worker thread */
   udap_thread_work_func work;
+  /** optional name to group stats under instead of the work function */
+  const char *label;
 
 #ifdef __cplusplus
 
-  udap_thread_job(void *u, udap_thread_work_func w) : user(u), work(w)
+  udap_thread_job(void *u, udap_thread_work_func w)
+      : user(u), work(w), label(nullptr)
   {
   }
 
-  udap_thread_job() : user(nullptr), work(nullptr)
+  udap_thread_job(void *u, udap_thread_work_func w, const char *l)
+      : user(u), work(w), label(l)
+  {
+  }
+
+  udap_thread_job() : user(nullptr), work(nullptr), label(nullptr)
   {
   }
 
@@ -43,10 +67,41 @@ struct udap_thread_job
 void
 udap_threadpool_tick(struct udap_threadpool *tp);
 
-void
+/// queue a job with normal priority
+/// returns false if the job was rejected because the queue is full or the
+/// pool is stopped, the job is not run and the caller still owns user
+bool
 udap_threadpool_queue_job(struct udap_threadpool *tp,
                            struct udap_thread_job j);
 
+/// queue a job in priority class prio
+bool
+udap_threadpool_queue_job_prio(struct udap_threadpool *tp,
+                                struct udap_thread_job j, int prio);
+
+/// queue n jobs at once, takes the queue lock once and only wakes as many
+/// workers as there are jobs
+/// returns how many of the first jobs were queued, the rest were rejected
+size_t
+udap_threadpool_queue_jobs(struct udap_threadpool *tp,
+                            const struct udap_thread_job *jobs, size_t n);
+
+/// queue n jobs at once in priority class prio
+size_t
+udap_threadpool_queue_jobs_prio(struct udap_threadpool *tp,
+                                 const struct udap_thread_job *jobs, size_t n,
+                                 int prio);
+
+/// limit the number of jobs waiting in the queue, further jobs are rejected
+/// 0 means no limit, the default
+void
+udap_threadpool_set_max_jobs(struct udap_threadpool *tp, size_t max);
+
+/// returns true if the queue is at its limit, lets callers shed work before
+/// building a job
+bool
+udap_threadpool_full(struct udap_threadpool *tp);
+
 void
 udap_threadpool_stop(struct udap_threadpool *tp);
 void
@@ -55,8 +110,117 @@ udap_threadpool_join(struct udap_threadpool *tp);
 void
 udap_threadpool_wait(struct udap_threadpool *tp);
 
+/// per priority class counters
+struct udap_threadpool_class_stats
+{
+  /// jobs queued since start
+  uint64_t jobs;
+  /// jobs currently waiting
+  uint64_t depth;
+  /// total time jobs spent waiting in the queue
+  uint64_t wait_ns;
+  /// longest time a job spent waiting in the queue
+  uint64_t max_wait_ns;
+};
+
+/// threadpool counters
+struct udap_threadpool_stats
+{
+  /// jobs queued since start
+  uint64_t jobs;
+  /// heap allocations made by the job queues since start
+  uint64_t allocations;
+  /// jobs rejected because the queue was full
+  uint64_t rejected;
+  struct udap_threadpool_class_stats classes[UDAP_JOB_NUM_PRIO];
+};
+
+void
+udap_threadpool_get_stats(struct udap_threadpool *tp,
+                           struct udap_threadpool_stats *stats);
+
+/// latency stats for one kind of job, jobs are grouped by label if they
+/// have one or by work function otherwise
+struct udap_threadpool_job_stats
+{
+  /// label or null
+  const char *label;
+  udap_thread_work_func work;
+  /// jobs run since start
+  uint64_t jobs;
+  /// jobs run per second since start
+  double jobs_per_sec;
+  /// total time spent running
+  uint64_t run_ns;
+  /// time spent waiting in the queue
+  uint64_t wait_p50_ns;
+  uint64_t wait_p90_ns;
+  uint64_t wait_p99_ns;
+  uint64_t wait_max_ns;
+  /// time spent running
+  uint64_t run_p50_ns;
+  uint64_t run_p90_ns;
+  uint64_t run_p99_ns;
+  uint64_t run_max_ns;
+};
+
+typedef void (*udap_threadpool_job_stats_visitor)(
+    void *user, const struct udap_threadpool_job_stats *stats);
+
+/// call visit for each kind of job the pool has run
+void
+udap_threadpool_visit_job_stats(struct udap_threadpool *tp, void *user,
+                                 udap_threadpool_job_stats_visitor visit);
+
+/// record latency stats for a job that ran inside another job on tp, like
+/// one of a batch, under its own label or work function
+void
+udap_threadpool_record_job(struct udap_threadpool *tp,
+                           struct udap_thread_job job, uint64_t wait_ns,
+                           uint64_t run_ns);
+
+/// log per job latency stats
+void
+udap_threadpool_dump_stats(struct udap_threadpool *tp);
+
+/// pin worker i to cpus[i % n], call before queueing jobs
+/// returns false if pinning is not supported or failed
+bool
+udap_threadpool_set_affinity(struct udap_threadpool *tp, const int *cpus,
+                              size_t n);
+
+/// queue jobs from non worker threads on the worker pinned nearest to the
+/// submitting cpu, so crypto for a net thread's sessions stays on its core
+/// needs a work stealing pool with affinity set, call before queueing jobs
+bool
+udap_threadpool_enable_locality(struct udap_threadpool *tp);
+
 #ifdef __cplusplus
 }
+
+/// queue a range of udap_thread_job, in batches of up to 64 jobs
+/// returns how many of the first jobs were queued
+template < typename Iter >
+size_t
+udap_threadpool_queue_jobs(struct udap_threadpool *tp, Iter begin, Iter end)
+{
+  udap_thread_job batch[64];
+  size_t n      = 0;
+  size_t queued = 0;
+  while(begin != end)
+  {
+    batch[n++] = *begin++;
+    if(n == sizeof(batch) / sizeof(batch[0]))
+    {
+      size_t ok = udap_threadpool_queue_jobs(tp, batch, n);
+      queued += ok;
+      if(ok < n)
+        return queued;
+      n = 0;
+    }
+  }
+  return queued + udap_threadpool_queue_jobs(tp, batch, n);
+}
 #endif
 
 #endif
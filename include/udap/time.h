@@ -10,6 +10,10 @@ udap_time_now_ms();
 udap_seconds_t
 udap_time_now_sec();
 
+/// monotonic time in nanoseconds, for measuring short intervals
+udap_time_t
+udap_time_now_ns();
+
 #ifdef __cplusplus
 }
 #endif
@@ -35,6 +35,11 @@ udap_timer_remove_job(struct udap_timer_context *t, uint32_t id);
 void
 udap_timer_stop(struct udap_timer_context *t);
 
+/// fd that is readable when timers are due, for adding to an event loop
+/// ticking clears it, -1 if not supported on this platform
+int
+udap_timer_fd(struct udap_timer_context *t);
+
 // blocking run timer and send events to thread pool
 void
 udap_timer_run(struct udap_timer_context *t, struct udap_threadpool *pool);
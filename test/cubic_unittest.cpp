@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+#include "cubic.hpp"
+
+using udap::util::Cubic;
+
+TEST(CubicTest, TestSlowStartDoublesPerRoundTrip)
+{
+  Cubic cc(1000);
+  ASSERT_EQ(cc.Window(), Cubic::InitialSegments * 1000);
+  ASSERT_TRUE(cc.InSlowStart());
+  // a whole window acked grows it by as much again
+  cc.OnAck(cc.Window(), 100, 50);
+  ASSERT_EQ(cc.Window(), 2 * Cubic::InitialSegments * 1000);
+};
+
+TEST(CubicTest, TestLossCutsOncePerWindow)
+{
+  Cubic cc(1000);
+  cc.OnAck(90 * 1000, 100, 50);
+  ASSERT_EQ(cc.Window(), 100 * 1000);
+  // lost something sent at 10, we had sent up to 200
+  ASSERT_TRUE(cc.OnLoss(10, 200));
+  ASSERT_EQ(cc.Window(), 70 * 1000);
+  ASSERT_FALSE(cc.InSlowStart());
+  // more losses from the same window change nothing
+  ASSERT_FALSE(cc.OnLoss(150, 210));
+  ASSERT_EQ(cc.Window(), 70 * 1000);
+  // one sent after the cut does
+  ASSERT_TRUE(cc.OnLoss(200, 300));
+  ASSERT_LT(cc.Window(), 70 * 1000);
+};
+
+TEST(CubicTest, TestRegrowsToWindowBeforeLoss)
+{
+  Cubic cc(1000);
+  cc.OnAck(90 * 1000, 100, 50);
+  cc.OnLoss(0, 1);
+  // ack a window every 500ms rtt, long enough that the cubic curve grows
+  // faster than reno would
+  uint64_t now = 1000;
+  while(now < 21000 && cc.Window() < 100 * 1000)
+  {
+    cc.OnAck(cc.Window(), now, 500);
+    now += 500;
+  }
+  ASSERT_GE(cc.Window(), 100 * 1000);
+  // K = cbrt(100 * 0.3 / 0.4) is a bit over 4 seconds, less the rtt
+  ASSERT_GT(now, 1000 + 3000);
+  ASSERT_LT(now, 1000 + 6000);
+};
+
+TEST(CubicTest, TestTimeoutStartsOver)
+{
+  Cubic cc(1000);
+  cc.OnAck(90 * 1000, 100, 50);
+  cc.OnTimeout(100);
+  ASSERT_EQ(cc.Window(), Cubic::MinSegments * 1000);
+  ASSERT_TRUE(cc.InSlowStart());
+  // losses of what was out before the timeout were already handled
+  ASSERT_FALSE(cc.OnLoss(50, 120));
+  // slow start again up to 70 segments
+  for(int round = 0; round < 10; ++round)
+    cc.OnAck(cc.Window(), 200 + round * 50, 50);
+  ASSERT_FALSE(cc.InSlowStart());
+  ASSERT_GE(cc.Window(), 70 * 1000);
+};
+
+TEST(CubicTest, TestWindowBounds)
+{
+  Cubic cc(1000, 50 * 1000);
+  for(int round = 0; round < 20; ++round)
+    cc.OnAck(cc.Window(), 100 + round * 50, 50);
+  ASSERT_EQ(cc.Window(), 50 * 1000);
+  for(uint64_t seq = 0; seq < 100; ++seq)
+    cc.OnLoss(seq * 10, seq * 10 + 1);
+  ASSERT_EQ(cc.Window(), Cubic::MinSegments * 1000);
+};
@@ -0,0 +1,579 @@
+#include <gtest/gtest.h>
+#include <udap/ev.h>
+#include <udap/time.h>
+#include "ev.hpp"
+#ifdef __linux__
+#include "ev_epoll.hpp"
+#endif
+
+#include <arpa/inet.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct DatagramSink
+{
+  std::vector< std::string > got;
+  std::vector< size_t > batches;
+  /// when the kernel got each one, from recvfrom_many
+  std::vector< uint64_t > stamps;
+  /// bytes in the packet behind each one, from recvfrom_many
+  std::vector< size_t > caps;
+
+  static void
+  RecvMany(udap_udp_io *udp, const udap_udp_datagram *datagrams, size_t n)
+  {
+    DatagramSink *self = static_cast< DatagramSink * >(udp->user);
+    self->batches.push_back(n);
+    for(size_t idx = 0; idx < n; ++idx)
+    {
+      self->got.emplace_back((const char *)datagrams[idx].buf,
+                             datagrams[idx].sz);
+      self->stamps.push_back(datagrams[idx].recv_ns);
+      self->caps.push_back(datagrams[idx].pkt ? datagrams[idx].pkt->cap : 0);
+    }
+  }
+
+  static void
+  Recv(udap_udp_io *udp, const sockaddr *, const void *buf, ssize_t sz)
+  {
+    DatagramSink *self = static_cast< DatagramSink * >(udp->user);
+    self->batches.push_back(1);
+    self->got.emplace_back((const char *)buf, sz);
+  }
+};
+
+class EvTest : public ::testing::Test
+{
+ public:
+  udap_ev_loop *loop = nullptr;
+  udap_udp_io udp;
+  DatagramSink sink;
+  sockaddr_in bound;
+
+  void
+  SetUp()
+  {
+    udap_ev_loop_alloc(&loop);
+    memset(&udp, 0, sizeof(udp));
+    udp.user     = &sink;
+    udp.recvfrom = &DatagramSink::Recv;
+  }
+
+  void
+  TearDown()
+  {
+    udap_ev_close_udp(&udp);
+    udap_ev_loop_free(&loop);
+  }
+
+  void
+  Listen()
+  {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(udap_ev_add_udp(loop, &udp, (const sockaddr *)&addr), 0);
+    int fd = static_cast< udap::ev_io * >(udp.impl)->fd;
+#ifdef __linux__
+    auto group = dynamic_cast< udap::udp_group * >((udap::ev_io *)udp.impl);
+    if(group)
+      fd = group->members[0]->fd;
+#endif
+    socklen_t slen = sizeof(bound);
+    ASSERT_EQ(getsockname(fd, (sockaddr *)&bound, &slen), 0);
+  }
+
+  void
+  Send(size_t n)
+  {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    for(size_t idx = 0; idx < n; ++idx)
+    {
+      std::string msg = "datagram " + std::to_string(idx);
+      sendto(fd, msg.data(), msg.size(), 0, (const sockaddr *)&bound,
+             sizeof(bound));
+    }
+    close(fd);
+  }
+
+#ifdef __linux__
+  /// close the socket while two shards read from it
+  void
+  CloseWhileShardsRun();
+#endif
+};
+
+#ifdef __linux__
+TEST_F(EvTest, TestRecvBatches)
+{
+  udap_ev_loop_set_recv_batch(loop, 4);
+  udp.recvfrom_many = &DatagramSink::RecvMany;
+  Listen();
+  Send(10);
+  for(size_t tries = 0; tries < 10 && sink.got.size() < 10; ++tries)
+    loop->tick(100);
+
+  ASSERT_EQ(sink.got.size(), 10);
+  for(size_t idx = 0; idx < sink.got.size(); ++idx)
+    ASSERT_EQ(sink.got[idx], "datagram " + std::to_string(idx));
+  for(auto n : sink.batches)
+    ASSERT_LE(n, 4);
+
+  udap_udp_stats stats;
+  udap_ev_udp_get_stats(&udp, &stats);
+  ASSERT_EQ(stats.recv_datagrams, 10);
+  ASSERT_EQ(stats.recv_calls, sink.batches.size());
+  ASSERT_GE(stats.recv_full_batches, 2);
+  ASSERT_EQ(stats.recv_max_batch, 4);
+};
+
+TEST_F(EvTest, TestKernelTimestampsAndBytes)
+{
+  udp.recvfrom_many = &DatagramSink::RecvMany;
+  Listen();
+  uint64_t before = udap_time_now_ns();
+  Send(10);
+  for(size_t tries = 0; tries < 10 && sink.got.size() < 10; ++tries)
+    loop->tick(100);
+  ASSERT_EQ(sink.got.size(), 10);
+  uint64_t after = udap_time_now_ns();
+  size_t bytes   = 0;
+  for(size_t idx = 0; idx < sink.got.size(); ++idx)
+  {
+    bytes += sink.got[idx].size();
+    // converted to our clock, allow for the wall clock's resolution
+    ASSERT_GT(sink.stamps[idx], 0);
+    ASSERT_GE(sink.stamps[idx] + 1000000, before);
+    ASSERT_LE(sink.stamps[idx], after);
+  }
+
+  udap_udp_stats stats;
+  udap_ev_udp_get_stats(&udp, &stats);
+  ASSERT_EQ(stats.recv_bytes, bytes);
+  ASSERT_EQ(stats.recv_stamped, 10);
+  ASSERT_LE(stats.recv_latency_p50, stats.recv_latency_max);
+  ASSERT_LE(stats.recv_latency_max, after - before + 1000000);
+  ASSERT_EQ(stats.recv_kernel_drops, 0);
+};
+
+TEST_F(EvTest, TestKernelDropsCounted)
+{
+  // smallest buffer the kernel allows so a burst overflows it
+  udap_ev_loop_set_socket_buffers(loop, 1, 0);
+  udp.recvfrom_many = &DatagramSink::RecvMany;
+  Listen();
+  Send(500);
+  for(size_t tries = 0; tries < 3; ++tries)
+    loop->tick(10);
+  size_t burst = sink.got.size();
+  ASSERT_LT(burst, 500);
+  // the kernel tells us the drop count with the next datagram it queues
+  Send(1);
+  for(size_t tries = 0; tries < 10 && sink.got.size() == burst; ++tries)
+    loop->tick(100);
+  ASSERT_EQ(sink.got.size(), burst + 1);
+
+  udap_udp_stats stats;
+  udap_ev_udp_get_stats(&udp, &stats);
+  ASSERT_EQ(stats.recv_kernel_drops, 500 - burst);
+  ASSERT_EQ(stats.recv_datagrams, sink.got.size());
+};
+#endif
+
+#ifdef __linux__
+/// keeps every datagram's packet past the callback
+struct PacketSink
+{
+  std::vector< udap_pkt * > pkts;
+  std::vector< udap_udp_datagram > kept;
+
+  static void
+  RecvMany(udap_udp_io *udp, const udap_udp_datagram *datagrams, size_t n)
+  {
+    PacketSink *self = static_cast< PacketSink * >(udp->user);
+    for(size_t idx = 0; idx < n; ++idx)
+    {
+      udap_pkt_ref(datagrams[idx].pkt);
+      self->pkts.push_back(datagrams[idx].pkt);
+      self->kept.push_back(datagrams[idx]);
+    }
+  }
+};
+
+TEST_F(EvTest, TestKeptPacketsSurviveLaterReads)
+{
+  PacketSink keep;
+  udap_ev_loop_set_recv_batch(loop, 4);
+  // without gro every datagram has a packet of its own
+  udap_ev_loop_set_udp_offload(loop, false);
+  udp.user          = &keep;
+  udp.recvfrom_many = &PacketSink::RecvMany;
+  Listen();
+  Send(10);
+  for(size_t tries = 0; tries < 10 && keep.kept.size() < 10; ++tries)
+    loop->tick(100);
+
+  ASSERT_EQ(keep.kept.size(), 10);
+  std::set< udap_pkt * > distinct(keep.pkts.begin(), keep.pkts.end());
+  ASSERT_EQ(distinct.size(), 10);
+  for(size_t idx = 0; idx < keep.kept.size(); ++idx)
+    ASSERT_EQ(std::string((const char *)keep.kept[idx].buf,
+                          keep.kept[idx].sz),
+              "datagram " + std::to_string(idx));
+  for(auto pkt : keep.pkts)
+    udap_pkt_unref(pkt);
+};
+#endif
+
+TEST_F(EvTest, TestRecvWithoutBatchCallback)
+{
+  Listen();
+  Send(3);
+  for(size_t tries = 0; tries < 10 && sink.got.size() < 3; ++tries)
+    loop->tick(100);
+
+  ASSERT_EQ(sink.got.size(), 3);
+  ASSERT_EQ(sink.got[2], "datagram 2");
+};
+
+#ifdef __linux__
+TEST_F(EvTest, TestSendBatchedUntilFlush)
+{
+  udap_ev_loop_set_send_batch(loop, 4, 16);
+  // one datagram per message
+  udap_ev_loop_set_udp_offload(loop, false);
+  Listen();
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in peer;
+  memset(&peer, 0, sizeof(peer));
+  peer.sin_family      = AF_INET;
+  peer.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(bind(fd, (const sockaddr *)&peer, sizeof(peer)), 0);
+  socklen_t slen = sizeof(peer);
+  ASSERT_EQ(getsockname(fd, (sockaddr *)&peer, &slen), 0);
+
+  char buf[64];
+  // a full batch goes out straight away, the rest waits for the loop
+  for(size_t idx = 0; idx < 6; ++idx)
+  {
+    std::string msg = "datagram " + std::to_string(idx);
+    ASSERT_EQ(udap_ev_udp_sendto(&udp, (const sockaddr *)&peer, msg.data(),
+                                  msg.size()),
+              msg.size());
+  }
+  for(size_t idx = 0; idx < 4; ++idx)
+    ASSERT_GT(recv(fd, buf, sizeof(buf), MSG_DONTWAIT), 0);
+  ASSERT_EQ(recv(fd, buf, sizeof(buf), MSG_DONTWAIT), -1);
+
+  loop->tick(100);
+  for(size_t idx = 4; idx < 6; ++idx)
+  {
+    ssize_t got = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+    ASSERT_GT(got, 0);
+    ASSERT_EQ(std::string(buf, got), "datagram " + std::to_string(idx));
+  }
+  close(fd);
+
+  udap_udp_stats stats;
+  udap_ev_udp_get_stats(&udp, &stats);
+  ASSERT_EQ(stats.send_calls, 2);
+  ASSERT_EQ(stats.send_datagrams, 6);
+  ASSERT_EQ(stats.send_full_batches, 1);
+  ASSERT_EQ(stats.send_rejected, 0);
+};
+#endif
+
+#ifdef __linux__
+struct ShardSink
+{
+  std::mutex mtx;
+  /// source port to the threads that saw it
+  std::map< uint16_t, std::set< std::thread::id > > seen;
+  std::atomic< size_t > got;
+
+  ShardSink() : got(0)
+  {
+  }
+
+  static void
+  Recv(udap_udp_io *udp, const sockaddr *from, const void *, ssize_t)
+  {
+    ShardSink *self = static_cast< ShardSink * >(udp->user);
+    uint16_t port   = ntohs(((const sockaddr_in *)from)->sin_port);
+    {
+      std::unique_lock< std::mutex > lock(self->mtx);
+      self->seen[port].insert(std::this_thread::get_id());
+    }
+    self->got++;
+  }
+};
+
+TEST_F(EvTest, TestShardsShareFlowsByPeer)
+{
+  ShardSink shards;
+  udp.user     = &shards;
+  udp.recvfrom = &ShardSink::Recv;
+  ASSERT_TRUE(udap_ev_loop_set_shards(loop, 2));
+  Listen();
+  std::vector< std::thread > threads;
+  for(size_t idx = 0; idx < 2; ++idx)
+    threads.emplace_back([&, idx]() { udap_ev_loop_run_shard(loop, idx); });
+
+  const size_t peers = 32, each = 8;
+  std::vector< int > fds;
+  for(size_t p = 0; p < peers; ++p)
+    fds.push_back(socket(AF_INET, SOCK_DGRAM, 0));
+  for(size_t n = 0; n < each; ++n)
+    for(int fd : fds)
+      sendto(fd, "x", 1, 0, (const sockaddr *)&bound, sizeof(bound));
+  auto start = std::chrono::steady_clock::now();
+  while(shards.got < peers * each
+        && std::chrono::steady_clock::now() - start < std::chrono::seconds(2))
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  udap_ev_loop_stop(loop);
+  for(auto &t : threads)
+    t.join();
+  for(int fd : fds)
+    close(fd);
+
+  ASSERT_EQ(shards.got, peers * each);
+  ASSERT_EQ(shards.seen.size(), peers);
+  std::set< std::thread::id > used;
+  for(const auto &item : shards.seen)
+  {
+    // a peer's flow always lands on the same net thread
+    ASSERT_EQ(item.second.size(), 1);
+    used.insert(*item.second.begin());
+  }
+  ASSERT_EQ(used.size(), 2);
+
+  udap_udp_stats stats;
+  udap_ev_udp_get_stats(&udp, &stats);
+  ASSERT_EQ(stats.recv_datagrams, peers * each);
+};
+#endif
+
+#ifdef __linux__
+void
+EvTest::CloseWhileShardsRun()
+{
+  ShardSink shards;
+  udp.user     = &shards;
+  udp.recvfrom = &ShardSink::Recv;
+  ASSERT_TRUE(udap_ev_loop_set_shards(loop, 2));
+  Listen();
+  std::vector< std::thread > threads;
+  for(size_t idx = 0; idx < 2; ++idx)
+    threads.emplace_back([&, idx]() { udap_ev_loop_run_shard(loop, idx); });
+
+  // keep both shards reading while we close under them
+  std::atomic< bool > sending(true);
+  std::thread sender([&]() {
+    std::vector< int > fds;
+    for(size_t p = 0; p < 16; ++p)
+      fds.push_back(socket(AF_INET, SOCK_DGRAM, 0));
+    while(sending)
+      for(int fd : fds)
+        sendto(fd, "x", 1, 0, (const sockaddr *)&bound, sizeof(bound));
+    for(int fd : fds)
+      close(fd);
+  });
+  while(shards.got < 100)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  udap_ev_close_udp(&udp);
+  size_t got = shards.got;
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  sending = false;
+  sender.join();
+  size_t after = shards.got;
+  udap_ev_loop_stop(loop);
+  for(auto &t : threads)
+    t.join();
+
+  ASSERT_EQ(udp.impl, nullptr);
+  // both shards dropped the socket before the close returned
+  ASSERT_EQ(after, got);
+}
+
+TEST_F(EvTest, TestCloseWhileShardsRun)
+{
+  CloseWhileShardsRun();
+};
+
+TEST_F(EvTest, TestUringCloseWhileShardsRun)
+{
+  udap_ev_loop_free(&loop);
+  // older kernels and sandboxes without io_uring
+  if(!udap_ev_loop_alloc_backend(&loop, "io_uring"))
+  {
+    udap_ev_loop_alloc(&loop);
+    return;
+  }
+  CloseWhileShardsRun();
+};
+#endif
+
+#ifdef __linux__
+TEST_F(EvTest, TestOffloadTrainsRoundTrip)
+{
+  Listen();
+  auto sender = static_cast< udap::udp_listener * >(udp.impl);
+  // the receiver is another listener on the same loop
+  udap_udp_io rx;
+  memset(&rx, 0, sizeof(rx));
+  DatagramSink got;
+  rx.user          = &got;
+  rx.recvfrom      = &DatagramSink::Recv;
+  rx.recvfrom_many = &DatagramSink::RecvMany;
+  sockaddr_in addr = bound;
+  addr.sin_port    = 0;
+  ASSERT_EQ(udap_ev_add_udp(loop, &rx, (const sockaddr *)&addr), 0);
+  int fd         = static_cast< udap::ev_io * >(rx.impl)->fd;
+  socklen_t slen = sizeof(addr);
+  ASSERT_EQ(getsockname(fd, (sockaddr *)&addr, &slen), 0);
+
+  // a train of equal frames and a short one to end it
+  std::vector< std::string > sent;
+  for(size_t idx = 0; idx < 10; ++idx)
+    sent.emplace_back(1100, 'a' + idx);
+  sent.emplace_back(100, 'z');
+  for(const auto &msg : sent)
+    ASSERT_EQ(udap_ev_udp_sendto(&udp, (const sockaddr *)&addr, msg.data(),
+                                  msg.size()),
+              msg.size());
+  for(size_t tries = 0; tries < 10 && got.got.size() < sent.size(); ++tries)
+    loop->tick(100);
+  ASSERT_EQ(got.got, sent);
+  auto receiver = static_cast< udap::udp_listener * >(rx.impl);
+  if(receiver->gro)
+  {
+    // frames kept from a train don't hold on to the whole train buffer
+    size_t train = udap::udp_listener::MaxTrain;
+    for(auto cap : got.caps)
+      ASSERT_LT(cap, train);
+  }
+
+  udap_udp_stats tx, rxs;
+  udap_ev_udp_get_stats(&udp, &tx);
+  udap_ev_udp_get_stats(&rx, &rxs);
+  udap_ev_close_udp(&rx);
+  ASSERT_EQ(tx.send_datagrams, sent.size());
+  ASSERT_EQ(rxs.recv_datagrams, sent.size());
+  if(sender->gso)
+  {
+    // the whole train went in one message
+    ASSERT_EQ(tx.send_calls, 1);
+    ASSERT_EQ(tx.send_segmented, sent.size());
+  }
+};
+#endif
+
+#ifdef __linux__
+TEST_F(EvTest, TestJumboDatagramsRoundTrip)
+{
+  Listen();
+  udap_udp_io rx;
+  memset(&rx, 0, sizeof(rx));
+  DatagramSink got;
+  rx.user          = &got;
+  rx.recvfrom      = &DatagramSink::Recv;
+  rx.recvfrom_many = &DatagramSink::RecvMany;
+  sockaddr_in addr = bound;
+  addr.sin_port    = 0;
+  ASSERT_EQ(udap_ev_add_udp(loop, &rx, (const sockaddr *)&addr), 0);
+  int fd         = static_cast< udap::ev_io * >(rx.impl)->fd;
+  socklen_t slen = sizeof(addr);
+  ASSERT_EQ(getsockname(fd, (sockaddr *)&addr, &slen), 0);
+
+  // jumbo frames, a train of them and ones around the send slot size
+  size_t max = udap::udp_listener::MaxDatagram;
+  std::vector< std::string > sent;
+  for(size_t idx = 0; idx < 4; ++idx)
+    sent.emplace_back(8972, 'a' + idx);
+  sent.emplace_back(max, 'm');
+  sent.emplace_back(100, 'z');
+  sent.emplace_back(3000, 'y');
+  for(const auto &msg : sent)
+    ASSERT_EQ(udap_ev_udp_sendto(&udp, (const sockaddr *)&addr, msg.data(),
+                                  msg.size()),
+              msg.size());
+  std::string big(max + 1, 'x');
+  ASSERT_EQ(udap_ev_udp_sendto(&udp, (const sockaddr *)&addr, big.data(),
+                                big.size()),
+            -1);
+  ASSERT_EQ(errno, EMSGSIZE);
+  for(size_t tries = 0; tries < 10 && got.got.size() < sent.size(); ++tries)
+    loop->tick(100);
+  udap_ev_close_udp(&rx);
+  ASSERT_EQ(got.got, sent);
+  // whole, in packets of their own or the one they were read into
+  for(size_t idx = 0; idx < sent.size(); ++idx)
+    ASSERT_GE(got.caps[idx], sent[idx].size());
+};
+
+TEST_F(EvTest, TestUringRecvAndSend)
+{
+  udap_ev_loop_free(&loop);
+  // older kernels and sandboxes without io_uring
+  if(!udap_ev_loop_alloc_backend(&loop, "io_uring"))
+  {
+    udap_ev_loop_alloc(&loop);
+    return;
+  }
+  udap_ev_loop_set_recv_batch(loop, 4);
+  udp.recvfrom_many = &DatagramSink::RecvMany;
+  Listen();
+  Send(10);
+  for(size_t tries = 0; tries < 10 && sink.got.size() < 10; ++tries)
+    loop->tick(100);
+  ASSERT_EQ(sink.got.size(), 10);
+  for(size_t idx = 0; idx < sink.got.size(); ++idx)
+    ASSERT_EQ(sink.got[idx], "datagram " + std::to_string(idx));
+  for(auto n : sink.batches)
+    ASSERT_LE(n, 4);
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in peer;
+  memset(&peer, 0, sizeof(peer));
+  peer.sin_family      = AF_INET;
+  peer.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(bind(fd, (const sockaddr *)&peer, sizeof(peer)), 0);
+  socklen_t slen = sizeof(peer);
+  ASSERT_EQ(getsockname(fd, (sockaddr *)&peer, &slen), 0);
+  for(size_t idx = 0; idx < 6; ++idx)
+  {
+    std::string msg = "datagram " + std::to_string(idx);
+    ASSERT_EQ(udap_ev_udp_sendto(&udp, (const sockaddr *)&peer, msg.data(),
+                                  msg.size()),
+              msg.size());
+  }
+  // nothing goes out until the loop submits
+  loop->tick(100);
+  char buf[64];
+  for(size_t idx = 0; idx < 6; ++idx)
+  {
+    ssize_t got = recv(fd, buf, sizeof(buf), 0);
+    ASSERT_GT(got, 0);
+    ASSERT_EQ(std::string(buf, got), "datagram " + std::to_string(idx));
+  }
+  close(fd);
+
+  udap_udp_stats stats;
+  udap_ev_udp_get_stats(&udp, &stats);
+  ASSERT_EQ(stats.recv_datagrams, 10);
+  ASSERT_EQ(stats.recv_stamped, 10);
+  ASSERT_EQ(stats.send_datagrams, 6);
+  ASSERT_EQ(stats.send_bytes, 6 * std::string("datagram 0").size());
+  ASSERT_EQ(stats.send_rejected, 0);
+  ASSERT_EQ(stats.send_errors, 0);
+};
+#endif
@@ -0,0 +1,30 @@
+#include <gtest/gtest.h>
+#include "histogram.hpp"
+
+using udap::util::Histogram;
+
+TEST(HistogramTest, TestBucketBounds)
+{
+  for(size_t idx = 0; idx + 1 < Histogram::NumBuckets; ++idx)
+  {
+    ASSERT_EQ(Histogram::Bucket(Histogram::Lowest(idx)), idx);
+    ASSERT_EQ(Histogram::Bucket(Histogram::Highest(idx)), idx);
+    ASSERT_EQ(Histogram::Highest(idx) + 1, Histogram::Lowest(idx + 1));
+  }
+  ASSERT_EQ(Histogram::Bucket(UINT64_MAX), Histogram::NumBuckets - 1);
+};
+
+TEST(HistogramTest, TestPercentiles)
+{
+  Histogram h;
+  ASSERT_EQ(h.Percentile(50), 0);
+  for(uint64_t val = 1; val <= 1000; ++val)
+    h.Record(val * 1000);
+  ASSERT_EQ(h.Count(), 1000);
+  ASSERT_EQ(h.Max(), 1000000);
+  ASSERT_EQ(h.Sum(), 500500000);
+  // within the bucket precision of 1/8
+  ASSERT_NEAR(h.Percentile(50), 500000, 500000 / 8);
+  ASSERT_NEAR(h.Percentile(99), 990000, 990000 / 8);
+  ASSERT_EQ(h.Percentile(100), 1000000);
+};
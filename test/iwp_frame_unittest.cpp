@@ -0,0 +1,540 @@
+#include <gtest/gtest.h>
+#include <udap/crypto.h>
+#include <udap/time.h>
+#include "iwp_frame.hpp"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using frame_state = iwp::frame_state;
+
+/// one end of a session, what its frame_state hands up
+struct FramePeer
+{
+  frame_state frame;
+  iwp::xmit_stats stats;
+  std::vector< std::string > got;
+
+  static bool
+  Recv(void *user, uint64_t, udap_buffer_t msg)
+  {
+    FramePeer *self = static_cast< FramePeer * >(user);
+    self->got.emplace_back((const char *)msg.base, msg.sz);
+    return true;
+  }
+
+  /// frames queued to go out, taken off the send queue
+  std::vector< iwp::sendbuf_t * >
+  Take()
+  {
+    std::vector< iwp::sendbuf_t * > frames;
+    while(frame.sendqueue.size())
+    {
+      frames.push_back(frame.sendqueue.front());
+      frame.sendqueue.pop();
+    }
+    return frames;
+  }
+
+  /// held acks in ACKS frames of their own, like a session once they are due
+  void
+  FlushAcks()
+  {
+    byte_t tmp[6 + frame_state::MaxAckEntries * frame_state::AckEntry];
+    while(frame.acks.size())
+    {
+      size_t sz = frame.write_acks(tmp, frame_state::MaxAckEntries);
+      frame.sendqueue.push(new iwp::sendbuf_t(sz));
+      memcpy(frame.sendqueue.back()->data(), tmp, sz);
+    }
+  }
+};
+
+class IWPFrameTest : public ::testing::Test
+{
+ public:
+  udap_crypto crypto;
+  FramePeer a, b;
+
+  IWPFrameTest()
+  {
+    udap_crypto_libsodium_init(&crypto);
+    Setup(a);
+    Setup(b);
+  }
+
+  ~IWPFrameTest()
+  {
+    for(auto sb : a.Take())
+      delete sb;
+    for(auto sb : b.Take())
+      delete sb;
+    a.frame.clear();
+    b.frame.clear();
+  }
+
+  void
+  Setup(FramePeer &p)
+  {
+    p.frame.crypto = &crypto;
+    p.frame.stats  = &p.stats;
+    p.frame.recv   = &FramePeer::Recv;
+    p.frame.user   = &p;
+  }
+
+  /// queue msg to go out of p like a session does, returns its msgid
+  uint64_t
+  Send(FramePeer &p, const std::string &msg, uint8_t flags = iwp::eXmitValid)
+  {
+    udap_buffer_t buf;
+    buf.base = (byte_t *)msg.data();
+    buf.cur  = buf.base;
+    buf.sz   = msg.size();
+    udap::ShortHash digest;
+    crypto.shorthash(digest, buf);
+    uint64_t id = p.frame.txids++;
+    p.frame.queue_tx(id, new iwp::transit_message(buf, digest, id,
+                                                  p.frame.fragsize(), flags));
+    return id;
+  }
+
+  /// hand one frame from one end to the other, with whatever acks from
+  /// has held that fit in the path mtu
+  bool
+  Carry(FramePeer &from, FramePeer &to, iwp::sendbuf_t *sb)
+  {
+    size_t sz   = sb->size();
+    size_t mtu  = from.frame.pmtu.mtu;
+    size_t room = mtu > sz + 64 ? mtu - sz - 64 : 0;
+    udap_pkt *pkt = udap::NewPacket(sz + room);
+    memcpy(pkt->data(), sb->data(), sz);
+    sz += from.frame.piggyback_acks(pkt->data(), sz, room);
+    delete sb;
+    bool ok = to.frame.process(pkt->data(), sz, pkt);
+    udap_pkt_unref(pkt);
+    return ok;
+  }
+
+  /// hand everything queued on from over, returns how many failed
+  size_t
+  Deliver(FramePeer &from, FramePeer &to)
+  {
+    size_t failed = 0;
+    for(auto sb : from.Take())
+      if(!Carry(from, to, sb))
+        ++failed;
+    return failed;
+  }
+
+  /// both ends hear from each other once so they know the other is new
+  void
+  Handshake()
+  {
+    Send(a, "a");
+    Send(b, "b");
+    ASSERT_EQ(Deliver(a, b), 0);
+    ASSERT_EQ(Deliver(b, a), 0);
+    a.FlushAcks();
+    b.FlushAcks();
+    ASSERT_EQ(Deliver(a, b), 0);
+    ASSERT_EQ(Deliver(b, a), 0);
+    a.got.clear();
+    b.got.clear();
+  }
+
+  static std::string
+  Message(size_t sz)
+  {
+    std::string msg(sz, 0);
+    for(size_t idx = 0; idx < sz; ++idx)
+      msg[idx] = char(idx * 7 + idx / 251);
+    return msg;
+  }
+
+  static uint8_t
+  Type(iwp::sendbuf_t *sb)
+  {
+    return iwp::frame_header(sb->data()).msgtype();
+  }
+};
+
+TEST_F(IWPFrameTest, TestReassembly)
+{
+  Handshake();
+  auto small = Message(100);
+  auto big   = Message(5000);
+  uint64_t messages = b.stats.rxMessages;
+  Send(a, small);
+  auto id     = Send(a, big);
+  auto frames = a.Take();
+  // one frame XMIT, then an XMIT and the fragments of the big one
+  ASSERT_EQ(frames.size(), 2 + (big.size() - 1) / a.frame.fragsize());
+  ASSERT_EQ(Type(frames[1]), iwp::eXMIT);
+  for(size_t idx = 2; idx < frames.size(); ++idx)
+    ASSERT_EQ(Type(frames[idx]), iwp::eFRAG);
+  // fragments are written into place whatever order they come in
+  std::reverse(frames.begin() + 2, frames.end());
+  for(auto sb : frames)
+    ASSERT_TRUE(Carry(a, b, sb));
+  ASSERT_EQ(b.got.size(), 2);
+  ASSERT_EQ(b.got[0], small);
+  ASSERT_EQ(b.got[1], big);
+  ASSERT_TRUE(b.frame.rx.empty());
+  ASSERT_EQ(b.frame.rxdone.count(id), 1);
+  ASSERT_EQ(uint64_t(b.stats.rxMessages), messages + 2);
+  ASSERT_EQ(uint64_t(b.stats.rxCopied), big.size());
+  // every XMIT and fragment is acked, in one entry per msgid
+  ASSERT_EQ(b.frame.acks.size(), 2);
+  ASSERT_EQ(b.frame.unacked, frames.size());
+  b.FlushAcks();
+  ASSERT_EQ(b.frame.sendqueue.size(), 1);
+  ASSERT_EQ(Deliver(b, a), 0);
+  ASSERT_TRUE(a.frame.tx.empty());
+  ASSERT_EQ(a.frame.inflight, 0);
+  ASSERT_TRUE(a.frame.rtt.sampled);
+};
+
+TEST_F(IWPFrameTest, TestSelectiveAck)
+{
+  Handshake();
+  auto msg = Message(6000);
+  Send(a, msg);
+  auto frames = a.Take();
+  ASSERT_GT(frames.size(), 2 + frame_state::DupThresh);
+  // the first fragment is lost
+  delete frames[1];
+  for(size_t idx = 0; idx < frames.size(); ++idx)
+  {
+    if(idx != 1)
+    {
+      ASSERT_TRUE(Carry(a, b, frames[idx]));
+    }
+  }
+  ASSERT_TRUE(b.got.empty());
+  b.FlushAcks();
+  ASSERT_EQ(Deliver(b, a), 0);
+  // enough sent after it got there, it goes again right away
+  ASSERT_EQ(a.frame.sendqueue.size(), 1);
+  ASSERT_EQ(Type(a.frame.sendqueue.front()), iwp::eFRAG);
+  ASSERT_EQ(uint64_t(a.stats.retransmits), 1);
+  ASSERT_EQ(uint64_t(a.stats.windowCuts), 1);
+  ASSERT_EQ(Deliver(a, b), 0);
+  ASSERT_EQ(b.got.size(), 1);
+  ASSERT_EQ(b.got[0], msg);
+  b.FlushAcks();
+  ASSERT_EQ(Deliver(b, a), 0);
+  ASSERT_TRUE(a.frame.tx.empty());
+  // the retransmit was needed
+  ASSERT_EQ(uint64_t(a.stats.spurious), 0);
+};
+
+TEST_F(IWPFrameTest, TestRetransmitTimeout)
+{
+  Handshake();
+  auto msg = Message(3000);
+  Send(a, msg);
+  auto sent = a.frame.sendqueue.size();
+  // everything is lost
+  for(auto sb : a.Take())
+    delete sb;
+  auto now = udap_time_now_ms();
+  a.frame.retransmit(now);
+  ASSERT_TRUE(a.frame.sendqueue.empty());
+  auto rto = a.frame.rtt.timeout(1);
+  now += rto;
+  a.frame.retransmit(now);
+  ASSERT_EQ(a.frame.sendqueue.size(), sent);
+  ASSERT_EQ(uint64_t(a.stats.timeouts), 1);
+  for(auto sb : a.Take())
+    delete sb;
+  // the second try waits twice as long
+  a.frame.retransmit(now + rto);
+  ASSERT_TRUE(a.frame.sendqueue.empty());
+  a.frame.retransmit(now + 2 * rto);
+  ASSERT_EQ(a.frame.sendqueue.size(), sent);
+  ASSERT_EQ(uint64_t(a.stats.timeouts), 2);
+  ASSERT_EQ(uint64_t(a.stats.retransmits), 2 * sent);
+  ASSERT_EQ(Deliver(a, b), 0);
+  ASSERT_EQ(b.got.size(), 1);
+  ASSERT_EQ(b.got[0], msg);
+  b.FlushAcks();
+  ASSERT_EQ(Deliver(b, a), 0);
+  ASSERT_TRUE(a.frame.tx.empty());
+  ASSERT_EQ(a.frame.timeoutsInRow, 0);
+};
+
+TEST_F(IWPFrameTest, TestWindow)
+{
+  Handshake();
+  auto msg = Message(20 * a.frame.fragsize() + 1);
+  Send(a, msg);
+  // the congestion window holds the rest back until acks make room
+  ASSERT_LT(a.frame.sendqueue.size(), 21);
+  ASSERT_GE(a.frame.inflight, a.frame.cc.Window());
+  ASSERT_EQ(a.frame.txpending.size(), 1);
+  for(int round = 0; round < 10 && b.got.empty(); ++round)
+  {
+    ASSERT_EQ(Deliver(a, b), 0);
+    b.FlushAcks();
+    ASSERT_EQ(Deliver(b, a), 0);
+  }
+  ASSERT_EQ(b.got.size(), 1);
+  ASSERT_EQ(b.got[0], msg);
+  b.FlushAcks();
+  ASSERT_EQ(Deliver(b, a), 0);
+  ASSERT_TRUE(a.frame.tx.empty());
+  ASSERT_TRUE(a.frame.txpending.empty());
+};
+
+TEST_F(IWPFrameTest, TestLegacyPeer)
+{
+  // b is an older peer that never sets eProtoUpgrade
+  b.frame.txflags = 0;
+  Send(b, "hello");
+  ASSERT_EQ(Deliver(b, a), 0);
+  ASSERT_FALSE(a.frame.windowed());
+  ASSERT_EQ(Deliver(a, b), 0);
+  ASSERT_TRUE(b.frame.tx.empty());
+  // no window, all of a big message goes at once
+  auto msg = Message(20 * a.frame.fragsize() + 1);
+  Send(a, msg);
+  ASSERT_EQ(a.frame.sendqueue.size(), 21);
+  ASSERT_TRUE(a.frame.txpending.empty());
+  auto sent = a.frame.sendqueue.size();
+  for(auto sb : a.Take())
+    delete sb;
+  // and retransmits neither back off nor reset a window
+  auto now = udap_time_now_ms();
+  auto rto = a.frame.rtt.timeout(1);
+  a.frame.retransmit(now + rto);
+  a.frame.retransmit(now + 2 * rto);
+  ASSERT_EQ(uint64_t(a.stats.retransmits), 2 * sent);
+  ASSERT_EQ(uint64_t(a.stats.timeouts), 0);
+  ASSERT_EQ(Deliver(a, b), 0);
+  ASSERT_EQ(b.got.size(), 1);
+  ASSERT_EQ(b.got[0], msg);
+};
+
+TEST_F(IWPFrameTest, TestPathMTUProbe)
+{
+  Handshake();
+  // nothing bigger than 1500 bytes gets through
+  size_t path = 1500;
+  auto now    = udap_time_now_ms();
+  for(int round = 0; round < 100 && a.frame.pmtu.searching(); ++round)
+  {
+    a.frame.probe_mtu(now);
+    for(auto sb : a.Take())
+    {
+      if(sb->size() + 64 > path)
+        delete sb;
+      else
+        ASSERT_TRUE(Carry(a, b, sb));
+    }
+    ASSERT_EQ(Deliver(b, a), 0);
+    now += a.frame.rtt.timeout(1);
+  }
+  ASSERT_FALSE(a.frame.pmtu.searching());
+  ASSERT_LE(a.frame.pmtu.mtu, path);
+  ASSERT_GT(a.frame.pmtu.mtu + iwp::mtu_search::Granularity, path);
+  ASSERT_EQ(uint16_t(a.frame.pathMTU), a.frame.pmtu.mtu);
+  ASSERT_GT(uint64_t(a.stats.mtuProbes), 0);
+  // new messages use the bigger fragments and still fit the path
+  auto msg = Message(4000);
+  Send(a, msg);
+  for(auto sb : a.Take())
+  {
+    ASSERT_LE(sb->size() + 64, path);
+    ASSERT_TRUE(Carry(a, b, sb));
+  }
+  ASSERT_EQ(b.got.size(), 1);
+  ASSERT_EQ(b.got[0], msg);
+};
+
+TEST_F(IWPFrameTest, TestJumboPathMTU)
+{
+  Handshake();
+  // a 9000 byte ipv4 jumbo frame path
+  size_t path = 9000 - 28;
+  auto now    = udap_time_now_ms();
+  for(int round = 0; round < 100 && a.frame.pmtu.searching(); ++round)
+  {
+    a.frame.probe_mtu(now);
+    for(auto sb : a.Take())
+    {
+      if(sb->size() + 64 > path)
+        delete sb;
+      else
+        ASSERT_TRUE(Carry(a, b, sb));
+    }
+    ASSERT_EQ(Deliver(b, a), 0);
+    now += a.frame.rtt.timeout(1);
+  }
+  ASSERT_LE(a.frame.pmtu.mtu, path);
+  ASSERT_GT(a.frame.pmtu.mtu + iwp::mtu_search::Granularity, path);
+  // a big message goes in a few jumbo fragments
+  auto msg = Message(30000);
+  Send(a, msg);
+  size_t frames = 0;
+  for(int round = 0; round < 10 && b.got.empty(); ++round)
+  {
+    for(auto sb : a.Take())
+    {
+      ++frames;
+      ASSERT_LE(sb->size() + 64, path);
+      ASSERT_TRUE(Carry(a, b, sb));
+    }
+    b.FlushAcks();
+    ASSERT_EQ(Deliver(b, a), 0);
+  }
+  ASSERT_EQ(frames, 1 + (msg.size() - 1) / a.frame.fragsize());
+  ASSERT_EQ(b.got.size(), 1);
+  ASSERT_EQ(b.got[0], msg);
+};
+
+TEST_F(IWPFrameTest, TestInterfaceLimit)
+{
+  Handshake();
+  // the interface takes no more than this, so probes never go past it
+  size_t limit = 1400;
+  a.frame.pmtu.limit(limit);
+  auto now = udap_time_now_ms();
+  for(int round = 0; round < 100 && a.frame.pmtu.searching(); ++round)
+  {
+    a.frame.probe_mtu(now);
+    for(auto sb : a.Take())
+    {
+      ASSERT_LE(sb->size() + 64, limit);
+      ASSERT_TRUE(Carry(a, b, sb));
+    }
+    ASSERT_EQ(Deliver(b, a), 0);
+    now += a.frame.rtt.timeout(1);
+  }
+  ASSERT_LE(a.frame.pmtu.mtu, limit);
+  ASSERT_GT(a.frame.pmtu.mtu + iwp::mtu_search::Granularity, limit);
+  // nor when searching again later
+  now += iwp::mtu_search::RaiseInterval;
+  a.frame.probe_mtu(now);
+  ASSERT_TRUE(a.frame.sendqueue.empty());
+};
+
+TEST_F(IWPFrameTest, TestBlackHole)
+{
+  Handshake();
+  auto now = udap_time_now_ms();
+  a.frame.probe_mtu(now);
+  ASSERT_EQ(Deliver(a, b), 0);
+  ASSERT_EQ(Deliver(b, a), 0);
+  uint16_t base = iwp::mtu_search::BaseMTU;
+  ASSERT_GT(a.frame.pmtu.mtu, base);
+  // then the path stops taking anything that big
+  auto msg = Message(3000);
+  Send(a, msg);
+  for(int tick = 0; tick < 3; ++tick)
+  {
+    for(auto sb : a.Take())
+      delete sb;
+    now += iwp::rtt_estimator::MaxRTO;
+    a.frame.retransmit(now);
+  }
+  ASSERT_EQ(a.frame.pmtu.mtu, base);
+  ASSERT_EQ(uint16_t(a.frame.pathMTU), base);
+  ASSERT_EQ(uint64_t(a.stats.mtuBlackholes), 1);
+  ASSERT_FALSE(a.frame.pmtu.searching());
+  // what is already out keeps its fragments
+  ASSERT_EQ(Deliver(a, b), 0);
+  ASSERT_EQ(b.got.size(), 1);
+  ASSERT_EQ(b.got[0], msg);
+};
+
+TEST_F(IWPFrameTest, TestBundle)
+{
+  Handshake();
+  std::string bundle;
+  for(std::string part : {"ab", "cde", ""})
+  {
+    uint16_t sz = part.size();
+    bundle.append((const char *)&sz, 2);
+    bundle += part;
+  }
+  Send(a, bundle, iwp::eXmitValid | iwp::eXmitBundle);
+  ASSERT_EQ(Deliver(a, b), 0);
+  ASSERT_EQ(b.got.size(), 3);
+  ASSERT_EQ(b.got[0], "ab");
+  ASSERT_EQ(b.got[1], "cde");
+  ASSERT_EQ(b.got[2], "");
+  b.got.clear();
+  // what comes before a truncated part is still handed up
+  std::string truncated = bundle.substr(0, 2 + 2 + 2 + 3);
+  uint16_t sz           = 10;
+  truncated.append((const char *)&sz, 2);
+  truncated += "xyz";
+  auto id = Send(a, truncated, iwp::eXmitValid | iwp::eXmitBundle);
+  ASSERT_EQ(Deliver(a, b), 1);
+  ASSERT_EQ(b.got.size(), 2);
+  ASSERT_EQ(b.got[1], "cde");
+  // it got here, a retransmit is acked instead of handled again
+  ASSERT_EQ(b.frame.rxdone.count(id), 1);
+};
+
+TEST_F(IWPFrameTest, TestTrailingAcks)
+{
+  Handshake();
+  Send(b, Message(500));
+  Send(b, Message(600));
+  ASSERT_EQ(Deliver(b, a), 0);
+  // held until something goes the other way
+  ASSERT_EQ(a.frame.acks.size(), 2);
+  ASSERT_TRUE(a.frame.sendqueue.empty());
+  auto msg = Message(200);
+  Send(a, msg);
+  ASSERT_EQ(Deliver(a, b), 0);
+  ASSERT_TRUE(a.frame.acks.empty());
+  ASSERT_EQ(uint64_t(a.stats.ackPiggybacked), 2);
+  ASSERT_TRUE(b.frame.tx.empty());
+  ASSERT_EQ(b.got.size(), 1);
+  ASSERT_EQ(b.got[0], msg);
+  // a message that says acks follow when none do
+  Send(a, Message(100));
+  auto sb = a.Take()[0];
+  iwp::frame_header(sb->data()).setflag(iwp::eAcksFollow);
+  ASSERT_FALSE(Carry(a, b, sb));
+  // the message itself was fine
+  ASSERT_EQ(b.got.size(), 2);
+  // or that are not ACKS
+  Send(a, Message(100));
+  sb = a.Take()[0];
+  auto fsz = sb->size();
+  iwp::sendbuf_t bad(fsz + 6 + frame_state::AckEntry);
+  memcpy(bad.data(), sb->data(), fsz);
+  memset(bad.data() + fsz, 0, 6 + frame_state::AckEntry);
+  iwp::frame_header(bad.data()).setflag(iwp::eAcksFollow);
+  iwp::frame_header(bad.data() + fsz).msgtype() = iwp::eFRAG;
+  delete sb;
+  udap_pkt *pkt = udap::NewPacket(bad.size());
+  memcpy(pkt->data(), bad.data(), bad.size());
+  ASSERT_FALSE(b.frame.process(pkt->data(), bad.size(), pkt));
+  udap_pkt_unref(pkt);
+  ASSERT_EQ(b.got.size(), 3);
+};
+
+TEST_F(IWPFrameTest, TestLegacyPeerAcks)
+{
+  // b is an older peer that never sets eProtoUpgrade
+  b.frame.txflags = 0;
+  Send(b, "hello");
+  ASSERT_EQ(Deliver(b, a), 0);
+  ASSERT_FALSE(a.frame.delays_acks());
+  // acks go out right away, one msgid each, and nothing is held to ride
+  // along on data
+  ASSERT_TRUE(a.frame.acks.empty());
+  ASSERT_EQ(a.frame.sendqueue.size(), 1);
+  auto ack = a.frame.sendqueue.front();
+  ASSERT_EQ(Type(ack), iwp::eACKS);
+  size_t entry = frame_state::AckEntry;
+  ASSERT_EQ(iwp::frame_header(ack->data()).size(), entry);
+  ASSERT_EQ(Deliver(a, b), 0);
+  ASSERT_TRUE(b.frame.tx.empty());
+  ASSERT_FALSE(a.frame.piggyback_acks(nullptr, 0, 1024));
+};
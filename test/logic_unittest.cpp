@@ -0,0 +1,158 @@
+#include <gtest/gtest.h>
+#include <udap/logic.h>
+#include "mpsc.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+using udap::util::MPSCNode;
+using udap::util::MPSCQueue;
+
+struct QueueItem : public MPSCNode
+{
+  int val;
+};
+
+TEST(MPSCQueueTest, TestFIFO)
+{
+  MPSCQueue q;
+  ASSERT_TRUE(q.Empty());
+  ASSERT_EQ(q.Pop(), nullptr);
+  std::vector< QueueItem > items(10);
+  for(size_t idx = 0; idx < items.size(); ++idx)
+  {
+    items[idx].val = idx;
+    q.Push(&items[idx]);
+  }
+  ASSERT_FALSE(q.Empty());
+  for(size_t idx = 0; idx < items.size(); ++idx)
+  {
+    QueueItem *item = static_cast< QueueItem * >(q.Pop());
+    ASSERT_NE(item, nullptr);
+    ASSERT_EQ(item->val, idx);
+  }
+  ASSERT_TRUE(q.Empty());
+  ASSERT_EQ(q.Pop(), nullptr);
+  // reuse after draining past the stub
+  q.Push(&items[0]);
+  ASSERT_EQ(q.Pop(), &items[0]);
+  ASSERT_TRUE(q.Empty());
+};
+
+struct LogicCounter
+{
+  static const size_t Producers   = 4;
+  static const size_t PerProducer = 10000;
+
+  /// only touched on the logic thread
+  size_t last[Producers];
+  bool ordered = true;
+  std::atomic< size_t > ran;
+
+  LogicCounter() : ran(0)
+  {
+    for(auto &l : last)
+      l = 0;
+  }
+
+  struct Job
+  {
+    LogicCounter *counter;
+    size_t producer;
+    size_t seq;
+
+    static void
+    Run(void *user)
+    {
+      Job *self         = static_cast< Job * >(user);
+      LogicCounter *ctr = self->counter;
+      if(ctr->last[self->producer] + 1 != self->seq)
+        ctr->ordered = false;
+      ctr->last[self->producer] = self->seq;
+      ctr->ran++;
+    }
+  };
+};
+
+TEST(LogicTest, TestManyProducersDrainInOrder)
+{
+  udap_logic *logic = udap_init_logic();
+  LogicCounter counter;
+  std::vector< LogicCounter::Job > jobs(LogicCounter::Producers
+                                       * LogicCounter::PerProducer);
+  std::vector< std::thread > producers;
+  for(size_t p = 0; p < LogicCounter::Producers; ++p)
+    producers.emplace_back([&, p]() {
+      for(size_t seq = 1; seq <= LogicCounter::PerProducer; ++seq)
+      {
+        LogicCounter::Job &job = jobs[p * LogicCounter::PerProducer + seq - 1];
+        job                    = {&counter, p, seq};
+        udap_logic_queue_job(logic, {&job, &LogicCounter::Job::Run});
+      }
+    });
+  for(auto &t : producers)
+    t.join();
+
+  const size_t total = jobs.size();
+  auto start         = std::chrono::steady_clock::now();
+  while(counter.ran < total
+        && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+    std::this_thread::yield();
+
+  udap_logic_stats stats;
+  udap_logic_get_stats(logic, &stats);
+  udap_logic_stop(logic);
+  udap_free_logic(&logic);
+
+  ASSERT_EQ(counter.ran, total);
+  ASSERT_TRUE(counter.ordered);
+  ASSERT_EQ(stats.jobs, total);
+  ASSERT_GT(stats.drains, 0);
+  ASSERT_LE(stats.drain_max, 64);
+  ASSERT_LE(stats.drain_p50, stats.drain_max);
+};
+
+struct LogicJobStats
+{
+  size_t counted = 0;
+
+  /// count jobs run under our label, they should not be lumped in with the
+  /// drain that ran them
+  static void
+  Visit(void *user, const udap_threadpool_job_stats *st)
+  {
+    if(st->label && std::string(st->label) == "logic-test")
+      static_cast< LogicJobStats * >(user)->counted += st->jobs;
+  }
+
+  static void
+  Run(void *)
+  {
+  }
+};
+
+TEST(LogicTest, TestJobStatsByKind)
+{
+  udap_threadpool *pool = udap_init_threadpool(1, "test-logic");
+  udap_logic *logic     = udap_init_single_process_logic(pool);
+  const size_t total    = 100;
+  for(size_t idx = 0; idx < total; ++idx)
+    udap_logic_queue_job(logic, {nullptr, &LogicJobStats::Run, "logic-test"});
+
+  LogicJobStats collect;
+  auto start = std::chrono::steady_clock::now();
+  while(collect.counted < total
+        && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+  {
+    std::this_thread::yield();
+    collect.counted = 0;
+    udap_threadpool_visit_job_stats(pool, &collect, &LogicJobStats::Visit);
+  }
+  udap_logic_stop(logic);
+  udap_free_logic(&logic);
+
+  ASSERT_EQ(collect.counted, total);
+};
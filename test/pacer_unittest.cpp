@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+#include "pacer.hpp"
+
+using udap::util::Pacer;
+
+TEST(PacerTest, TestUnlimited)
+{
+  Pacer p;
+  for(int idx = 0; idx < 1000; ++idx)
+  {
+    ASSERT_EQ(p.Delay(1), 0);
+    p.Spend(1500);
+  }
+};
+
+TEST(PacerTest, TestBurstThenRate)
+{
+  Pacer p;
+  // 1500 bytes per ms
+  p.SetRate(1500000);
+  uint64_t now = 1000;
+  // a full bucket lets the burst out back to back
+  size_t sent = 0;
+  while(p.Delay(now) == 0)
+  {
+    p.Spend(1500);
+    ++sent;
+  }
+  ASSERT_EQ(sent, Pacer::MinBurst / 1500 + 1);
+  ASSERT_EQ(p.Delay(now), 1);
+  // then one frame a ms
+  for(int idx = 0; idx < 100; ++idx)
+  {
+    ++now;
+    ASSERT_EQ(p.Delay(now), 0);
+    p.Spend(1500);
+    ASSERT_EQ(p.Delay(now), 1);
+  }
+};
+
+TEST(PacerTest, TestAverageRate)
+{
+  Pacer p;
+  // 300KB/s with sends whenever allowed over 10 seconds
+  p.SetRate(300000);
+  uint64_t now = 1, bytes = 0;
+  while(now < 10001)
+  {
+    auto wait = p.Delay(now);
+    if(wait)
+    {
+      now += wait;
+      continue;
+    }
+    p.Spend(1200);
+    bytes += 1200;
+  }
+  // all but the first burst is at the rate
+  ASSERT_NEAR(bytes, 3000000, Pacer::MinBurst + 1200);
+};
+
+TEST(PacerTest, TestSlowRateKeepsRemainder)
+{
+  Pacer p;
+  // half a byte per ms
+  p.SetRate(500);
+  // the first refill is 500 bytes, 100 short
+  p.Delay(1000);
+  p.Spend(600);
+  // paid back in 200ms even though each ms adds under a byte
+  ASSERT_EQ(p.Delay(1000), 200);
+  uint64_t now = 1000;
+  while(p.Delay(now))
+    ++now;
+  ASSERT_EQ(now, 1200);
+};
@@ -0,0 +1,61 @@
+#include <gtest/gtest.h>
+#include "pkt.hpp"
+
+#include <thread>
+#include <vector>
+
+TEST(PacketPoolTest, TestReusesGivenBackPackets)
+{
+  udap::PacketPool *pool = new udap::PacketPool(1500);
+  udap_pkt *first        = pool->Get();
+  ASSERT_EQ(first->cap, 1500);
+  udap_pkt *second = pool->Get();
+  ASSERT_NE(first, second);
+  udap_pkt_unref(first);
+  // the free list is fifo, the stub goes behind the only node on pop
+  ASSERT_EQ(pool->Get(), first);
+  udap_pkt_unref(first);
+  udap_pkt_unref(second);
+  pool->Close();
+};
+
+TEST(PacketPoolTest, TestPacketsOutliveOwner)
+{
+  udap::PacketPool *pool = new udap::PacketPool(64);
+  std::vector< udap_pkt * > held;
+  for(size_t idx = 0; idx < 100; ++idx)
+  {
+    udap_pkt *pkt = pool->Get();
+    memset(pkt->data(), idx, pkt->cap);
+    held.push_back(pkt);
+  }
+  pool->Close();
+  // given back from other threads after the owner let go
+  std::vector< std::thread > threads;
+  for(size_t t = 0; t < 4; ++t)
+    threads.emplace_back([&held, t]() {
+      for(size_t idx = t; idx < held.size(); idx += 4)
+      {
+        ASSERT_EQ(held[idx]->data()[63], (byte_t)idx);
+        udap_pkt_unref(held[idx]);
+      }
+    });
+  for(auto &t : threads)
+    t.join();
+};
+
+TEST(PacketPoolTest, TestRefsKeepPacket)
+{
+  udap_pkt *pkt = udap::NewPacket(16);
+  memcpy(pkt->data(), "fragment", 8);
+  udap::PacketRef ref(pkt, pkt->data(), 8);
+  // the ref holds its own reference
+  udap_pkt_unref(pkt);
+  ASSERT_EQ(pkt->refs, 1);
+  udap::PacketRef moved(std::move(ref));
+  ASSERT_TRUE(ref.empty());
+  ASSERT_EQ(std::string((const char *)moved.data(), moved.size()),
+            "fragment");
+  moved.reset();
+  ASSERT_TRUE(moved.empty());
+};
@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+#include "retire_list.hpp"
+
+#include <set>
+
+/// stands in for an iwp session, freeing it records its id
+struct RetiredSession : public udap::util::RefCount
+{
+  int id;
+};
+
+static std::set< int > freedSessions;
+
+static void
+FreeSession(RetiredSession *s)
+{
+  ASSERT_EQ(freedSessions.count(s->id), 0);
+  freedSessions.insert(s->id);
+  delete s;
+}
+
+class RetireListTest : public ::testing::Test
+{
+ public:
+  udap::util::RetireList< RetiredSession > retired;
+
+  RetireListTest()
+  {
+    freedSessions.clear();
+  }
+
+  ~RetireListTest()
+  {
+    retired.Clear(&FreeSession);
+  }
+
+  RetiredSession *
+  Make(int id)
+  {
+    RetiredSession *s = new RetiredSession;
+    s->id             = id;
+    return s;
+  }
+};
+
+TEST_F(RetireListTest, TestUnheldFreedOnCollect)
+{
+  retired.Retire(Make(1));
+  retired.Retire(Make(2));
+  ASSERT_TRUE(freedSessions.empty());
+  ASSERT_EQ(retired.Collect(&FreeSession), 2);
+  ASSERT_EQ(freedSessions, std::set< int >({1, 2}));
+  ASSERT_EQ(retired.Size(), 0);
+};
+
+TEST_F(RetireListTest, TestHeldUntilLastRelease)
+{
+  RetiredSession *s = Make(1);
+  // a frame being decrypted, a handshake job and an armed timer all hold it
+  // when it is removed
+  s->acquire();
+  s->acquire();
+  s->acquire();
+  retired.Retire(s);
+  retired.Retire(Make(2));
+  // only the one nothing holds goes
+  ASSERT_EQ(retired.Collect(&FreeSession), 1);
+  ASSERT_EQ(freedSessions, std::set< int >({2}));
+  // the frame is done with it
+  s->release();
+  ASSERT_EQ(retired.Collect(&FreeSession), 0);
+  // the handshake job's hook returns
+  s->release();
+  ASSERT_EQ(retired.Collect(&FreeSession), 0);
+  ASSERT_EQ(retired.Size(), 1);
+  // the timer fires and lets go last
+  s->release();
+  ASSERT_EQ(retired.Collect(&FreeSession), 1);
+  ASSERT_EQ(freedSessions, std::set< int >({1, 2}));
+  ASSERT_EQ(retired.Size(), 0);
+};
@@ -0,0 +1,138 @@
+#include <gtest/gtest.h>
+#include "net.hpp"
+#include "sharded_map.hpp"
+
+#include <arpa/inet.h>
+#include <string.h>
+#include <atomic>
+#include <set>
+#include <thread>
+#include <vector>
+
+typedef udap::util::ShardedMap< udap::Addr, uint64_t, udap::addrhash >
+    AddrMap;
+
+static udap::Addr
+MakeAddr(uint32_t n)
+{
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl(0x0a000000 | (n >> 16));
+  addr.sin_port        = htons(n & 0xffff);
+  return udap::Addr(*(const sockaddr *)&addr);
+}
+
+TEST(ShardedMapTest, TestInsertKeepsFirst)
+{
+  AddrMap map;
+  udap::Addr a = MakeAddr(1);
+  ASSERT_TRUE(map.Insert(a, 1));
+  ASSERT_FALSE(map.Insert(a, 2));
+  uint64_t val = 0;
+  ASSERT_TRUE(map.Get(a, val));
+  ASSERT_EQ(val, 1);
+  map.Put(a, 3);
+  ASSERT_TRUE(map.Get(a, val));
+  ASSERT_EQ(val, 3);
+  // only the value it still has removes it
+  ASSERT_FALSE(map.RemoveIfValue(a, 1));
+  ASSERT_TRUE(map.RemoveIfValue(a, 3));
+  ASSERT_FALSE(map.Has(a));
+  ASSERT_EQ(map.Size(), 0);
+};
+
+TEST(ShardedMapTest, TestConcurrentLookupsSeeWholeEntries)
+{
+  AddrMap map;
+  const uint32_t writers = 4, readers = 4, keys = 1024, rounds = 200;
+  std::atomic< bool > stop(false);
+  std::atomic< uint64_t > hits(0);
+  std::vector< std::thread > threads;
+  // each writer churns its own keys, value is the key number times round
+  for(uint32_t w = 0; w < writers; ++w)
+    threads.emplace_back([&, w]() {
+      for(uint32_t round = 1; round <= rounds; ++round)
+      {
+        for(uint32_t k = w; k < keys; k += writers)
+          map.Put(MakeAddr(k), uint64_t(k) * rounds + round);
+        for(uint32_t k = w; k < keys; k += writers * 2)
+          map.Remove(MakeAddr(k));
+      }
+    });
+  for(uint32_t r = 0; r < readers; ++r)
+    threads.emplace_back([&, r]() {
+      uint32_t k = r;
+      while(!stop)
+      {
+        uint64_t val = 0;
+        if(map.Get(MakeAddr(k), val))
+        {
+          // whatever round it is from it belongs to this key
+          ASSERT_EQ((val - 1) / rounds, k);
+          ++hits;
+        }
+        k = (k + 7) % keys;
+      }
+    });
+  // iterating while the rest run only ever sees whole entries
+  threads.emplace_back([&]() {
+    std::vector< AddrMap::Entry > entries;
+    while(!stop)
+    {
+      entries.clear();
+      map.Snapshot(entries);
+      for(const auto &item : entries)
+        ASSERT_EQ(item.first, MakeAddr((item.second - 1) / rounds));
+    }
+  });
+  for(uint32_t w = 0; w < writers; ++w)
+    threads[w].join();
+  stop = true;
+  for(size_t idx = writers; idx < threads.size(); ++idx)
+    threads[idx].join();
+
+  ASSERT_GT(hits, 0);
+  // every writer ends having removed every other key of its own
+  ASSERT_EQ(map.Size(), keys / 2);
+  for(uint32_t k = 0; k < keys; ++k)
+  {
+    uint64_t val = 0;
+    bool removed = (k / writers) % 2 == 0;
+    ASSERT_EQ(map.Get(MakeAddr(k), val), !removed);
+    if(!removed)
+    {
+      ASSERT_EQ(val, uint64_t(k) * rounds + rounds);
+    }
+  }
+};
+
+TEST(ShardedMapTest, TestRemoveIfRacingInserts)
+{
+  AddrMap map;
+  const uint32_t inserters = 4, each = 20000;
+  std::atomic< uint32_t > done(0);
+  std::vector< std::thread > threads;
+  for(uint32_t t = 0; t < inserters; ++t)
+    threads.emplace_back([&, t]() {
+      for(uint32_t idx = 0; idx < each; ++idx)
+        ASSERT_TRUE(map.Insert(MakeAddr(t * each + idx), t * each + idx));
+      ++done;
+    });
+  // like the session tick, repeatedly take out everything it finds
+  std::vector< AddrMap::Entry > removed;
+  while(done < inserters)
+    map.RemoveIf([](const udap::Addr &, uint64_t) { return true; }, removed);
+  for(auto &t : threads)
+    t.join();
+  map.Drain(removed);
+
+  ASSERT_EQ(map.Size(), 0);
+  ASSERT_EQ(removed.size(), inserters * each);
+  std::set< uint64_t > seen;
+  for(const auto &item : removed)
+  {
+    ASSERT_EQ(item.first, MakeAddr(item.second));
+    ASSERT_TRUE(seen.insert(item.second).second);
+  }
+};
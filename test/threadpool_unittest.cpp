@@ -0,0 +1,297 @@
+#include <gtest/gtest.h>
+#include <udap/threadpool.h>
+#include "affinity.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+struct ThreadpoolJob
+{
+  std::atomic< size_t > ran;
+  udap_threadpool *pool = nullptr;
+  size_t spawn          = 0;
+
+  ThreadpoolJob() : ran(0)
+  {
+  }
+
+  static void
+  Work(void *user)
+  {
+    static_cast< ThreadpoolJob * >(user)->ran++;
+  }
+
+  static void
+  Spawn(void *user)
+  {
+    ThreadpoolJob *self = static_cast< ThreadpoolJob * >(user);
+    // queue follow up jobs from inside a worker
+    for(size_t idx = 0; idx < self->spawn; ++idx)
+      udap_threadpool_queue_job(self->pool, {self, &Work});
+    self->ran++;
+  }
+};
+
+class ThreadpoolTest : public ::testing::TestWithParam< bool >
+{
+ public:
+  udap_threadpool *pool = nullptr;
+
+  void
+  SetUp()
+  {
+    if(GetParam())
+      pool = udap_init_work_stealing_threadpool(4, "test-steal");
+    else
+      pool = udap_init_threadpool(4, "test-shared");
+  }
+
+  void
+  TearDown()
+  {
+    udap_free_threadpool(&pool);
+  }
+
+  /// wait up to a second for n jobs to have run
+  void
+  WaitFor(const std::atomic< size_t > &ran, size_t n)
+  {
+    auto start = std::chrono::steady_clock::now();
+    while(ran < n
+          && std::chrono::steady_clock::now() - start
+              < std::chrono::seconds(1))
+      std::this_thread::yield();
+  }
+
+  void
+  Finish()
+  {
+    udap_threadpool_stop(pool);
+    udap_threadpool_join(pool);
+  }
+};
+
+TEST_P(ThreadpoolTest, TestRunsAllJobs)
+{
+  ThreadpoolJob job;
+  const size_t num = 10000;
+  for(size_t idx = 0; idx < num; ++idx)
+    udap_threadpool_queue_job(pool, {&job, &ThreadpoolJob::Work});
+  Finish();
+  ASSERT_EQ(job.ran, num);
+};
+
+TEST_P(ThreadpoolTest, TestJobsQueuedFromWorkers)
+{
+  ThreadpoolJob job;
+  job.pool         = pool;
+  job.spawn        = 10;
+  const size_t num = 100;
+  for(size_t idx = 0; idx < num; ++idx)
+    udap_threadpool_queue_job(pool, {&job, &ThreadpoolJob::Spawn});
+  // jobs queued after stopping are dropped so let the spawned jobs land first
+  WaitFor(job.ran, num * (1 + job.spawn));
+  Finish();
+  ASSERT_EQ(job.ran, num * (1 + job.spawn));
+};
+
+INSTANTIATE_TEST_CASE_P(Schedulers, ThreadpoolTest,
+                        ::testing::Values(false, true));
+
+TEST_P(ThreadpoolTest, TestSteadyStreamDoesNotAllocate)
+{
+  ThreadpoolJob job;
+  udap_threadpool_stats before, after;
+  udap_threadpool_get_stats(pool, &before);
+  size_t expect = 0;
+  for(size_t round = 0; round < 100; ++round)
+  {
+    for(size_t idx = 0; idx < 64; ++idx)
+      udap_threadpool_queue_job(pool, {&job, &ThreadpoolJob::Work});
+    expect += 64;
+    WaitFor(job.ran, expect);
+  }
+  udap_threadpool_get_stats(pool, &after);
+  Finish();
+  ASSERT_EQ(after.jobs - before.jobs, expect);
+  ASSERT_EQ(after.allocations, before.allocations);
+};
+
+TEST_P(ThreadpoolTest, TestQueueBatch)
+{
+  ThreadpoolJob job;
+  std::vector< udap_thread_job > jobs(1000, {&job, &ThreadpoolJob::Work});
+  // c api
+  udap_threadpool_queue_jobs(pool, jobs.data(), jobs.size());
+  // range overload
+  udap_threadpool_queue_jobs(pool, jobs.begin(), jobs.end());
+  WaitFor(job.ran, 2 * jobs.size());
+  Finish();
+  ASSERT_EQ(job.ran, 2 * jobs.size());
+};
+
+struct OrderJob
+{
+  std::atomic< bool > *gate;
+  std::vector< int > *order;
+  int id;
+
+  static void
+  Block(void *user)
+  {
+    OrderJob *self = static_cast< OrderJob * >(user);
+    while(!*self->gate)
+      std::this_thread::yield();
+  }
+
+  static void
+  Record(void *user)
+  {
+    OrderJob *self = static_cast< OrderJob * >(user);
+    self->order->push_back(self->id);
+  }
+};
+
+TEST_P(ThreadpoolTest, TestHighPriorityRunsFirst)
+{
+  // one worker so run order is the dequeue order
+  udap_threadpool *single = GetParam()
+      ? udap_init_work_stealing_threadpool(1, "test-prio")
+      : udap_init_threadpool(1, "test-prio");
+  std::atomic< bool > gate(false);
+  std::vector< int > order;
+  OrderJob block{&gate, &order, -1};
+  OrderJob low{&gate, &order, UDAP_JOB_PRIO_LOW};
+  OrderJob normal{&gate, &order, UDAP_JOB_PRIO_NORMAL};
+  OrderJob high{&gate, &order, UDAP_JOB_PRIO_HIGH};
+  udap_threadpool_queue_job(single, {&block, &OrderJob::Block});
+  udap_threadpool_queue_job_prio(single, {&low, &OrderJob::Record},
+                                 UDAP_JOB_PRIO_LOW);
+  udap_threadpool_queue_job_prio(single, {&normal, &OrderJob::Record},
+                                 UDAP_JOB_PRIO_NORMAL);
+  udap_threadpool_queue_job_prio(single, {&high, &OrderJob::Record},
+                                 UDAP_JOB_PRIO_HIGH);
+  gate = true;
+  udap_threadpool_stop(single);
+  udap_threadpool_join(single);
+
+  udap_threadpool_stats stats;
+  udap_threadpool_get_stats(single, &stats);
+  udap_free_threadpool(&single);
+
+  ASSERT_EQ(order.size(), 3);
+  ASSERT_EQ(order[0], UDAP_JOB_PRIO_HIGH);
+  ASSERT_EQ(order[1], UDAP_JOB_PRIO_NORMAL);
+  ASSERT_EQ(order[2], UDAP_JOB_PRIO_LOW);
+  ASSERT_EQ(stats.classes[UDAP_JOB_PRIO_HIGH].jobs, 1);
+  ASSERT_EQ(stats.classes[UDAP_JOB_PRIO_NORMAL].jobs, 2);
+  ASSERT_EQ(stats.classes[UDAP_JOB_PRIO_LOW].jobs, 1);
+  ASSERT_EQ(stats.classes[UDAP_JOB_PRIO_LOW].depth, 0);
+};
+
+struct JobStatsCollector
+{
+  std::vector< udap_threadpool_job_stats > stats;
+
+  static void
+  Visit(void *user, const udap_threadpool_job_stats *st)
+  {
+    static_cast< JobStatsCollector * >(user)->stats.push_back(*st);
+  }
+};
+
+TEST_P(ThreadpoolTest, TestJobStatsByKind)
+{
+  ThreadpoolJob job;
+  for(size_t idx = 0; idx < 100; ++idx)
+  {
+    udap_threadpool_queue_job(pool, {&job, &ThreadpoolJob::Work});
+    udap_threadpool_queue_job(pool, {&job, &ThreadpoolJob::Work, "labeled"});
+  }
+  Finish();
+
+  JobStatsCollector collect;
+  udap_threadpool_visit_job_stats(pool, &collect, &JobStatsCollector::Visit);
+  ASSERT_EQ(collect.stats.size(), 2);
+  for(const auto &st : collect.stats)
+  {
+    ASSERT_EQ(st.jobs, 100);
+    ASSERT_EQ(st.work, &ThreadpoolJob::Work);
+    ASSERT_LE(st.wait_p50_ns, st.wait_max_ns);
+    ASSERT_LE(st.run_p99_ns, st.run_max_ns);
+  }
+  ASSERT_TRUE(collect.stats[0].label || collect.stats[1].label);
+  ASSERT_FALSE(collect.stats[0].label && collect.stats[1].label);
+};
+
+TEST(AffinityTest, TestParseCPUList)
+{
+  std::vector< int > cpus;
+  ASSERT_TRUE(udap::thread::ParseCPUList("0-3,8,10-11", cpus));
+  ASSERT_EQ(cpus, std::vector< int >({0, 1, 2, 3, 8, 10, 11}));
+  ASSERT_TRUE(udap::thread::ParseCPUList("5", cpus));
+  ASSERT_EQ(cpus, std::vector< int >({5}));
+  ASSERT_FALSE(udap::thread::ParseCPUList("", cpus));
+  ASSERT_FALSE(udap::thread::ParseCPUList("3-1", cpus));
+  ASSERT_FALSE(udap::thread::ParseCPUList("1,x", cpus));
+  ASSERT_FALSE(udap::thread::ParseCPUList("-1", cpus));
+  ASSERT_FALSE(udap::thread::ParseCPUList("0-2000000000", cpus));
+  ASSERT_FALSE(udap::thread::ParseCPUList("99999999999999999999", cpus));
+};
+
+struct GateJob
+{
+  std::atomic< bool > started;
+  std::atomic< bool > open;
+
+  GateJob() : started(false), open(false)
+  {
+  }
+
+  static void
+  Wait(void *user)
+  {
+    GateJob *self = static_cast< GateJob * >(user);
+    self->started = true;
+    while(!self->open)
+      std::this_thread::yield();
+  }
+};
+
+TEST_P(ThreadpoolTest, TestBoundedQueueRejects)
+{
+  udap_threadpool *single = GetParam()
+      ? udap_init_work_stealing_threadpool(1, "test-bounded")
+      : udap_init_threadpool(1, "test-bounded");
+  udap_threadpool_set_max_jobs(single, 4);
+  GateJob gate;
+  ThreadpoolJob job;
+  ASSERT_TRUE(udap_threadpool_queue_job(single, {&gate, &GateJob::Wait}));
+  while(!gate.started)
+    std::this_thread::yield();
+
+  size_t queued = 0;
+  for(size_t idx = 0; idx < 10; ++idx)
+    if(udap_threadpool_queue_job(single, {&job, &ThreadpoolJob::Work}))
+      ++queued;
+  ASSERT_EQ(queued, 4);
+  ASSERT_TRUE(udap_threadpool_full(single));
+  std::vector< udap_thread_job > jobs(5, {&job, &ThreadpoolJob::Work});
+  ASSERT_EQ(udap_threadpool_queue_jobs(single, jobs.data(), jobs.size()), 0);
+
+  udap_threadpool_stats stats;
+  udap_threadpool_get_stats(single, &stats);
+  ASSERT_EQ(stats.rejected, 11);
+
+  gate.open = true;
+  WaitFor(job.ran, 4);
+  ASSERT_FALSE(udap_threadpool_full(single));
+  ASSERT_EQ(udap_threadpool_queue_jobs(single, jobs.data(), jobs.size()), 4);
+  WaitFor(job.ran, 8);
+  udap_threadpool_stop(single);
+  udap_threadpool_join(single);
+  udap_free_threadpool(&single);
+  ASSERT_EQ(job.ran, 8);
+};
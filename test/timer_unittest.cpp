@@ -0,0 +1,189 @@
+#include <gtest/gtest.h>
+#include <udap/timer.h>
+#include "timer_wheel.hpp"
+
+#include <poll.h>
+#include <chrono>
+#include <map>
+#include <vector>
+
+using udap::util::TimerWheel;
+
+struct WheelEntry : public TimerWheel::Entry
+{
+  uint64_t firedAt = 0;
+  bool fired       = false;
+};
+
+class TimerWheelTest : public ::testing::Test
+{
+ public:
+  /// advance the wheel in steps, recording when each entry fired
+  void
+  Run(TimerWheel &wheel, uint64_t until, uint64_t step)
+  {
+    for(uint64_t now = wheel.now(); now <= until; now += step)
+    {
+      wheel.Advance(now, [now](TimerWheel::Entry *e) {
+        WheelEntry *w = static_cast< WheelEntry * >(e);
+        w->fired      = true;
+        w->firedAt    = now;
+      });
+    }
+  }
+};
+
+TEST_F(TimerWheelTest, TestExpiresOnTimeAcrossLevels)
+{
+  const uint64_t start = 1000;
+  TimerWheel wheel(start);
+  std::vector< uint64_t > delays = {0,     1,      255,     256,
+                                    257,   1000,   16383,   16384,
+                                    70000, 300000, 1 << 20, 5000000};
+  std::vector< WheelEntry > entries(delays.size());
+  for(size_t idx = 0; idx < delays.size(); ++idx)
+  {
+    entries[idx].expires = start + delays[idx];
+    wheel.Add(&entries[idx]);
+  }
+  ASSERT_EQ(wheel.size(), delays.size());
+  const uint64_t step = 7;
+  Run(wheel, start + 5000000 + step, step);
+  ASSERT_EQ(wheel.size(), 0);
+  for(const auto &e : entries)
+  {
+    ASSERT_TRUE(e.fired);
+    ASSERT_GE(e.firedAt, e.expires);
+    ASSERT_LT(e.firedAt, e.expires + step);
+  }
+};
+
+TEST_F(TimerWheelTest, TestRemove)
+{
+  TimerWheel wheel(0);
+  WheelEntry keep, drop;
+  keep.expires = 500;
+  drop.expires = 500;
+  wheel.Add(&keep);
+  wheel.Add(&drop);
+  wheel.Remove(&drop);
+  ASSERT_FALSE(drop.linked());
+  ASSERT_EQ(wheel.size(), 1);
+  Run(wheel, 1000, 1);
+  ASSERT_TRUE(keep.fired);
+  ASSERT_FALSE(drop.fired);
+};
+
+TEST_F(TimerWheelTest, TestPastDueFiresNext)
+{
+  TimerWheel wheel(100);
+  WheelEntry late;
+  late.expires = 10;
+  wheel.Add(&late);
+  Run(wheel, 100, 1);
+  ASSERT_TRUE(late.fired);
+};
+
+TEST_F(TimerWheelTest, TestNextExpiry)
+{
+  TimerWheel wheel(1000);
+  ASSERT_EQ(wheel.NextExpiry(), UINT64_MAX);
+  WheelEntry soon, far;
+  soon.expires = 1100;
+  wheel.Add(&soon);
+  ASSERT_EQ(wheel.NextExpiry(), 1100);
+  // far out timers don't wake us any earlier
+  far.expires = 100000;
+  wheel.Add(&far);
+  ASSERT_EQ(wheel.NextExpiry(), 1100);
+  wheel.Remove(&soon);
+  ASSERT_EQ(wheel.NextExpiry(), 100000);
+  // still exact after the root wrapped and the level below cascaded
+  Run(wheel, 5000, 1);
+  ASSERT_EQ(wheel.NextExpiry(), 100000);
+  wheel.Remove(&far);
+  WheelEntry late;
+  late.expires = 10;
+  wheel.Add(&late);
+  ASSERT_EQ(wheel.NextExpiry(), 0);
+};
+
+struct TimerCalls
+{
+  std::map< uint64_t, uint64_t > left;
+
+  static void
+  Handle(void *user, uint64_t timeout, uint64_t left)
+  {
+    static_cast< TimerCalls * >(user)->left[timeout] = left;
+  }
+};
+
+TEST(TimerContextTest, TestCancelAndRemove)
+{
+  udap_threadpool *pool   = udap_init_same_process_threadpool();
+  udap_timer_context *ctx = udap_init_timer();
+  TimerCalls calls;
+  udap_timer_call_later(ctx, {0, &calls, &TimerCalls::Handle});
+  uint32_t canceled =
+      udap_timer_call_later(ctx, {100000, &calls, &TimerCalls::Handle});
+  uint32_t removed =
+      udap_timer_call_later(ctx, {200000, &calls, &TimerCalls::Handle});
+  udap_timer_cancel_job(ctx, canceled);
+  udap_timer_remove_job(ctx, removed);
+  udap_timer_tick_all(ctx, pool);
+  udap_threadpool_tick(pool);
+
+  ASSERT_EQ(calls.left.size(), 2);
+  // expired
+  ASSERT_EQ(calls.left[0], 0);
+  // canceled early, time was left
+  ASSERT_GT(calls.left[100000], 0);
+
+  // stale ids are ignored
+  udap_timer_cancel_job(ctx, canceled);
+  udap_timer_call_later(ctx, {0, &calls, &TimerCalls::Handle});
+  udap_timer_remove_job(ctx, canceled);
+  calls.left.clear();
+  udap_timer_tick_all(ctx, pool);
+  udap_threadpool_tick(pool);
+  ASSERT_EQ(calls.left.size(), 1);
+
+  udap_timer_stop(ctx);
+  udap_free_timer(&ctx);
+  udap_free_threadpool(&pool);
+};
+
+TEST(TimerContextTest, TestFdReadyAtDeadline)
+{
+  udap_threadpool *pool   = udap_init_same_process_threadpool();
+  udap_timer_context *ctx = udap_init_timer();
+  int fd                  = udap_timer_fd(ctx);
+  if(fd == -1)
+  {
+    udap_free_timer(&ctx);
+    udap_free_threadpool(&pool);
+    return;
+  }
+  TimerCalls calls;
+  pollfd pfd = {fd, POLLIN, 0};
+  ASSERT_EQ(poll(&pfd, 1, 0), 0);
+
+  auto start = std::chrono::steady_clock::now();
+  udap_timer_call_later(ctx, {20, &calls, &TimerCalls::Handle});
+  ASSERT_EQ(poll(&pfd, 1, 1000), 1);
+  auto waited = std::chrono::duration_cast< std::chrono::milliseconds >(
+      std::chrono::steady_clock::now() - start);
+  ASSERT_GE(waited.count(), 19);
+  ASSERT_LT(waited.count(), 100);
+
+  udap_timer_tick_all(ctx, pool);
+  udap_threadpool_tick(pool);
+  ASSERT_EQ(calls.left.size(), 1);
+  // nothing left to wait for
+  ASSERT_EQ(poll(&pfd, 1, 0), 0);
+
+  udap_timer_stop(ctx);
+  udap_free_timer(&ctx);
+  udap_free_threadpool(&pool);
+};
@@ -0,0 +1,119 @@
+#include "affinity.hpp"
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "logger.hpp"
+
+#if(__FreeBSD__)
+#include <pthread_np.h>
+#include <sys/cpuset.h>
+typedef cpuset_t cpu_set_t;
+#endif
+
+#ifndef CPU_SETSIZE
+#define CPU_SETSIZE 1024
+#endif
+
+namespace udap
+{
+  namespace thread
+  {
+    bool
+    ParseCPUList(const char* str, std::vector< int >& cpus)
+    {
+      cpus.clear();
+      const char* ptr = str;
+      while(*ptr)
+      {
+        char* end;
+        long first = strtol(ptr, &end, 10);
+        if(end == ptr || first < 0 || first >= CPU_SETSIZE)
+          return false;
+        long last = first;
+        ptr       = end;
+        if(*ptr == '-')
+        {
+          ++ptr;
+          last = strtol(ptr, &end, 10);
+          if(end == ptr || last < first || last >= CPU_SETSIZE)
+            return false;
+          ptr = end;
+        }
+        for(long cpu = first; cpu <= last; ++cpu)
+          cpus.push_back(cpu);
+        if(*ptr == ',')
+          ++ptr;
+        else if(*ptr)
+          return false;
+      }
+      return !cpus.empty();
+    }
+
+    bool
+    SetAffinity(std::thread::native_handle_type thread, int cpu)
+    {
+#if(__linux__ || __FreeBSD__)
+      if(cpu < 0 || cpu >= CPU_SETSIZE)
+        return false;
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cpu, &set);
+      int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+      if(err)
+      {
+        udap::Warn("failed to pin thread to cpu ", cpu, ": ", strerror(err));
+        return false;
+      }
+      return true;
+#else
+      (void)thread;
+      udap::Warn("cannot pin thread to cpu ", cpu, ", not supported");
+      return false;
+#endif
+    }
+
+    bool
+    SetCurrentAffinity(int cpu)
+    {
+      return SetAffinity(pthread_self(), cpu);
+    }
+
+    int
+    CurrentCPU()
+    {
+#if(__linux__)
+      return sched_getcpu();
+#else
+      return -1;
+#endif
+    }
+
+    int
+    CPUPackage(int cpu)
+    {
+      char fname[128];
+      snprintf(fname, sizeof(fname),
+               "/sys/devices/system/cpu/cpu%d/topology/physical_package_id",
+               cpu);
+      FILE* f = fopen(fname, "r");
+      if(!f)
+        return -1;
+      int pkg = -1;
+      if(fscanf(f, "%d", &pkg) != 1)
+        pkg = -1;
+      fclose(f);
+      return pkg;
+    }
+
+    int
+    NumCPUs()
+    {
+      long n = sysconf(_SC_NPROCESSORS_CONF);
+      return n > 0 ? n : 1;
+    }
+  }  // namespace thread
+}  // namespace udap
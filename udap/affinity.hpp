@@ -0,0 +1,39 @@
+#ifndef UDAP_AFFINITY_HPP
+#define UDAP_AFFINITY_HPP
+
+#include <thread>
+#include <vector>
+
+namespace udap
+{
+  namespace thread
+  {
+    /// parse a cpu list like "0-3,8,10-11" into cpus
+    /// return false on malformed input or a cpu past CPU_SETSIZE
+    bool
+    ParseCPUList(const char* str, std::vector< int >& cpus);
+
+    /// pin thread to a single cpu
+    /// return false if it failed or the platform does not support it
+    bool
+    SetAffinity(std::thread::native_handle_type thread, int cpu);
+
+    /// pin the calling thread to a single cpu
+    bool
+    SetCurrentAffinity(int cpu);
+
+    /// cpu the calling thread is running on or -1 if unknown
+    int
+    CurrentCPU();
+
+    /// physical package (socket) the cpu is on or -1 if unknown
+    int
+    CPUPackage(int cpu);
+
+    /// number of configured cpus
+    int
+    NumCPUs();
+  }  // namespace thread
+}  // namespace udap
+
+#endif
@@ -67,6 +67,8 @@ namespace udap
         ouraddr.sin_port        = 0;
         udp.user                = this;
         udp.recvfrom            = &HandleRecv;
+        udp.recvfrom_many       = nullptr;
+        udp.tick                = nullptr;
         return udap_ev_add_udp(loop, &udp, (const sockaddr*)&ouraddr) != -1;
       }
 
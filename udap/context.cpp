@@ -1,6 +1,8 @@
 #include <udap.h>
 #include <signal.h>
+#include <unistd.h>
 #include <udap.hpp>
+#include "affinity.hpp"
 #include "logger.hpp"
 #include "router.hpp"
 
@@ -44,6 +46,16 @@ namespace udap
     return true;
   }
 
+  static void
+  parse_cpus(const char *key, const char *val, std::vector< int > &cpus)
+  {
+    if(!udap::thread::ParseCPUList(val, cpus))
+    {
+      udap::Warn("invalid cpu list for ", key, ": ", val);
+      cpus.clear();
+    }
+  }
+
   void
   Context::iter_config(udap_config_iterator *itr, const char *section,
                        const char *key, const char *val)
@@ -54,11 +66,84 @@ namespace udap
       if(!strcmp(key, "worker-threads") && !ctx->singleThreaded)
       {
         int workers = atoi(val);
-        if(workers > 0 && ctx->worker == nullptr)
-        {
-          ctx->worker = udap_init_threadpool(workers, "udap-worker");
-        }
+        if(workers > 0)
+          ctx->num_workers = workers;
+      }
+      if(!strcmp(key, "worker-scheduler"))
+      {
+        if(!strcmp(val, "steal"))
+          ctx->workStealing = true;
+        else if(!strcmp(val, "shared"))
+          ctx->workStealing = false;
+        else
+          udap::Warn("unknown worker-scheduler ", val, ", using shared");
+      }
+      if(!strcmp(key, "worker-queue-limit"))
+      {
+        int limit = atoi(val);
+        if(limit >= 0)
+          ctx->workerQueueLimit = limit;
+      }
+      if(!strcmp(key, "net-recv-batch"))
+      {
+        int batch = atoi(val);
+        if(batch > 0)
+          ctx->netRecvBatch = batch;
+        else
+          udap::Warn("invalid net-recv-batch ", val);
+      }
+      if(!strcmp(key, "net-send-batch"))
+      {
+        int batch = atoi(val);
+        if(batch > 0)
+          ctx->netSendBatch = batch;
+        else
+          udap::Warn("invalid net-send-batch ", val);
+      }
+      if(!strcmp(key, "net-send-queue"))
+      {
+        int queue = atoi(val);
+        if(queue > 0)
+          ctx->netSendQueue = queue;
+        else
+          udap::Warn("invalid net-send-queue ", val);
+      }
+      if(!strcmp(key, "net-udp-offload"))
+        ctx->netUDPOffload = atoi(val) != 0;
+      if(!strcmp(key, "net-rcvbuf"))
+      {
+        int size = atoi(val);
+        if(size >= 0)
+          ctx->netRcvBuf = size;
+        else
+          udap::Warn("invalid net-rcvbuf ", val);
+      }
+      if(!strcmp(key, "net-sndbuf"))
+      {
+        int size = atoi(val);
+        if(size >= 0)
+          ctx->netSndBuf = size;
+        else
+          udap::Warn("invalid net-sndbuf ", val);
       }
+      if(!strcmp(key, "net-backend"))
+        ctx->netBackend = val;
+      if(!strcmp(key, "worker-cpus"))
+        parse_cpus(key, val, ctx->workerCPUs);
+      if(!strcmp(key, "net-cpus"))
+        parse_cpus(key, val, ctx->netCPUs);
+      if(!strcmp(key, "disk-cpus"))
+        parse_cpus(key, val, ctx->diskCPUs);
+      if(!strcmp(key, "logic-cpu"))
+      {
+        std::vector< int > cpus;
+        parse_cpus(key, val, cpus);
+        ctx->logicCPU = cpus.size() == 1 ? cpus[0] : -1;
+        if(cpus.size() > 1)
+          udap::Warn("logic-cpu takes a single cpu, not pinning");
+      }
+      if(!strcmp(key, "crypto-locality"))
+        ctx->cryptoLocality = atoi(val) > 0;
       if(!strcmp(key, "net-threads"))
       {
         ctx->num_nethreads = atoi(val);
@@ -129,11 +214,42 @@ namespace udap
   {
     udap::Info("starting up");
     this->LoadDatabase();
-    udap_ev_loop_alloc(&mainloop);
+    if(netBackend.empty())
+      udap_ev_loop_alloc(&mainloop);
+    else if(!udap_ev_loop_alloc_backend(&mainloop, netBackend.c_str()))
+    {
+      udap::Warn("net-backend ", netBackend,
+                 " is not available, using the default");
+      udap_ev_loop_alloc(&mainloop);
+    }
+    udap_ev_loop_set_recv_batch(mainloop, netRecvBatch);
+    udap_ev_loop_set_send_batch(mainloop, netSendBatch, netSendQueue);
+    udap_ev_loop_set_udp_offload(mainloop, netUDPOffload);
+    udap_ev_loop_set_socket_buffers(mainloop, netRcvBuf, netSndBuf);
+    if(!singleThreaded && num_nethreads > 1
+       && !udap_ev_loop_set_shards(mainloop, num_nethreads))
+      udap::Warn("net threads will share one socket per address");
 
     // ensure worker thread pool
     if(!worker && !singleThreaded)
-      worker = udap_init_threadpool(2, "udap-worker");
+    {
+      if(workStealing)
+      {
+        udap::Info("using work stealing scheduler for ", num_workers,
+                    " workers");
+        worker =
+            udap_init_work_stealing_threadpool(num_workers, "udap-worker");
+      }
+      else
+        worker = udap_init_threadpool(num_workers, "udap-worker");
+      udap_threadpool_set_max_jobs(worker, workerQueueLimit);
+      if(workerCPUs.size())
+        udap_threadpool_set_affinity(worker, workerCPUs.data(),
+                                      workerCPUs.size());
+      if(cryptoLocality && !udap_threadpool_enable_locality(worker))
+        udap::Warn("crypto-locality needs worker-scheduler=steal and "
+                   "worker-cpus, not enabled");
+    }
     else if(singleThreaded)
     {
       udap::Info("running in single threaded mode");
@@ -145,9 +261,20 @@ namespace udap
       logic = udap_init_single_process_logic(worker);
     }
     else
+    {
       logic = udap_init_logic();
+      if(logicCPU >= 0)
+      {
+        udap_logic_set_affinity(logic, logicCPU);
+        // timers are run from this thread
+        udap::thread::SetCurrentAffinity(logicCPU);
+      }
+    }
 
     router = udap_init_router(worker, mainloop, logic);
+    if(diskCPUs.size() && router->disk != worker)
+      udap_threadpool_set_affinity(router->disk, diskCPUs.data(),
+                                    diskCPUs.size());
 
     if(udap_configure_router(router, config))
     {
@@ -157,6 +284,11 @@ namespace udap
         udap_dht_set_msg_handler(router->dht, custom_dht_func);
       }
       udap_run_router(router, nodedb);
+      // signal handlers only hand the signal to this thread
+      if(pipe(sigpipe) == -1)
+        udap::Warn("no signal pipe, signals are ignored");
+      else
+        sigThread = std::thread([this]() { SignalLoop(); });
       // run net io thread
       if(singleThreaded)
       {
@@ -166,9 +298,10 @@ namespace udap
       else
       {
         auto netio = mainloop;
-        while(num_nethreads--)
+        for(int idx = 0; idx < num_nethreads; ++idx)
         {
-          netio_threads.emplace_back([netio]() { udap_ev_loop_run(netio); });
+          netio_threads.emplace_back(
+              [netio, idx]() { udap_ev_loop_run_shard(netio, idx); });
 #if(__APPLE__ && __MACH__)
 
 #elif(__FreeBSD__)
@@ -178,10 +311,17 @@ namespace udap
           pthread_setname_np(netio_threads.back().native_handle(),
                              "udap-netio");
 #endif
+          if(netCPUs.size())
+          {
+            int cpu = netCPUs[(netio_threads.size() - 1) % netCPUs.size()];
+            udap::thread::SetAffinity(netio_threads.back().native_handle(),
+                                      cpu);
+          }
         }
         udap::Info("running mainloop");
         udap_logic_mainloop(logic);
       }
+      Close();
       return 0;
     }
     else
@@ -192,31 +332,101 @@ namespace udap
   void
   Context::HandleSignal(int sig)
   {
-    if(sig == SIGINT)
-    {
-      udap::Info("SIGINT");
-      SigINT();
-    }
-    if(sig == SIGHUP)
+    // runs in the signal handler, anything that locks could deadlock with
+    // the thread it interrupted
+    int fd = sigpipe[1];
+    if(fd == -1)
+      return;
+    unsigned char b = sig;
+    auto val        = ::write(fd, &b, 1);
+    (void)val;
+  }
+
+  void
+  Context::SignalLoop()
+  {
+    unsigned char sig;
+    while(::read(sigpipe[0], &sig, 1) == 1)
     {
-      udap::Info("SIGHUP");
-      ReloadConfig();
+      if(sig == SIGINT)
+      {
+        udap::Info("SIGINT");
+        SigINT();
+      }
+      if(sig == SIGHUP)
+      {
+        udap::Info("SIGHUP");
+        udap_logic_queue_job(logic, {this, &handle_reload});
+      }
+      if(sig == SIGUSR1)
+      {
+        udap::Info("SIGUSR1");
+        udap_logic_queue_job(logic, {this, &handle_dump_stats});
+      }
     }
   }
 
+  void
+  Context::handle_reload(void *user)
+  {
+    static_cast< Context * >(user)->ReloadConfig();
+  }
+
+  void
+  Context::handle_dump_stats(void *user)
+  {
+    static_cast< Context * >(user)->DumpStats();
+  }
+
+  static bool
+  dump_link_stats(udap_router_link_iter *, udap_router *, udap_link *link)
+  {
+    if(link)
+      link->dump_stats(link);
+    return true;
+  }
+
+  void
+  Context::DumpStats()
+  {
+    if(worker)
+      udap_threadpool_dump_stats(worker);
+    if(logic)
+      udap_logic_dump_stats(logic);
+    if(router && router->disk != worker)
+      udap_threadpool_dump_stats(router->disk);
+    if(mainloop)
+      udap_ev_loop_dump_stats(mainloop);
+    if(router)
+      udap_router_iterate_links(router, {nullptr, &dump_link_stats});
+  }
+
   void
   Context::SigINT()
   {
-    Close();
+    // Run returns on the main thread and closes everything from there
+    if(singleThreaded)
+      udap_ev_loop_stop(mainloop);
+    else
+      udap_logic_stop_mainloop(logic);
   }
 
   void
   Context::Close()
   {
-    udap::Debug("stop router");
-    if(router)
-      udap_stop_router(router);
+    if(sigThread.joinable())
+    {
+      udap::Debug("stop signal thread");
+      int fd     = sigpipe[1];
+      sigpipe[1] = -1;
+      ::close(fd);
+      sigThread.join();
+      ::close(sigpipe[0]);
+      sigpipe[0] = -1;
+    }
 
+    // nothing may be running on the workers, net threads or logic thread
+    // when the links free their sessions
     udap::Debug("stop workers");
     if(worker)
       udap_threadpool_stop(worker);
@@ -225,11 +435,30 @@ namespace udap
     if(worker)
       udap_threadpool_join(worker);
 
-    udap::Debug("stop logic");
+    for(size_t i = 0; i < netio_threads.size(); ++i)
+    {
+      if(mainloop)
+      {
+        udap::Debug("stopping event loop thread ", i);
+        udap_ev_loop_stop(mainloop);
+      }
+    }
 
+    for(auto &t : netio_threads)
+    {
+      udap::Debug("join netio thread");
+      t.join();
+    }
+    netio_threads.clear();
+
+    udap::Debug("stop logic");
     if(logic)
       udap_logic_stop(logic);
 
+    udap::Debug("stop router");
+    if(router)
+      udap_stop_router(router);
+
     udap::Debug("free config");
     udap_free_config(&config);
 
@@ -239,28 +468,12 @@ namespace udap
     udap::Debug("free nodedb");
     udap_nodedb_free(&nodedb);
 
-    for(size_t i = 0; i < netio_threads.size(); ++i)
-    {
-      if(mainloop)
-      {
-        udap::Debug("stopping event loop thread ", i);
-        udap_ev_loop_stop(mainloop);
-      }
-    }
-
     udap::Debug("free router");
     udap_free_router(&router);
 
     udap::Debug("free logic");
     udap_free_logic(&logic);
 
-    for(auto &t : netio_threads)
-    {
-      udap::Debug("join netio thread");
-      t.join();
-    }
-
-    netio_threads.clear();
     udap::Debug("free mainloop");
     udap_ev_loop_free(&mainloop);
   }
@@ -326,7 +326,7 @@ namespace iwp
   {
     iwp_async_frame *frame = static_cast< iwp_async_frame * >(user);
     frame->hook(frame);
-    delete frame;
+    iwp_free_frame(frame);
   }
 
   void
@@ -345,7 +345,7 @@ namespace iwp
     iwp_encrypt_frame(frame);
     // call result RIGHT HERE
     frame->hook(frame);
-    delete frame;
+    iwp_free_frame(frame);
   }
 }  // namespace iwp
 
@@ -355,7 +355,18 @@ iwp_call_async_keygen(struct udap_async_iwp *iwp,
                       struct iwp_async_keygen *keygen)
 {
   keygen->iwp = iwp;
-  udap_threadpool_queue_job(iwp->worker, {keygen, &iwp::keygen});
+  udap_threadpool_queue_job_prio(iwp->worker, {keygen, &iwp::keygen},
+                                 UDAP_JOB_PRIO_HIGH);
+}
+
+void
+iwp_free_frame(struct iwp_async_frame *frame)
+{
+  if(frame->release)
+    frame->release(frame);
+  if(frame->pkt)
+    udap_pkt_unref(frame->pkt);
+  delete frame;
 }
 
 bool
@@ -415,7 +426,8 @@ iwp_call_async_gen_intro(struct udap_async_iwp *iwp,
                          struct iwp_async_intro *intro)
 {
   intro->iwp = iwp;
-  udap_threadpool_queue_job(iwp->worker, {intro, &iwp::gen_intro});
+  udap_threadpool_queue_job_prio(iwp->worker, {intro, &iwp::gen_intro},
+                                 UDAP_JOB_PRIO_HIGH);
 }
 
 void
@@ -423,7 +435,8 @@ iwp_call_async_verify_introack(struct udap_async_iwp *iwp,
                                struct iwp_async_introack *introack)
 {
   introack->iwp = iwp;
-  udap_threadpool_queue_job(iwp->worker, {introack, &iwp::verify_introack});
+  udap_threadpool_queue_job_prio(
+      iwp->worker, {introack, &iwp::verify_introack}, UDAP_JOB_PRIO_HIGH);
 }
 
 void
@@ -431,7 +444,8 @@ iwp_call_async_gen_session_start(struct udap_async_iwp *iwp,
                                  struct iwp_async_session_start *session)
 {
   session->iwp = iwp;
-  udap_threadpool_queue_job(iwp->worker, {session, &iwp::gen_session_start});
+  udap_threadpool_queue_job_prio(
+      iwp->worker, {session, &iwp::gen_session_start}, UDAP_JOB_PRIO_HIGH);
 }
 
 void
@@ -439,7 +453,8 @@ iwp_call_async_verify_intro(struct udap_async_iwp *iwp,
                             struct iwp_async_intro *intro)
 {
   intro->iwp = iwp;
-  udap_threadpool_queue_job(iwp->worker, {intro, &iwp::verify_intro});
+  udap_threadpool_queue_job_prio(iwp->worker, {intro, &iwp::verify_intro},
+                                 UDAP_JOB_PRIO_HIGH);
 }
 
 void
@@ -447,23 +462,65 @@ iwp_call_async_gen_introack(struct udap_async_iwp *iwp,
                             struct iwp_async_introack *introack)
 {
   introack->iwp = iwp;
-  udap_threadpool_queue_job(iwp->worker, {introack, &iwp::gen_introack});
+  udap_threadpool_queue_job_prio(iwp->worker, {introack, &iwp::gen_introack},
+                                 UDAP_JOB_PRIO_HIGH);
 }
 
-void
+bool
 iwp_call_async_frame_decrypt(struct udap_async_iwp *iwp,
                              struct iwp_async_frame *frame)
 {
   frame->iwp = iwp;
-  udap_threadpool_queue_job(iwp->worker, {frame, &iwp::hmac_then_decrypt});
+  return udap_threadpool_queue_job(
+      iwp->worker, {frame, &iwp::hmac_then_decrypt, "iwp-decrypt"});
 }
 
-void
+bool
 iwp_call_async_frame_encrypt(struct udap_async_iwp *iwp,
                              struct iwp_async_frame *frame)
 {
   frame->iwp = iwp;
-  udap_threadpool_queue_job(iwp->worker, {frame, &iwp::encrypt_then_hmac});
+  return udap_threadpool_queue_job(
+      iwp->worker, {frame, &iwp::encrypt_then_hmac, "iwp-encrypt"});
+}
+
+/// queue work on each frame as a batch
+static size_t
+iwp_call_async_frames(struct udap_async_iwp *iwp,
+                      struct iwp_async_frame **frames, size_t n,
+                      udap_thread_work_func work, const char *label)
+{
+  udap_thread_job batch[64];
+  size_t idx = 0;
+  while(idx < n)
+  {
+    size_t sz = 0;
+    while(idx < n && sz < sizeof(batch) / sizeof(batch[0]))
+    {
+      frames[idx]->iwp = iwp;
+      batch[sz++]      = {frames[idx++], work, label};
+    }
+    size_t queued = udap_threadpool_queue_jobs(iwp->worker, batch, sz);
+    if(queued < sz)
+      return idx - sz + queued;
+  }
+  return n;
+}
+
+size_t
+iwp_call_async_frame_decrypt_many(struct udap_async_iwp *iwp,
+                                  struct iwp_async_frame **frames, size_t n)
+{
+  return iwp_call_async_frames(iwp, frames, n, &iwp::hmac_then_decrypt,
+                               "iwp-decrypt");
+}
+
+size_t
+iwp_call_async_frame_encrypt_many(struct udap_async_iwp *iwp,
+                                  struct iwp_async_frame **frames, size_t n)
+{
+  return iwp_call_async_frames(iwp, frames, n, &iwp::encrypt_then_hmac,
+                               "iwp-encrypt");
 }
 
 void
@@ -471,8 +528,8 @@ iwp_call_async_verify_session_start(struct udap_async_iwp *iwp,
                                     struct iwp_async_session_start *session)
 {
   session->iwp = iwp;
-  udap_threadpool_queue_job(iwp->worker,
-                             {session, &iwp::verify_session_start});
+  udap_threadpool_queue_job_prio(
+      iwp->worker, {session, &iwp::verify_session_start}, UDAP_JOB_PRIO_HIGH);
 }
 
 struct udap_async_iwp *
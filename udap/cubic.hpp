@@ -0,0 +1,150 @@
+#ifndef UDAP_CUBIC_HPP
+#define UDAP_CUBIC_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+namespace udap
+{
+  namespace util
+  {
+    /// cubic congestion window (rfc 8312) of a reliable sender, in bytes
+    /// the sender keeps no more than Window() bytes unacked and tells it
+    /// about acks, losses and retransmit timeouts
+    /// times are ms, sequence numbers are whatever the sender counts its
+    /// sends with as long as they only go up
+    /// not thread safe, owned by the sender
+    struct Cubic
+    {
+      static const size_t InitialSegments = 10;
+      static const size_t MinSegments     = 2;
+
+      /// mss is the size of a full segment, the window never grows past
+      /// maxWindow bytes
+      Cubic(size_t mss = 1024, size_t maxWindow = 4 * 1024 * 1024)
+          : m_MSS(mss)
+          , m_Max(double(maxWindow) / mss)
+          , m_Cwnd(InitialSegments)
+          , m_Ssthresh(m_Max)
+      {
+      }
+
+      size_t
+      Window() const
+      {
+        return m_Cwnd * m_MSS;
+      }
+
+      bool
+      InSlowStart() const
+      {
+        return m_Cwnd < m_Ssthresh;
+      }
+
+      /// bytes newly acked at now, srtt is the current smoothed rtt
+      void
+      OnAck(size_t bytes, uint64_t now, uint64_t srtt)
+      {
+        double segs = double(bytes) / m_MSS;
+        if(InSlowStart())
+        {
+          m_Cwnd += segs;
+          if(m_Cwnd > m_Ssthresh)
+            m_Cwnd = m_Ssthresh;
+        }
+        else
+          Avoid(segs, now, srtt);
+        if(m_Cwnd > m_Max)
+          m_Cwnd = m_Max;
+      }
+
+      /// something sent at seq was lost, nextSeq is what the next send gets
+      /// the window is cut once per window of data, false if this loss was
+      /// from one already cut for
+      bool
+      OnLoss(uint64_t seq, uint64_t nextSeq)
+      {
+        if(seq < m_Recover)
+          return false;
+        m_Recover = nextSeq;
+        // fast convergence, give up bandwidth to newer flows sooner
+        if(m_Cwnd < m_WMax)
+          m_WMax = m_Cwnd * (1 + Beta) / 2;
+        else
+          m_WMax = m_Cwnd;
+        m_Cwnd *= Beta;
+        if(m_Cwnd < MinSegments)
+          m_Cwnd = MinSegments;
+        m_Ssthresh = m_Cwnd;
+        m_Epoch    = 0;
+        return true;
+      }
+
+      /// a retransmit timer ran out, start over from the minimum
+      void
+      OnTimeout(uint64_t nextSeq)
+      {
+        m_Recover  = nextSeq;
+        m_WMax     = m_Cwnd;
+        m_Ssthresh = m_Cwnd * Beta;
+        if(m_Ssthresh < MinSegments)
+          m_Ssthresh = MinSegments;
+        m_Cwnd  = MinSegments;
+        m_Epoch = 0;
+      }
+
+     private:
+      static constexpr double C    = 0.4;
+      static constexpr double Beta = 0.7;
+
+      /// congestion avoidance, grow towards the cubic curve around the
+      /// window at the last loss
+      void
+      Avoid(double segs, uint64_t now, uint64_t srtt)
+      {
+        if(m_Epoch == 0)
+        {
+          m_Epoch = now ? now : 1;
+          if(m_Cwnd < m_WMax)
+          {
+            m_K      = std::cbrt((m_WMax - m_Cwnd) / C);
+            m_Origin = m_WMax;
+          }
+          else
+          {
+            m_K      = 0;
+            m_Origin = m_Cwnd;
+          }
+          m_WEst = m_Cwnd;
+        }
+        double t      = double(now + srtt - m_Epoch) / 1000.0;
+        double target = m_Origin + C * (t - m_K) * (t - m_K) * (t - m_K);
+        if(target > m_Cwnd)
+          m_Cwnd += (target - m_Cwnd) * segs / m_Cwnd;
+        else
+          m_Cwnd += 0.01 * segs / m_Cwnd;
+        // never slower than reno would be
+        m_WEst += 3 * (1 - Beta) / (1 + Beta) * segs / m_Cwnd;
+        if(m_WEst > m_Cwnd)
+          m_Cwnd = m_WEst;
+      }
+
+      size_t m_MSS;
+      /// all in segments
+      double m_Max;
+      double m_Cwnd;
+      double m_Ssthresh;
+      double m_WMax   = 0;
+      double m_K      = 0;
+      double m_Origin = 0;
+      double m_WEst   = 0;
+      /// when the current avoidance epoch began, 0 if none
+      uint64_t m_Epoch = 0;
+      /// losses of anything sent before this were already cut for
+      uint64_t m_Recover = 0;
+    };
+  }  // namespace util
+}  // namespace udap
+
+#endif
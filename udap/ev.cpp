@@ -1,9 +1,13 @@
 #include <udap/ev.h>
 #include <udap/logic.h>
+#include "logger.hpp"
 #include "mem.hpp"
 
 #ifdef __linux__
 #include "ev_epoll.hpp"
+#if __has_include(<linux/io_uring.h>)
+#include "ev_uring.hpp"
+#endif
 #endif
 #if(__APPLE__ && __MACH__)
 #include "ev_kqueue.hpp"
@@ -28,6 +32,31 @@ udap_ev_loop_alloc(struct udap_ev_loop **ev)
   (*ev)->init();
 }
 
+bool
+udap_ev_loop_alloc_backend(struct udap_ev_loop **ev, const char *backend)
+{
+  udap_ev_loop *loop = nullptr;
+#ifdef __linux__
+  if(!strcmp(backend, "epoll"))
+    loop = new udap_epoll_loop;
+#ifdef UDAP_HAVE_IO_URING
+  if(!strcmp(backend, "io_uring"))
+    loop = new udap_uring_loop;
+#endif
+#endif
+#if(__APPLE__ && __MACH__) || defined(__FreeBSD__)
+  if(!strcmp(backend, "kqueue"))
+    loop = new udap_kqueue_loop;
+#endif
+  if(loop && !loop->init())
+  {
+    delete loop;
+    loop = nullptr;
+  }
+  *ev = loop;
+  return loop != nullptr;
+}
+
 void
 udap_ev_loop_free(struct udap_ev_loop **ev)
 {
@@ -41,17 +70,88 @@ udap_ev_loop_run(struct udap_ev_loop *ev)
   return ev->run();
 }
 
+bool
+udap_ev_loop_set_shards(struct udap_ev_loop *ev, size_t n)
+{
+  return ev->set_shards(n);
+}
+
+int
+udap_ev_loop_run_shard(struct udap_ev_loop *ev, size_t idx)
+{
+  return ev->run_shard(idx);
+}
+
 void
 udap_ev_loop_run_single_process(struct udap_ev_loop *ev,
                                  struct udap_threadpool *tp,
                                  struct udap_logic *logic)
 {
+  // sleep until a socket or timer is ready if we can watch the timers,
+  // otherwise poll them
+  int timerfd = udap_logic_timer_fd(logic);
+  int wait    = timerfd != -1 && ev->watch_fd(timerfd) ? -1 : 10;
   while(true)
   {
-    if(ev->tick(10) == -1)
-      return;
+    // run what is due before we block
     udap_logic_tick(logic);
     udap_threadpool_tick(tp);
+    if(ev->tick(wait) == -1)
+      return;
+  }
+}
+
+void
+udap_ev_loop_set_recv_batch(struct udap_ev_loop *ev, size_t batch)
+{
+  ev->recvBatch = batch ? batch : 1;
+}
+
+void
+udap_ev_loop_set_send_batch(struct udap_ev_loop *ev, size_t batch,
+                             size_t queue)
+{
+  ev->sendBatch = batch ? batch : 1;
+  ev->sendQueue = queue < ev->sendBatch ? ev->sendBatch : queue;
+}
+
+void
+udap_ev_loop_set_udp_offload(struct udap_ev_loop *ev, bool enable)
+{
+  ev->udpOffload = enable;
+}
+
+void
+udap_ev_loop_set_socket_buffers(struct udap_ev_loop *ev, size_t rcvbuf,
+                                 size_t sndbuf)
+{
+  ev->rcvBuf = rcvbuf;
+  ev->sndBuf = sndbuf;
+}
+
+void
+udap_ev_loop_dump_stats(struct udap_ev_loop *ev)
+{
+  for(auto udp : ev->udp_listeners)
+  {
+    udap_udp_stats st;
+    udap_ev_udp_get_stats(udp, &st);
+    double rx = st.recv_calls ? double(st.recv_datagrams) / st.recv_calls : 0;
+    double tx = st.send_calls ? double(st.send_datagrams) / st.send_calls : 0;
+    udap::Info("udp listener ", udp, " rx datagrams=", st.recv_datagrams,
+               " calls=", st.recv_calls, " per call=", rx,
+               " full batches=", st.recv_full_batches,
+               " max batch=", st.recv_max_batch,
+               " coalesced=", st.recv_coalesced, " bytes=", st.recv_bytes,
+               " kernel drops=", st.recv_kernel_drops,
+               " latency us p50=", st.recv_latency_p50 / 1000,
+               " p99=", st.recv_latency_p99 / 1000,
+               " max=", st.recv_latency_max / 1000,
+               " tx datagrams=", st.send_datagrams, " calls=", st.send_calls,
+               " per call=", tx, " full batches=", st.send_full_batches,
+               " segmented=", st.send_segmented,
+               " blocked=", st.send_blocked, " rejected=", st.send_rejected,
+               " bytes=", st.send_bytes, " errors=", st.send_errors);
   }
 }
 
@@ -85,4 +185,10 @@ udap_ev_udp_sendto(struct udap_udp_io *udp, const sockaddr *to,
 {
   return static_cast< udap::ev_io * >(udp->impl)->sendto(to, buf, sz);
 }
+
+void
+udap_ev_udp_get_stats(struct udap_udp_io *udp, struct udap_udp_stats *stats)
+{
+  static_cast< udap::ev_io * >(udp->impl)->get_stats(stats);
+}
 }
@@ -3,7 +3,11 @@
 #include <udap/ev.h>
 
 #include <unistd.h>
+#include <atomic>
 #include <list>
+#include <memory>
+#include <vector>
+#include "histogram.hpp"
 
 namespace udap
 {
@@ -16,11 +20,145 @@ namespace udap
 
     virtual int
     sendto(const sockaddr* dst, const void* data, size_t sz) = 0;
+
+    /// send anything queued by sendto
+    virtual void
+    flush()
+    {
+    }
+
+    virtual void
+    get_stats(udap_udp_stats* stats)
+    {
+      *stats = udap_udp_stats{};
+    }
+
     virtual ~ev_io()
     {
       ::close(fd);
     };
   };
+
+  /// receive counters for a udp listener
+  /// written by the net thread, read from anywhere
+  struct udp_counters
+  {
+    std::atomic< uint64_t > calls;
+    std::atomic< uint64_t > datagrams;
+    std::atomic< uint64_t > fullBatches;
+    std::atomic< uint64_t > maxBatch;
+    /// datagrams the kernel handed us coalesced
+    std::atomic< uint64_t > recvCoalesced;
+    std::atomic< uint64_t > recvBytes;
+    /// the socket's count of datagrams it dropped, SO_RXQ_OVFL
+    std::atomic< uint64_t > kernelDrops;
+    /// nanoseconds between the kernel and us receiving each datagram
+    util::Histogram recvLatency;
+    std::atomic< uint64_t > sendCalls;
+    std::atomic< uint64_t > sendDatagrams;
+    std::atomic< uint64_t > sendFullBatches;
+    /// datagrams handed to the kernel as part of a train
+    std::atomic< uint64_t > sendSegmented;
+    /// sends put off because the socket buffer was full
+    std::atomic< uint64_t > sendBlocked;
+    /// sends refused because our queue was full
+    std::atomic< uint64_t > sendRejected;
+    std::atomic< uint64_t > sendBytes;
+    /// datagrams dropped because the kernel would not send them
+    std::atomic< uint64_t > sendErrors;
+
+    udp_counters()
+        : calls(0)
+        , datagrams(0)
+        , fullBatches(0)
+        , maxBatch(0)
+        , recvCoalesced(0)
+        , recvBytes(0)
+        , kernelDrops(0)
+        , sendCalls(0)
+        , sendDatagrams(0)
+        , sendFullBatches(0)
+        , sendSegmented(0)
+        , sendBlocked(0)
+        , sendRejected(0)
+        , sendBytes(0)
+        , sendErrors(0)
+    {
+    }
+
+    /// one call read msgs messages holding n datagrams of bytes in total
+    void
+    Read(size_t msgs, size_t n, size_t batch, size_t bytes)
+    {
+      calls.fetch_add(1, std::memory_order_relaxed);
+      datagrams.fetch_add(n, std::memory_order_relaxed);
+      recvBytes.fetch_add(bytes, std::memory_order_relaxed);
+      if(msgs == batch)
+        fullBatches.fetch_add(1, std::memory_order_relaxed);
+      if(n > maxBatch.load(std::memory_order_relaxed))
+        maxBatch.store(n, std::memory_order_relaxed);
+    }
+
+    /// one call sent msgs messages holding n datagrams of bytes in total
+    void
+    Sent(size_t msgs, size_t n, size_t batch, size_t bytes)
+    {
+      sendCalls.fetch_add(1, std::memory_order_relaxed);
+      sendDatagrams.fetch_add(n, std::memory_order_relaxed);
+      sendBytes.fetch_add(bytes, std::memory_order_relaxed);
+      if(msgs == batch)
+        sendFullBatches.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void
+    Fill(udap_udp_stats* stats) const
+    {
+      stats->recv_calls        = calls;
+      stats->recv_datagrams    = datagrams;
+      stats->recv_full_batches = fullBatches;
+      stats->recv_max_batch    = maxBatch;
+      stats->recv_coalesced    = recvCoalesced;
+      stats->recv_bytes        = recvBytes;
+      stats->recv_kernel_drops = kernelDrops;
+      stats->recv_stamped      = recvLatency.Count();
+      stats->recv_latency_p50  = recvLatency.Percentile(50);
+      stats->recv_latency_p99  = recvLatency.Percentile(99);
+      stats->recv_latency_max  = recvLatency.Max();
+      stats->send_calls        = sendCalls;
+      stats->send_datagrams    = sendDatagrams;
+      stats->send_full_batches = sendFullBatches;
+      stats->send_segmented    = sendSegmented;
+      stats->send_blocked      = sendBlocked;
+      stats->send_rejected     = sendRejected;
+      stats->send_bytes        = sendBytes;
+      stats->send_errors       = sendErrors;
+    }
+  };
+
+  /// only wakes up the event loop when fd is readable
+  /// the owner of fd reads and closes it
+  struct fd_watch : public ev_io
+  {
+    fd_watch(int f) : ev_io(f){};
+
+    ~fd_watch()
+    {
+      // not ours to close
+      fd = -1;
+    }
+
+    virtual int
+    read(void*, size_t)
+    {
+      return 0;
+    }
+
+    virtual int
+    sendto(const sockaddr*, const void*, size_t)
+    {
+      return -1;
+    }
+  };
 };  // namespace udap
 
 struct udap_ev_loop
@@ -30,6 +168,22 @@ struct udap_ev_loop
   virtual int
   run() = 0;
 
+  /// split into n loops that each run on their own thread with their own
+  /// sockets, before any udp is added, return false if not supported
+  virtual bool
+  set_shards(size_t n)
+  {
+    return n == 1;
+  }
+
+  /// run shard idx, loops that can't shard run everything on every thread
+  virtual int
+  run_shard(size_t)
+  {
+    return run();
+  }
+
+  /// run one iteration waiting up to ms, -1 once stopped
   virtual int
   tick(int ms) = 0;
 
@@ -43,9 +197,25 @@ struct udap_ev_loop
   virtual bool
   close_ev(udap::ev_io* ev) = 0;
 
+  /// make tick return when fd is readable
+  virtual bool
+  watch_fd(int fd) = 0;
+
   virtual ~udap_ev_loop(){};
 
+  /// datagrams udp listeners read per syscall
+  size_t recvBatch = UDAP_EV_DEFAULT_RECV_BATCH;
+  /// datagrams udp listeners send per syscall
+  size_t sendBatch = UDAP_EV_DEFAULT_SEND_BATCH;
+  /// most datagrams queued per udp listener
+  size_t sendQueue = UDAP_EV_DEFAULT_SEND_QUEUE;
+  /// let the kernel split and coalesce datagram trains where it can
+  bool udpOffload = true;
+  /// socket buffer sizes for new udp sockets, 0 for the kernel default
+  size_t rcvBuf = 0;
+  size_t sndBuf = 0;
   std::list< udap_udp_io* > udp_listeners;
+  std::vector< std::unique_ptr< udap::fd_watch > > watches;
 };
 
 #endif
@@ -2,39 +2,356 @@
 #define EV_EPOLL_HPP
 #include <udap/buffer.h>
 #include <udap/net.h>
+#include <udap/time.h>
 #include <signal.h>
+#include <netinet/udp.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
 #include <unistd.h>
+#include <algorithm>
+#include <condition_variable>
 #include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "ev.hpp"
 #include "logger.hpp"
 #include "net.hpp"
+#include "pkt.hpp"
 
 namespace udap
 {
+  /// what the kernel told us about a received message in its cmsgs
+  struct recv_meta
+  {
+    /// size of each datagram in a coalesced train, 0 if it is not one
+    size_t seg = 0;
+    /// kernel receive time in CLOCK_REALTIME nanoseconds, 0 if not stamped
+    uint64_t stamp = 0;
+    /// the socket's running count of datagrams it dropped, SO_RXQ_OVFL
+    bool haveDrops = false;
+    uint32_t drops = 0;
+
+    explicit recv_meta(msghdr& hdr)
+    {
+      for(cmsghdr* c = CMSG_FIRSTHDR(&hdr); c; c = CMSG_NXTHDR(&hdr, c))
+      {
+        if(c->cmsg_level == SOL_UDP && c->cmsg_type == UDP_GRO)
+        {
+          int size;
+          memcpy(&size, CMSG_DATA(c), sizeof(size));
+          seg = size > 0 ? size : 0;
+        }
+        else if(c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS)
+        {
+          timespec ts;
+          memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+          stamp = uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+        }
+        else if(c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL)
+        {
+          memcpy(&drops, CMSG_DATA(c), sizeof(drops));
+          haveDrops = true;
+        }
+      }
+    }
+
+    /// current CLOCK_REALTIME in nanoseconds, what the kernel stamps with
+    static uint64_t
+    realtime()
+    {
+      timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    /// put what we learned in counters, real is realtime() and now is
+    /// udap_time_now_ns() as the message is read
+    /// returns when the kernel got it on the udap_time_now_ns clock, 0 if
+    /// it was not stamped
+    uint64_t
+    account(udp_counters& counters, uint64_t real, uint64_t now) const
+    {
+      if(haveDrops)
+        counters.kernelDrops.store(drops, std::memory_order_relaxed);
+      // the wall clock may have stepped back since
+      if(stamp == 0 || stamp > real)
+        return 0;
+      uint64_t waited = real - stamp;
+      counters.recvLatency.Record(waited);
+      return waited < now ? now - waited : 0;
+    }
+  };
+
+  /// with gro we read into train sized buffers, a callback keeping a frame
+  /// of one would pin the whole train, so each datagram is copied out into
+  /// a packet its own size first
+  struct gro_copies
+  {
+    /// pooled copies are this big, most datagrams fit
+    static const size_t PacketSize = 2048;
+
+    /// packets of sz bytes, bigger datagrams get one of their own
+    PacketPool* pool = nullptr;
+    /// copies in the current batch, we hold a reference to each
+    std::vector< udap_pkt* > pkts;
+
+    ~gro_copies()
+    {
+      release();
+      if(pool)
+        pool->Close();
+    }
+
+    void
+    init(size_t sz)
+    {
+      pool = new PacketPool(sz);
+    }
+
+    /// append the datagram at buf in pkt to out, in a copy if there is a
+    /// pool
+    void
+    push(std::vector< udap_udp_datagram >& out, const sockaddr* from,
+         const byte_t* buf, size_t sz, udap_pkt* pkt, uint64_t at)
+    {
+      if(pool)
+      {
+        pkt = sz <= pool->Size() ? pool->Get() : NewPacket(sz);
+        memcpy(pkt->data(), buf, sz);
+        buf = pkt->data();
+        pkts.push_back(pkt);
+      }
+      out.push_back({from, buf, sz, pkt, at});
+    }
+
+    /// the callbacks have had the batch, they ref what they keep
+    void
+    release()
+    {
+      for(auto pkt : pkts)
+        udap_pkt_unref(pkt);
+      pkts.clear();
+    }
+  };
+
+  /// bytes of a queued outbound datagram, in place unless it is bigger than
+  /// most, jumbo ones go in memory the slot holds on to for the next one
+  struct send_buf
+  {
+    /// most datagrams fit
+    static const size_t MinSize = 2048;
+
+    byte_t small[MinSize];
+    std::unique_ptr< byte_t[] > big;
+    size_t bigSize = 0;
+    byte_t* ptr    = small;
+
+    void
+    put(const void* data, size_t sz)
+    {
+      ptr = small;
+      if(sz > MinSize)
+      {
+        if(sz > bigSize)
+        {
+          big.reset(new byte_t[sz]);
+          bigSize = sz;
+        }
+        ptr = big.get();
+      }
+      memcpy(ptr, data, sz);
+    }
+
+    byte_t*
+    data()
+    {
+      return ptr;
+    }
+  };
+
   struct udp_listener : public ev_io
   {
     udap_udp_io* udp;
+    /// datagrams read per recvmmsg
+    size_t batch;
+    /// true if the kernel coalesces inbound trains for us (UDP_GRO)
+    bool gro = false;
+    /// true if we can hand the kernel trains to split (UDP_SEGMENT)
+    bool gso = false;
+    /// bytes per receive buffer, room for a whole train with gro
+    size_t bufSize;
+    /// packets of bufSize bytes, one per batch slot
+    PacketPool* pool;
+    /// what each batch slot reads into, replaced when a callback keeps it
+    std::vector< udap_pkt* > pkts;
+    std::vector< mmsghdr > msgs;
+    std::vector< iovec > iovs;
+    std::vector< sockaddr_in6 > addrs;
+    /// ancillary data per received message
+    std::vector< byte_t > ctrl;
+    /// datagrams of the current batch after splitting trains
+    std::vector< udap_udp_datagram > datagrams;
+    /// with gro, what datagrams are copied into
+    gro_copies copies;
+    udp_counters counters;
+
+    /// fits a 9000 byte jumbo frame
+    static const size_t MaxDatagram = 9216;
+    /// biggest train gro can hand us
+    static const size_t MaxTrain = 65536;
+    /// most bytes and datagrams in one train we send with gso
+    static const size_t MaxTrainBytes = 64000;
+    static const size_t MaxSegments   = 64;
+    /// room for the gro, drop count and timestamp cmsgs
+    static const size_t CtrlSize      = 128;
+    /// most recvmmsg calls per readiness event so one busy socket can't
+    /// starve the rest of the loop
+    static const size_t MaxReads = 8;
 
-    udp_listener(int fd, udap_udp_io* u) : ev_io(fd), udp(u){};
+    udp_listener(int fd, udap_udp_io* u, size_t b, size_t sb, size_t sq,
+                 bool offload, int efd, int wfd)
+        : ev_io(fd)
+        , udp(u)
+        , batch(b)
+        , msgs(b)
+        , iovs(b)
+        , addrs(b)
+        , ctrl(b * CtrlSize)
+        , epollfd(efd)
+        , wakefd(wfd)
+        , sendBatch(sb)
+        , sendq(sq)
+        , sendMsgs(sb)
+        , sendSegs(sb)
+        , sendCtrl(sb * CtrlSize)
+        , sendIovs(sq)
+    {
+      if(offload)
+      {
+        // both fail on kernels before 5.0 / 4.18, we then do it ourselves
+        int one = 1;
+        gro = setsockopt(fd, SOL_UDP, UDP_GRO, &one, sizeof(one)) == 0;
+        int size       = 0;
+        socklen_t slen = sizeof(size);
+        gso = getsockopt(fd, SOL_UDP, UDP_SEGMENT, &size, &slen) == 0;
+      }
+      bufSize = gro ? MaxTrain : MaxDatagram;
+      pool = new PacketPool(bufSize);
+      if(gro)
+        copies.init(gro_copies::PacketSize);
+      pkts.resize(batch);
+      datagrams.reserve(gro ? batch * MaxSegments : batch);
+      for(size_t idx = 0; idx < batch; ++idx)
+      {
+        pkts[idx]                    = pool->Get();
+        iovs[idx].iov_base           = pkts[idx]->data();
+        iovs[idx].iov_len            = bufSize;
+        msgs[idx].msg_hdr            = msghdr{};
+        msgs[idx].msg_hdr.msg_name   = &addrs[idx];
+        msgs[idx].msg_hdr.msg_iov    = &iovs[idx];
+        msgs[idx].msg_hdr.msg_iovlen = 1;
+      }
+    };
 
     ~udp_listener()
     {
+      // best effort, anything the kernel won't take now is dropped
+      flush();
+      for(auto pkt : pkts)
+        udap_pkt_unref(pkt);
+      // packets still held by callbacks keep the pool around
+      pool->Close();
     }
 
+    /// drain the socket in batches, buf is not used
     virtual int
-    read(void* buf, size_t sz)
+    read(void*, size_t)
     {
-      sockaddr_in6 src;
-      socklen_t slen = sizeof(sockaddr_in6);
-      sockaddr* addr = (sockaddr*)&src;
-      int ret        = ::recvfrom(fd, buf, sz, 0, addr, &slen);
-      if(ret == -1)
-        return -1;
-      udp->recvfrom(udp, addr, buf, ret);
+      for(size_t reads = 0; reads < MaxReads; ++reads)
+      {
+        for(size_t idx = 0; idx < batch; ++idx)
+        {
+          msghdr& hdr        = msgs[idx].msg_hdr;
+          hdr.msg_namelen    = sizeof(sockaddr_in6);
+          hdr.msg_control    = &ctrl[idx * CtrlSize];
+          hdr.msg_controllen = CtrlSize;
+        }
+        int ret = ::recvmmsg(fd, msgs.data(), batch, MSG_DONTWAIT, nullptr);
+        if(ret == -1)
+        {
+          if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return 0;
+          return -1;
+        }
+        size_t n = ret;
+        deliver(n);
+        if(n < batch)
+          return 0;
+      }
       return 0;
     }
 
+    void
+    deliver(size_t n)
+    {
+      datagrams.clear();
+      uint64_t real = recv_meta::realtime();
+      uint64_t now  = udap_time_now_ns();
+      size_t bytes  = 0;
+      for(size_t idx = 0; idx < n; ++idx)
+      {
+        const sockaddr* from = (const sockaddr*)&addrs[idx];
+        const byte_t* buf    = pkts[idx]->data();
+        size_t len           = msgs[idx].msg_len;
+        recv_meta meta(msgs[idx].msg_hdr);
+        uint64_t at = meta.account(counters, real, now);
+        size_t seg  = meta.seg;
+        bytes += len;
+        if(seg == 0 || seg >= len)
+        {
+          copies.push(datagrams, from, buf, len, pkts[idx], at);
+          continue;
+        }
+        // split the train back into the datagrams that were sent
+        size_t before = datagrams.size();
+        for(size_t off = 0; off < len; off += seg)
+          copies.push(datagrams, from, buf + off,
+                      len - off < seg ? len - off : seg, pkts[idx], at);
+        counters.recvCoalesced.fetch_add(datagrams.size() - before,
+                                         std::memory_order_relaxed);
+      }
+      counters.Read(n, datagrams.size(), batch, bytes);
+      if(udp->recvfrom_many)
+        udp->recvfrom_many(udp, datagrams.data(), datagrams.size());
+      else
+      {
+        for(const auto& dgram : datagrams)
+          udp->recvfrom(udp, dgram.from, dgram.buf, dgram.sz);
+      }
+      copies.release();
+      // read the next batch into fresh packets where callbacks kept ours
+      for(size_t idx = 0; idx < n; ++idx)
+      {
+        if(pkts[idx]->refs.load(std::memory_order_acquire) == 1)
+          continue;
+        udap_pkt_unref(pkts[idx]);
+        pkts[idx]          = pool->Get();
+        iovs[idx].iov_base = pkts[idx]->data();
+      }
+    }
+
+    void
+    get_stats(udap_udp_stats* stats)
+    {
+      counters.Fill(stats);
+    }
+
+    /// queue a datagram to go out on the next flush
+    /// returns -1 with errno EAGAIN if the send queue is full
     virtual int
     sendto(const sockaddr* to, const void* data, size_t sz)
     {
@@ -50,134 +367,311 @@ namespace udap
         default:
           return -1;
       }
-      ssize_t sent = ::sendto(fd, data, sz, SOCK_NONBLOCK, to, slen);
-      if(sent == -1)
+      if(sz > MaxDatagram)
       {
-        udap::Warn(strerror(errno));
+        errno = EMSGSIZE;
+        return -1;
+      }
+      std::unique_lock< std::mutex > lock(sendMutex);
+      if(sendSize == sendq.size())
+      {
+        flush_locked();
+        if(sendSize == sendq.size())
+        {
+          counters.sendRejected.fetch_add(1, std::memory_order_relaxed);
+          errno = EAGAIN;
+          return -1;
+        }
       }
-      return sent;
+      outbound& out = sendq[(sendHead + sendSize) % sendq.size()];
+      memcpy(&out.addr, to, slen);
+      out.slen = slen;
+      out.sz   = sz;
+      out.buf.put(data, sz);
+      ++sendSize;
+      if(sendSize >= sendBatch)
+        flush_locked();
+      else if(sendSize == 1)
+        wake();
+      return sz;
     }
-  };
-};  // namespace udap
-
-struct udap_epoll_loop : public udap_ev_loop
-{
-  int epollfd;
-  int pipefds[2];
-  udap_epoll_loop() : epollfd(-1)
-  {
-    pipefds[0] = -1;
-    pipefds[1] = -1;
-  }
-
-  ~udap_epoll_loop()
-  {
-    if(pipefds[0] != -1)
-      close(pipefds[0]);
 
-    if(pipefds[1] != -1)
-      close(pipefds[1]);
-
-    if(epollfd != -1)
-      close(epollfd);
-  }
+    /// send everything queued that the socket will take
+    void
+    flush()
+    {
+      std::unique_lock< std::mutex > lock(sendMutex);
+      if(sendSize)
+        flush_locked();
+    }
 
-  bool
-  init()
-  {
-    if(epollfd == -1)
-      epollfd = epoll_create1(EPOLL_CLOEXEC);
-    if(epollfd != -1)
+   private:
+    /// a queued outbound datagram
+    struct outbound
     {
-      if(pipe(pipefds) == -1)
-        return false;
-      epoll_event sig_ev;
+      sockaddr_in6 addr;
+      socklen_t slen;
+      size_t sz;
+      send_buf buf;
+    };
 
-      sig_ev.data.fd = pipefds[0];
-      sig_ev.events  = EPOLLIN;
-      return epoll_ctl(epollfd, EPOLL_CTL_ADD, pipefds[0], &sig_ev) != -1;
+    outbound&
+    queued(size_t idx)
+    {
+      return sendq[(sendHead + idx) % sendq.size()];
     }
-    return false;
-  }
-
-  int
-  tick(int ms)
-  {
-    epoll_event events[1024];
-    int result;
-    byte_t readbuf[2048];
 
-    result = epoll_wait(epollfd, events, 1024, ms);
-    if(result > 0)
+    /// build up to sendBatch messages from the queue, with gso each one
+    /// takes a train of datagrams to the same peer that are all the same
+    /// size except maybe the last
+    /// return how many messages were built
+    size_t
+    build_send()
     {
-      int idx = 0;
-      while(idx < result)
+      size_t msg = 0, used = 0;
+      while(msg < sendBatch && used < sendSize)
       {
-        // handle signalfd
-        if(events[idx].data.fd == pipefds[0])
+        outbound& first = queued(used);
+        size_t seg      = first.sz;
+        size_t total    = seg;
+        size_t segs     = 1;
+        iovec* iov      = &sendIovs[used];
+        iov->iov_base   = first.buf.data();
+        iov->iov_len    = first.sz;
+        while(gso && used + segs < sendSize && segs < MaxSegments)
         {
-          udap::Debug("exiting epoll loop");
-          return 0;
+          outbound& next = queued(used + segs);
+          if(next.slen != first.slen
+             || memcmp(&next.addr, &first.addr, next.slen) || next.sz > seg
+             || total + next.sz > MaxTrainBytes)
+            break;
+          iov[segs].iov_base = next.buf.data();
+          iov[segs].iov_len  = next.sz;
+          total += next.sz;
+          ++segs;
+          // a shorter datagram ends the train
+          if(next.sz < seg)
+            break;
         }
-        udap::ev_io* ev = static_cast< udap::ev_io* >(events[idx].data.ptr);
-        if(events[idx].events & EPOLLIN)
+        msghdr& hdr     = sendMsgs[msg].msg_hdr;
+        hdr             = msghdr{};
+        hdr.msg_name    = &first.addr;
+        hdr.msg_namelen = first.slen;
+        hdr.msg_iov     = iov;
+        hdr.msg_iovlen  = segs;
+        if(segs > 1)
         {
-          if(ev->read(readbuf, sizeof(readbuf)) == -1)
-          {
-            udap::Debug("close ev");
-            close_ev(ev);
-          }
+          hdr.msg_control    = &sendCtrl[msg * CtrlSize];
+          hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+          cmsghdr* c         = CMSG_FIRSTHDR(&hdr);
+          c->cmsg_level      = SOL_UDP;
+          c->cmsg_type       = UDP_SEGMENT;
+          c->cmsg_len        = CMSG_LEN(sizeof(uint16_t));
+          uint16_t size      = seg;
+          memcpy(CMSG_DATA(c), &size, sizeof(size));
         }
-        ++idx;
+        sendSegs[msg] = segs;
+        used += segs;
+        ++msg;
       }
+      return msg;
     }
-    for(auto& l : udp_listeners)
-      if(l->tick)
-        l->tick(l);
-    return result;
-  }
 
-  int
-  run()
-  {
-    epoll_event events[1024];
-    int result;
-    byte_t readbuf[2048];
-    do
+    void
+    flush_locked()
     {
-      result = epoll_wait(epollfd, events, 1024, 100);
-      if(result > 0)
+      while(sendSize)
       {
-        int idx = 0;
-        while(idx < result)
+        size_t n = build_send();
+        int ret  = ::sendmmsg(fd, sendMsgs.data(), n, MSG_DONTWAIT);
+        if(ret == -1)
         {
-          // handle signalfd
-          if(events[idx].data.fd == pipefds[0])
+          if(errno == EINTR)
+            continue;
+          if(errno == EAGAIN || errno == EWOULDBLOCK)
           {
-            udap::Debug("exiting epoll loop");
-            return 0;
+            // socket buffer is full, try again when it drains
+            counters.sendBlocked.fetch_add(1, std::memory_order_relaxed);
+            watch_writable(true);
+            return;
           }
-          udap::ev_io* ev = static_cast< udap::ev_io* >(events[idx].data.ptr);
-          if(events[idx].events & EPOLLIN)
+          if(sendSegs[0] > 1)
           {
-            if(ev->read(readbuf, sizeof(readbuf)) == -1)
-            {
-              udap::Debug("close ev");
-              close_ev(ev);
-            }
+            // the route or device won't take trains, send them one by one
+            udap::Warn("udp segmentation offload failed, disabling: ",
+                       strerror(errno));
+            gso = false;
+            continue;
           }
-          ++idx;
+          // the first datagram can't be sent, drop it like sendto did
+          // too big for the device is expected of path mtu probes
+          if(errno == EMSGSIZE)
+            udap::Debug("sendmmsg: ", strerror(errno));
+          else
+            udap::Warn("sendmmsg: ", strerror(errno));
+          counters.sendErrors.fetch_add(1, std::memory_order_relaxed);
+          pop_sent(1);
+          continue;
+        }
+        size_t sent = 0, bytes = 0;
+        for(int idx = 0; idx < ret; ++idx)
+        {
+          sent += sendSegs[idx];
+          bytes += sendMsgs[idx].msg_len;
+          if(sendSegs[idx] > 1)
+            counters.sendSegmented.fetch_add(sendSegs[idx],
+                                             std::memory_order_relaxed);
         }
+        counters.Sent(ret, sent, sendBatch, bytes);
+        pop_sent(sent);
       }
-      for(auto& l : udp_listeners)
-        if(l->tick)
-          l->tick(l);
-    } while(epollfd != -1);
-    return result;
+      watch_writable(false);
+    }
+
+    void
+    pop_sent(size_t n)
+    {
+      sendHead = (sendHead + n) % sendq.size();
+      sendSize -= n;
+    }
+
+    /// ask for EPOLLOUT while we have datagrams the kernel would not take
+    void
+    watch_writable(bool on)
+    {
+      if(on == pollingOut)
+        return;
+      epoll_event ev;
+      ev.data.ptr = this;
+      ev.events   = on ? EPOLLIN | EPOLLOUT : EPOLLIN;
+      if(epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &ev) != -1)
+        pollingOut = on;
+    }
+
+    /// make the loop flush us soon
+    void
+    wake()
+    {
+      uint64_t one = 1;
+      auto val     = ::write(wakefd, &one, sizeof(one));
+      (void)val;
+    }
+
+    int epollfd;
+    /// eventfd the loop wakes up on
+    int wakefd;
+    /// datagrams sent per sendmmsg
+    size_t sendBatch;
+    /// bounded ring of outbound datagrams
+    std::vector< outbound > sendq;
+    size_t sendHead = 0;
+    size_t sendSize = 0;
+    bool pollingOut = false;
+    std::vector< mmsghdr > sendMsgs;
+    /// datagrams in each built message
+    std::vector< size_t > sendSegs;
+    std::vector< byte_t > sendCtrl;
+    /// one per queued datagram, a message's iovs are contiguous
+    std::vector< iovec > sendIovs;
+    std::mutex sendMutex;
+  };
+
+  /// one udp address bound by a socket per shard with SO_REUSEPORT
+  /// the shards read and flush their own socket, this only routes sends
+  struct udp_group : public ev_io
+  {
+    /// one listener per shard, owned by the loop
+    std::vector< ev_io* > members;
+
+    udp_group() : ev_io(-1){};
+
+    ~udp_group()
+    {
+      // no socket of our own
+      fd = -1;
+    }
+
+    virtual int
+    read(void*, size_t)
+    {
+      return 0;
+    }
+
+    /// always send to a peer from the same socket
+    virtual int
+    sendto(const sockaddr* to, const void* data, size_t sz)
+    {
+      size_t idx = udap::addrhash()(udap::Addr(*to)) % members.size();
+      return members[idx]->sendto(to, data, sz);
+    }
+
+    void
+    flush()
+    {
+      for(auto member : members)
+        member->flush();
+    }
+
+    void
+    get_stats(udap_udp_stats* stats)
+    {
+      *stats = udap_udp_stats{};
+      for(auto member : members)
+      {
+        udap_udp_stats st;
+        member->get_stats(&st);
+        stats->recv_calls += st.recv_calls;
+        stats->recv_datagrams += st.recv_datagrams;
+        stats->recv_full_batches += st.recv_full_batches;
+        stats->recv_coalesced += st.recv_coalesced;
+        if(st.recv_max_batch > stats->recv_max_batch)
+          stats->recv_max_batch = st.recv_max_batch;
+        stats->recv_bytes += st.recv_bytes;
+        stats->recv_kernel_drops += st.recv_kernel_drops;
+        stats->recv_stamped += st.recv_stamped;
+        // the slowest shard's latencies
+        stats->recv_latency_p50 =
+            std::max(stats->recv_latency_p50, st.recv_latency_p50);
+        stats->recv_latency_p99 =
+            std::max(stats->recv_latency_p99, st.recv_latency_p99);
+        stats->recv_latency_max =
+            std::max(stats->recv_latency_max, st.recv_latency_max);
+        stats->send_calls += st.send_calls;
+        stats->send_datagrams += st.send_datagrams;
+        stats->send_full_batches += st.send_full_batches;
+        stats->send_segmented += st.send_segmented;
+        stats->send_blocked += st.send_blocked;
+        stats->send_rejected += st.send_rejected;
+        stats->send_bytes += st.send_bytes;
+        stats->send_errors += st.send_errors;
+      }
+    }
+  };
+
+  /// ask for a size byte socket buffer, as root past the sysctl limit
+  inline void
+  udp_buffer(int fd, int opt, int force, size_t size, const char* name)
+  {
+    if(size == 0)
+      return;
+    int want = size;
+    if(setsockopt(fd, SOL_SOCKET, force, &want, sizeof(want)) == -1)
+      setsockopt(fd, SOL_SOCKET, opt, &want, sizeof(want));
+    // the kernel reports double what it was asked for to cover overhead
+    int got        = 0;
+    socklen_t slen = sizeof(got);
+    if(getsockopt(fd, SOL_SOCKET, opt, &got, &slen) == 0 && got / 2 < want)
+      udap::Warn(name, " is ", got / 2, " bytes, not ", want,
+                 ", raise net.core.", opt == SO_RCVBUF ? "rmem" : "wmem",
+                 "_max");
   }
 
-  int
-  udp_bind(const sockaddr* addr)
+  /// make a udp socket bound to addr, -1 on error
+  /// with reuseport other sockets can bind the same address and the kernel
+  /// hashes flows across them
+  inline int
+  udp_bind(const sockaddr* addr, bool reuseport, size_t rcvbuf = 0,
+           size_t sndbuf = 0)
   {
     socklen_t slen;
     switch(addr->sa_family)
@@ -210,6 +704,37 @@ struct udap_epoll_loop : public udap_ev_loop
         return -1;
       }
     }
+    int one = 1;
+    if(reuseport)
+    {
+      // every shard binds the same port, the kernel hashes flows across them
+      if(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1)
+      {
+        perror("setsockopt(SO_REUSEPORT)");
+        close(fd);
+        return -1;
+      }
+    }
+    // have the kernel tell us how many datagrams it dropped and when each
+    // one arrived, both only feed our stats
+    if(setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)) == -1)
+      udap::Debug("no SO_RXQ_OVFL: ", strerror(errno));
+    if(setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)) == -1)
+      udap::Debug("no SO_TIMESTAMPNS: ", strerror(errno));
+    udp_buffer(fd, SO_RCVBUF, SO_RCVBUFFORCE, rcvbuf, "SO_RCVBUF");
+    udp_buffer(fd, SO_SNDBUF, SO_SNDBUFFORCE, sndbuf, "SO_SNDBUF");
+    // never fragment, links find the path mtu themselves and a probe that
+    // got through in pieces would look like it fit
+    int pmtu = IP_PMTUDISC_PROBE;
+    if(setsockopt(fd, IPPROTO_IP, IP_MTU_DISCOVER, &pmtu, sizeof(pmtu)) == -1)
+      udap::Debug("no IP_MTU_DISCOVER: ", strerror(errno));
+    if(addr->sa_family == AF_INET6)
+    {
+      pmtu = IPV6_PMTUDISC_PROBE;
+      if(setsockopt(fd, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &pmtu, sizeof(pmtu))
+         == -1)
+        udap::Debug("no IPV6_MTU_DISCOVER: ", strerror(errno));
+    }
     udap::Addr a(*addr);
     udap::Debug("bind to ", a);
     if(bind(fd, addr, slen) == -1)
@@ -222,44 +747,361 @@ struct udap_epoll_loop : public udap_ev_loop
     return fd;
   }
 
+  /// work other threads post for a net thread, it runs it between polls when
+  /// nothing is using its sockets
+  struct shard_calls
+  {
+    /// run fn on the shard's thread and wait for it, waking it with the
+    /// eventfd wakefd, right here if nobody runs the shard or this is its
+    /// thread
+    void
+    call(int wakefd, std::function< void() > fn)
+    {
+      std::unique_lock< std::mutex > lock(mtx);
+      if(owner == std::thread::id() || owner == std::this_thread::get_id())
+      {
+        fn();
+        return;
+      }
+      uint64_t ticket = ++posted;
+      calls.emplace_back(std::move(fn));
+      uint64_t one = 1;
+      auto val     = ::write(wakefd, &one, sizeof(one));
+      (void)val;
+      called.wait(lock, [&]() { return done >= ticket; });
+    }
+
+    /// run what was posted, on the shard's thread
+    void
+    run()
+    {
+      std::unique_lock< std::mutex > lock(mtx);
+      if(calls.empty())
+        return;
+      for(auto& fn : calls)
+        fn();
+      calls.clear();
+      done = posted;
+      called.notify_all();
+    }
+
+    /// the shard runs on this thread from now on, or nowhere if stopped
+    void
+    set_owner(bool running)
+    {
+      {
+        std::unique_lock< std::mutex > lock(mtx);
+        owner = running ? std::this_thread::get_id() : std::thread::id();
+      }
+      // whatever was posted before we stopped
+      run();
+    }
+
+   private:
+    std::mutex mtx;
+    std::condition_variable called;
+    std::vector< std::function< void() > > calls;
+    /// calls posted and run so far
+    uint64_t posted = 0;
+    uint64_t done   = 0;
+    /// thread running the shard, default if nobody is
+    std::thread::id owner;
+  };
+
+  /// reads the loop's wakeup eventfd, the loop flushes after every wakeup
+  struct ev_wake : public ev_io
+  {
+    ev_wake(int f) : ev_io(f){};
+
+    virtual int
+    read(void*, size_t)
+    {
+      uint64_t val;
+      auto ret = ::read(fd, &val, sizeof(val));
+      (void)ret;
+      return 0;
+    }
+
+    virtual int
+    sendto(const sockaddr*, const void*, size_t)
+    {
+      return -1;
+    }
+  };
+};  // namespace udap
+
+struct udap_epoll_loop : public udap_ev_loop
+{
+  /// an epoll instance run by one net thread, with its own sockets
+  struct shard
+  {
+    int epollfd = -1;
+    /// wakes us up to flush queued sends
+    std::unique_ptr< udap::ev_wake > wake;
+    /// sockets read and flushed by this shard
+    std::vector< udap::udp_listener* > listeners;
+
+    /// work other threads post for us
+    udap::shard_calls calls;
+
+    ~shard()
+    {
+      if(epollfd != -1)
+        close(epollfd);
+    }
+  };
+
+  std::vector< std::unique_ptr< shard > > shards;
+  int pipefds[2];
+
+  udap_epoll_loop()
+  {
+    pipefds[0] = -1;
+    pipefds[1] = -1;
+  }
+
+  ~udap_epoll_loop()
+  {
+    if(pipefds[0] != -1)
+      close(pipefds[0]);
+
+    if(pipefds[1] != -1)
+      close(pipefds[1]);
+  }
+
+  bool
+  init()
+  {
+    if(pipefds[0] == -1 && pipe(pipefds) == -1)
+      return false;
+    return shards.size() || add_shard();
+  }
+
+  bool
+  add_shard()
+  {
+    std::unique_ptr< shard > sh(new shard);
+    sh->epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if(sh->epollfd == -1)
+      return false;
+    int wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(wakefd == -1)
+      return false;
+    sh->wake.reset(new udap::ev_wake(wakefd));
+    epoll_event wake_ev;
+    wake_ev.data.ptr = sh->wake.get();
+    wake_ev.events   = EPOLLIN;
+    if(epoll_ctl(sh->epollfd, EPOLL_CTL_ADD, wakefd, &wake_ev) == -1)
+      return false;
+    // stop() writes the pipe and nobody reads it, so every shard sees it
+    epoll_event sig_ev;
+    sig_ev.data.fd = pipefds[0];
+    sig_ev.events  = EPOLLIN;
+    if(epoll_ctl(sh->epollfd, EPOLL_CTL_ADD, pipefds[0], &sig_ev) == -1)
+      return false;
+    shards.emplace_back(std::move(sh));
+    return true;
+  }
+
+  bool
+  set_shards(size_t n)
+  {
+    if(udp_listeners.size())
+      return false;
+    while(shards.size() < n)
+      if(!add_shard())
+        return false;
+    return true;
+  }
+
+  /// wait up to ms for events on sh and handle them
+  /// returns -1 when stopped
+  int
+  poll(shard& sh, int ms)
+  {
+    epoll_event events[1024];
+    int result = epoll_wait(sh.epollfd, events, 1024, ms);
+    // interrupted by a signal, -1 means stopped to our callers
+    if(result == -1)
+      result = 0;
+    if(result > 0)
+    {
+      int idx = 0;
+      while(idx < result)
+      {
+        // handle signalfd
+        if(events[idx].data.fd == pipefds[0])
+        {
+          udap::Debug("exiting epoll loop");
+          return -1;
+        }
+        udap::ev_io* ev = static_cast< udap::ev_io* >(events[idx].data.ptr);
+        if(events[idx].events & EPOLLIN)
+        {
+          if(ev->read(nullptr, 0) == -1)
+          {
+            udap::Debug("close ev");
+            epoll_ctl(sh.epollfd, EPOLL_CTL_DEL, ev->fd, nullptr);
+          }
+        }
+        ++idx;
+      }
+    }
+    // end of loop iteration, tick listeners then send what they queued
+    if(&sh == shards[0].get())
+      for(auto& l : udp_listeners)
+        if(l->tick)
+          l->tick(l);
+    for(auto l : sh.listeners)
+      l->flush();
+    sh.calls.run();
+    return result;
+  }
+
+  int
+  tick(int ms)
+  {
+    return poll(*shards[0], ms);
+  }
+
+  int
+  run()
+  {
+    return run_shard(0);
+  }
+
+  int
+  run_shard(size_t idx)
+  {
+    shard& sh = *shards[idx < shards.size() ? idx : 0];
+    sh.calls.set_owner(true);
+    // stop() wakes us through the pipe, no need to time out
+    while(poll(sh, -1) != -1)
+      ;
+    sh.calls.set_owner(false);
+    return 0;
+  }
+
   bool
   close_ev(udap::ev_io* ev)
   {
-    return epoll_ctl(epollfd, EPOLL_CTL_DEL, ev->fd, nullptr) != -1;
+    bool ret = false;
+    for(auto& sh : shards)
+      ret |= epoll_ctl(sh->epollfd, EPOLL_CTL_DEL, ev->fd, nullptr) != -1;
+    return ret;
   }
 
   bool
-  udp_listen(udap_udp_io* l, const sockaddr* src)
+  watch_fd(int fd)
   {
-    int fd = udp_bind(src);
-    if(fd == -1)
+    std::unique_ptr< udap::fd_watch > watch(new udap::fd_watch(fd));
+    epoll_event ev;
+    ev.data.ptr = watch.get();
+    ev.events   = EPOLLIN;
+    if(epoll_ctl(shards[0]->epollfd, EPOLL_CTL_ADD, fd, &ev) == -1)
       return false;
-    udap::udp_listener* listener = new udap::udp_listener(fd, l);
+    watches.emplace_back(std::move(watch));
+    return true;
+  }
+
+  udap::udp_listener*
+  add_listener(shard& sh, int fd, udap_udp_io* l)
+  {
+    udap::udp_listener* listener = new udap::udp_listener(
+        fd, l, recvBatch, sendBatch, sendQueue, udpOffload, sh.epollfd,
+        sh.wake->fd);
     epoll_event ev;
     ev.data.ptr = listener;
     ev.events   = EPOLLIN;
-    if(epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+    if(epoll_ctl(sh.epollfd, EPOLL_CTL_ADD, fd, &ev) == -1)
     {
       delete listener;
+      return nullptr;
+    }
+    sh.listeners.push_back(listener);
+    return listener;
+  }
+
+  bool
+  udp_listen(udap_udp_io* l, const sockaddr* src)
+  {
+    bool reuseport = shards.size() > 1;
+    int fd         = udap::udp_bind(src, reuseport, rcvBuf, sndBuf);
+    if(fd == -1)
+      return false;
+    udap::udp_listener* first = add_listener(*shards[0], fd, l);
+    if(first == nullptr)
       return false;
+    if(!reuseport)
+    {
+      l->impl = first;
+      udp_listeners.push_back(l);
+      return true;
     }
-    l->impl = listener;
+    // the rest bind the port we actually got in case src asked for any
+    sockaddr_storage bound;
+    socklen_t slen = sizeof(bound);
+    getsockname(fd, (sockaddr*)&bound, &slen);
+    udap::udp_group* group = new udap::udp_group;
+    group->members.push_back(first);
+    for(size_t idx = 1; idx < shards.size(); ++idx)
+    {
+      fd = udap::udp_bind((const sockaddr*)&bound, true, rcvBuf, sndBuf);
+      udap::udp_listener* listener =
+          fd == -1 ? nullptr : add_listener(*shards[idx], fd, l);
+      if(listener == nullptr)
+      {
+        udap::Warn("only ", idx, " of ", shards.size(),
+                   " net threads will read from ", udap::Addr(*src));
+        break;
+      }
+      group->members.push_back(listener);
+    }
+    l->impl = group;
     udp_listeners.push_back(l);
     return true;
   }
 
+  /// the shard reading listener drops it from its own thread, between
+  /// polls, so we only delete it once no shard can be using it
+  void
+  remove_listener(udap::udp_listener* listener)
+  {
+    for(auto& sh : shards)
+    {
+      shard* s = sh.get();
+      s->calls.call(s->wake->fd, [s, listener]() {
+        auto& ls = s->listeners;
+        auto itr = std::find(ls.begin(), ls.end(), listener);
+        if(itr == ls.end())
+          return;
+        epoll_ctl(s->epollfd, EPOLL_CTL_DEL, listener->fd, nullptr);
+        ls.erase(itr);
+      });
+    }
+    delete listener;
+  }
+
   bool
   udp_close(udap_udp_io* l)
   {
     bool ret = false;
-    udap::udp_listener* listener =
-        static_cast< udap::udp_listener* >(l->impl);
-    if(listener)
+    udap::ev_io* impl = static_cast< udap::ev_io* >(l->impl);
+    if(impl)
     {
-      close_ev(listener);
+      udap::udp_group* group = dynamic_cast< udap::udp_group* >(impl);
+      if(group)
+      {
+        for(auto listener : group->members)
+          remove_listener(static_cast< udap::udp_listener* >(listener));
+        delete group;
+      }
+      else
+        remove_listener(static_cast< udap::udp_listener* >(impl));
       l->impl = nullptr;
-      delete listener;
-      udp_listeners.remove(l);
+      // shard 0 ticks every udp_listener
+      shard& sh = *shards[0];
+      sh.calls.call(sh.wake->fd, [this, l]() { udp_listeners.remove(l); });
     }
     return ret;
   }
@@ -33,6 +33,7 @@ namespace udap
   struct udp_listener : public ev_io
   {
     udap_udp_io* udp;
+    udp_counters counters;
 
     udp_listener(int fd, udap_udp_io* u) : ev_io(fd), udp(u){};
 
@@ -49,10 +50,23 @@ namespace udap
       ssize_t ret    = ::recvfrom(fd, buf, sz, 0, addr, &slen);
       if(ret == -1)
         return -1;
-      udp->recvfrom(udp, addr, buf, ret);
+      counters.Read(1, 1, 1, ret);
+      if(udp->recvfrom_many)
+      {
+        udap_udp_datagram dgram = {addr, buf, size_t(ret)};
+        udp->recvfrom_many(udp, &dgram, 1);
+      }
+      else
+        udp->recvfrom(udp, addr, buf, ret);
       return 0;
     }
 
+    void
+    get_stats(udap_udp_stats* stats)
+    {
+      counters.Fill(stats);
+    }
+
     virtual int
     sendto(const sockaddr* to, const void* data, size_t sz)
     {
@@ -70,7 +84,12 @@ namespace udap
       }
       ssize_t sent = ::sendto(fd, data, sz, 0, to, slen);
       if(sent == -1)
+      {
         perror("kqueue sendto()");
+        counters.sendErrors.fetch_add(1, std::memory_order_relaxed);
+      }
+      else
+        counters.Sent(1, 1, 1, sent);
       return sent;
     }
   };
@@ -105,7 +124,8 @@ struct udap_kqueue_loop : public udap_ev_loop
     (void)ms;
     struct kevent events[1024];
     int result;
-    byte_t readbuf[2048];
+    // fits a jumbo frame
+    byte_t readbuf[9216];
     result = kevent(kqueuefd, NULL, 0, events, 1024, NULL);
     // result: 0 is a timeout
     if(result > 0)
@@ -134,7 +154,8 @@ struct udap_kqueue_loop : public udap_ev_loop
   {
     struct kevent events[1024];
     int result;
-    byte_t readbuf[2048];
+    // fits a jumbo frame
+    byte_t readbuf[9216];
     do
     {
       result = kevent(kqueuefd, NULL, 0, events, 1024, NULL);
@@ -162,7 +183,7 @@ struct udap_kqueue_loop : public udap_ev_loop
   }
 
   int
-  udp_bind(const sockaddr* addr)
+  udp_bind(const sockaddr* addr, size_t rcvbuf, size_t sndbuf)
   {
     socklen_t slen;
     udap::Debug("kqueue bind affam", addr->sa_family);
@@ -204,6 +225,23 @@ struct udap_kqueue_loop : public udap_ev_loop
         return -1;
       }
     }
+    int size = rcvbuf;
+    if(size && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) == -1)
+      perror("setsockopt(SO_RCVBUF)");
+    size = sndbuf;
+    if(size && setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) == -1)
+      perror("setsockopt(SO_SNDBUF)");
+    // never fragment, links find the path mtu themselves
+    int one = 1;
+#ifdef IP_DONTFRAG
+    if(addr->sa_family == AF_INET)
+      setsockopt(fd, IPPROTO_IP, IP_DONTFRAG, &one, sizeof(one));
+#endif
+#ifdef IPV6_DONTFRAG
+    if(addr->sa_family == AF_INET6)
+      setsockopt(fd, IPPROTO_IPV6, IPV6_DONTFRAG, &one, sizeof(one));
+#endif
+    (void)one;
     udap::Addr a(*addr);
     udap::Info("bind to ", a);
     // FreeBSD handbook said to do this
@@ -227,10 +265,21 @@ struct udap_kqueue_loop : public udap_ev_loop
     return kevent(kqueuefd, &change, 1, NULL, 0, NULL) == -1;
   }
 
+  bool
+  watch_fd(int fd)
+  {
+    std::unique_ptr< udap::fd_watch > watch(new udap::fd_watch(fd));
+    EV_SET(&change, fd, EVFILT_READ, EV_ADD, 0, 0, watch.get());
+    if(kevent(kqueuefd, &change, 1, NULL, 0, NULL) == -1)
+      return false;
+    watches.emplace_back(std::move(watch));
+    return true;
+  }
+
   bool
   udp_listen(udap_udp_io* l, const sockaddr* src)
   {
-    int fd = udp_bind(src);
+    int fd = udp_bind(src, rcvBuf, sndBuf);
     if(fd == -1)
       return false;
     udap::udp_listener* listener = new udap::udp_listener(fd, l);
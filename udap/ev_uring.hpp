@@ -0,0 +1,1011 @@
+#ifndef EV_URING_HPP
+#define EV_URING_HPP
+#include <linux/io_uring.h>
+
+// multishot recvmsg needs linux 6.0 headers
+#ifdef IORING_RECV_MULTISHOT
+#define UDAP_HAVE_IO_URING 1
+
+#include <linux/time_types.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "ev_epoll.hpp"
+
+namespace udap
+{
+  /// something waiting on a completion, the sqe user_data points at it
+  struct uring_op
+  {
+    virtual void
+    complete(const io_uring_cqe* cqe) = 0;
+
+    virtual ~uring_op(){};
+  };
+
+  /// minimal io_uring on the raw syscalls
+  /// only touched by the thread running its loop
+  struct uring
+  {
+    int fd             = -1;
+    unsigned sqEntries = 0;
+    unsigned* sqHead   = nullptr;
+    unsigned* sqTail   = nullptr;
+    unsigned* sqArray  = nullptr;
+    unsigned sqMask    = 0;
+    /// tail we have filled up to, published on submit
+    unsigned sqLocalTail = 0;
+    /// filled and not yet submitted
+    unsigned pending   = 0;
+    io_uring_sqe* sqes = nullptr;
+    unsigned* cqHead   = nullptr;
+    unsigned* cqTail   = nullptr;
+    unsigned cqMask    = 0;
+    io_uring_cqe* cqes = nullptr;
+    void* sqRing       = MAP_FAILED;
+    void* cqRing       = MAP_FAILED;
+    size_t sqRingSize  = 0;
+    size_t cqRingSize  = 0;
+    size_t sqesSize    = 0;
+
+    uring() = default;
+
+    uring(const uring&) = delete;
+
+    uring&
+    operator=(const uring&) = delete;
+
+    ~uring()
+    {
+      close_ring();
+    }
+
+    bool
+    init(unsigned entries)
+    {
+      io_uring_params p;
+      memset(&p, 0, sizeof(p));
+      // multishot receives post many completions per submission
+      p.flags      = IORING_SETUP_CQSIZE;
+      p.cq_entries = entries * 8;
+      fd           = syscall(__NR_io_uring_setup, entries, &p);
+      if(fd == -1)
+        return false;
+      sqEntries  = p.sq_entries;
+      sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+      cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+      bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+      if(single)
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+      sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+      if(sqRing == MAP_FAILED)
+        return false;
+      if(single)
+        cqRing = sqRing;
+      else
+      {
+        cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if(cqRing == MAP_FAILED)
+          return false;
+      }
+      sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+      void* mem = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+      if(mem == MAP_FAILED)
+        return false;
+      sqes = static_cast< io_uring_sqe* >(mem);
+
+      byte_t* sq  = static_cast< byte_t* >(sqRing);
+      sqHead      = (unsigned*)(sq + p.sq_off.head);
+      sqTail      = (unsigned*)(sq + p.sq_off.tail);
+      sqMask      = *(unsigned*)(sq + p.sq_off.ring_mask);
+      sqArray     = (unsigned*)(sq + p.sq_off.array);
+      sqLocalTail = *sqTail;
+      byte_t* cq  = static_cast< byte_t* >(cqRing);
+      cqHead      = (unsigned*)(cq + p.cq_off.head);
+      cqTail      = (unsigned*)(cq + p.cq_off.tail);
+      cqMask      = *(unsigned*)(cq + p.cq_off.ring_mask);
+      cqes        = (io_uring_cqe*)(cq + p.cq_off.cqes);
+      return true;
+    }
+
+    void
+    close_ring()
+    {
+      if(sqes)
+        munmap(sqes, sqesSize);
+      if(cqRing != MAP_FAILED && cqRing != sqRing)
+        munmap(cqRing, cqRingSize);
+      if(sqRing != MAP_FAILED)
+        munmap(sqRing, sqRingSize);
+      if(fd != -1)
+        ::close(fd);
+      sqes   = nullptr;
+      sqRing = cqRing = MAP_FAILED;
+      fd              = -1;
+    }
+
+    /// next sqe zeroed with user_data set to op, submits what is queued if
+    /// the ring is full, nullptr if it is still full after that
+    io_uring_sqe*
+    get_sqe(uring_op* op)
+    {
+      if(sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+      {
+        submit(0);
+        if(sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE)
+           >= sqEntries)
+          return nullptr;
+      }
+      unsigned idx      = sqLocalTail & sqMask;
+      io_uring_sqe* sqe = &sqes[idx];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->user_data = (uint64_t)op;
+      sqArray[idx]   = idx;
+      ++sqLocalTail;
+      ++pending;
+      return sqe;
+    }
+
+    /// submit queued sqes and wait for at least wait completions
+    int
+    submit(unsigned wait)
+    {
+      __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+      unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+      int ret = syscall(__NR_io_uring_enter, fd, pending, wait, flags, nullptr,
+                        0);
+      if(ret > 0)
+        pending -= ret;
+      return ret;
+    }
+
+    int
+    register_op(unsigned opcode, void* arg, unsigned n)
+    {
+      return syscall(__NR_io_uring_register, fd, opcode, arg, n);
+    }
+
+    /// hand every waiting completion to its op, return how many
+    size_t
+    reap()
+    {
+      unsigned head = *cqHead;
+      unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+      size_t n      = 0;
+      while(head != tail)
+      {
+        const io_uring_cqe* cqe = &cqes[head & cqMask];
+        uring_op* op            = (uring_op*)cqe->user_data;
+        // cancels have no op
+        if(op)
+          op->complete(cqe);
+        ++head;
+        ++n;
+      }
+      __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+      return n;
+    }
+  };
+
+  /// udp socket read with multishot recvmsg into provided buffers
+  /// and written with one sendmsg sqe per datagram or segmentation train
+  struct uring_listener : public ev_io, public uring_op
+  {
+    udap_udp_io* udp;
+    uring* ring;
+    /// buffer group id, unique per ring
+    uint16_t bgid;
+    size_t batch;
+    bool gro = false;
+    bool gso = false;
+    /// most payload bytes per receive buffer
+    size_t payloadSize;
+    /// bytes per buffer, room for the recvmsg header, address and cmsgs
+    size_t bufSize;
+    unsigned numBufs;
+    PacketPool* pool;
+    /// the packet behind each buffer id
+    std::vector< udap_pkt* > pkts;
+    /// template for the multishot recvmsg
+    msghdr recvHdr;
+    /// true while the multishot recvmsg is live
+    bool armed = false;
+    /// cancelled, waiting for in flight ops before it can be freed
+    bool closing = false;
+    /// received since the last deliver
+    std::vector< udap_udp_datagram > datagrams;
+    std::vector< uint16_t > held;
+    /// with gro, what datagrams are copied into
+    gro_copies copies;
+    size_t received      = 0;
+    size_t receivedBytes = 0;
+    udp_counters counters;
+
+    static const size_t MaxDatagram = udp_listener::MaxDatagram;
+    static const size_t CtrlSize    = udp_listener::CtrlSize;
+
+    /// a queued outbound datagram, completes when the kernel sent it
+    struct outbound : public uring_op
+    {
+      uring_listener* owner = nullptr;
+      sockaddr_in6 addr;
+      socklen_t slen;
+      size_t sz;
+      /// datagrams sent with this one's sendmsg, 0 if sent by an earlier one
+      size_t segs = 0;
+      bool done   = false;
+      msghdr hdr;
+      byte_t ctrl[CMSG_SPACE(sizeof(uint16_t))];
+      send_buf buf;
+
+      void
+      complete(const io_uring_cqe* cqe)
+      {
+        owner->sent(this, cqe->res);
+      }
+    };
+
+    uring_listener(int fd, udap_udp_io* u, uring* r, uint16_t group,
+                   size_t b, size_t sb, size_t sq, bool offload, int wfd)
+        : ev_io(fd)
+        , udp(u)
+        , ring(r)
+        , bgid(group)
+        , batch(b)
+        , wakefd(wfd)
+        , sendBatch(sb)
+        , sendq(sq)
+        , sendIovs(sq)
+    {
+      if(offload)
+      {
+        int one = 1;
+        gro = setsockopt(fd, SOL_UDP, UDP_GRO, &one, sizeof(one)) == 0;
+        int size       = 0;
+        socklen_t slen = sizeof(size);
+        gso = getsockopt(fd, SOL_UDP, UDP_SEGMENT, &size, &slen) == 0;
+      }
+      payloadSize = gro ? udp_listener::MaxTrain : MaxDatagram;
+      if(gro)
+        copies.init(gro_copies::PacketSize);
+      // fewer, bigger buffers with gro
+      numBufs = gro ? 64 : 512;
+      recvHdr = msghdr{};
+      recvHdr.msg_namelen    = sizeof(sockaddr_in6);
+      // always room for the drop count and timestamp
+      recvHdr.msg_controllen = CtrlSize;
+      bufSize = sizeof(io_uring_recvmsg_out) + recvHdr.msg_namelen
+          + recvHdr.msg_controllen + payloadSize;
+      pool = new PacketPool(bufSize);
+      for(unsigned bid = 0; bid < numBufs; ++bid)
+        pkts.push_back(pool->Get());
+      datagrams.reserve(numBufs);
+      for(auto& out : sendq)
+        out.owner = this;
+    }
+
+    ~uring_listener()
+    {
+      for(auto pkt : pkts)
+        udap_pkt_unref(pkt);
+      pool->Close();
+    }
+
+    /// hand all our buffers to the kernel
+    bool
+    init()
+    {
+      for(unsigned bid = 0; bid < numBufs; ++bid)
+        if(!give_back(bid))
+          return false;
+      return true;
+    }
+
+    /// give buffer bid back to the kernel, goes in with the loop's next
+    /// submit
+    bool
+    give_back(uint16_t bid)
+    {
+      io_uring_sqe* sqe = ring->get_sqe(nullptr);
+      if(sqe == nullptr)
+        return false;
+      sqe->opcode    = IORING_OP_PROVIDE_BUFFERS;
+      sqe->fd        = 1;
+      sqe->addr      = (uint64_t)pkts[bid]->data();
+      sqe->len       = bufSize;
+      sqe->off       = bid;
+      sqe->buf_group = bgid;
+      return true;
+    }
+
+    /// start the multishot receive
+    void
+    arm()
+    {
+      io_uring_sqe* sqe = ring->get_sqe(this);
+      if(sqe == nullptr)
+        return;
+      sqe->opcode    = IORING_OP_RECVMSG;
+      sqe->fd        = fd;
+      sqe->addr      = (uint64_t)&recvHdr;
+      sqe->ioprio    = IORING_RECV_MULTISHOT;
+      sqe->flags     = IOSQE_BUFFER_SELECT;
+      sqe->buf_group = bgid;
+      armed          = true;
+    }
+
+    /// stop receiving, freed once nothing is in flight
+    void
+    cancel()
+    {
+      closing           = true;
+      io_uring_sqe* sqe = nullptr;
+      if(armed && (sqe = ring->get_sqe(nullptr)))
+      {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr   = (uint64_t)static_cast< uring_op* >(this);
+      }
+      // the group id is never reused, this only lets the kernel forget them
+      if((sqe = ring->get_sqe(nullptr)))
+      {
+        sqe->opcode    = IORING_OP_REMOVE_BUFFERS;
+        sqe->fd        = numBufs;
+        sqe->buf_group = bgid;
+      }
+    }
+
+    bool
+    idle()
+    {
+      std::unique_lock< std::mutex > lock(sendMutex);
+      return !armed && sendSubmitted == 0;
+    }
+
+    /// a datagram arrived in one of our buffers
+    void
+    complete(const io_uring_cqe* cqe)
+    {
+      if(!(cqe->flags & IORING_CQE_F_MORE))
+        armed = false;
+      if(cqe->res < 0)
+      {
+        // out of buffers until we give some back, rearmed after deliver
+        if(cqe->res != -ENOBUFS && cqe->res != -ECANCELED)
+          udap::Warn("io_uring recvmsg: ", strerror(-cqe->res));
+        return;
+      }
+      if(!(cqe->flags & IORING_CQE_F_BUFFER))
+        return;
+      uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+      held.push_back(bid);
+      ++received;
+      udap_pkt* pkt = pkts[bid];
+      byte_t* buf   = pkt->data();
+      io_uring_recvmsg_out out;
+      memcpy(&out, buf, sizeof(out));
+      byte_t* name    = buf + sizeof(out);
+      byte_t* control = name + recvHdr.msg_namelen;
+      byte_t* payload = control + recvHdr.msg_controllen;
+      size_t len      = out.payloadlen;
+      size_t avail    = cqe->res - (payload - buf);
+      if(len > avail)
+        len = avail;
+      const sockaddr* from = (const sockaddr*)name;
+      msghdr hdr           = msghdr{};
+      hdr.msg_control      = control;
+      hdr.msg_controllen   = out.controllen;
+      recv_meta meta(hdr);
+      uint64_t at =
+          meta.account(counters, recv_meta::realtime(), udap_time_now_ns());
+      size_t seg = meta.seg;
+      receivedBytes += len;
+      if(seg == 0 || seg >= len)
+      {
+        copies.push(datagrams, from, payload, len, pkt, at);
+        return;
+      }
+      size_t before = datagrams.size();
+      for(size_t off = 0; off < len; off += seg)
+        copies.push(datagrams, from, payload + off,
+                    len - off < seg ? len - off : seg, pkt, at);
+      counters.recvCoalesced.fetch_add(datagrams.size() - before,
+                                       std::memory_order_relaxed);
+    }
+
+    /// hand what arrived since last time to the callbacks in batches and
+    /// give the buffers back
+    void
+    deliver()
+    {
+      if(received == 0)
+        return;
+      counters.Read(received < batch ? received : batch, datagrams.size(),
+                    batch, receivedBytes);
+      if(udp->recvfrom_many)
+      {
+        for(size_t idx = 0; idx < datagrams.size(); idx += batch)
+        {
+          size_t n = std::min(batch, datagrams.size() - idx);
+          udp->recvfrom_many(udp, &datagrams[idx], n);
+        }
+      }
+      else
+      {
+        for(const auto& dgram : datagrams)
+          udp->recvfrom(udp, dgram.from, dgram.buf, dgram.sz);
+      }
+      copies.release();
+      for(auto bid : held)
+      {
+        // a callback kept the packet, the kernel gets a fresh one
+        if(pkts[bid]->refs.load(std::memory_order_acquire) != 1)
+        {
+          udap_pkt_unref(pkts[bid]);
+          pkts[bid] = pool->Get();
+        }
+        if(!closing)
+          give_back(bid);
+      }
+      held.clear();
+      datagrams.clear();
+      received      = 0;
+      receivedBytes = 0;
+    }
+
+    void
+    get_stats(udap_udp_stats* stats)
+    {
+      counters.Fill(stats);
+    }
+
+    virtual int
+    read(void*, size_t)
+    {
+      return 0;
+    }
+
+    /// queue a datagram for the loop to submit
+    /// returns -1 with errno EAGAIN if the send queue is full
+    virtual int
+    sendto(const sockaddr* to, const void* data, size_t sz)
+    {
+      socklen_t slen;
+      switch(to->sa_family)
+      {
+        case AF_INET:
+          slen = sizeof(struct sockaddr_in);
+          break;
+        case AF_INET6:
+          slen = sizeof(struct sockaddr_in6);
+          break;
+        default:
+          return -1;
+      }
+      if(sz > MaxDatagram)
+      {
+        errno = EMSGSIZE;
+        return -1;
+      }
+      std::unique_lock< std::mutex > lock(sendMutex);
+      if(sendSize == sendq.size())
+      {
+        counters.sendRejected.fetch_add(1, std::memory_order_relaxed);
+        errno = EAGAIN;
+        return -1;
+      }
+      outbound& out = queued(sendSize);
+      memcpy(&out.addr, to, slen);
+      out.buf.put(data, sz);
+      out.slen = slen;
+      out.sz   = sz;
+      ++sendSize;
+      // only the loop thread can submit, make sure it is awake
+      if(sendSize - sendSubmitted == 1)
+        wake();
+      return sz;
+    }
+
+    /// put a sendmsg sqe on the ring for everything queued, they all go to
+    /// the kernel with the loop's next submit
+    void
+    submit_sends()
+    {
+      std::unique_lock< std::mutex > lock(sendMutex);
+      size_t calls = 0, n = 0, bytes = 0;
+      while(sendSubmitted < sendSize)
+      {
+        size_t slot       = (sendHead + sendSubmitted) % sendq.size();
+        outbound& out     = sendq[slot];
+        io_uring_sqe* sqe = ring->get_sqe(&out);
+        if(sqe == nullptr)
+          break;
+        out.segs = build_train(slot);
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd     = fd;
+        sqe->addr   = (uint64_t)&out.hdr;
+        sqe->len    = 1;
+        if(out.segs > 1)
+          counters.sendSegmented.fetch_add(out.segs,
+                                           std::memory_order_relaxed);
+        for(size_t idx = 0; idx < out.hdr.msg_iovlen; ++idx)
+          bytes += out.hdr.msg_iov[idx].iov_len;
+        sendSubmitted += out.segs;
+        n += out.segs;
+        ++calls;
+      }
+      if(n)
+        counters.Sent(calls < sendBatch ? calls : sendBatch, n, sendBatch,
+                      bytes);
+    }
+
+    void
+    sent(outbound* out, int res)
+    {
+      std::unique_lock< std::mutex > lock(sendMutex);
+      if(res < 0 && out->segs > 1 && gso)
+      {
+        // the route or device won't take trains, later ones go one by one
+        udap::Warn("udp segmentation offload failed, disabling: ",
+                   strerror(-res));
+        gso = false;
+      }
+      else if(res == -EMSGSIZE)
+        udap::Debug("io_uring sendmsg: ", strerror(-res));
+      else if(res < 0)
+        udap::Warn("io_uring sendmsg: ", strerror(-res));
+      // nothing is resent, a failed train is dropped
+      if(res < 0)
+        counters.sendErrors.fetch_add(out->segs, std::memory_order_relaxed);
+      out->done = true;
+      // free the oldest slots once the kernel is done with them
+      while(sendSubmitted && queued(0).done)
+      {
+        size_t segs    = queued(0).segs;
+        queued(0).done = false;
+        sendHead       = (sendHead + segs) % sendq.size();
+        sendSize -= segs;
+        sendSubmitted -= segs;
+      }
+    }
+
+   private:
+    /// fill in the sendmsg header of the datagram in slot, with the ones
+    /// after it to the same peer as one udp segmentation train
+    /// returns how many datagrams it covers
+    size_t
+    build_train(size_t slot)
+    {
+      outbound& first = sendq[slot];
+      size_t seg      = first.sz;
+      size_t total    = seg;
+      size_t segs     = 1;
+      iovec* iov      = &sendIovs[slot];
+      iov->iov_base   = first.buf.data();
+      iov->iov_len    = first.sz;
+      // a train never wraps around the end of the queue
+      while(gso && sendSubmitted + segs < sendSize
+            && segs < udp_listener::MaxSegments
+            && slot + segs < sendq.size())
+      {
+        outbound& next = sendq[slot + segs];
+        if(next.slen != first.slen
+           || memcmp(&next.addr, &first.addr, next.slen) || next.sz > seg
+           || total + next.sz > udp_listener::MaxTrainBytes)
+          break;
+        iov[segs].iov_base = next.buf.data();
+        iov[segs].iov_len  = next.sz;
+        next.segs          = 0;
+        total += next.sz;
+        ++segs;
+        // a shorter datagram ends the train
+        if(next.sz < seg)
+          break;
+      }
+      msghdr& hdr     = first.hdr;
+      hdr             = msghdr{};
+      hdr.msg_name    = &first.addr;
+      hdr.msg_namelen = first.slen;
+      hdr.msg_iov     = iov;
+      hdr.msg_iovlen  = segs;
+      if(segs > 1)
+      {
+        hdr.msg_control    = first.ctrl;
+        hdr.msg_controllen = sizeof(first.ctrl);
+        cmsghdr* c         = CMSG_FIRSTHDR(&hdr);
+        c->cmsg_level      = SOL_UDP;
+        c->cmsg_type       = UDP_SEGMENT;
+        c->cmsg_len        = CMSG_LEN(sizeof(uint16_t));
+        uint16_t size      = seg;
+        memcpy(CMSG_DATA(c), &size, sizeof(size));
+      }
+      return segs;
+    }
+
+    outbound&
+    queued(size_t idx)
+    {
+      return sendq[(sendHead + idx) % sendq.size()];
+    }
+
+    void
+    wake()
+    {
+      uint64_t one = 1;
+      auto val     = ::write(wakefd, &one, sizeof(one));
+      (void)val;
+    }
+
+    /// eventfd the loop wakes up on
+    int wakefd;
+    size_t sendBatch;
+    /// bounded ring of outbound datagrams, the first sendSubmitted are
+    /// with the kernel
+    std::vector< outbound > sendq;
+    size_t sendHead      = 0;
+    size_t sendSize      = 0;
+    size_t sendSubmitted = 0;
+    /// iovecs for each queue slot, a train uses a run of them
+    std::vector< iovec > sendIovs;
+    std::mutex sendMutex;
+  };
+}  // namespace udap
+
+struct udap_uring_loop : public udap_ev_loop
+{
+  /// sqes per ring
+  static const unsigned QueueDepth = 1024;
+
+  struct shard;
+
+  /// multishot poll on a fd
+  struct poll_op : public udap::uring_op
+  {
+    enum Kind
+    {
+      eStop,
+      eWake,
+      eWatch
+    };
+
+    shard* sh;
+    int fd;
+    Kind kind;
+
+    poll_op(shard* s, int f, Kind k) : sh(s), fd(f), kind(k)
+    {
+    }
+
+    void
+    arm()
+    {
+      io_uring_sqe* sqe = sh->ring.get_sqe(this);
+      if(sqe == nullptr)
+        return;
+      sqe->opcode        = IORING_OP_POLL_ADD;
+      sqe->fd            = fd;
+      sqe->poll32_events = POLLIN;
+      sqe->len           = IORING_POLL_ADD_MULTI;
+    }
+
+    void
+    complete(const io_uring_cqe* cqe)
+    {
+      if(kind == eStop)
+      {
+        // nobody reads the pipe, every shard sees it
+        sh->stopped = true;
+        return;
+      }
+      if(kind == eWake)
+      {
+        uint64_t val;
+        auto ret = ::read(fd, &val, sizeof(val));
+        (void)ret;
+      }
+      // the owner of a watched fd reads it
+      if(!(cqe->flags & IORING_CQE_F_MORE))
+        arm();
+    }
+  };
+
+  /// bounds how long a wait takes
+  struct timeout_op : public udap::uring_op
+  {
+    void
+    complete(const io_uring_cqe*)
+    {
+    }
+  };
+
+  /// a ring run by one net thread, with its own sockets
+  struct shard
+  {
+    udap::uring ring;
+    std::unique_ptr< poll_op > stop;
+    std::unique_ptr< poll_op > wake;
+    std::vector< std::unique_ptr< poll_op > > watches;
+    int wakefd = -1;
+    bool stopped = false;
+    timeout_op timeout;
+    __kernel_timespec ts;
+    uint16_t nextGroup = 0;
+    std::vector< udap::uring_listener* > listeners;
+    /// cancelled, freed once idle
+    std::vector< udap::uring_listener* > closing;
+    /// work other threads post for us, the ring only takes sqes from us
+    udap::shard_calls calls;
+
+    ~shard()
+    {
+      // the kernel lets go of our buffers when the ring goes
+      ring.close_ring();
+      for(auto l : listeners)
+        delete l;
+      for(auto l : closing)
+        delete l;
+      if(wakefd != -1)
+        ::close(wakefd);
+    }
+  };
+
+  std::vector< std::unique_ptr< shard > > shards;
+  int pipefds[2];
+
+  udap_uring_loop()
+  {
+    pipefds[0] = -1;
+    pipefds[1] = -1;
+  }
+
+  ~udap_uring_loop()
+  {
+    shards.clear();
+    if(pipefds[0] != -1)
+      close(pipefds[0]);
+    if(pipefds[1] != -1)
+      close(pipefds[1]);
+  }
+
+  bool
+  init()
+  {
+    if(pipefds[0] == -1 && pipe(pipefds) == -1)
+      return false;
+    return shards.size() || add_shard();
+  }
+
+  bool
+  add_shard()
+  {
+    std::unique_ptr< shard > sh(new shard);
+    if(!sh->ring.init(QueueDepth))
+      return false;
+    sh->wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(sh->wakefd == -1)
+      return false;
+    sh->stop.reset(new poll_op(sh.get(), pipefds[0], poll_op::eStop));
+    sh->wake.reset(new poll_op(sh.get(), sh->wakefd, poll_op::eWake));
+    sh->stop->arm();
+    sh->wake->arm();
+    if(sh->ring.submit(0) == -1)
+      return false;
+    shards.emplace_back(std::move(sh));
+    return true;
+  }
+
+  bool
+  set_shards(size_t n)
+  {
+    if(udp_listeners.size())
+      return false;
+    while(shards.size() < n)
+      if(!add_shard())
+        return false;
+    return true;
+  }
+
+  /// submit what is queued, wait up to ms for completions and handle them
+  /// returns -1 when stopped
+  int
+  poll(shard& sh, int ms)
+  {
+    for(auto l : sh.listeners)
+      l->submit_sends();
+    if(ms >= 0)
+    {
+      // done after the timeout or the first other completion
+      sh.ts.tv_sec      = ms / 1000;
+      sh.ts.tv_nsec     = (ms % 1000) * 1000000L;
+      io_uring_sqe* sqe = sh.ring.get_sqe(&sh.timeout);
+      if(sqe)
+      {
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->addr   = (uint64_t)&sh.ts;
+        sqe->len    = 1;
+        sqe->off    = 1;
+      }
+    }
+    if(sh.ring.submit(1) == -1 && errno != EINTR && errno != EBUSY)
+      udap::Warn("io_uring_enter: ", strerror(errno));
+    int result = sh.ring.reap();
+    for(auto l : sh.listeners)
+    {
+      l->deliver();
+      if(!l->armed)
+        l->arm();
+    }
+    sh.calls.run();
+    for(auto itr = sh.closing.begin(); itr != sh.closing.end();)
+    {
+      (*itr)->deliver();
+      if((*itr)->idle())
+      {
+        delete *itr;
+        itr = sh.closing.erase(itr);
+      }
+      else
+        ++itr;
+    }
+    if(&sh == shards[0].get())
+      for(auto& l : udp_listeners)
+        if(l->tick)
+          l->tick(l);
+    if(sh.stopped)
+    {
+      udap::Debug("exiting io_uring loop");
+      return -1;
+    }
+    return result;
+  }
+
+  int
+  tick(int ms)
+  {
+    return poll(*shards[0], ms);
+  }
+
+  int
+  run()
+  {
+    return run_shard(0);
+  }
+
+  int
+  run_shard(size_t idx)
+  {
+    shard& sh = *shards[idx < shards.size() ? idx : 0];
+    sh.calls.set_owner(true);
+    // stop() wakes us through the pipe, no need to time out
+    while(poll(sh, -1) != -1)
+      ;
+    sh.calls.set_owner(false);
+    return 0;
+  }
+
+  bool
+  close_ev(udap::ev_io*)
+  {
+    return false;
+  }
+
+  bool
+  watch_fd(int fd)
+  {
+    shard& sh = *shards[0];
+    std::unique_ptr< poll_op > op(new poll_op(&sh, fd, poll_op::eWatch));
+    op->arm();
+    sh.watches.emplace_back(std::move(op));
+    return true;
+  }
+
+  udap::uring_listener*
+  add_listener(shard& sh, int fd, udap_udp_io* l)
+  {
+    udap::uring_listener* listener = new udap::uring_listener(
+        fd, l, &sh.ring, sh.nextGroup++, recvBatch, sendBatch, sendQueue,
+        udpOffload, sh.wakefd);
+    if(!listener->init())
+    {
+      udap::Error("failed to set up io_uring buffers: ", strerror(errno));
+      delete listener;
+      return nullptr;
+    }
+    listener->arm();
+    sh.listeners.push_back(listener);
+    return listener;
+  }
+
+  bool
+  udp_listen(udap_udp_io* l, const sockaddr* src)
+  {
+    bool reuseport = shards.size() > 1;
+    int fd         = udap::udp_bind(src, reuseport, rcvBuf, sndBuf);
+    if(fd == -1)
+      return false;
+    udap::uring_listener* first = add_listener(*shards[0], fd, l);
+    if(first == nullptr)
+      return false;
+    if(!reuseport)
+    {
+      l->impl = first;
+      udp_listeners.push_back(l);
+      return true;
+    }
+    sockaddr_storage bound;
+    socklen_t slen = sizeof(bound);
+    getsockname(fd, (sockaddr*)&bound, &slen);
+    udap::udp_group* group = new udap::udp_group;
+    group->members.push_back(first);
+    for(size_t idx = 1; idx < shards.size(); ++idx)
+    {
+      fd = udap::udp_bind((const sockaddr*)&bound, true, rcvBuf, sndBuf);
+      udap::uring_listener* listener =
+          fd == -1 ? nullptr : add_listener(*shards[idx], fd, l);
+      if(listener == nullptr)
+      {
+        udap::Warn("only ", idx, " of ", shards.size(),
+                   " net threads will read from ", udap::Addr(*src));
+        break;
+      }
+      group->members.push_back(listener);
+    }
+    l->impl = group;
+    udp_listeners.push_back(l);
+    return true;
+  }
+
+  /// cancelling takes sqes, which only the shard's own thread may do
+  void
+  remove_listener(udap::uring_listener* listener)
+  {
+    for(auto& sh : shards)
+    {
+      shard* s = sh.get();
+      s->calls.call(s->wakefd, [s, listener]() {
+        auto& ls = s->listeners;
+        auto itr = std::find(ls.begin(), ls.end(), listener);
+        if(itr == ls.end())
+          return;
+        ls.erase(itr);
+        listener->cancel();
+        s->closing.push_back(listener);
+      });
+    }
+  }
+
+  bool
+  udp_close(udap_udp_io* l)
+  {
+    udap::ev_io* impl = static_cast< udap::ev_io* >(l->impl);
+    if(impl == nullptr)
+      return false;
+    udap::udp_group* group = dynamic_cast< udap::udp_group* >(impl);
+    if(group)
+    {
+      for(auto listener : group->members)
+        remove_listener(static_cast< udap::uring_listener* >(listener));
+      delete group;
+    }
+    else
+      remove_listener(static_cast< udap::uring_listener* >(impl));
+    l->impl = nullptr;
+    // shard 0 ticks every udp_listener
+    shard& sh = *shards[0];
+    sh.calls.call(sh.wakefd, [this, l]() { udp_listeners.remove(l); });
+    return true;
+  }
+
+  void
+  stop()
+  {
+    int i    = 1;
+    auto val = write(pipefds[1], &i, sizeof(i));
+    (void)val;
+  }
+};
+
+#endif
+#endif
@@ -0,0 +1,139 @@
+#ifndef UDAP_HISTOGRAM_HPP
+#define UDAP_HISTOGRAM_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace udap
+{
+  namespace util
+  {
+    /// log linear histogram of unsigned samples, hdr style
+    /// each power of two range is split into 2^SubBits buckets so recorded
+    /// values are kept to within 1 / 2^SubBits of the real value
+    /// recording is wait free and can happen from any thread
+    struct Histogram
+    {
+      static const size_t SubBits    = 3;
+      static const size_t SubBuckets = 1 << SubBits;
+      /// values at or above 2^MaxBits go in the last bucket
+      static const size_t MaxBits    = 48;
+      static const size_t NumBuckets = (MaxBits - SubBits + 1) * SubBuckets;
+
+      Histogram()
+      {
+        Reset();
+      }
+
+      Histogram(const Histogram&) = delete;
+
+      Histogram&
+      operator=(const Histogram&) = delete;
+
+      void
+      Reset()
+      {
+        for(auto& b : m_Buckets)
+          b = 0;
+        m_Count = 0;
+        m_Sum   = 0;
+        m_Max   = 0;
+      }
+
+      void
+      Record(uint64_t val)
+      {
+        ++m_Buckets[Bucket(val)];
+        ++m_Count;
+        m_Sum += val;
+        uint64_t max = m_Max;
+        while(val > max && !m_Max.compare_exchange_weak(max, val))
+          ;
+      }
+
+      uint64_t
+      Count() const
+      {
+        return m_Count;
+      }
+
+      uint64_t
+      Sum() const
+      {
+        return m_Sum;
+      }
+
+      uint64_t
+      Max() const
+      {
+        return m_Max;
+      }
+
+      /// value at percentile pct (0 - 100), 0 if empty
+      uint64_t
+      Percentile(double pct) const
+      {
+        uint64_t total = 0;
+        uint64_t counts[NumBuckets];
+        for(size_t idx = 0; idx < NumBuckets; ++idx)
+          total += counts[idx] = m_Buckets[idx];
+        if(total == 0)
+          return 0;
+        uint64_t want = (pct / 100.0) * total;
+        if(want == 0)
+          want = 1;
+        uint64_t seen = 0;
+        for(size_t idx = 0; idx < NumBuckets; ++idx)
+        {
+          seen += counts[idx];
+          if(seen >= want)
+          {
+            uint64_t val = Highest(idx);
+            return val < m_Max ? val : m_Max.load();
+          }
+        }
+        return m_Max;
+      }
+
+      static size_t
+      Bucket(uint64_t val)
+      {
+        if(val < SubBuckets)
+          return val;
+        size_t msb = 63 - __builtin_clzll(val);
+        if(msb >= MaxBits)
+          return NumBuckets - 1;
+        size_t shift = msb - SubBits;
+        return (shift + 1) * SubBuckets + ((val >> shift) & (SubBuckets - 1));
+      }
+
+      /// smallest value that goes in bucket idx
+      static uint64_t
+      Lowest(size_t idx)
+      {
+        if(idx < SubBuckets)
+          return idx;
+        size_t shift = idx / SubBuckets - 1;
+        return uint64_t(SubBuckets + idx % SubBuckets) << shift;
+      }
+
+      /// largest value that goes in bucket idx
+      static uint64_t
+      Highest(size_t idx)
+      {
+        if(idx + 1 == NumBuckets)
+          return UINT64_MAX;
+        return Lowest(idx + 1) - 1;
+      }
+
+     private:
+      std::atomic< uint64_t > m_Buckets[NumBuckets];
+      std::atomic< uint64_t > m_Count;
+      std::atomic< uint64_t > m_Sum;
+      std::atomic< uint64_t > m_Max;
+    };
+  }  // namespace util
+}  // namespace udap
+
+#endif
@@ -0,0 +1,1489 @@
+#ifndef UDAP_IWP_FRAME_HPP
+#define UDAP_IWP_FRAME_HPP
+
+#include <udap/buffer.h>
+#include <udap/crypto.h>
+#include <udap/crypto_async.h>
+#include <udap/link.h>
+#include <udap/time.h>
+#include <udap/crypto.hpp>
+
+#include <atomic>
+#include <bitset>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <queue>
+#include <unordered_map>
+
+#include "cubic.hpp"
+#include "histogram.hpp"
+#include "logger.hpp"
+#include "pkt.hpp"
+
+struct udap_router;
+
+namespace iwp
+{
+  // session activity timeout is 10s
+  constexpr udap_time_t SESSION_TIMEOUT = 10000;
+
+  enum msgtype
+  {
+    eALIV = 0x00,
+    eXMIT = 0x01,
+    eACKS = 0x02,
+    eFRAG = 0x03
+  };
+
+  struct sendbuf_t
+  {
+    sendbuf_t(size_t s) : sz(s)
+    {
+      buf = new byte_t[s];
+    }
+
+    ~sendbuf_t()
+    {
+      delete[] buf;
+    }
+
+    byte_t *buf;
+    size_t sz;
+
+    size_t
+    size() const
+    {
+      return sz;
+    }
+
+    byte_t *
+    data()
+    {
+      return buf;
+    }
+  };
+
+  enum header_flag
+  {
+    eSessionInvalidated = (1 << 0),
+    eHighPacketDrop     = (1 << 1),
+    eHighMTUDetected    = (1 << 2),
+    /// set on every frame by peers that ack every fragment and take
+    /// eXmitBundle messages and delayed ACKS with more than one msgid
+    eProtoUpgrade = (1 << 3),
+    /// an ACKS message follows the first message of the frame, before the
+    /// padding
+    eAcksFollow = (1 << 4)
+  };
+
+  /// xmit header flags
+  enum xmit_flag
+  {
+    /// always set
+    eXmitValid = (1 << 0),
+    /// the message is several link messages, each after its 2 byte size
+    eXmitBundle = (1 << 1)
+  };
+
+  /** plaintext frame header */
+  struct frame_header
+  {
+    byte_t *ptr;
+
+    frame_header(byte_t *buf) : ptr(buf)
+    {
+    }
+
+    byte_t *
+    data()
+    {
+      return ptr + 6;
+    }
+
+    uint8_t &
+    version()
+    {
+      return ptr[0];
+    }
+
+    uint8_t &
+    msgtype()
+    {
+      return ptr[1];
+    }
+
+    uint16_t
+    size() const
+    {
+      uint16_t sz;
+      memcpy(&sz, ptr + 2, 2);
+      return sz;
+    }
+
+    void
+    setsize(uint16_t sz)
+    {
+      memcpy(ptr + 2, &sz, 2);
+    }
+
+    uint8_t &
+    flags()
+    {
+      return ptr[5];
+    }
+
+    void
+    setflag(header_flag f)
+    {
+      ptr[5] |= f;
+    }
+  };
+
+  inline byte_t *
+  init_sendbuf(sendbuf_t *buf, msgtype t, uint16_t sz, uint8_t flags)
+  {
+    frame_header hdr(buf->data());
+    hdr.version() = 0;
+    hdr.msgtype() = t;
+    hdr.setsize(sz);
+    buf->data()[4] = 0;
+    buf->data()[5] = flags;
+    return hdr.data();
+  }
+
+  /** xmit header */
+  struct xmit
+  {
+    byte_t buffer[48];
+
+    xmit() = default;
+
+    xmit(byte_t *ptr)
+    {
+      memcpy(buffer, ptr, sizeof(buffer));
+    }
+
+    xmit(const xmit &other)
+    {
+      memcpy(buffer, other.buffer, sizeof(buffer));
+    }
+
+    void
+    set_info(const byte_t *hash, uint64_t id, uint16_t fragsz, uint16_t lastsz,
+             uint8_t numfrags, uint8_t flags = eXmitValid)
+    {
+      // big endian assumed
+      // TODO: implement little endian
+      memcpy(buffer, hash, 32);
+      memcpy(buffer + 32, &id, 8);
+      memcpy(buffer + 40, &fragsz, 2);
+      memcpy(buffer + 42, &lastsz, 2);
+      buffer[44] = 0;
+      buffer[45] = 0;
+      buffer[46] = numfrags;
+      buffer[47] = flags;
+    }
+
+    const byte_t *
+    hash() const
+    {
+      return &buffer[0];
+    }
+
+    uint64_t
+    msgid() const
+    {
+      // big endian assumed
+      // TODO: implement little endian
+      const byte_t *start   = buffer + 32;
+      const uint64_t *msgid = (const uint64_t *)start;
+      return *msgid;
+    }
+
+    // size of each full fragment
+    uint16_t
+    fragsize() const
+    {
+      // big endian assumed
+      // TODO: implement little endian
+      const byte_t *start    = buffer + 40;
+      const uint16_t *fragsz = (uint16_t *)start;
+      return *fragsz;
+    }
+
+    // number of full fragments
+    uint8_t
+    numfrags() const
+    {
+      return buffer[46];
+    }
+
+    // size of the entire message
+    size_t
+    totalsize() const
+    {
+      return (fragsize() * numfrags()) + lastfrag();
+    }
+
+    // size of the last fragment
+    uint16_t
+    lastfrag() const
+    {
+      // big endian assumed
+      // TODO: implement little endian
+      const byte_t *start    = buffer + 42;
+      const uint16_t *lastsz = (uint16_t *)start;
+      return *lastsz;
+    }
+
+    uint8_t
+    flags()
+    {
+      return buffer[47];
+    }
+  };
+
+  /// smoothed round trip time and retransmit timeout of a session, rfc 6298
+  /// with ms granularity
+  struct rtt_estimator
+  {
+    static const udap_time_t InitialRTO = 1000;
+    static const udap_time_t MinRTO     = 200;
+    /// well inside SESSION_TIMEOUT so a few backed off tries still fit
+    static const udap_time_t MaxRTO = 3000;
+
+    bool sampled       = false;
+    udap_time_t srtt   = 0;
+    udap_time_t rttvar = 0;
+    udap_time_t rto    = InitialRTO;
+
+    void
+    sample(udap_time_t rtt)
+    {
+      if(!sampled)
+      {
+        srtt    = rtt;
+        rttvar  = rtt / 2;
+        sampled = true;
+      }
+      else
+      {
+        udap_time_t err = srtt > rtt ? srtt - rtt : rtt - srtt;
+        rttvar          = (3 * rttvar + err) / 4;
+        srtt            = (7 * srtt + rtt) / 8;
+      }
+      rto = srtt + 4 * rttvar;
+      if(rto < MinRTO)
+        rto = MinRTO;
+      if(rto > MaxRTO)
+        rto = MaxRTO;
+    }
+
+    /// how long to wait on something already sent tries times, doubling
+    /// with every try
+    udap_time_t
+    timeout(uint8_t tries) const
+    {
+      udap_time_t t = rto;
+      for(uint8_t n = 1; n < tries && t < MaxRTO; ++n)
+        t *= 2;
+      return t < MaxRTO ? t : MaxRTO;
+    }
+  };
+
+  /// packetization layer path mtu discovery (rfc 8899) of a session, a
+  /// binary search for the biggest datagram that gets through, confirmed
+  /// by the peer answering probes of that size
+  /// sizes are whole datagrams
+  struct mtu_search
+  {
+    /// fits the ipv6 minimum mtu of 1280 after ip and udp headers
+    static const uint16_t BaseMTU = 1232;
+    static const uint16_t MaxMTU  = IWP_MAX_FRAME_SIZE;
+    /// stop once the bounds are this close
+    static const uint16_t Granularity = 32;
+    /// probes of one size without an answer before it is too big
+    static const uint8_t MaxProbes = 3;
+    /// search again this long after the last one ended, the path may have
+    /// changed
+    static const udap_time_t RaiseInterval = 600000;
+
+    uint16_t mtu = BaseMTU;
+    /// biggest size the interface takes, searches start from it
+    uint16_t ceiling = MaxMTU;
+    /// biggest size not known to be too big
+    uint16_t high = MaxMTU;
+    /// size of the probe out, 0 if none
+    uint16_t probing = 0;
+    uint8_t probes   = 0;
+    udap_time_t sentAt = 0;
+    /// when the last search ended
+    udap_time_t doneAt = 0;
+
+    bool
+    searching() const
+    {
+      return high - mtu >= Granularity;
+    }
+
+    /// size to send a probe of now, 0 if none is due
+    /// timeout is how long to wait for an answer to one
+    uint16_t
+    due(udap_time_t now, udap_time_t timeout)
+    {
+      if(probing && now < sentAt + timeout)
+        return 0;
+      if(probing && probes >= MaxProbes)
+      {
+        // never got through, the path mtu is below it
+        high    = probing - 1;
+        probing = 0;
+        if(!searching())
+        {
+          doneAt = now;
+          return 0;
+        }
+      }
+      if(!probing)
+      {
+        if(!searching())
+        {
+          if(now < doneAt + RaiseInterval)
+            return 0;
+          high = ceiling;
+          if(!searching())
+          {
+            doneAt = now;
+            return 0;
+          }
+        }
+        probing = mtu + (high - mtu + 1) / 2;
+        probes  = 0;
+      }
+      ++probes;
+      sentAt = now;
+      return probing;
+    }
+
+    /// the peer got our probe of size, false if it is not the one out
+    bool
+    acked(uint16_t size, udap_time_t now)
+    {
+      if(!probing || size != probing)
+        return false;
+      mtu     = size;
+      probing = 0;
+      if(!searching())
+        doneAt = now;
+      return true;
+    }
+
+    /// never search past size, what the interface under the path takes
+    void
+    limit(size_t size)
+    {
+      if(size > MaxMTU)
+        size = MaxMTU;
+      if(size < BaseMTU)
+        size = BaseMTU;
+      ceiling = size;
+      if(high > ceiling)
+        high = ceiling;
+    }
+
+    /// what we send stopped getting through, go back to the base size and
+    /// search again later
+    void
+    reset(udap_time_t now)
+    {
+      mtu     = BaseMTU;
+      high    = BaseMTU;
+      probing = 0;
+      doneAt  = now;
+    }
+  };
+
+  /// reliability counters for every session of a link, sessions update them
+  /// from the logic thread and they are read from anywhere
+  struct xmit_stats
+  {
+    /// fragments and XMITs sent again
+    std::atomic< uint64_t > retransmits{0};
+    /// ones of those the ACK says the peer already had
+    std::atomic< uint64_t > spurious{0};
+    /// fragments we got again after we had them
+    std::atomic< uint64_t > rxDuplicates{0};
+    /// round trip samples in ms
+    udap::util::Histogram rtt;
+    /// unacked bytes of all sessions
+    std::atomic< uint64_t > inflight{0};
+    /// times a congestion window was cut for loss, or reset by a timeout
+    std::atomic< uint64_t > windowCuts{0};
+    std::atomic< uint64_t > timeouts{0};
+    /// congestion window in bytes, sampled on every ACK
+    udap::util::Histogram cwnd;
+    /// times a session held frames back to pace them
+    std::atomic< uint64_t > paced{0};
+    /// bundled XMITs sent and the link messages in them
+    std::atomic< uint64_t > bundles{0};
+    std::atomic< uint64_t > bundledMessages{0};
+    /// path mtu probes sent, and times a session fell back to the base mtu
+    /// because nothing got through
+    std::atomic< uint64_t > mtuProbes{0};
+    std::atomic< uint64_t > mtuBlackholes{0};
+    /// ACKS frames sent on their own, msgids acked in all of them and
+    /// msgids acked on the back of an XMIT or fragment instead
+    std::atomic< uint64_t > ackFrames{0};
+    std::atomic< uint64_t > ackEntries{0};
+    std::atomic< uint64_t > ackPiggybacked{0};
+    /// whole inbound messages and bytes copied to put them together from
+    /// their fragments
+    std::atomic< uint64_t > rxMessages{0};
+    std::atomic< uint64_t > rxCopied{0};
+  };
+
+  struct transit_message
+  {
+    xmit msginfo;
+    std::bitset< 32 > status = {};
+
+    /// the whole message, fragment n at n * fragsize and the last one after
+    /// the full ones
+    /// outbound it is what we send and retransmit from, inbound fragments
+    /// are written into place as they arrive
+    std::unique_ptr< byte_t[] > msgbuf;
+
+    /// inbound message that came in one frame, kept in its packet
+    udap::PacketRef rxlast;
+
+    /// most fragments status can track
+    static const size_t MaxFrags = 32;
+
+    /// outbound, per fragment when it was last sent, how many times and
+    /// the session send sequence of the last time
+    udap_time_t sentAt[MaxFrags];
+    uint8_t tries[MaxFrags];
+    uint64_t sentSeq[MaxFrags];
+    /// the same for the XMIT, which any ACK for the message acks
+    udap_time_t xmitSentAt = 0;
+    uint8_t xmitTries      = 0;
+    uint64_t xmitSeq       = 0;
+    bool xmitAcked         = false;
+    /// first fragment not sent yet, the congestion window holds back the
+    /// rest
+    byte_t nextfrag = 0;
+
+    byte_t *
+    fragment(byte_t idx)
+    {
+      return msgbuf.get() + size_t(idx) * msginfo.fragsize();
+    }
+
+    byte_t *
+    last()
+    {
+      return fragment(msginfo.numfrags());
+    }
+
+    // calculate acked bitmask
+    uint32_t
+    get_bitmask() const
+    {
+      uint32_t bitmask = 0;
+      uint8_t idx      = 0;
+      while(idx < 32)
+      {
+        bitmask |= (status.test(idx) ? (1U << idx) : 0);
+        ++idx;
+      }
+      return bitmask;
+    }
+
+    // outbound
+    transit_message(udap_buffer_t buf, const byte_t *hash, uint64_t id,
+                    uint16_t fragsize = 1024, uint8_t flags = eXmitValid)
+    {
+      put_message(buf, hash, id, fragsize, flags);
+    }
+
+    // inbound
+    transit_message(const xmit &x) : msginfo(x)
+    {
+      status.reset();
+      // one frame messages stay in their packet
+      if(x.numfrags())
+        msgbuf.reset(new byte_t[x.totalsize()]);
+    }
+
+    /// ack packets based off a bitmask
+    void
+    ack(uint32_t bitmask)
+    {
+      uint8_t idx = 0;
+      while(idx < 32)
+      {
+        if(bitmask & (1U << idx))
+        {
+          status.set(idx);
+        }
+        ++idx;
+      }
+    }
+
+    bool
+    completed() const
+    {
+      for(byte_t idx = 0; idx < msginfo.numfrags(); ++idx)
+      {
+        if(!status.test(idx))
+          return false;
+      }
+      return true;
+    }
+
+    template < typename T >
+    void
+    generate_xmit(T &queue, byte_t flags, udap_time_t now, uint64_t seq)
+    {
+      uint16_t sz = msginfo.lastfrag() + sizeof(msginfo.buffer);
+      queue.push(new sendbuf_t(sz + 6));
+      auto body_ptr = init_sendbuf(queue.back(), eXMIT, sz, flags);
+      memcpy(body_ptr, msginfo.buffer, sizeof(msginfo.buffer));
+      body_ptr += sizeof(msginfo.buffer);
+      memcpy(body_ptr, last(), msginfo.lastfrag());
+      xmitSentAt = now;
+      xmitSeq    = seq;
+      ++xmitTries;
+    }
+
+    /// queue fragment idx, seq is the session's send sequence for it
+    template < typename T >
+    void
+    generate_frag(T &queue, byte_t idx, byte_t flags, udap_time_t now,
+                  uint64_t seq)
+    {
+      auto msgid    = msginfo.msgid();
+      auto fragsize = msginfo.fragsize();
+      uint16_t sz   = 9 + fragsize;
+      queue.push(new sendbuf_t(sz + 6));
+      auto body_ptr = init_sendbuf(queue.back(), eFRAG, sz, flags);
+      // TODO: assumes big endian
+      memcpy(body_ptr, &msgid, 8);
+      body_ptr[8] = idx;
+      memcpy(body_ptr + 9, fragment(idx), fragsize);
+      sentAt[idx]  = now;
+      sentSeq[idx] = seq;
+      ++tries[idx];
+    }
+
+    /// take one copy of buf, its fragments are sent from it in place
+    void
+    put_message(udap_buffer_t buf, const byte_t *hash, uint64_t id,
+                uint16_t fragsize = 1024, uint8_t flags = eXmitValid)
+    {
+      status.reset();
+      // the last fragment is never empty unless the message is
+      uint8_t numfrags  = buf.sz ? (buf.sz - 1) / fragsize : 0;
+      uint16_t lastfrag = buf.sz - size_t(numfrags) * fragsize;
+      // set info for xmit
+      msginfo.set_info(hash, id, fragsize, lastfrag, numfrags, flags);
+      memset(tries, 0, sizeof(tries));
+      nextfrag = 0;
+      msgbuf.reset(new byte_t[buf.sz]);
+      memcpy(msgbuf.get(), buf.base, buf.sz);
+    }
+
+    /// write the last fragment of a multi fragment inbound message
+    void
+    put_lastfrag(const byte_t *buf)
+    {
+      memcpy(last(), buf, msginfo.lastfrag());
+    }
+
+    /// write an inbound fragment into place
+    bool
+    put_frag(byte_t fragno, const byte_t *buf)
+    {
+      if(fragno >= msginfo.numfrags())
+        return false;
+      memcpy(fragment(fragno), buf, msginfo.fragsize());
+      status.set(fragno);
+      return true;
+    }
+  };
+
+  struct frame_state
+  {
+    byte_t rxflags         = 0;
+    byte_t txflags         = eProtoUpgrade;
+    uint64_t rxids         = 0;
+    uint64_t txids         = 0;
+    udap_time_t lastEvent = 0;
+    std::unordered_map< uint64_t, transit_message * > rx;
+    std::unordered_map< uint64_t, transit_message * > tx;
+
+    typedef std::queue< sendbuf_t * > sendqueue_t;
+
+    udap_router *router       = nullptr;
+    udap_link_session *parent = nullptr;
+    xmit_stats *stats         = nullptr;
+    /// checks the hash of inbound messages
+    udap_crypto *crypto = nullptr;
+
+    /// hands up each inbound link message, id is the msgid it came in, the
+    /// session's passes it to the router
+    typedef bool (*recv_hook)(void *, uint64_t, udap_buffer_t);
+    recv_hook recv = nullptr;
+    void *user     = nullptr;
+
+    sendqueue_t sendqueue;
+
+    rtt_estimator rtt;
+    /// counts every fragment we send, a fragment is lost once enough sent
+    /// after it are acked
+    uint64_t txseq = 0;
+    /// acked fragments sent after a missing one that make it lost
+    static const size_t DupThresh = 3;
+
+    /// how many unacked bytes we let out
+    udap::util::Cubic cc;
+    /// XMIT and fragment bytes sent and not acked yet
+    size_t inflight = 0;
+    /// timeouts of things sent before this were already reset for
+    uint64_t timeoutSeq = 0;
+    /// session ticks in a row that had to retransmit on a timeout
+    uint8_t timeoutsInRow = 0;
+
+    mtu_search pmtu;
+    /// pmtu.mtu for the stats dump on other threads
+    std::atomic< uint16_t > pathMTU{mtu_search::BaseMTU};
+    /// nonce and hmac, frame header and xmit header, the most an XMIT adds
+    /// to its last fragment
+    static const uint16_t XmitOverhead = 64 + 6 + 48;
+    /// outbound messages with parts the window has not let out yet, oldest
+    /// first
+    std::deque< uint64_t > txpending;
+
+    /// full ack mask and completion time of inbound messages we are done
+    /// with, so a retransmit after our last ACK got lost is acked again
+    /// instead of handled twice
+    std::unordered_map< uint64_t, std::pair< uint32_t, udap_time_t > >
+        rxdone;
+
+    /// ack masks by msgid not sent yet, peers that set eProtoUpgrade get
+    /// them together once AckDelay ms pass or AckEvery XMITs and fragments
+    /// came in, or sooner on the back of a data frame
+    std::unordered_map< uint64_t, uint32_t > acks;
+    /// XMITs and fragments acked in acks
+    size_t unacked = 0;
+    /// when acks got its oldest entry
+    udap_time_t acksSince = 0;
+    static const udap_time_t AckDelay = 5;
+    static const size_t AckEvery      = 16;
+    /// msgid and mask
+    static const size_t AckEntry = 12;
+    /// most entries in an ACKS frame that fits in the base mtu
+    static const size_t MaxAckEntries =
+        (mtu_search::BaseMTU - 64 - 6) / AckEntry;
+
+    /// return true if both sides have the same state flags
+    bool
+    flags_agree(byte_t flags) const
+    {
+      return ((rxflags & flags) & (txflags & flags)) == flags;
+    }
+
+    void
+    clear()
+    {
+      auto _rx = rx;
+      auto _tx = tx;
+      for(auto &item : _rx)
+        delete item.second;
+      for(auto &item : _tx)
+        delete item.second;
+      rx.clear();
+      tx.clear();
+      txpending.clear();
+      if(stats)
+        stats->inflight -= inflight;
+      inflight = 0;
+    }
+
+    bool
+    inbound_frame_complete(uint64_t id);
+
+    /// hand each link message in a bundle up
+    bool
+    handle_bundle(uint64_t id, udap_buffer_t buf)
+    {
+      bool success = true;
+      size_t left  = buf.sz;
+      byte_t *ptr  = buf.base;
+      while(left)
+      {
+        uint16_t sz = 0;
+        // TODO: assumes big endian
+        if(left >= 2)
+          memcpy(&sz, ptr, 2);
+        if(left < 2 || sz > left - 2)
+        {
+          udap::Warn("truncated bundle, ", left, " bytes left");
+          return false;
+        }
+        udap_buffer_t msg;
+        msg.base = ptr + 2;
+        msg.cur  = msg.base;
+        msg.sz   = sz;
+        if(!recv(user, id, msg))
+          success = false;
+        ptr += 2 + sz;
+        left -= 2 + sz;
+      }
+      return success;
+    }
+
+    /// fragment size for new messages, whole XMITs fit the path mtu
+    uint16_t
+    fragsize() const
+    {
+      return (pmtu.mtu - XmitOverhead) / 64 * 64;
+    }
+
+    /// send a path mtu probe if one is due
+    void
+    probe_mtu(udap_time_t now)
+    {
+      auto size = pmtu.due(now, rtt.timeout(1));
+      if(size == 0)
+        return;
+      if(stats)
+        ++stats->mtuProbes;
+      push_probe(size, 0, size - 64 - 6);
+    }
+
+    /// ALIV frame with eHighMTUDetected, a probe padded out to size or the
+    /// answer to one
+    void
+    push_probe(uint16_t size, byte_t answer, uint16_t bodysz)
+    {
+      sendqueue.push(new sendbuf_t(bodysz + 6));
+      auto body_ptr = init_sendbuf(sendqueue.back(), eALIV, bodysz,
+                                   txflags | eHighMTUDetected);
+      memset(body_ptr, 0, bodysz);
+      memcpy(body_ptr, &size, 2);
+      body_ptr[2] = answer;
+    }
+
+    bool
+    got_probe(frame_header hdr, size_t sz)
+    {
+      if(hdr.size() > sz || hdr.size() < 3)
+      {
+        udap::Warn("invalid mtu probe size ", hdr.size());
+        return false;
+      }
+      uint16_t size;
+      memcpy(&size, hdr.data(), 2);
+      if(hdr.data()[2])
+      {
+        if(pmtu.acked(size, udap_time_now_ms()))
+        {
+          udap::Debug("path mtu is at least ", size);
+          pathMTU = pmtu.mtu;
+        }
+      }
+      else if(size_t(hdr.size()) + 6 + 64 == size)
+        push_probe(size, 1, 3);
+      else
+        udap::Warn("mtu probe of ", size, " came in ", hdr.size() + 6 + 64,
+                   " bytes");
+      return true;
+    }
+
+    void
+    push_ackfor(uint64_t id, uint32_t bitmask)
+    {
+      udap::Debug("ACK for msgid=", id, " mask=", bitmask);
+      sendqueue.push(new sendbuf_t(12 + 6));
+      auto body_ptr = init_sendbuf(sendqueue.back(), eACKS, 12, txflags);
+      // TODO: this assumes big endian
+      memcpy(body_ptr, &id, 8);
+      memcpy(body_ptr + 8, &bitmask, 4);
+    }
+
+    /// true if the peer takes ACKS late and with more than one msgid
+    bool
+    delays_acks() const
+    {
+      return rxflags & eProtoUpgrade;
+    }
+
+    /// true if the peer acks every fragment it gets, so the congestion
+    /// window and backed off retransmit timeouts can run on its acks
+    /// older peers ack a message a couple of times at most, they get it
+    /// all at once and unacked parts again every rto
+    bool
+    windowed() const
+    {
+      return rxflags & eProtoUpgrade;
+    }
+
+    /// ack what we have of a message, right away to peers that want every
+    /// ACK on its own and held in acks for the others
+    void
+    queue_ack(uint64_t id, uint32_t bitmask)
+    {
+      if(!delays_acks())
+      {
+        push_ackfor(id, bitmask);
+        return;
+      }
+      if(acks.empty())
+        acksSince = udap_time_now_ms();
+      // masks only grow, the latest one has it all
+      acks[id] = bitmask;
+      ++unacked;
+    }
+
+    /// true if held acks should not wait for a data frame any longer
+    bool
+    acks_due(udap_time_t now) const
+    {
+      return acks.size()
+          && (unacked >= AckEvery || now >= acksSince + AckDelay);
+    }
+
+    /// write an ACKS message with up to max held acks at ptr and forget
+    /// them, returns its size
+    size_t
+    write_acks(byte_t *ptr, size_t max)
+    {
+      frame_header hdr(ptr);
+      auto body = hdr.data();
+      size_t n  = 0;
+      auto itr  = acks.begin();
+      while(itr != acks.end() && n < max)
+      {
+        udap::Debug("ACK for msgid=", itr->first, " mask=", itr->second);
+        // TODO: this assumes big endian
+        memcpy(body, &itr->first, 8);
+        memcpy(body + 8, &itr->second, 4);
+        body += AckEntry;
+        ++n;
+        itr = acks.erase(itr);
+      }
+      hdr.version() = 0;
+      hdr.msgtype() = eACKS;
+      hdr.setsize(n * AckEntry);
+      ptr[4]      = 0;
+      hdr.flags() = txflags;
+      if(acks.empty())
+        unacked = 0;
+      if(stats)
+        stats->ackEntries += n;
+      return 6 + n * AckEntry;
+    }
+
+    /// put held acks after the XMIT or fragment of sz bytes in buf, using
+    /// no more than room bytes, returns how many bytes were added
+    size_t
+    piggyback_acks(byte_t *buf, size_t sz, size_t room)
+    {
+      if(acks.empty() || room < 6 + AckEntry)
+        return 0;
+      frame_header hdr(buf);
+      if(hdr.msgtype() != eXMIT && hdr.msgtype() != eFRAG)
+        return 0;
+      auto held  = acks.size();
+      auto added = write_acks(buf + sz, (room - 6) / AckEntry);
+      hdr.setflag(eAcksFollow);
+      if(stats)
+        stats->ackPiggybacked += held - acks.size();
+      return added;
+    }
+
+    bool
+    got_xmit(frame_header hdr, size_t sz, udap_pkt *pkt)
+    {
+      if(hdr.size() > sz)
+      {
+        // overflow
+        udap::Warn("invalid XMIT frame size ", hdr.size(), " > ", sz);
+        return false;
+      }
+      sz = hdr.size();
+
+      // extract xmit data
+      xmit x(hdr.data());
+
+      const auto bufsz = sizeof(x.buffer);
+
+      if(sz - bufsz < x.lastfrag())
+      {
+        // bad size of last fragment
+        udap::Warn("XMIT frag size missmatch ", sz - bufsz, " < ",
+                    x.lastfrag());
+        return false;
+      }
+
+      if(x.numfrags() > transit_message::MaxFrags
+         || x.totalsize() > MAX_LINK_MSG_SIZE)
+      {
+        udap::Warn("XMIT too big, ", (int)x.numfrags(), " fragments ",
+                   x.totalsize(), " bytes");
+        return false;
+      }
+
+      // check LSB set on flags
+      if(x.flags() & 0x01)
+      {
+        auto id   = x.msgid();
+        auto itr  = rx.find(id);
+        auto done = rxdone.find(id);
+        if(done != rxdone.end())
+        {
+          // our ACKs got lost, the peer still has it in flight
+          queue_ack(id, done->second.first);
+          return true;
+        }
+        if(itr != rx.end())
+        {
+          // the XMIT was retransmitted, tell them what we have so far
+          queue_ack(id, itr->second->get_bitmask());
+          return true;
+        }
+        else
+        {
+          auto msg = new transit_message(x);
+          rx[id]   = msg;
+          udap::Debug("got message XMIT with ", (int)x.numfrags(),
+                       " fragments");
+          // inserted, keep last fragment
+          if(x.numfrags() == 0)
+            msg->rxlast = udap::PacketRef(
+                pkt, hdr.data() + sizeof(x.buffer), x.lastfrag());
+          else
+            msg->put_lastfrag(hdr.data() + sizeof(x.buffer));
+          queue_ack(id, 0);
+          if(x.numfrags() == 0)
+          {
+            return inbound_frame_complete(id);
+          }
+          return true;
+        }
+      }
+      else
+        udap::Warn("LSB not set on flags");
+      return false;
+    }
+
+    void
+    alive()
+    {
+      lastEvent = udap_time_now_ms();
+    }
+
+    bool
+    got_frag(frame_header hdr, size_t sz)
+    {
+      if(hdr.size() > sz)
+      {
+        // overflow
+        udap::Warn("invalid FRAG frame size ", hdr.size(), " > ", sz);
+        return false;
+      }
+      sz = hdr.size();
+
+      if(sz <= 9)
+      {
+        // underflow
+        udap::Warn("invalid FRAG frame size ", sz, " <= 9");
+        return false;
+      }
+
+      uint64_t msgid;
+      byte_t fragno;
+      // assumes big endian
+      // TODO: implement little endian
+      memcpy(&msgid, hdr.data(), 8);
+      memcpy(&fragno, hdr.data() + 8, 1);
+
+      auto itr = rx.find(msgid);
+      if(itr == rx.end())
+      {
+        auto done = rxdone.find(msgid);
+        if(done != rxdone.end())
+        {
+          // retransmitted because our final ACK got lost
+          if(stats)
+            ++stats->rxDuplicates;
+          queue_ack(msgid, done->second.first);
+        }
+        else
+          udap::Warn("no such RX fragment, msgid=", msgid);
+        return true;
+      }
+      auto fragsize = itr->second->msginfo.fragsize();
+      if(fragsize != sz - 9)
+      {
+        udap::Warn("RX fragment size missmatch ", fragsize, " != ", sz - 9);
+        return false;
+      }
+      udap::Debug("RX got fragment ", (int)fragno, " msgid=", msgid);
+      if(fragno < itr->second->msginfo.numfrags()
+         && itr->second->status.test(fragno))
+      {
+        if(stats)
+          ++stats->rxDuplicates;
+        // the sender is missing our ACK for it, so send the mask again
+        queue_ack(msgid, itr->second->get_bitmask());
+        return true;
+      }
+      if(!itr->second->put_frag(fragno, hdr.data() + 9))
+      {
+        udap::Warn("inbound message does not have fragment msgid=", msgid,
+                    " fragno=", (int)fragno);
+        return false;
+      }
+      auto mask = itr->second->get_bitmask();
+      // every fragment is acked, the sender's window and loss detection
+      // run on them
+      queue_ack(msgid, mask);
+      if(itr->second->completed())
+        return inbound_frame_complete(msgid);
+      return true;
+    }
+
+    bool
+    got_acks(frame_header hdr, size_t sz);
+
+    /// ack of one msgid from an ACKS message
+    void
+    got_ack(uint64_t msgid, uint32_t bitmask, udap_time_t now);
+
+    /// the ACKS message after the first message of a frame of sz bytes
+    bool
+    got_trailing_acks(frame_header hdr, size_t sz)
+    {
+      size_t offset = 6 + size_t(hdr.size());
+      if(offset + 6 > sz)
+      {
+        udap::Warn("no ACKS after message of ", hdr.size(), " bytes");
+        return false;
+      }
+      frame_header trailer(hdr.data() + hdr.size());
+      if(trailer.msgtype() != eACKS)
+      {
+        udap::Warn("invalid message after ", hdr.size(), " bytes");
+        return false;
+      }
+      return got_acks(trailer, sz - offset - 6);
+    }
+
+    // queue new outbound message, the fragments go right behind the XMIT
+    // as far as the congestion window lets them
+    void
+    queue_tx(uint64_t id, transit_message *msg)
+    {
+      tx.insert(std::make_pair(id, msg));
+      txpending.push_back(id);
+      send_window(udap_time_now_ms());
+    }
+
+    void
+    sent_new(size_t bytes)
+    {
+      inflight += bytes;
+      if(stats)
+        stats->inflight += bytes;
+    }
+
+    void
+    acked(size_t bytes)
+    {
+      inflight -= bytes;
+      if(stats)
+        stats->inflight -= bytes;
+    }
+
+    /// send parts of pending messages never sent before while the window
+    /// has room, or all of them if there is no window
+    void
+    send_window(udap_time_t now)
+    {
+      while(txpending.size())
+      {
+        auto itr = tx.find(txpending.front());
+        if(itr != tx.end())
+        {
+          auto msg = itr->second;
+          if(msg->xmitTries == 0)
+          {
+            if(windowed() && inflight >= cc.Window())
+              return;
+            msg->generate_xmit(sendqueue, txflags, now, txseq++);
+            sent_new(msg->msginfo.lastfrag());
+          }
+          while(msg->nextfrag < msg->msginfo.numfrags())
+          {
+            if(windowed() && inflight >= cc.Window())
+              return;
+            msg->generate_frag(sendqueue, msg->nextfrag++, txflags, now,
+                               txseq++);
+            sent_new(msg->msginfo.fragsize());
+          }
+        }
+        txpending.pop_front();
+      }
+    }
+
+    /// send again whatever has gone unacked past its timeout
+    void
+    retransmit(udap_time_t now);
+
+    /// forget inbound messages done with longer ago than a peer would
+    /// still retransmit them
+    void
+    expire_rxdone(udap_time_t now)
+    {
+      auto itr = rxdone.begin();
+      while(itr != rxdone.end())
+      {
+        if(itr->second.second + SESSION_TIMEOUT < now)
+          itr = rxdone.erase(itr);
+        else
+          ++itr;
+      }
+    }
+
+    /// ack mask with every fragment of a numfrags message
+    static uint32_t
+    full_mask(uint8_t numfrags)
+    {
+      return numfrags >= 32 ? 0xFFFFFFFF : (1U << numfrags) - 1;
+    }
+
+    // get next frame to encrypt and transmit
+    bool
+    next_frame(udap_buffer_t *buf)
+    {
+      auto left = sendqueue.size();
+      udap::Debug("next frame, ", left, " frames left in send queue");
+      if(left)
+      {
+        sendbuf_t *send = sendqueue.front();
+        buf->base       = send->data();
+        buf->cur        = send->data();
+        buf->sz         = send->size();
+        return true;
+      }
+      return false;
+    }
+
+    void
+    pop_next_frame()
+    {
+      sendbuf_t *buf = sendqueue.front();
+      sendqueue.pop();
+      delete buf;
+    }
+
+    /// handle a decrypted frame in buf, which lives in pkt
+    bool
+    process(byte_t *buf, size_t sz, udap_pkt *pkt)
+    {
+      frame_header hdr(buf);
+      if(hdr.flags() & eSessionInvalidated)
+      {
+        rxflags |= eSessionInvalidated;
+      }
+      if(hdr.flags() & eProtoUpgrade)
+        rxflags |= eProtoUpgrade;
+      bool ok = process_message(hdr, sz, pkt);
+      // acks that came along are good even if the message was not
+      if(hdr.flags() & eAcksFollow)
+        ok = got_trailing_acks(hdr, sz) && ok;
+      return ok;
+    }
+
+    bool
+    process_message(frame_header hdr, size_t sz, udap_pkt *pkt)
+    {
+      switch(hdr.msgtype())
+      {
+        case eALIV:
+          if(rxflags & eSessionInvalidated)
+          {
+            txflags |= eSessionInvalidated;
+          }
+          if(hdr.flags() & eHighMTUDetected)
+            return got_probe(hdr, sz - 6);
+          return true;
+        case eXMIT:
+          return got_xmit(hdr, sz - 6, pkt);
+        case eACKS:
+          return got_acks(hdr, sz - 6);
+        case eFRAG:
+          return got_frag(hdr, sz - 6);
+        default:
+          udap::Warn("invalid message header");
+          return false;
+      }
+    }
+  };
+
+
+  inline bool
+  frame_state::inbound_frame_complete(uint64_t id)
+  {
+    bool success = false;
+    auto rxmsg   = rx[id];
+    udap_buffer_t buf;
+    bool whole = false;
+    if(rxmsg->msginfo.numfrags() == 0)
+    {
+      // came in one frame, hand it up straight from the packet
+      buf.base = rxmsg->rxlast.data();
+      buf.cur  = buf.base;
+      buf.sz   = rxmsg->rxlast.size();
+      whole    = true;
+    }
+    else if(rxmsg->completed())
+    {
+      // fragments were copied into place as they came in
+      buf.base = rxmsg->msgbuf.get();
+      buf.cur  = buf.base;
+      buf.sz   = rxmsg->msginfo.totalsize();
+      if(stats)
+        stats->rxCopied += buf.sz;
+      whole = true;
+    }
+    if(whole)
+    {
+      if(stats)
+        ++stats->rxMessages;
+      udap::ShortHash digest;
+      crypto->shorthash(digest, buf);
+      if(memcmp(digest, rxmsg->msginfo.hash(), 32))
+      {
+        udap::Warn("message hash missmatch ",
+                    udap::AlignedBuffer< 32 >(digest),
+                    " != ", udap::AlignedBuffer< 32 >(rxmsg->msginfo.hash()));
+        delete rxmsg;
+        rx.erase(id);
+        return false;
+      }
+      // whatever the handler makes of it we have it, ack it if it comes again
+      rxdone[id] = std::make_pair(full_mask(rxmsg->msginfo.numfrags()),
+                                  udap_time_now_ms());
+      if(rxmsg->msginfo.flags() & eXmitBundle)
+        success = handle_bundle(id, buf);
+      else
+        success = recv(user, id, buf);
+      if(!success)
+        udap::Warn("failed to handle inbound message ", id);
+    }
+    else
+    {
+      udap::Warn("failed to reassemble message ", id);
+    }
+    delete rxmsg;
+    rx.erase(id);
+    return success;
+  }
+
+  inline bool
+  frame_state::got_acks(frame_header hdr, size_t sz)
+  {
+    if(hdr.size() > sz)
+    {
+      udap::Error("invalid ACKS frame size ", hdr.size(), " > ", sz);
+      return false;
+    }
+    sz = hdr.size();
+    if(sz < AckEntry)
+    {
+      udap::Error("invalid ACKS frame size ", sz, " < 12");
+      return false;
+    }
+
+    // one entry from old peers, any number from ones that delay acks
+    auto ptr = hdr.data();
+    auto now = udap_time_now_ms();
+    for(size_t idx = 0; idx + AckEntry <= sz; idx += AckEntry)
+    {
+      uint64_t msgid;
+      uint32_t bitmask;
+      memcpy(&msgid, ptr + idx, 8);
+      memcpy(&bitmask, ptr + idx + 8, 4);
+      got_ack(msgid, bitmask, now);
+    }
+    // acked bytes made room
+    send_window(now);
+    return true;
+  }
+
+  inline void
+  frame_state::got_ack(uint64_t msgid, uint32_t bitmask, udap_time_t now)
+  {
+    auto itr = tx.find(msgid);
+    if(itr == tx.end())
+    {
+      udap::Debug("ACK for missing TX frame msgid=", msgid);
+      return;
+    }
+
+    transit_message *msg = itr->second;
+    auto numfrags        = msg->msginfo.numfrags();
+    bitmask &= full_mask(numfrags);
+
+    // any ACK for the message means the XMIT got there, only time ones
+    // never sent again so a sample can't be matched to the wrong send
+    size_t ackedBytes = 0;
+    if(!msg->xmitAcked && msg->xmitTries)
+    {
+      msg->xmitAcked = true;
+      ackedBytes += msg->msginfo.lastfrag();
+      if(msg->xmitTries == 1)
+      {
+        rtt.sample(now - msg->xmitSentAt);
+        if(stats)
+          stats->rtt.Record(now - msg->xmitSentAt);
+      }
+    }
+
+    // newly acked fragments, newest send first
+    uint64_t newest = 0;
+    for(byte_t idx = 0; idx < numfrags; ++idx)
+    {
+      if(!(bitmask & (1U << idx)) || msg->status.test(idx)
+         || !msg->tries[idx])
+        continue;
+      ackedBytes += msg->msginfo.fragsize();
+      auto elapsed = now - msg->sentAt[idx];
+      if(msg->tries[idx] == 1)
+      {
+        if(msg->sentSeq[idx] >= newest)
+        {
+          newest = msg->sentSeq[idx];
+          rtt.sample(elapsed);
+          if(stats)
+            stats->rtt.Record(elapsed);
+        }
+      }
+      else if(stats && elapsed < rtt.srtt / 2)
+      {
+        // acked quicker than the retransmit could have made it there, the
+        // one before it did
+        ++stats->spurious;
+      }
+    }
+
+    msg->ack(bitmask);
+    if(ackedBytes)
+    {
+      timeoutsInRow = 0;
+      acked(ackedBytes);
+      cc.OnAck(ackedBytes, now, rtt.srtt);
+      if(stats)
+        stats->cwnd.Record(cc.Window());
+    }
+
+    if(msg->completed() && msg->xmitAcked)
+    {
+      udap::Debug("message transmitted msgid=", msgid);
+      tx.erase(msgid);
+      delete msg;
+    }
+    else
+    {
+      // selective ack, a hole is lost once DupThresh fragments sent after
+      // it got there or every one sent after it did
+      for(byte_t idx = 0; idx < msg->nextfrag; ++idx)
+      {
+        if(msg->status.test(idx))
+          continue;
+        size_t later = 0, ackedLater = 0;
+        for(byte_t other = 0; other < msg->nextfrag; ++other)
+        {
+          if(msg->sentSeq[other] <= msg->sentSeq[idx])
+            continue;
+          ++later;
+          if(msg->status.test(other))
+            ++ackedLater;
+        }
+        if(ackedLater >= DupThresh || (later && ackedLater == later))
+        {
+          udap::Debug("message ", msgid, " fragment ", (int)idx, " lost");
+          if(windowed() && cc.OnLoss(msg->sentSeq[idx], txseq) && stats)
+            ++stats->windowCuts;
+          msg->generate_frag(sendqueue, idx, txflags, now, txseq++);
+          if(stats)
+            ++stats->retransmits;
+        }
+      }
+    }
+  }
+
+  inline void
+  frame_state::retransmit(udap_time_t now)
+  {
+    bool timedout = false;
+    auto firstSeq = txseq;
+    // peers without a window ack too rarely to back off on, nothing
+    // acked for an rto is as much as they ever tell us
+    bool backoff = windowed();
+    for(auto &item : tx)
+    {
+      auto msg = item.second;
+      if(msg->xmitTries && !msg->xmitAcked
+         && now >= msg->xmitSentAt
+                 + rtt.timeout(backoff ? msg->xmitTries : 1))
+      {
+        udap::Debug("message ", item.first, " XMIT timed out");
+        timedout |= msg->xmitSeq >= timeoutSeq;
+        msg->generate_xmit(sendqueue, txflags, now, txseq++);
+        if(stats)
+          ++stats->retransmits;
+      }
+      for(byte_t idx = 0; idx < msg->nextfrag; ++idx)
+      {
+        if(msg->status.test(idx)
+           || now < msg->sentAt[idx]
+                   + rtt.timeout(backoff ? msg->tries[idx] : 1))
+          continue;
+        udap::Debug("message ", item.first, " fragment ", (int)idx,
+                    " timed out");
+        timedout |= msg->sentSeq[idx] >= timeoutSeq;
+        msg->generate_frag(sendqueue, idx, txflags, now, txseq++);
+        if(stats)
+          ++stats->retransmits;
+      }
+    }
+    // one reset for everything that was out when the timer ran out
+    if(timedout)
+    {
+      timeoutSeq = firstSeq;
+      if(backoff)
+      {
+        cc.OnTimeout(txseq);
+        if(stats)
+          ++stats->timeouts;
+      }
+      // nothing acked over a few rtos, frames at the probed size may have
+      // stopped getting through
+      if(++timeoutsInRow >= 3 && pmtu.mtu > mtu_search::BaseMTU)
+      {
+        udap::Warn("path mtu of ", pmtu.mtu, " stopped working");
+        pmtu.reset(now);
+        pathMTU = pmtu.mtu;
+        if(stats)
+          ++stats->mtuBlackholes;
+      }
+    }
+  }
+}  // namespace iwp
+
+#endif
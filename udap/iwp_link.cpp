@@ -5,660 +5,46 @@
 #include <udap/crypto.hpp>
 #include "address_info.hpp"
 #include "codel.hpp"
+#include "iwp_frame.hpp"
 #include "link/encoder.hpp"
 
 #include <sodium/crypto_sign_ed25519.h>
 
 #include <algorithm>
+#include <atomic>
 #include <bitset>
 #include <cassert>
+#include <deque>
 #include <fstream>
 #include <list>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <queue>
-#include <set>
 #include <unordered_map>
 #include <vector>
 
 #include "buffer.hpp"
+#include "cubic.hpp"
 #include "fs.hpp"
+#include "histogram.hpp"
 #include "logger.hpp"
 #include "mem.hpp"
 #include "net.hpp"
+#include "pacer.hpp"
+#include "pkt.hpp"
+#include "retire_list.hpp"
 #include "router.hpp"
+#include "sharded_map.hpp"
 #include "str.hpp"
 
 namespace iwp
 {
-  // session activity timeout is 10s
-  constexpr udap_time_t SESSION_TIMEOUT = 10000;
-
   constexpr size_t MAX_PAD = 128;
 
-  enum msgtype
-  {
-    eALIV = 0x00,
-    eXMIT = 0x01,
-    eACKS = 0x02,
-    eFRAG = 0x03
-  };
-
-  struct sendbuf_t
-  {
-    sendbuf_t(size_t s) : sz(s)
-    {
-      buf = new byte_t[s];
-    }
-
-    ~sendbuf_t()
-    {
-      delete[] buf;
-    }
-
-    byte_t *buf;
-    size_t sz;
-
-    size_t
-    size() const
-    {
-      return sz;
-    }
-
-    byte_t *
-    data()
-    {
-      return buf;
-    }
-  };
-
-  enum header_flag
-  {
-    eSessionInvalidated = (1 << 0),
-    eHighPacketDrop     = (1 << 1),
-    eHighMTUDetected    = (1 << 2),
-    eProtoUpgrade       = (1 << 3)
-  };
-
-  /** plaintext frame header */
-  struct frame_header
-  {
-    byte_t *ptr;
-
-    frame_header(byte_t *buf) : ptr(buf)
-    {
-    }
-
-    byte_t *
-    data()
-    {
-      return ptr + 6;
-    }
-
-    uint8_t &
-    version()
-    {
-      return ptr[0];
-    }
-
-    uint8_t &
-    msgtype()
-    {
-      return ptr[1];
-    }
-
-    uint16_t
-    size() const
-    {
-      uint16_t sz;
-      memcpy(&sz, ptr + 2, 2);
-      return sz;
-    }
-
-    void
-    setsize(uint16_t sz)
-    {
-      memcpy(ptr + 2, &sz, 2);
-    }
-
-    uint8_t &
-    flags()
-    {
-      return ptr[5];
-    }
-
-    void
-    setflag(header_flag f)
-    {
-      ptr[5] |= f;
-    }
-  };
-
-  byte_t *
-  init_sendbuf(sendbuf_t *buf, msgtype t, uint16_t sz, uint8_t flags)
-  {
-    frame_header hdr(buf->data());
-    hdr.version() = 0;
-    hdr.msgtype() = t;
-    hdr.setsize(sz);
-    buf->data()[4] = 0;
-    buf->data()[5] = flags;
-    return hdr.data();
-  }
-
-  /** xmit header */
-  struct xmit
-  {
-    byte_t buffer[48];
-
-    xmit() = default;
-
-    xmit(byte_t *ptr)
-    {
-      memcpy(buffer, ptr, sizeof(buffer));
-    }
-
-    xmit(const xmit &other)
-    {
-      memcpy(buffer, other.buffer, sizeof(buffer));
-    }
-
-    void
-    set_info(const byte_t *hash, uint64_t id, uint16_t fragsz, uint16_t lastsz,
-             uint8_t numfrags, uint8_t flags = 0x01)
-    {
-      // big endian assumed
-      // TODO: implement little endian
-      memcpy(buffer, hash, 32);
-      memcpy(buffer + 32, &id, 8);
-      memcpy(buffer + 40, &fragsz, 2);
-      memcpy(buffer + 42, &lastsz, 2);
-      buffer[44] = 0;
-      buffer[45] = 0;
-      buffer[46] = numfrags;
-      buffer[47] = flags;
-    }
-
-    const byte_t *
-    hash() const
-    {
-      return &buffer[0];
-    }
-
-    uint64_t
-    msgid() const
-    {
-      // big endian assumed
-      // TODO: implement little endian
-      const byte_t *start   = buffer + 32;
-      const uint64_t *msgid = (const uint64_t *)start;
-      return *msgid;
-    }
-
-    // size of each full fragment
-    uint16_t
-    fragsize() const
-    {
-      // big endian assumed
-      // TODO: implement little endian
-      const byte_t *start    = buffer + 40;
-      const uint16_t *fragsz = (uint16_t *)start;
-      return *fragsz;
-    }
-
-    // number of full fragments
-    uint8_t
-    numfrags() const
-    {
-      return buffer[46];
-    }
-
-    // size of the entire message
-    size_t
-    totalsize() const
-    {
-      return (fragsize() * numfrags()) + lastfrag();
-    }
-
-    // size of the last fragment
-    uint16_t
-    lastfrag() const
-    {
-      // big endian assumed
-      // TODO: implement little endian
-      const byte_t *start    = buffer + 42;
-      const uint16_t *lastsz = (uint16_t *)start;
-      return *lastsz;
-    }
-
-    uint8_t
-    flags()
-    {
-      return buffer[47];
-    }
-  };
-
   // forward declare
-  struct session;
   struct server;
 
-  struct transit_message
-  {
-    xmit msginfo;
-    std::bitset< 32 > status = {};
-
-    typedef std::vector< byte_t > fragment_t;
-
-    std::unordered_map< byte_t, fragment_t > frags;
-    fragment_t lastfrag;
-
-    void
-    clear()
-    {
-      frags.clear();
-      lastfrag.clear();
-    }
-
-    // calculate acked bitmask
-    uint32_t
-    get_bitmask() const
-    {
-      uint32_t bitmask = 0;
-      uint8_t idx      = 0;
-      while(idx < 32)
-      {
-        bitmask |= (status.test(idx) ? (1 << idx) : 0);
-        ++idx;
-      }
-      return bitmask;
-    }
-
-    // outbound
-    transit_message(udap_buffer_t buf, const byte_t *hash, uint64_t id,
-                    uint16_t mtu = 1024)
-    {
-      put_message(buf, hash, id, mtu);
-    }
-
-    // inbound
-    transit_message(const xmit &x) : msginfo(x)
-    {
-      byte_t fragidx    = 0;
-      uint16_t fragsize = x.fragsize();
-      while(fragidx < x.numfrags())
-      {
-        frags[fragidx].resize(fragsize);
-        ++fragidx;
-      }
-      status.reset();
-    }
-
-    /// ack packets based off a bitmask
-    void
-    ack(uint32_t bitmask)
-    {
-      uint8_t idx = 0;
-      while(idx < 32)
-      {
-        if(bitmask & (1 << idx))
-        {
-          status.set(idx);
-        }
-        ++idx;
-      }
-    }
-
-    bool
-    should_send_ack() const
-    {
-      if(msginfo.numfrags() == 0)
-        return true;
-      return status.count() % (1 + (msginfo.numfrags() / 2)) == 0;
-    }
-
-    bool
-    completed() const
-    {
-      for(byte_t idx = 0; idx < msginfo.numfrags(); ++idx)
-      {
-        if(!status.test(idx))
-          return false;
-      }
-      return true;
-    }
-
-    template < typename T >
-    void
-    generate_xmit(T &queue, byte_t flags = 0)
-    {
-      uint16_t sz = lastfrag.size() + sizeof(msginfo.buffer);
-      queue.push(new sendbuf_t(sz + 6));
-      auto body_ptr = init_sendbuf(queue.back(), eXMIT, sz, flags);
-      memcpy(body_ptr, msginfo.buffer, sizeof(msginfo.buffer));
-      body_ptr += sizeof(msginfo.buffer);
-      memcpy(body_ptr, lastfrag.data(), lastfrag.size());
-    }
-
-    template < typename T >
-    void
-    retransmit_frags(T &queue, byte_t flags = 0)
-    {
-      auto msgid    = msginfo.msgid();
-      auto fragsize = msginfo.fragsize();
-      for(auto &frag : frags)
-      {
-        if(status.test(frag.first))
-          continue;
-        uint16_t sz = 9 + fragsize;
-        queue.push(new sendbuf_t(sz + 6));
-        auto body_ptr = init_sendbuf(queue.back(), eFRAG, sz, flags);
-        // TODO: assumes big endian
-        memcpy(body_ptr, &msgid, 8);
-        body_ptr[8] = frag.first;
-        memcpy(body_ptr + 9, frag.second.data(), fragsize);
-      }
-    }
-
-    bool
-    reassemble(std::vector< byte_t > &buffer)
-    {
-      auto total = msginfo.totalsize();
-      buffer.resize(total);
-      auto fragsz = msginfo.fragsize();
-      auto ptr    = &buffer[0];
-      for(byte_t idx = 0; idx < msginfo.numfrags(); ++idx)
-      {
-        if(!status.test(idx))
-          return false;
-        memcpy(ptr, frags[idx].data(), fragsz);
-        ptr += fragsz;
-      }
-      memcpy(ptr, lastfrag.data(), lastfrag.size());
-      return true;
-    }
-
-    void
-    put_message(udap_buffer_t buf, const byte_t *hash, uint64_t id,
-                uint16_t mtu = 1024)
-    {
-      status.reset();
-      uint8_t fragid    = 0;
-      uint16_t fragsize = mtu;
-      size_t left       = buf.sz;
-      while(left > fragsize)
-      {
-        auto &frag = frags[fragid];
-        frag.resize(fragsize);
-        memcpy(frag.data(), buf.cur, fragsize);
-        buf.cur += fragsize;
-        fragid++;
-        left -= fragsize;
-      }
-      uint16_t lastfrag = buf.sz - (buf.cur - buf.base);
-      // set info for xmit
-      msginfo.set_info(hash, id, fragsize, lastfrag, fragid);
-      put_lastfrag(buf.cur, lastfrag);
-    }
-
-    void
-    put_lastfrag(byte_t *buf, size_t sz)
-    {
-      lastfrag.resize(sz);
-      memcpy(lastfrag.data(), buf, sz);
-    }
-
-    bool
-    put_frag(byte_t fragno, byte_t *buf)
-    {
-      auto itr = frags.find(fragno);
-      if(itr == frags.end())
-        return false;
-      memcpy(itr->second.data(), buf, msginfo.fragsize());
-      status.set(fragno);
-      return true;
-    }
-  };
-
-  struct frame_state
-  {
-    byte_t rxflags         = 0;
-    byte_t txflags         = 0;
-    uint64_t rxids         = 0;
-    uint64_t txids         = 0;
-    udap_time_t lastEvent = 0;
-    std::unordered_map< uint64_t, transit_message * > rx;
-    std::unordered_map< uint64_t, transit_message * > tx;
-
-    typedef std::queue< sendbuf_t * > sendqueue_t;
-
-    udap_router *router       = nullptr;
-    udap_link_session *parent = nullptr;
-
-    sendqueue_t sendqueue;
-
-    /// return true if both sides have the same state flags
-    bool
-    flags_agree(byte_t flags) const
-    {
-      return ((rxflags & flags) & (txflags & flags)) == flags;
-    }
-
-    void
-    clear()
-    {
-      auto _rx = rx;
-      auto _tx = tx;
-      for(auto &item : _rx)
-        delete item.second;
-      for(auto &item : _tx)
-        delete item.second;
-      rx.clear();
-      tx.clear();
-    }
-
-    bool
-    inbound_frame_complete(uint64_t id);
-
-    void
-    push_ackfor(uint64_t id, uint32_t bitmask)
-    {
-      udap::Debug("ACK for msgid=", id, " mask=", bitmask);
-      sendqueue.push(new sendbuf_t(12 + 6));
-      auto body_ptr = init_sendbuf(sendqueue.back(), eACKS, 12, txflags);
-      // TODO: this assumes big endian
-      memcpy(body_ptr, &id, 8);
-      memcpy(body_ptr + 8, &bitmask, 4);
-    }
-
-    bool
-    got_xmit(frame_header hdr, size_t sz)
-    {
-      if(hdr.size() > sz)
-      {
-        // overflow
-        udap::Warn("invalid XMIT frame size ", hdr.size(), " > ", sz);
-        return false;
-      }
-      sz = hdr.size();
-
-      // extract xmit data
-      xmit x(hdr.data());
-
-      const auto bufsz = sizeof(x.buffer);
-
-      if(sz - bufsz < x.lastfrag())
-      {
-        // bad size of last fragment
-        udap::Warn("XMIT frag size missmatch ", sz - bufsz, " < ",
-                    x.lastfrag());
-        return false;
-      }
-
-      // check LSB set on flags
-      if(x.flags() & 0x01)
-      {
-        auto id  = x.msgid();
-        auto itr = rx.find(id);
-        if(itr == rx.end())
-        {
-          auto msg = new transit_message(x);
-          rx[id]   = msg;
-          udap::Debug("got message XMIT with ", (int)x.numfrags(),
-                       " fragments");
-          // inserted, put last fragment
-          msg->put_lastfrag(hdr.data() + sizeof(x.buffer), x.lastfrag());
-          push_ackfor(id, 0);
-          if(x.numfrags() == 0)
-          {
-            return inbound_frame_complete(id);
-          }
-          return true;
-        }
-        else
-          udap::Warn("duplicate XMIT msgid=", x.msgid());
-      }
-      else
-        udap::Warn("LSB not set on flags");
-      return false;
-    }
-
-    void
-    alive()
-    {
-      lastEvent = udap_time_now_ms();
-    }
-
-    bool
-    got_frag(frame_header hdr, size_t sz)
-    {
-      if(hdr.size() > sz)
-      {
-        // overflow
-        udap::Warn("invalid FRAG frame size ", hdr.size(), " > ", sz);
-        return false;
-      }
-      sz = hdr.size();
-
-      if(sz <= 9)
-      {
-        // underflow
-        udap::Warn("invalid FRAG frame size ", sz, " <= 9");
-        return false;
-      }
-
-      uint64_t msgid;
-      byte_t fragno;
-      // assumes big endian
-      // TODO: implement little endian
-      memcpy(&msgid, hdr.data(), 8);
-      memcpy(&fragno, hdr.data() + 8, 1);
-
-      auto itr = rx.find(msgid);
-      if(itr == rx.end())
-      {
-        udap::Warn("no such RX fragment, msgid=", msgid);
-        return true;
-      }
-      auto fragsize = itr->second->msginfo.fragsize();
-      if(fragsize != sz - 9)
-      {
-        udap::Warn("RX fragment size missmatch ", fragsize, " != ", sz - 9);
-        return false;
-      }
-      udap::Debug("RX got fragment ", (int)fragno, " msgid=", msgid);
-      if(!itr->second->put_frag(fragno, hdr.data() + 9))
-      {
-        udap::Warn("inbound message does not have fragment msgid=", msgid,
-                    " fragno=", (int)fragno);
-        return false;
-      }
-      auto mask = itr->second->get_bitmask();
-      if(itr->second->completed())
-      {
-        push_ackfor(msgid, mask);
-        return inbound_frame_complete(msgid);
-      }
-      else if(itr->second->should_send_ack())
-      {
-        push_ackfor(msgid, mask);
-      }
-      return true;
-    }
-
-    bool
-    got_acks(frame_header hdr, size_t sz);
-
-    // queue new outbound message
-    void
-    queue_tx(uint64_t id, transit_message *msg)
-    {
-      tx.insert(std::make_pair(id, msg));
-      msg->generate_xmit(sendqueue, txflags);
-    }
-
-    void
-    retransmit()
-    {
-      for(auto &item : tx)
-      {
-        item.second->retransmit_frags(sendqueue, txflags);
-      }
-    }
-
-    // get next frame to encrypt and transmit
-    bool
-    next_frame(udap_buffer_t *buf)
-    {
-      auto left = sendqueue.size();
-      udap::Debug("next frame, ", left, " frames left in send queue");
-      if(left)
-      {
-        sendbuf_t *send = sendqueue.front();
-        buf->base       = send->data();
-        buf->cur        = send->data();
-        buf->sz         = send->size();
-        return true;
-      }
-      return false;
-    }
-
-    void
-    pop_next_frame()
-    {
-      sendbuf_t *buf = sendqueue.front();
-      sendqueue.pop();
-      delete buf;
-    }
-
-    bool
-    process(byte_t *buf, size_t sz)
-    {
-      frame_header hdr(buf);
-      if(hdr.flags() & eSessionInvalidated)
-      {
-        rxflags |= eSessionInvalidated;
-      }
-      switch(hdr.msgtype())
-      {
-        case eALIV:
-          if(rxflags & eSessionInvalidated)
-          {
-            txflags |= eSessionInvalidated;
-          }
-          return true;
-        case eXMIT:
-          return got_xmit(hdr, sz - 6);
-        case eACKS:
-          return got_acks(hdr, sz - 6);
-        case eFRAG:
-          return got_frag(hdr, sz - 6);
-        default:
-          udap::Warn("invalid message header");
-          return false;
-      }
-    }
-  };
-
   /// get the time from a iwp_async_frame
   struct FrameGetTime
   {
@@ -674,11 +60,16 @@ namespace iwp
     void
     operator()(iwp_async_frame *frame) const
     {
-      frame->created = udap_time_now_ms();
+      // frames off the wire keep the time the kernel got them so their
+      // sojourn counts the wait in the socket buffer
+      if(frame->created == 0)
+        frame->created = udap_time_now_ms();
     }
   };
 
-  struct session
+  /// acquire()d by everything using the session off the logic thread, a
+  /// removed session is only freed once nothing holds it
+  struct session : public udap::util::RefCount
   {
     udap_udp_io *udp;
     udap_crypto *crypto;
@@ -701,7 +92,47 @@ namespace iwp
     udap_time_t now, inboundNow;
     uint32_t establish_job_id = 0;
     uint32_t frames           = 0;
-    bool working              = false;
+    /// handshake crypto jobs in flight
+    std::atomic< uint32_t > working{0};
+
+    /// a handshake job holds the session until its hook returns
+    void
+    begin_work()
+    {
+      ++working;
+      acquire();
+    }
+
+    /// hand a session that is not in the map to the server to free
+    void
+    retire();
+
+    /// set by done(), timers that fire after it only let go of the session
+    std::atomic< bool > stopped{false};
+
+    /// call handler on the logic thread in wait ms unless armed says it is
+    /// already coming, from any thread, return true if this armed it
+    /// the timer holds the session until handler runs, so done() leaves it
+    /// be rather than racing another thread to remove it
+    bool
+    arm_timer(std::atomic< bool > &armed, uint64_t wait,
+              udap_timer_handler_func handler);
+
+    /// in handler, let armed be set again and return true if the session
+    /// is still in use, handler must release() after either way
+    bool
+    timer_fired(std::atomic< bool > &armed, uint64_t left);
+
+    struct work_guard
+    {
+      session *self;
+
+      ~work_guard()
+      {
+        --self->working;
+        self->release();
+      }
+    };
 
     udap::util::CoDelQueue< iwp_async_frame *, FrameGetTime, FramePutTime >
         outboundFrames;
@@ -712,9 +143,13 @@ namespace iwp
         decryptedFrames;
      */
 
-    uint32_t pump_send_timer_id = 0;
+    /// a pace timer is on its way
+    std::atomic< bool > pump_send_armed{false};
     uint32_t pump_recv_timer_id = 0;
 
+    /// spaces out what pump sends
+    udap::util::Pacer pacer;
+
     udap::Addr addr;
     iwp_async_intro intro;
     iwp_async_introack introack;
@@ -773,14 +208,44 @@ namespace iwp
     sendto(udap_link_session *s, udap_buffer_t msg)
     {
       session *self = static_cast< session * >(s->impl);
-      auto id       = self->frame.txids++;
-      udap::ShortHash digest;
-      self->crypto->shorthash(digest, msg);
-      transit_message *m = new transit_message(msg, digest, id);
-      self->add_outbound_message(id, m);
+      // more fragments than an ACK can cover
+      if(msg.sz > MAX_LINK_MSG_SIZE)
+      {
+        udap::Warn("link message too big, ", msg.sz, " > ",
+                   MAX_LINK_MSG_SIZE);
+        return false;
+      }
+      self->queue_message(msg);
       return true;
     }
 
+    /// send msg now, or bundle it with others if it is small
+    void
+    queue_message(udap_buffer_t msg);
+
+    void
+    send_message(udap_buffer_t msg, uint8_t flags)
+    {
+      auto id = frame.txids++;
+      udap::ShortHash digest;
+      crypto->shorthash(digest, msg);
+      transit_message *m =
+          new transit_message(msg, digest, id, frame.fragsize(), flags);
+      add_outbound_message(id, m);
+    }
+
+    /// small link messages waiting to go as one, each after its size
+    std::vector< byte_t > bundle;
+    size_t bundled = 0;
+    std::atomic< bool > bundle_armed{false};
+
+    /// send what is in the bundle
+    void
+    flush_bundle();
+
+    static void
+    handle_bundle_timer(void *user, uint64_t orig, uint64_t left);
+
     void
     add_outbound_message(uint64_t id, transit_message *msg)
     {
@@ -883,20 +348,86 @@ namespace iwp
                                       &handle_inbound_codel_delayed});
         }
       */
+    /// bytes per second to space our frames out to, twice the window per
+    /// round trip while it is growing fast and a quarter over after, like
+    /// linux does for tcp
+    uint64_t
+    pacing_rate() const
+    {
+      uint64_t rate = 0;
+      if(frame.windowed() && frame.rtt.sampled && frame.rtt.srtt)
+      {
+        rate = frame.cc.Window() * 1000 / frame.rtt.srtt;
+        rate = frame.cc.InSlowStart() ? rate * 2 : rate * 5 / 4;
+      }
+      uint64_t cap = frame.router ? frame.router->peerRate : 0;
+      if(cap && (rate == 0 || cap < rate))
+        rate = cap;
+      return rate;
+    }
+
     void
     pump()
     {
       // TODO: in codel the timestamp may cause excssive drop when all the
       // packets have a similar timestamp
       now = udap_time_now_ms();
+      pacer.SetRate(pacing_rate());
       udap_buffer_t buf;
       while(frame.next_frame(&buf))
       {
+        uint64_t wait = pacer.Delay(now);
+        uint64_t left = frame.router ? frame.router->egress.Delay(now) : 0;
+        if(left > wait)
+          wait = left;
+        if(wait)
+        {
+          PaceSend(wait);
+          break;
+        }
         encrypt_frame_async_send(buf.base, buf.sz);
+        pacer.Spend(buf.sz);
+        if(frame.router)
+          frame.router->egress.Spend(buf.sz);
         frame.pop_next_frame();
       }
+      // acks no data frame took, they are small enough to skip the pacer
+      if(frame.acks_due(now))
+        send_acks();
+      else if(frame.acks.size())
+        DelayAcks();
     }
 
+    /// send held acks in ACKS frames of their own
+    void
+    send_acks()
+    {
+      byte_t tmp[6 + frame_state::MaxAckEntries * frame_state::AckEntry];
+      while(frame.acks.size())
+      {
+        encrypt_frame_async_send(
+            tmp, frame.write_acks(tmp, frame_state::MaxAckEntries));
+        if(frame.stats)
+          ++frame.stats->ackFrames;
+      }
+    }
+
+    std::atomic< bool > ack_armed{false};
+
+    /// pump again when held acks are due
+    void
+    DelayAcks();
+
+    static void
+    handle_ack_timer(void *user, uint64_t orig, uint64_t left);
+
+    /// pump again in wait ms, frames stay in the send queue until then
+    void
+    PaceSend(uint64_t wait);
+
+    static void
+    handle_pace_timer(void *user, uint64_t orig, uint64_t left);
+
     // this is called from net thread
     void
     recv(const void *buf, size_t sz)
@@ -948,7 +479,7 @@ namespace iwp
         // hash message buffer
         crypto->shorthash(digest, buf);
         auto id  = frame.txids++;
-        auto msg = new transit_message(buf, digest, id);
+        auto msg = new transit_message(buf, digest, id, frame.fragsize());
         // put into outbound send queue
         add_outbound_message(id, msg);
         // enter state
@@ -961,9 +492,14 @@ namespace iwp
     static void
     send_keepalive(void *user);
 
+    /// queue a keepalive frame without pumping crypto
+    void
+    queue_keepalive();
+
     // return true if we should be removed
+    // pushes a crypto job onto jobs if we have frames to encrypt
     bool
-    Tick(uint64_t now);
+    Tick(uint64_t now, std::vector< udap_thread_job > &jobs);
 
     static void
     codel_timer_handler(void *user, uint64_t orig, uint64_t left);
@@ -997,7 +533,7 @@ namespace iwp
       start.sessionkey    = sessionkey;
       start.user          = this;
       start.hook          = &handle_verify_session_start;
-      working             = true;
+      begin_work();
       iwp_call_async_verify_session_start(iwp, &start);
     }
 
@@ -1037,17 +573,22 @@ namespace iwp
       // as session invalidated
       impl->frame.txflags |= eSessionInvalidated;
       // TODO: add timer for session invalidation
+      impl->acquire();
       udap_logic_queue_job(impl->logic, {impl, &send_keepalive});
     }
 
     static void
     handle_verify_introack(iwp_async_introack *introack);
 
+    /// frame_state hands up inbound link messages here
+    static bool
+    handle_recv_message(void *user, uint64_t id, udap_buffer_t msg);
+
     static void
     handle_generated_session_start(iwp_async_session_start *start)
     {
       session *link = static_cast< session * >(start->user);
-      link->working = false;
+      work_guard guard{link};
       if(udap_ev_udp_sendto(link->udp, link->addr, start->buf, start->sz)
          == -1)
         udap::Error("sendto failed");
@@ -1077,18 +618,25 @@ namespace iwp
       start.sessionkey    = sessionkey;
       start.user          = this;
       start.hook          = &handle_generated_session_start;
-      working             = true;
+      begin_work();
       iwp_call_async_gen_session_start(iwp, &start);
     }
 
+    static void
+    handle_frame_release(iwp_async_frame *frame)
+    {
+      static_cast< session * >(frame->user)->release();
+    }
+
     static void
     handle_frame_decrypt(iwp_async_frame *frame)
     {
       session *self = static_cast< session * >(frame->user);
       udap::Debug("rx ", frame->sz);
+      self->FrameSojourn(frame->created);
       if(frame->success)
       {
-        if(self->frame.process(frame->buf + 64, frame->sz - 64))
+        if(self->frame.process(frame->buf + 64, frame->sz - 64, frame->pkt))
         {
           self->frame.alive();
           self->pump();
@@ -1101,33 +649,23 @@ namespace iwp
     }
 
     void
-    decrypt_frame(const void *buf, size_t sz)
+    decrypt_frame(const void *buf, size_t sz);
+
+    /// true once the peer only sends us encrypted frames
+    bool
+    frames_expected() const
     {
-      if(sz > 64)
-      {
-        auto f = alloc_frame(buf, sz);
-        /*
-        if(iwp_decrypt_frame(f))
-        {
-          decryptedFrames.Put(f);
-          if(state == eEstablished)
-          {
-            if(pump_recv_timer_id == 0)
-              PumpCodelInbound();
-          }
-          else
-            ManualPumpInboundCodel();
-        }
-        else
-          udap::Warn("decrypt frame fail");
-       */
-        f->hook = &handle_frame_decrypt;
-        iwp_call_async_frame_decrypt(iwp, f);
-      }
-      else
-        udap::Warn("short packet of ", sz, " bytes");
+      return state == eSessionStartSent || state == eLIMSent
+          || state == eEstablished;
     }
 
+    /// an inbound frame ready to be decrypted in place, nullptr if it is
+    /// invalid
+    /// buf is copied unless it is in pkt
+    iwp_async_frame *
+    recv_frame(const void *buf, size_t sz, udap_pkt *pkt,
+               uint64_t recv_ns = 0);
+
     static void
     handle_crypto_outbound(void *u);
 
@@ -1138,19 +676,35 @@ namespace iwp
       udap::Debug("tx ", frame->sz);
       if(udap_ev_udp_sendto(self->udp, self->addr, frame->buf, frame->sz)
          == -1)
-        udap::Warn("sendto failed");
+      {
+        // the net thread is behind, let retransmission cover it
+        if(errno == EAGAIN)
+          self->DroppedSend();
+        else
+          udap::Warn("sendto failed");
+      }
     }
 
+    void
+    DroppedSend();
+
+    /// a received frame created at created was handled
+    void
+    FrameSojourn(udap_time_t created);
+
+    /// a frame of sz bytes at buf in pkt, which it takes a reference to
     iwp_async_frame *
-    alloc_frame(const void *buf, size_t sz)
+    alloc_frame(udap_pkt *pkt, byte_t *buf, size_t sz)
     {
-      // TODO don't hard code 1500
-      if(sz > 1500)
+      if(sz > IWP_MAX_FRAME_SIZE)
         return nullptr;
 
       iwp_async_frame *frame = new iwp_async_frame;
-      if(buf)
-        memcpy(frame->buf, buf, sz);
+      udap_pkt_ref(pkt);
+      frame->buf        = buf;
+      frame->pkt        = pkt;
+      frame->release    = nullptr;
+      frame->created    = 0;
       frame->iwp        = iwp;
       frame->sz         = sz;
       frame->user       = this;
@@ -1161,10 +715,29 @@ namespace iwp
     void
     encrypt_frame_async_send(const void *buf, size_t sz)
     {
-      // 64 bytes frame overhead for nonce and hmac
-      iwp_async_frame *frame = alloc_frame(nullptr, sz + 64);
+      // padding stays within the path mtu
+      size_t room = this->frame.pmtu.mtu > sz + 64
+          ? this->frame.pmtu.mtu - sz - 64
+          : 0;
+      // 64 bytes frame overhead for nonce and hmac, the packet has room for
+      // whatever goes after it
+      udap_pkt *pkt          = udap::NewPacket(sz + 64 + room);
+      iwp_async_frame *frame = alloc_frame(pkt, pkt->data(), sz + 64);
+      udap_pkt_unref(pkt);
+      if(frame == nullptr)
+      {
+        udap::Warn("frame of ", sz, " bytes too big to send");
+        return;
+      }
       memcpy(frame->buf + 64, buf, sz);
-      auto padding = rand() % MAX_PAD;
+      // held acks ride along on data frames with room for them
+      size_t acks = this->frame.piggyback_acks(frame->buf + 64, sz, room);
+      sz += acks;
+      frame->sz += acks;
+      room -= acks;
+      size_t padding = rand() % MAX_PAD;
+      if(padding > room)
+        padding = room;
       if(padding)
         crypto->randbytes(frame->buf + 64 + sz, padding);
       frame->sz += padding;
@@ -1181,7 +754,7 @@ namespace iwp
         auto &front = outq.front();
         if(iwp_encrypt_frame(front))
           handle_frame_encrypt(front);
-        delete front;
+        iwp_free_frame(front);
         outq.pop();
       }
     }
@@ -1215,7 +788,7 @@ namespace iwp
       // call
       introack.user = this;
       introack.hook = &handle_introack_generated;
-      working       = true;
+      begin_work();
       iwp_call_async_gen_introack(iwp, &introack);
     }
 
@@ -1226,7 +799,7 @@ namespace iwp
       {
         // too big?
         udap::Error("intro too big");
-        delete this;
+        retire();
         return;
       }
       // copy so we own it
@@ -1245,7 +818,7 @@ namespace iwp
 
       // call
       EnterState(eIntroRecv);
-      working = true;
+      begin_work();
       iwp_call_async_verify_intro(iwp, &intro);
     }
 
@@ -1259,7 +832,7 @@ namespace iwp
     handle_generated_intro(iwp_async_intro *i)
     {
       session *link = static_cast< session * >(i->user);
-      link->working = false;
+      work_guard guard{link};
       if(i->buf)
       {
         udap::Debug("send intro");
@@ -1301,7 +874,7 @@ namespace iwp
       // async generate intro packet
       intro.user = this;
       intro.hook = &handle_generated_intro;
-      working    = true;
+      begin_work();
       iwp_call_async_gen_intro(iwp, &intro);
       // start introduce timer
       establish_job_id = udap_logic_call_later(
@@ -1343,18 +916,52 @@ namespace iwp
     char keyfile[255];
     uint32_t timeout_job_id;
 
-    typedef std::unordered_map< udap::Addr, udap_link_session *,
-                                udap::addrhash >
+    typedef udap::util::ShardedMap< udap::Addr, udap_link_session *,
+                                    udap::addrhash >
         LinkMap_t;
 
+    /// sessions by address, looked up for every datagram and send
     LinkMap_t m_sessions;
-    mtx_t m_sessions_Mutex;
 
-    typedef std::unordered_map< udap::PubKey, udap::Addr, udap::PubKeyHash >
+    typedef udap::util::ShardedMap< udap::PubKey, udap::Addr,
+                                    udap::PubKeyHash >
         SessionMap_t;
 
+    /// address of the session to each router we are connected to
     SessionMap_t m_Connected;
-    mtx_t m_Connected_Mutex;
+
+    /// removed sessions, freed on a later tick once nothing holds them
+    udap::util::RetireList< session > m_Retired;
+
+    /// sessions being ticked and the crypto jobs they hand us
+    std::vector< LinkMap_t::Entry > m_TickSessions;
+    std::vector< udap_thread_job > m_TickJobs;
+
+    /// inbound frames dropped because the workers were full
+    std::atomic< uint64_t > m_RecvDropped;
+    /// m_RecvDropped when we last logged it
+    uint64_t m_RecvDroppedLogged = 0;
+
+    void
+    DroppedFrame(size_t n = 1)
+    {
+      m_RecvDropped += n;
+    }
+
+    /// outbound frames dropped because the send queue was full
+    std::atomic< uint64_t > m_SendDropped;
+    uint64_t m_SendDroppedLogged = 0;
+
+    /// bytes copied off the socket for inbound frames, m_XmitStats has the
+    /// ones copied to put messages together
+    std::atomic< uint64_t > m_RecvCopied;
+    /// ms from the kernel receiving a frame to us handling it decrypted
+    udap::util::Histogram m_RecvSojourn;
+    /// retransmits and round trips of every session
+    xmit_stats m_XmitStats;
+    /// biggest datagram the interface we are bound to takes, sessions
+    /// probe no further
+    size_t maxMTU = mtu_search::MaxMTU;
 
     udap::SecretKey seckey;
 
@@ -1366,6 +973,9 @@ namespace iwp
       logic  = l;
       worker = w;
       iwp    = udap_async_iwp_new(crypto, logic, w);
+      m_RecvDropped  = 0;
+      m_SendDropped  = 0;
+      m_RecvCopied   = 0;
     }
 
     ~server()
@@ -1377,35 +987,106 @@ namespace iwp
     void
     MapAddr(const udap::Addr &src, const udap::PubKey &identity)
     {
-      lock_t lock(m_Connected_Mutex);
-      m_Connected[identity] = src;
+      m_Connected.Put(identity, src);
     }
 
     static bool
     HasSessionToRouter(udap_link *l, const byte_t *pubkey)
     {
       server *serv = static_cast< server * >(l->impl);
-      udap::PubKey pk(pubkey);
-      lock_t lock(serv->m_Connected_Mutex);
-      return serv->m_Connected.find(pk) != serv->m_Connected.end();
+      return serv->m_Connected.Has(udap::PubKey(pubkey));
     }
 
     void
     TickSessions()
     {
       auto now = udap_time_now_ms();
+      // tick without holding any lock so receives and sends carry on
+      m_sessions.Snapshot(m_TickSessions);
+      for(auto &item : m_TickSessions)
       {
-        lock_t lock(m_sessions_Mutex);
-        std::set< udap::Addr > remove;
-        for(auto &itr : m_sessions)
-        {
-          session *s = static_cast< session * >(itr.second->impl);
-          if(s && s->Tick(now))
-            remove.insert(itr.first);
-        }
+        session *s = static_cast< session * >(item.second->impl);
+        // something else may have replaced it since the snapshot
+        if(s && s->Tick(now, m_TickJobs)
+           && m_sessions.RemoveIfValue(item.first, item.second))
+          retire_session(item.first, item.second);
+      }
+      m_TickSessions.clear();
+      FreeRetired();
+      // hand every session's crypto to the workers in one go
+      // anything rejected stays queued in the session until next tick
+      size_t queued = udap_threadpool_queue_jobs(worker, m_TickJobs.begin(),
+                                                 m_TickJobs.end());
+      for(size_t idx = queued; idx < m_TickJobs.size(); ++idx)
+        static_cast< session * >(m_TickJobs[idx].user)->release();
+      m_TickJobs.clear();
+
+      uint64_t dropped = m_RecvDropped;
+      if(dropped != m_RecvDroppedLogged)
+      {
+        udap::Warn("dropped ", dropped - m_RecvDroppedLogged,
+                   " inbound frames, worker queue full");
+        m_RecvDroppedLogged = dropped;
+      }
+      dropped = m_SendDropped;
+      if(dropped != m_SendDroppedLogged)
+      {
+        udap::Warn("dropped ", dropped - m_SendDroppedLogged,
+                   " outbound frames, send queue full");
+        m_SendDroppedLogged = dropped;
+      }
+    }
 
-        for(const auto &addr : remove)
-          RemoveSessionByAddr(addr);
+    void
+    DumpStats()
+    {
+      uint64_t copied   = m_RecvCopied + m_XmitStats.rxCopied,
+               messages = m_XmitStats.rxMessages;
+      udap::Info("iwp link ", addr, " rx messages=", messages,
+                 " bytes copied=", copied, " per message=",
+                 messages ? copied / messages : 0,
+                 " frame sojourn ms p50=", m_RecvSojourn.Percentile(50),
+                 " p99=", m_RecvSojourn.Percentile(99),
+                 " max=", m_RecvSojourn.Max());
+      uint64_t retransmits = m_XmitStats.retransmits,
+               spurious    = m_XmitStats.spurious,
+               duplicates  = m_XmitStats.rxDuplicates;
+      udap::Info("iwp link ", addr, " retransmits=", retransmits,
+                 " spurious=", spurious, " rx duplicates=", duplicates,
+                 " rtt ms p50=", m_XmitStats.rtt.Percentile(50),
+                 " p99=", m_XmitStats.rtt.Percentile(99),
+                 " max=", m_XmitStats.rtt.Max());
+      uint64_t inflight = m_XmitStats.inflight,
+               cuts     = m_XmitStats.windowCuts,
+               timeouts = m_XmitStats.timeouts,
+               paced    = m_XmitStats.paced;
+      udap::Info("iwp link ", addr, " bytes in flight=", inflight,
+                 " cwnd bytes p50=", m_XmitStats.cwnd.Percentile(50),
+                 " p99=", m_XmitStats.cwnd.Percentile(99),
+                 " max=", m_XmitStats.cwnd.Max(), " window cuts=", cuts,
+                 " timeouts=", timeouts, " paced=", paced);
+      uint64_t probes = m_XmitStats.mtuProbes,
+               holes  = m_XmitStats.mtuBlackholes;
+      udap::Info("iwp link ", addr, " mtu probes=", probes,
+                 " black holes=", holes);
+      uint64_t bundles = m_XmitStats.bundles,
+               bundled = m_XmitStats.bundledMessages;
+      udap::Info("iwp link ", addr, " bundles=", bundles,
+                 " messages per bundle=", bundles ? bundled / bundles : 0);
+      uint64_t ackFrames  = m_XmitStats.ackFrames,
+               ackEntries = m_XmitStats.ackEntries,
+               piggyback  = m_XmitStats.ackPiggybacked;
+      udap::Info("iwp link ", addr, " ack frames=", ackFrames,
+                 " acks=", ackEntries, " piggybacked=", piggyback);
+      // removed sessions stay valid for a while, read without locks held
+      std::vector< LinkMap_t::Entry > sessions;
+      m_sessions.Snapshot(sessions);
+      for(const auto &item : sessions)
+      {
+        session *s = static_cast< session * >(item.second->impl);
+        if(s)
+          udap::Info("iwp session ", item.first,
+                     " path mtu=", s->frame.pathMTU.load());
       }
     }
 
@@ -1413,40 +1094,28 @@ namespace iwp
     SendToSession(udap_link *l, const byte_t *pubkey, udap_buffer_t buf)
     {
       server *serv = static_cast< server * >(l->impl);
-      {
-        lock_t lock(serv->m_Connected_Mutex);
-        auto itr = serv->m_Connected.find(pubkey);
-        if(itr != serv->m_Connected.end())
-        {
-          lock_t innerlock(serv->m_sessions_Mutex);
-          auto inner_itr = serv->m_sessions.find(itr->second);
-          if(inner_itr != serv->m_sessions.end())
-          {
-            udap_link_session *link = inner_itr->second;
-            return link->sendto(link, buf);
-          }
-        }
-      }
-      return false;
+      udap::Addr addr;
+      udap_link_session *link = nullptr;
+      // two lookups, each only locks one shard for the find
+      if(!serv->m_Connected.Get(udap::PubKey(pubkey), addr))
+        return false;
+      if(!serv->m_sessions.Get(addr, link))
+        return false;
+      return link->sendto(link, buf);
     }
 
     void
     UnmapAddr(const udap::Addr &src)
     {
-      lock_t lock(m_Connected_Mutex);
-      // std::unordered_map< udap::pubkey, udap::Addr, udap::pubkeyhash >
-      auto itr = std::find_if(
-          m_Connected.begin(), m_Connected.end(),
-          [src](const std::pair< udap::PubKey, udap::Addr > &item) -> bool {
-            return src == item.second;
-          });
-      if(itr == std::end(m_Connected))
-        return;
-
+      std::vector< SessionMap_t::Entry > removed;
+      m_Connected.RemoveIf(
+          [src](const udap::PubKey &, const udap::Addr &addr) -> bool {
+            return src == addr;
+          },
+          removed);
       // tell router we are done with this session
-      router->SessionClosed(itr->first);
-
-      m_Connected.erase(itr);
+      for(const auto &item : removed)
+        router->SessionClosed(item.first);
     }
 
     session *
@@ -1460,19 +1129,30 @@ namespace iwp
     bool
     has_session_to(const udap::Addr &dst)
     {
-      lock_t lock(m_sessions_Mutex);
-      return m_sessions.find(dst) != m_sessions.end();
+      return m_sessions.Has(dst);
     }
 
+    /// only on the logic thread, which is where sessions are freed
     session *
     find_session(const udap::Addr &addr)
     {
-      lock_t lock(m_sessions_Mutex);
-      auto itr = m_sessions.find(addr);
-      if(itr == m_sessions.end())
+      udap_link_session *s = nullptr;
+      if(!m_sessions.Get(addr, s))
         return nullptr;
-      else
-        return static_cast< session * >(itr->second->impl);
+      return static_cast< session * >(s->impl);
+    }
+
+    /// find_session for other threads, takes a ref on the session while it
+    /// is still in the map, the caller releases it when done
+    session *
+    acquire_session(const udap::Addr &addr)
+    {
+      session *impl = nullptr;
+      m_sessions.Visit(addr, [&](udap_link_session *s) {
+        impl = static_cast< session * >(s->impl);
+        impl->acquire();
+      });
+      return impl;
     }
 
     void
@@ -1486,44 +1166,74 @@ namespace iwp
       s->get_remote_router  = &session::get_remote_router;
       s->established        = &session::set_established;
       s->get_parent         = &session::get_parent;
+      if(!m_sessions.Insert(src, s))
       {
-        lock_t lock(m_sessions_Mutex);
-        m_sessions.emplace(src, s);
-        impl->parent       = m_sessions[src];
-        impl->frame.router = router;
-        impl->frame.parent = impl->parent;
-        impl->our_router   = &router->rc;
+        // already have one, attach to it like before
+        delete s;
+        m_sessions.Get(src, s);
       }
-    }
-
+      impl->parent       = s;
+      impl->frame.router = router;
+      impl->frame.parent = impl->parent;
+      impl->frame.stats  = &m_XmitStats;
+      impl->frame.pmtu.limit(maxMTU);
+      impl->frame.crypto = crypto;
+      impl->frame.recv   = &session::handle_recv_message;
+      impl->frame.user   = impl;
+      impl->our_router   = &router->rc;
+    }
+
+    /// the workers and net threads must be joined first, nothing can be
+    /// holding a session after that
     void
     clear_sessions()
     {
-      lock_t lock(m_sessions_Mutex);
-      auto itr = m_sessions.begin();
-      while(itr != m_sessions.end())
-      {
-        session *s = static_cast< session * >(itr->second->impl);
-        delete s;
-        delete itr->second;
-        itr = m_sessions.erase(itr);
-      }
+      std::vector< LinkMap_t::Entry > sessions;
+      m_sessions.Drain(sessions);
+      for(auto &item : sessions)
+        free_session(static_cast< session * >(item.second->impl));
+      m_Retired.Clear(&free_session);
     }
 
     void
     RemoveSessionByAddr(const udap::Addr &addr)
     {
-      auto itr = m_sessions.find(addr);
-      if(itr != m_sessions.end())
-      {
-        udap::Debug("removing session ", addr);
-        UnmapAddr(addr);
-        session *s = static_cast< session * >(itr->second->impl);
-        s->done();
-        delete itr->second;
-        m_sessions.erase(itr);
-        delete s;
-      }
+      udap_link_session *s = nullptr;
+      if(m_sessions.Remove(addr, &s))
+        retire_session(addr, s);
+    }
+
+    /// s was just taken out of m_sessions
+    void
+    retire_session(const udap::Addr &addr, udap_link_session *s)
+    {
+      udap::Debug("removing session ", addr);
+      UnmapAddr(addr);
+      session *impl = static_cast< session * >(s->impl);
+      impl->done();
+      retire_session(impl);
+    }
+
+    /// free s once nothing holds it, s is not in m_sessions
+    void
+    retire_session(session *s)
+    {
+      m_Retired.Retire(s);
+    }
+
+    /// free removed sessions nothing holds anymore, on the logic thread
+    void
+    FreeRetired()
+    {
+      m_Retired.Collect(&free_session);
+    }
+
+    static void
+    free_session(session *s)
+    {
+      udap_link_session *parent = s->parent;
+      delete s;
+      delete parent;
     }
 
     uint8_t *
@@ -1583,13 +1293,84 @@ namespace iwp
     {
       server *link = static_cast< server * >(udp->user);
 
-      session *s = link->find_session(*saddr);
+      // shed load before we look up sessions or copy the frame
+      if(udap_threadpool_full(link->worker))
+      {
+        link->DroppedFrame();
+        return;
+      }
+
+      session *s = link->acquire_session(*saddr);
       if(s == nullptr)
       {
         // new inbound session
         s = link->create_session(*saddr);
+        s->acquire();
       }
       s->recv(buf, sz);
+      s->release();
+    }
+
+    // this is called in net threadpool
+    static void
+    handle_recvfrom_many(struct udap_udp_io *udp,
+                         const struct udap_udp_datagram *datagrams, size_t n)
+    {
+      server *link = static_cast< server * >(udp->user);
+
+      if(udap_threadpool_full(link->worker))
+      {
+        link->DroppedFrame(n);
+        return;
+      }
+
+      // each net thread has its own socket and batch
+      static thread_local std::vector< iwp_async_frame * > frames;
+      // the kernel sends a peer's datagrams to the same socket every time
+      // so a batch is mostly runs from a few peers, only look up the session
+      // again when the peer changes, holding on to it until then
+      session *last = nullptr;
+      for(size_t idx = 0; idx < n; ++idx)
+      {
+        const udap_udp_datagram &dgram = datagrams[idx];
+        session *s                     = nullptr;
+        if(last && last->addr == udap::Addr(*dgram.from))
+          s = last;
+        else if((s = link->acquire_session(*dgram.from)))
+        {
+          if(last)
+            last->release();
+          last = s;
+        }
+        else
+        {
+          s = link->create_session(*dgram.from);
+          s->acquire();
+        }
+        if(s->frames_expected())
+        {
+          auto f =
+              s->recv_frame(dgram.buf, dgram.sz, dgram.pkt, dgram.recv_ns);
+          if(f)
+            frames.push_back(f);
+        }
+        else
+          s->recv(dgram.buf, dgram.sz);
+        if(s != last)
+          s->release();
+      }
+      if(last)
+        last->release();
+      // hand the whole batch to the workers in one go
+      size_t queued = iwp_call_async_frame_decrypt_many(
+          link->iwp, frames.data(), frames.size());
+      if(queued < frames.size())
+      {
+        for(size_t idx = queued; idx < frames.size(); ++idx)
+          iwp_free_frame(frames[idx]);
+        link->DroppedFrame(frames.size() - queued);
+      }
+      frames.clear();
     }
 
     void
@@ -1611,63 +1392,34 @@ namespace iwp
   };
 
   bool
-  frame_state::inbound_frame_complete(uint64_t id)
+  session::handle_recv_message(void *user, uint64_t id, udap_buffer_t msg)
   {
-    bool success = false;
-    std::vector< byte_t > msg;
-    auto rxmsg = rx[id];
-    if(rxmsg->reassemble(msg))
+    session *self = static_cast< session * >(user);
+    if(!self->frame.router->HandleRecvLinkMessage(self->parent, msg))
+      return false;
+    if(id == 0)
     {
-      udap::ShortHash digest;
-      auto buf = udap::Buffer< decltype(msg) >(msg);
-      router->crypto.shorthash(digest, buf);
-      if(memcmp(digest, rxmsg->msginfo.hash(), 32))
+      if(!self->CheckRCValid())
       {
-        udap::Warn("message hash missmatch ",
-                    udap::AlignedBuffer< 32 >(digest),
-                    " != ", udap::AlignedBuffer< 32 >(rxmsg->msginfo.hash()));
+        udap::PubKey k = self->remote_router.pubkey;
+        udap::Warn("spoofed LIM from ", k);
+        self->parent->close(self->parent);
         return false;
       }
-      session *impl = static_cast< session * >(parent->impl);
-      success       = router->HandleRecvLinkMessage(parent, buf);
-      if(success)
+      if(!self->IsEstablished())
       {
-        if(id == 0)
-        {
-          if(impl->CheckRCValid())
-          {
-            if(!impl->IsEstablished())
-            {
-              impl->send_LIM();
-              impl->session_established();
-            }
-          }
-          else
-          {
-            udap::PubKey k = impl->remote_router.pubkey;
-            udap::Warn("spoofed LIM from ", k);
-            impl->parent->close(impl->parent);
-            success = false;
-          }
-        }
+        self->send_LIM();
+        self->session_established();
       }
-      if(!success)
-        udap::Warn("failed to handle inbound message ", id);
-    }
-    else
-    {
-      udap::Warn("failed to reassemble message ", id);
     }
-    delete rxmsg;
-    rx.erase(id);
-    return success;
-  }  // namespace iwp
+    return true;
+  }
 
   void
   session::handle_verify_intro(iwp_async_intro *intro)
   {
     session *self = static_cast< session * >(intro->user);
-    self->working = false;
+    work_guard guard{self};
     if(!intro->buf)
     {
       udap::Error("intro verify failed from ", self->addr, " via ",
@@ -1690,6 +1442,7 @@ namespace iwp
   void
   session::done()
   {
+    stopped    = true;
     auto logic = serv->logic;
     if(establish_job_id)
     {
@@ -1700,10 +1453,69 @@ namespace iwp
     {
       udap_logic_remove_call(logic, pump_recv_timer_id);
     }
-    if(pump_send_timer_id)
+  }
+
+  void
+  session::queue_message(udap_buffer_t msg)
+  {
+    uint64_t window = frame.router ? frame.router->bundleWindow : 0;
+    // a bundle goes in one frame, only messages that leave room for
+    // another are worth holding back
+    size_t room = frame.fragsize();
+    bool small  = window && (frame.rxflags & eProtoUpgrade)
+        && msg.sz + 2 <= room / 2;
+    if(bundle.size() && (!small || bundle.size() + msg.sz + 2 > room))
+      flush_bundle();
+    if(!small)
+    {
+      send_message(msg, eXmitValid);
+      return;
+    }
+    // TODO: assumes big endian
+    uint16_t sz = msg.sz;
+    bundle.insert(bundle.end(), (const byte_t *)&sz, (const byte_t *)&sz + 2);
+    bundle.insert(bundle.end(), msg.base, msg.base + msg.sz);
+    ++bundled;
+    arm_timer(bundle_armed, window, &handle_bundle_timer);
+  }
+
+  void
+  session::flush_bundle()
+  {
+    if(bundle.empty())
+      return;
+    udap_buffer_t buf;
+    if(bundled == 1)
+    {
+      // nothing joined it, send it like any other
+      buf.base = bundle.data() + 2;
+      buf.sz   = bundle.size() - 2;
+      buf.cur  = buf.base;
+      send_message(buf, eXmitValid);
+    }
+    else
     {
-      udap_logic_remove_call(logic, pump_send_timer_id);
+      buf.base = bundle.data();
+      buf.sz   = bundle.size();
+      buf.cur  = buf.base;
+      send_message(buf, eXmitValid | eXmitBundle);
+      if(frame.stats)
+      {
+        ++frame.stats->bundles;
+        frame.stats->bundledMessages += bundled;
+      }
     }
+    bundle.clear();
+    bundled = 0;
+  }
+
+  void
+  session::handle_bundle_timer(void *user, uint64_t, uint64_t left)
+  {
+    session *self = static_cast< session * >(user);
+    if(self->timer_fired(self->bundle_armed, left))
+      self->flush_bundle();
+    self->release();
   }
 
   void
@@ -1728,7 +1540,7 @@ namespace iwp
     introack.user          = this;
     introack.hook          = &handle_verify_introack;
     // async verify
-    working = true;
+    begin_work();
     iwp_call_async_verify_introack(iwp, &introack);
   }
 
@@ -1736,70 +1548,28 @@ namespace iwp
   session::send_keepalive(void *user)
   {
     session *self = static_cast< session * >(user);
-    // if both sides agree on invalidation
-    if(self->is_invalidated())
+    // if both sides agree on invalidation don't send keepalive
+    if(!self->is_invalidated())
     {
-      // don't send keepalive
-      return;
+      self->queue_keepalive();
+      self->PumpCryptoOutbound();
     }
+    self->release();
+  }
+
+  void
+  session::queue_keepalive()
+  {
     // all zeros means keepalive
     byte_t tmp[8] = {0};
     // set flags for tx
     frame_header hdr(tmp);
-    hdr.flags() = self->frame.txflags;
+    hdr.flags() = frame.txflags;
     // send frame after encrypting
-    auto buf  = udap::StackBuffer< decltype(tmp) >(tmp);
-    self->now = udap_time_now_ms();
-    self->encrypt_frame_async_send(buf.base, buf.sz);
-    self->pump();
-    self->PumpCryptoOutbound();
-  }
-
-  bool
-  frame_state::got_acks(frame_header hdr, size_t sz)
-  {
-    if(hdr.size() > sz)
-    {
-      udap::Error("invalid ACKS frame size ", hdr.size(), " > ", sz);
-      return false;
-    }
-    sz = hdr.size();
-    if(sz < 12)
-    {
-      udap::Error("invalid ACKS frame size ", sz, " < 12");
-      return false;
-    }
-
-    auto ptr = hdr.data();
-    uint64_t msgid;
-    uint32_t bitmask;
-    memcpy(&msgid, ptr, 8);
-    memcpy(&bitmask, ptr + 8, 4);
-
-    auto itr = tx.find(msgid);
-    if(itr == tx.end())
-    {
-      udap::Debug("ACK for missing TX frame msgid=", msgid);
-      return true;
-    }
-
-    transit_message *msg = itr->second;
-
-    msg->ack(bitmask);
-
-    if(msg->completed())
-    {
-      udap::Debug("message transmitted msgid=", msgid);
-      tx.erase(msgid);
-      delete msg;
-    }
-    else
-    {
-      udap::Debug("message ", msgid, " retransmit fragments");
-      msg->retransmit_frags(sendqueue, txflags);
-    }
-
-    return true;
+    auto buf = udap::StackBuffer< decltype(tmp) >(tmp);
+    now      = udap_time_now_ms();
+    encrypt_frame_async_send(buf.base, buf.sz);
+    pump();
   }
 
   udap_link *
@@ -1813,7 +1583,7 @@ namespace iwp
   session::handle_verify_introack(iwp_async_introack *introack)
   {
     session *link = static_cast< session * >(introack->user);
-    link->working = false;
+    work_guard guard{link};
     if(introack->buf == nullptr)
     {
       // invalid signature
@@ -1826,7 +1596,7 @@ namespace iwp
   }
 
   bool
-  session::Tick(udap_time_t now)
+  session::Tick(udap_time_t now, std::vector< udap_thread_job > &jobs)
   {
     if(timedout(now, SESSION_TIMEOUT))
     {
@@ -1844,25 +1614,166 @@ namespace iwp
       udap::Debug(addr, " invaldiated session with ", frames, " frames left");
       return !working;
     }
+    bool crypto = false;
     // send keepalive if we are established or a session is made
     if(state == eEstablished || state == eLIMSent)
-      send_keepalive(this);
+    {
+      queue_keepalive();
+      crypto = true;
+    }
 
     // pump frame state
     if(state == eEstablished)
     {
-      frame.retransmit();
+      frame.probe_mtu(now);
+      frame.retransmit(now);
+      frame.expire_rxdone(now);
       pump();
-      PumpCryptoOutbound();
+      crypto = true;
+    }
+    if(crypto)
+    {
+      acquire();
+      jobs.emplace_back(this, &handle_crypto_outbound);
     }
     // TODO: determine if we are too idle
     return false;
   }
 
+  void
+  session::DroppedSend()
+  {
+    ++serv->m_SendDropped;
+  }
+
+  void
+  session::FrameSojourn(udap_time_t created)
+  {
+    udap_time_t t = udap_time_now_ms();
+    serv->m_RecvSojourn.Record(t > created ? t - created : 0);
+  }
+
+  iwp_async_frame *
+  session::recv_frame(const void *buf, size_t sz, udap_pkt *pkt,
+                      uint64_t recv_ns)
+  {
+    now = udap_time_now_ms();
+    if(sz <= 64)
+    {
+      udap::Warn("short packet of ", sz, " bytes");
+      return nullptr;
+    }
+    if(sz > IWP_MAX_FRAME_SIZE)
+    {
+      udap::Warn("oversized packet of ", sz, " bytes");
+      return nullptr;
+    }
+    iwp_async_frame *f;
+    if(pkt)
+      f = alloc_frame(pkt, (byte_t *)buf, sz);
+    else
+    {
+      // fragments outlive the frame, they need a packet to hold on to
+      pkt = udap::NewPacket(sz);
+      memcpy(pkt->data(), buf, sz);
+      serv->m_RecvCopied += sz;
+      f = alloc_frame(pkt, pkt->data(), sz);
+      udap_pkt_unref(pkt);
+    }
+    f->hook = &handle_frame_decrypt;
+    // the frame holds us until it is freed, decrypted or dropped
+    acquire();
+    f->release = &handle_frame_release;
+    // same clock as udap_time_now_ms
+    f->created = recv_ns ? recv_ns / 1000000 : now;
+    return f;
+  }
+
+  void
+  session::decrypt_frame(const void *buf, size_t sz)
+  {
+    auto f = recv_frame(buf, sz, nullptr);
+    if(f && !iwp_call_async_frame_decrypt(iwp, f))
+    {
+      // workers filled up since we checked
+      iwp_free_frame(f);
+      serv->DroppedFrame();
+    }
+  }
+
+  bool
+  session::arm_timer(std::atomic< bool > &armed, uint64_t wait,
+                     udap_timer_handler_func handler)
+  {
+    if(stopped || armed.exchange(true))
+      return false;
+    acquire();
+    udap_logic_call_later(serv->logic, {wait, this, handler});
+    return true;
+  }
+
+  bool
+  session::timer_fired(std::atomic< bool > &armed, uint64_t left)
+  {
+    armed = false;
+    return !left && !stopped;
+  }
+
+  void
+  session::PaceSend(uint64_t wait)
+  {
+    // unless already waiting for the frame at the head of the queue
+    if(arm_timer(pump_send_armed, wait, &handle_pace_timer) && frame.stats)
+      ++frame.stats->paced;
+  }
+
+  void
+  session::handle_pace_timer(void *user, uint64_t, uint64_t left)
+  {
+    session *self = static_cast< session * >(user);
+    if(self->timer_fired(self->pump_send_armed, left))
+    {
+      self->pump();
+      self->PumpCryptoOutbound();
+    }
+    self->release();
+  }
+
+  void
+  session::DelayAcks()
+  {
+    if(ack_armed)
+      return;
+    uint64_t due  = frame.acksSince + frame_state::AckDelay;
+    uint64_t wait = due > now ? due - now : 1;
+    arm_timer(ack_armed, wait, &handle_ack_timer);
+  }
+
+  void
+  session::handle_ack_timer(void *user, uint64_t, uint64_t left)
+  {
+    session *self = static_cast< session * >(user);
+    if(self->timer_fired(self->ack_armed, left))
+    {
+      self->pump();
+      self->PumpCryptoOutbound();
+    }
+    self->release();
+  }
+
+  void
+  session::retire()
+  {
+    serv->retire_session(this);
+  }
+
   void
   session::PumpCryptoOutbound()
   {
-    udap_threadpool_queue_job(serv->worker, {this, &handle_crypto_outbound});
+    acquire();
+    if(!udap_threadpool_queue_job(serv->worker,
+                                  {this, &handle_crypto_outbound}))
+      release();
   }
 
   void
@@ -1870,13 +1781,14 @@ namespace iwp
   {
     session *self = static_cast< session * >(u);
     self->EncryptOutboundFrames();
+    self->release();
   }
 
   void
   session::handle_verify_session_start(iwp_async_session_start *s)
   {
     session *self = static_cast< session * >(s->user);
-    self->working = false;
+    work_guard guard{self};
     if(!s->buf)
     {
       // verify fail
@@ -1963,6 +1875,11 @@ namespace iwp
         udap::Error("failed to get address of network interface ", ifname);
         return false;
       }
+      // less the ip and udp headers
+      int mtu = udap_getifmtu(ifname);
+      if(mtu > 0)
+        link->maxMTU = mtu - (af == AF_INET6 ? 48 : 28);
+      udap::Debug("path mtu probes stop at ", link->maxMTU);
     }
     else
       l->name = outboundLink_name;
@@ -1982,9 +1899,10 @@ namespace iwp
 
     link->addr         = *addr;
     link->netloop      = netloop;
-    link->udp.recvfrom = &server::handle_recvfrom;
-    link->udp.user     = link;
-    link->udp.tick     = nullptr;
+    link->udp.recvfrom      = &server::handle_recvfrom;
+    link->udp.recvfrom_many = &server::handle_recvfrom_many;
+    link->udp.user          = link;
+    link->udp.tick          = nullptr;
     udap::Debug("bind IWP link to ", link->addr);
     if(udap_ev_add_udp(link->netloop, &link->udp, link->addr) == -1)
     {
@@ -2021,13 +1939,14 @@ namespace iwp
   link_iter_sessions(struct udap_link *l, struct udap_link_session_iter iter)
   {
     server *link = static_cast< server * >(l->impl);
-    auto sz      = link->m_sessions.size();
-    if(sz)
+    // removed sessions stay valid for a while, visit without locks held
+    std::vector< server::LinkMap_t::Entry > sessions;
+    link->m_sessions.Snapshot(sessions);
+    if(sessions.size())
     {
-      udap::Debug("we have ", sz, "sessions");
+      udap::Debug("we have ", sessions.size(), "sessions");
       iter.link = l;
-      // TODO: race condition with cleanup timer
-      for(auto &item : link->m_sessions)
+      for(auto &item : sessions)
         if(item.second->impl)
           if(!iter.visit(&iter, item.second))
             return;
@@ -2068,6 +1987,13 @@ namespace iwp
     delete link;
   }
 
+  void
+  link_dump_stats(struct udap_link *l)
+  {
+    server *link = static_cast< server * >(l->impl);
+    link->DumpStats();
+  }
+
   void
   session::handle_establish_timeout(void *user, uint64_t orig, uint64_t left)
   {
@@ -2097,6 +2023,7 @@ namespace iwp
   session::handle_introack_generated(iwp_async_introack *i)
   {
     session *link = static_cast< session * >(i->user);
+    work_guard guard{link};
     if(i->buf)
     {
       // track it with the server here
@@ -2104,7 +2031,7 @@ namespace iwp
       {
         // duplicate session
         udap::Warn("duplicate session to ", link->addr);
-        delete link;
+        link->retire();
         return;
       }
       link->frame.alive();
@@ -2121,7 +2048,7 @@ namespace iwp
     {
       // failed to generate?
       udap::Warn("failed to generate introack");
-      delete link;
+      link->retire();
     }
   }
 }  // namespace iwp
@@ -2143,5 +2070,6 @@ iwp_link_init(struct udap_link *link, struct udap_iwp_args args)
   link->sendto              = iwp::server::SendToSession;
   link->mark_session_active = iwp::link_mark_session_active;
   link->free_impl           = iwp::link_free;
+  link->dump_stats          = iwp::link_dump_stats;
 }
 }
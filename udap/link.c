@@ -6,7 +6,8 @@ udap_link_initialized(struct udap_link* link)
   return link && link->impl && link->name && link->get_our_address
       && link->configure && link->start_link && link->stop_link
       && link->iter_sessions && link->try_establish && link->sendto
-      && link->has_session_to && link->mark_session_active && link->free_impl;
+      && link->has_session_to && link->mark_session_active && link->free_impl
+      && link->dump_stats;
 }
 
 bool
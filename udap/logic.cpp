@@ -1,11 +1,125 @@
 #include <udap/logic.h>
 #include <udap/mem.h>
+#include <udap/time.h>
+#include "histogram.hpp"
 #include "logger.hpp"
+#include "mpsc.hpp"
+#include "pkt.hpp"
+
+#include <atomic>
+#include <new>
+
+/// a job waiting in the logic queue, lives in a pooled packet that is
+/// the queue node
+struct udap_logic_job
+{
+  udap_thread_job job;
+  /// monotonic timestamp in ns of when it was queued
+  uint64_t queued;
+
+  static udap_logic_job*
+  from(udap::util::MPSCNode* node)
+  {
+    return reinterpret_cast< udap_logic_job* >(
+        static_cast< udap_pkt* >(node)->data());
+  }
+};
+
+namespace
+{
+  /// every thread queueing jobs takes their packets from its own pool and
+  /// the logic thread gives them back when they ran, so posting a job only
+  /// allocates until the pool has warmed up
+  struct logic_job_pool
+  {
+    udap::PacketPool* pool;
+
+    logic_job_pool() : pool(new udap::PacketPool(sizeof(udap_logic_job)))
+    {
+    }
+
+    ~logic_job_pool()
+    {
+      // jobs still queued keep it around
+      pool->Close();
+    }
+  };
+
+  thread_local logic_job_pool jobPool;
+}  // namespace
 
 struct udap_logic
 {
   struct udap_threadpool* thread;
   struct udap_timer_context* timer;
+
+  /// jobs from other threads, drained in batches on the logic thread so
+  /// producers never take the pool mutex
+  udap::util::MPSCQueue jobs;
+  /// true while a drain is queued on thread
+  std::atomic< bool > draining;
+  std::atomic< uint64_t > queued;
+  /// jobs run per drain
+  udap::util::Histogram drained;
+  /// ns jobs spent in the queue
+  udap::util::Histogram wait;
+
+  /// most jobs run per drain before letting timers in
+  static const size_t DrainBatch = 64;
+
+  udap_logic() : thread(nullptr), timer(nullptr), draining(false), queued(0)
+  {
+  }
+
+  ~udap_logic()
+  {
+    // jobs that never got to run
+    while(auto node = jobs.Pop())
+      udap_pkt_unref(static_cast< udap_pkt* >(node));
+  }
+
+  /// queue a drain on the logic thread unless one is already queued
+  void
+  Schedule()
+  {
+    if(draining.exchange(true))
+      return;
+    if(!udap_threadpool_queue_job(thread, {this, &Drain, "logic-drain"}))
+      draining = false;
+  }
+
+  static void
+  Drain(void* user)
+  {
+    udap_logic* self = static_cast< udap_logic* >(user);
+    uint64_t now     = udap_time_now_ns();
+    size_t n         = 0;
+    while(n < DrainBatch)
+    {
+      auto node = self->jobs.Pop();
+      if(node == nullptr)
+        break;
+      udap_logic_job* job = udap_logic_job::from(node);
+      // the job may free user but work and label stay valid
+      udap_thread_job run = job->job;
+      uint64_t wait       = now - job->queued;
+      self->wait.Record(wait);
+      udap_pkt_unref(static_cast< udap_pkt* >(node));
+      run.work(run.user);
+      // jobs share one drain on the pool, count each under its own kind
+      uint64_t end = udap_time_now_ns();
+      udap_threadpool_record_job(self->thread, run, wait, end - now);
+      now = end;
+      ++n;
+    }
+    if(n)
+      self->drained.Record(n);
+    self->draining = false;
+    // pair with the producer's push before it checks draining
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(!self->jobs.Empty())
+      self->Schedule();
+  }
 };
 
 extern "C" {
@@ -67,6 +181,49 @@ udap_logic_stop(struct udap_logic* logic)
     udap_timer_stop(logic->timer);
 }
 
+void
+udap_logic_stop_mainloop(struct udap_logic* logic)
+{
+  udap_timer_stop(logic->timer);
+}
+
+int
+udap_logic_timer_fd(struct udap_logic* logic)
+{
+  return udap_timer_fd(logic->timer);
+}
+
+void
+udap_logic_get_stats(struct udap_logic* logic, struct udap_logic_stats* stats)
+{
+  stats->jobs        = logic->queued;
+  stats->drains      = logic->drained.Count();
+  stats->drain_p50   = logic->drained.Percentile(50);
+  stats->drain_p99   = logic->drained.Percentile(99);
+  stats->drain_max   = logic->drained.Max();
+  stats->wait_p50_ns = logic->wait.Percentile(50);
+  stats->wait_p99_ns = logic->wait.Percentile(99);
+  stats->wait_max_ns = logic->wait.Max();
+}
+
+void
+udap_logic_dump_stats(struct udap_logic* logic)
+{
+  udap_logic_stats st;
+  udap_logic_get_stats(logic, &st);
+  udap::Info("logic queue jobs=", st.jobs, " drains=", st.drains,
+             " per drain p50/p99/max=", st.drain_p50, "/", st.drain_p99, "/",
+             st.drain_max, " wait p50/p99/max=", st.wait_p50_ns, "/",
+             st.wait_p99_ns, "/", st.wait_max_ns, "ns");
+  udap_threadpool_dump_stats(logic->thread);
+}
+
+bool
+udap_logic_set_affinity(struct udap_logic* logic, int cpu)
+{
+  return udap_threadpool_set_affinity(logic->thread, &cpu, 1);
+}
+
 void
 udap_logic_mainloop(struct udap_logic* logic)
 {
@@ -76,10 +233,11 @@ udap_logic_mainloop(struct udap_logic* logic)
 void
 udap_logic_queue_job(struct udap_logic* logic, struct udap_thread_job job)
 {
-  udap_thread_job j;
-  j.user = job.user;
-  j.work = job.work;
-  udap_threadpool_queue_job(logic->thread, j);
+  udap_pkt* pkt = jobPool.pool->Get();
+  new(pkt->data()) udap_logic_job{job, udap_time_now_ns()};
+  logic->jobs.Push(pkt);
+  ++logic->queued;
+  logic->Schedule();
 }
 
 uint32_t
@@ -0,0 +1,100 @@
+#ifndef UDAP_MPSC_HPP
+#define UDAP_MPSC_HPP
+
+#include <atomic>
+#include <cstddef>
+
+namespace udap
+{
+  namespace util
+  {
+    /// link embedded in items of an MPSCQueue
+    struct MPSCNode
+    {
+      std::atomic< MPSCNode* > next;
+
+      MPSCNode() : next(nullptr)
+      {
+      }
+    };
+
+    /// intrusive unbounded multi producer single consumer queue (vyukov)
+    /// Push is wait free, one atomic exchange and a store, and can happen
+    /// from any thread
+    /// Pop, Empty and Size must only be called from the consumer
+    /// the queue never owns its nodes
+    struct MPSCQueue
+    {
+      MPSCQueue() : m_Head(&m_Stub), m_Tail(&m_Stub)
+      {
+      }
+
+      MPSCQueue(const MPSCQueue&) = delete;
+
+      MPSCQueue&
+      operator=(const MPSCQueue&) = delete;
+
+      void
+      Push(MPSCNode* n)
+      {
+        n->next.store(nullptr, std::memory_order_relaxed);
+        MPSCNode* prev = m_Head.exchange(n, std::memory_order_acq_rel);
+        // between the exchange and this store the consumer sees the queue
+        // as busy but can't get past prev
+        prev->next.store(n, std::memory_order_release);
+      }
+
+      /// get the oldest node, nullptr if empty or a producer is half way
+      /// through pushing the next one
+      MPSCNode*
+      Pop()
+      {
+        MPSCNode* tail = m_Tail;
+        MPSCNode* next = tail->next.load(std::memory_order_acquire);
+        if(tail == &m_Stub)
+        {
+          if(next == nullptr)
+            return nullptr;
+          m_Tail = next;
+          tail   = next;
+          next   = next->next.load(std::memory_order_acquire);
+        }
+        if(next)
+        {
+          m_Tail = next;
+          return tail;
+        }
+        if(tail != m_Head.load(std::memory_order_acquire))
+          return nullptr;
+        // tail is the last node, put the stub behind it so it can be popped
+        Push(&m_Stub);
+        next = tail->next.load(std::memory_order_acquire);
+        if(next)
+        {
+          m_Tail = next;
+          return tail;
+        }
+        return nullptr;
+      }
+
+      /// false if anything was pushed, including pushes still in progress
+      bool
+      Empty() const
+      {
+        return m_Tail == &m_Stub
+            && m_Stub.next.load(std::memory_order_acquire) == nullptr
+            && m_Head.load(std::memory_order_acquire) == &m_Stub;
+      }
+
+     private:
+      /// producers push here
+      std::atomic< MPSCNode* > m_Head;
+      char m_Pad[64 - sizeof(std::atomic< MPSCNode* >)];
+      /// consumer pops here
+      MPSCNode* m_Tail;
+      MPSCNode m_Stub;
+    };
+  }  // namespace util
+}  // namespace udap
+
+#endif
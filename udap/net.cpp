@@ -4,6 +4,8 @@
 #include <arpa/inet.h>
 #include <ifaddrs.h>
 #include <net/if.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
 #include <cstdio>
 #include "logger.hpp"
 
@@ -78,4 +80,20 @@ udap_getifaddr(const char* ifname, int af, struct sockaddr* addr)
     freeifaddrs(ifa);
   return found;
 }
+
+int
+udap_getifmtu(const char* ifname)
+{
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if(fd == -1)
+    return 0;
+  ifreq ifr;
+  udap::Zero(&ifr, sizeof(ifr));
+  strncpy(ifr.ifr_name, ifname, sizeof(ifr.ifr_name) - 1);
+  int mtu = 0;
+  if(ioctl(fd, SIOCGIFMTU, &ifr) == 0)
+    mtu = ifr.ifr_mtu;
+  close(fd);
+  return mtu;
+}
 }
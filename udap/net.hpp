@@ -208,8 +208,10 @@ namespace udap
       {
         return a.port() + a.addr4()->s_addr;
       }
-      uint8_t empty[16] = {0};
-      return (a.af() + memcmp(a.addr6(), empty, 16)) ^ a.port();
+      // fold the whole address in, peers often differ only in the low bits
+      uint64_t words[2];
+      memcpy(words, a.addr6(), sizeof(words));
+      return (words[0] * 31 + words[1]) ^ a.port();
     }
   };
 }  // namespace udap
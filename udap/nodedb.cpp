@@ -284,8 +284,9 @@ crypto_threadworker_verifyrc(void *user)
   if(verify_request->valid)
   {
     udap::Debug("RC is valid, saving to disk");
-    udap_threadpool_queue_job(verify_request->diskworker,
-                               {verify_request, &disk_threadworker_setRC});
+    udap_threadpool_queue_job_prio(verify_request->diskworker,
+                                    {verify_request, &disk_threadworker_setRC},
+                                    UDAP_JOB_PRIO_LOW);
   }
   else
   {
@@ -401,7 +402,8 @@ void
 udap_nodedb_async_load_rc(struct udap_async_load_rc *job)
 {
   // call in the disk io thread so we don't bog down the others
-  udap_threadpool_queue_job(job->diskworker, {job, &nodedb_async_load_rc});
+  udap_threadpool_queue_job_prio(job->diskworker, {job, &nodedb_async_load_rc},
+                                  UDAP_JOB_PRIO_LOW);
 }
 
 struct udap_rc *
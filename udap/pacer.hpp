@@ -0,0 +1,82 @@
+#ifndef UDAP_PACER_HPP
+#define UDAP_PACER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace udap
+{
+  namespace util
+  {
+    /// token bucket spacing sends out to a byte rate
+    /// a send may go whenever the bucket is not in debt and takes its bytes
+    /// from it, so any size goes out and the next waits for it to be paid
+    /// back
+    /// times are ms, not thread safe
+    struct Pacer
+    {
+      /// bytes that can go back to back after an idle period, timers fire
+      /// every ms at best so it has to cover at least that
+      static const uint64_t MinBurst = 4500;
+      static const uint64_t BurstMs  = 2;
+
+      /// bytes per second, 0 for no limit
+      void
+      SetRate(uint64_t rate)
+      {
+        m_Rate = rate;
+      }
+
+      uint64_t
+      Rate() const
+      {
+        return m_Rate;
+      }
+
+      /// ms until the next send may go, 0 for now
+      uint64_t
+      Delay(uint64_t now)
+      {
+        if(m_Rate == 0)
+          return 0;
+        Refill(now);
+        if(m_Credit >= 0)
+          return 0;
+        return (uint64_t(-m_Credit) * 1000 + m_Rate - 1) / m_Rate;
+      }
+
+      /// sz bytes were sent
+      void
+      Spend(size_t sz)
+      {
+        if(m_Rate)
+          m_Credit -= sz;
+      }
+
+     private:
+      void
+      Refill(uint64_t now)
+      {
+        if(now <= m_Last)
+          return;
+        uint64_t add = (now - m_Last) * m_Rate / 1000;
+        // keep the remainder for later at rates under a byte per ms
+        if(add == 0)
+          return;
+        m_Last         = now;
+        uint64_t burst = m_Rate * BurstMs / 1000;
+        if(burst < MinBurst)
+          burst = MinBurst;
+        m_Credit += add;
+        if(m_Credit > int64_t(burst))
+          m_Credit = burst;
+      }
+
+      uint64_t m_Rate  = 0;
+      int64_t m_Credit = 0;
+      uint64_t m_Last  = 0;
+    };
+  }  // namespace util
+}  // namespace udap
+
+#endif
@@ -0,0 +1,94 @@
+#include "pkt.hpp"
+
+#include <new>
+
+namespace udap
+{
+  static udap_pkt *
+  alloc_packet(PacketPool *pool, size_t cap)
+  {
+    void *mem     = ::operator new(sizeof(udap_pkt) + cap);
+    udap_pkt *pkt = new(mem) udap_pkt;
+    pkt->refs     = 1;
+    pkt->pool     = pool;
+    pkt->cap      = cap;
+    return pkt;
+  }
+
+  static void
+  free_packet(udap_pkt *pkt)
+  {
+    pkt->~udap_pkt();
+    ::operator delete(pkt);
+  }
+
+  udap_pkt *
+  NewPacket(size_t cap)
+  {
+    return alloc_packet(nullptr, cap);
+  }
+
+  PacketPool::PacketPool(size_t sz) : m_Size(sz), m_Refs(1)
+  {
+  }
+
+  PacketPool::~PacketPool()
+  {
+    while(auto node = m_Free.Pop())
+      free_packet(static_cast< udap_pkt * >(node));
+  }
+
+  udap_pkt *
+  PacketPool::Get()
+  {
+    ++m_Refs;
+    udap_pkt *pkt = static_cast< udap_pkt * >(m_Free.Pop());
+    if(pkt == nullptr)
+      return alloc_packet(this, m_Size);
+    pkt->refs = 1;
+    return pkt;
+  }
+
+  void
+  PacketPool::Put(udap_pkt *pkt)
+  {
+    m_Free.Push(pkt);
+    Unref();
+  }
+
+  void
+  PacketPool::Close()
+  {
+    while(auto node = m_Free.Pop())
+      free_packet(static_cast< udap_pkt * >(node));
+    Unref();
+  }
+
+  void
+  PacketPool::Unref()
+  {
+    // the last one out is the only thread left touching the free list
+    if(--m_Refs == 0)
+      delete this;
+  }
+}  // namespace udap
+
+extern "C" {
+
+void
+udap_pkt_ref(struct udap_pkt *pkt)
+{
+  pkt->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void
+udap_pkt_unref(struct udap_pkt *pkt)
+{
+  if(pkt->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+    return;
+  if(pkt->pool)
+    pkt->pool->Put(pkt);
+  else
+    udap::free_packet(pkt);
+}
+}
@@ -0,0 +1,164 @@
+#ifndef UDAP_PKT_HPP
+#define UDAP_PKT_HPP
+
+#include <udap/buffer.h>
+#include <udap/pkt.h>
+#include <atomic>
+#include <cstring>
+#include "mpsc.hpp"
+
+namespace udap
+{
+  struct PacketPool;
+}
+
+struct udap_pkt : public udap::util::MPSCNode
+{
+  std::atomic< uint32_t > refs;
+  /// nullptr if not pooled
+  udap::PacketPool *pool;
+  /// bytes of memory after the header
+  size_t cap;
+
+  byte_t *
+  data()
+  {
+    return reinterpret_cast< byte_t * >(this + 1);
+  }
+};
+
+namespace udap
+{
+  /// a packet with cap bytes that is not from a pool
+  udap_pkt *
+  NewPacket(size_t cap);
+
+  /// packets of one size, taken by one thread and given back from any
+  struct PacketPool
+  {
+    PacketPool(size_t sz);
+
+    PacketPool(const PacketPool &) = delete;
+
+    PacketPool &
+    operator=(const PacketPool &) = delete;
+
+    /// a packet with one reference, only from the owner's thread
+    udap_pkt *
+    Get();
+
+    /// the owner is done with the pool, it goes away once every packet
+    /// has been given back
+    void
+    Close();
+
+    /// called when the last reference to pkt goes
+    void
+    Put(udap_pkt *pkt);
+
+    size_t
+    Size() const
+    {
+      return m_Size;
+    }
+
+   private:
+    ~PacketPool();
+
+    void
+    Unref();
+
+    size_t m_Size;
+    /// given back packets, the owner pops them
+    util::MPSCQueue m_Free;
+    /// one for the owner and one per packet out of the pool
+    std::atomic< size_t > m_Refs;
+  };
+
+  /// a counted reference to bytes inside a packet
+  struct PacketRef
+  {
+    PacketRef() = default;
+
+    PacketRef(udap_pkt *p, byte_t *buf, size_t sz) : pkt(p), ptr(buf), len(sz)
+    {
+      udap_pkt_ref(pkt);
+    }
+
+    PacketRef(PacketRef &&other)
+        : pkt(other.pkt), ptr(other.ptr), len(other.len)
+    {
+      other.pkt = nullptr;
+    }
+
+    PacketRef &
+    operator=(PacketRef &&other)
+    {
+      reset();
+      pkt       = other.pkt;
+      ptr       = other.ptr;
+      len       = other.len;
+      other.pkt = nullptr;
+      return *this;
+    }
+
+    PacketRef(const PacketRef &) = delete;
+
+    PacketRef &
+    operator=(const PacketRef &) = delete;
+
+    ~PacketRef()
+    {
+      reset();
+    }
+
+    /// reference buf inside pkt, or a copy of it if there is no packet
+    static PacketRef
+    Borrow(udap_pkt *pkt, byte_t *buf, size_t sz)
+    {
+      if(pkt)
+        return PacketRef(pkt, buf, sz);
+      udap_pkt *copy = NewPacket(sz);
+      memcpy(copy->data(), buf, sz);
+      PacketRef ref(copy, copy->data(), sz);
+      // the ref owns the only reference
+      udap_pkt_unref(copy);
+      return ref;
+    }
+
+    void
+    reset()
+    {
+      if(pkt)
+        udap_pkt_unref(pkt);
+      pkt = nullptr;
+      ptr = nullptr;
+      len = 0;
+    }
+
+    bool
+    empty() const
+    {
+      return pkt == nullptr;
+    }
+
+    byte_t *
+    data() const
+    {
+      return ptr;
+    }
+
+    size_t
+    size() const
+    {
+      return len;
+    }
+
+   private:
+    udap_pkt *pkt = nullptr;
+    byte_t *ptr   = nullptr;
+    size_t len    = 0;
+  };
+}  // namespace udap
+
+#endif
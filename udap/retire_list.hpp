@@ -0,0 +1,105 @@
+#ifndef UDAP_RETIRE_LIST_HPP
+#define UDAP_RETIRE_LIST_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace udap
+{
+  namespace util
+  {
+    /// held by everything using an object off the thread that frees it
+    struct RefCount
+    {
+      std::atomic< uint32_t > refs{0};
+
+      void
+      acquire()
+      {
+        ++refs;
+      }
+
+      void
+      release()
+      {
+        --refs;
+      }
+    };
+
+    /// objects taken out of the table that found them, each one is freed on
+    /// a later pass once nothing holds it
+    /// T has a refs count like RefCount, Retire can happen from any thread
+    template < typename T >
+    struct RetireList
+    {
+      RetireList() = default;
+
+      RetireList(const RetireList&) = delete;
+
+      RetireList&
+      operator=(const RetireList&) = delete;
+
+      /// t is out of its table, nothing new can find it
+      void
+      Retire(T* t)
+      {
+        lock_t lock(mtx);
+        list.push_back(t);
+      }
+
+      /// call free on each retired object nothing holds anymore
+      /// return how many were freed
+      template < typename Free >
+      size_t
+      Collect(Free free)
+      {
+        lock_t lock(mtx);
+        size_t freed = 0;
+        auto itr     = list.begin();
+        while(itr != list.end())
+        {
+          if((*itr)->refs == 0)
+          {
+            free(*itr);
+            itr = list.erase(itr);
+            ++freed;
+          }
+          else
+            ++itr;
+        }
+        return freed;
+      }
+
+      /// call free on every retired object held or not, for when nothing
+      /// that could hold them is running anymore
+      template < typename Free >
+      void
+      Clear(Free free)
+      {
+        lock_t lock(mtx);
+        for(auto t : list)
+          free(t);
+        list.clear();
+      }
+
+      size_t
+      Size() const
+      {
+        lock_t lock(mtx);
+        return list.size();
+      }
+
+     private:
+      typedef std::mutex mtx_t;
+      typedef std::lock_guard< mtx_t > lock_t;
+
+      mutable mtx_t mtx;
+      std::vector< T* > list;
+    };
+  }  // namespace util
+}  // namespace udap
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef UDAP_RING_HPP
+#define UDAP_RING_HPP
+
+#include <cstddef>
+#include <memory>
+
+namespace udap
+{
+  namespace util
+  {
+    /// growable ring buffer holding T by value
+    /// storage only grows, so a steady stream of push/pop never allocates
+    /// not thread safe
+    template < typename T >
+    struct Ring
+    {
+      Ring(size_t initialSize = 256)
+          : m_Capacity(RoundUp(initialSize))
+          , m_Buffer(new T[m_Capacity])
+          , m_Head(0)
+          , m_Size(0)
+          , allocations(1)
+      {
+      }
+
+      Ring(const Ring&) = delete;
+
+      Ring&
+      operator=(const Ring&) = delete;
+
+      bool
+      empty() const
+      {
+        return m_Size == 0;
+      }
+
+      size_t
+      size() const
+      {
+        return m_Size;
+      }
+
+      size_t
+      capacity() const
+      {
+        return m_Capacity;
+      }
+
+      void
+      push_back(const T& val)
+      {
+        if(m_Size == m_Capacity)
+          Grow();
+        m_Buffer[(m_Head + m_Size) & (m_Capacity - 1)] = val;
+        ++m_Size;
+      }
+
+      T&
+      front()
+      {
+        return m_Buffer[m_Head];
+      }
+
+      T&
+      back()
+      {
+        return m_Buffer[(m_Head + m_Size - 1) & (m_Capacity - 1)];
+      }
+
+      void
+      pop_front()
+      {
+        m_Head = (m_Head + 1) & (m_Capacity - 1);
+        --m_Size;
+      }
+
+      void
+      pop_back()
+      {
+        --m_Size;
+      }
+
+     private:
+      static size_t
+      RoundUp(size_t sz)
+      {
+        size_t cap = 1;
+        while(cap < sz)
+          cap <<= 1;
+        return cap;
+      }
+
+      void
+      Grow()
+      {
+        size_t cap = m_Capacity * 2;
+        std::unique_ptr< T[] > buf(new T[cap]);
+        for(size_t idx = 0; idx < m_Size; ++idx)
+          buf[idx] = m_Buffer[(m_Head + idx) & (m_Capacity - 1)];
+        m_Buffer.swap(buf);
+        m_Capacity = cap;
+        m_Head     = 0;
+        ++allocations;
+      }
+
+      size_t m_Capacity;
+      std::unique_ptr< T[] > m_Buffer;
+      size_t m_Head;
+      size_t m_Size;
+
+     public:
+      /// number of times backing storage was allocated
+      size_t allocations;
+    };
+  }  // namespace util
+}  // namespace udap
+
+#endif
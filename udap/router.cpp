@@ -1083,6 +1083,18 @@ namespace udap
       {
         self->ident_keyfile = val;
       }
+      if(StrEq(key, "bundle-window"))
+      {
+        self->bundleWindow = strtoull(val, nullptr, 10);
+      }
+      if(StrEq(key, "peer-rate"))
+      {
+        self->peerRate = strtoull(val, nullptr, 10);
+      }
+      if(StrEq(key, "egress-rate"))
+      {
+        self->egress.SetRate(strtoull(val, nullptr, 10));
+      }
     }
   }
 
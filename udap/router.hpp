@@ -19,6 +19,7 @@
 #include "crypto.hpp"
 #include "fs.hpp"
 #include "mem.hpp"
+#include "pacer.hpp"
 
 namespace udap
 {
@@ -78,6 +79,16 @@ struct udap_router
   // should we be sending padded messages every interval?
   bool sendPadding = false;
 
+  /// ms a link session holds small messages to send them together, 0 to
+  /// send each on its own
+  uint64_t bundleWindow = 0;
+
+  /// bytes per second one link session may send, 0 for no cap
+  uint64_t peerRate = 0;
+  /// what all links together may send, shared by their sessions on the
+  /// logic thread
+  udap::util::Pacer egress;
+
   uint32_t ticker_job_id = 0;
 
   udap::InboundMessageParser inbound_link_msg_parser;
@@ -0,0 +1,212 @@
+#ifndef UDAP_SHARDED_MAP_HPP
+#define UDAP_SHARDED_MAP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace udap
+{
+  namespace util
+  {
+    /// hash map split into NumShards maps that each have their own lock, so
+    /// threads working on different keys almost never wait on each other
+    /// values are copied in and out, hold pointers for anything big
+    /// every operation can happen from any thread
+    template < typename Key, typename Val, typename Hash,
+               size_t NumShards = 16 >
+    struct ShardedMap
+    {
+      typedef std::pair< Key, Val > Entry;
+
+      ShardedMap() = default;
+
+      ShardedMap(const ShardedMap&) = delete;
+
+      ShardedMap&
+      operator=(const ShardedMap&) = delete;
+
+      /// copy the value for k to val, false if there is none
+      bool
+      Get(const Key& k, Val& val) const
+      {
+        const Shard& sh = shard(k);
+        lock_t lock(sh.mtx);
+        auto itr = sh.map.find(k);
+        if(itr == sh.map.end())
+          return false;
+        val = itr->second;
+        return true;
+      }
+
+      /// call fn with the value for k while its shard is locked, false if
+      /// there is none, fn must not touch this map
+      template < typename Fn >
+      bool
+      Visit(const Key& k, Fn fn) const
+      {
+        const Shard& sh = shard(k);
+        lock_t lock(sh.mtx);
+        auto itr = sh.map.find(k);
+        if(itr == sh.map.end())
+          return false;
+        fn(itr->second);
+        return true;
+      }
+
+      bool
+      Has(const Key& k) const
+      {
+        const Shard& sh = shard(k);
+        lock_t lock(sh.mtx);
+        return sh.map.find(k) != sh.map.end();
+      }
+
+      /// add k if it is not there, false if it already was
+      bool
+      Insert(const Key& k, const Val& val)
+      {
+        Shard& sh = shard(k);
+        lock_t lock(sh.mtx);
+        return sh.map.emplace(k, val).second;
+      }
+
+      /// add k or replace its value
+      void
+      Put(const Key& k, const Val& val)
+      {
+        Shard& sh = shard(k);
+        lock_t lock(sh.mtx);
+        sh.map[k] = val;
+      }
+
+      /// remove k, its value goes in old if given, false if it wasn't there
+      bool
+      Remove(const Key& k, Val* old = nullptr)
+      {
+        Shard& sh = shard(k);
+        lock_t lock(sh.mtx);
+        auto itr = sh.map.find(k);
+        if(itr == sh.map.end())
+          return false;
+        if(old)
+          *old = itr->second;
+        sh.map.erase(itr);
+        return true;
+      }
+
+      /// remove k only if it still has value val
+      bool
+      RemoveIfValue(const Key& k, const Val& val)
+      {
+        Shard& sh = shard(k);
+        lock_t lock(sh.mtx);
+        auto itr = sh.map.find(k);
+        if(itr == sh.map.end() || !(itr->second == val))
+          return false;
+        sh.map.erase(itr);
+        return true;
+      }
+
+      /// remove every entry pred is true for, appending them to removed
+      /// pred runs with its shard locked and must not touch this map
+      template < typename Pred >
+      void
+      RemoveIf(Pred pred, std::vector< Entry >& removed)
+      {
+        for(auto& sh : m_Shards)
+        {
+          lock_t lock(sh.mtx);
+          auto itr = sh.map.begin();
+          while(itr != sh.map.end())
+          {
+            if(pred(itr->first, itr->second))
+            {
+              removed.emplace_back(*itr);
+              itr = sh.map.erase(itr);
+            }
+            else
+              ++itr;
+          }
+        }
+      }
+
+      /// append a copy of every entry, one shard locked at a time so it is
+      /// not a single point in time snapshot
+      void
+      Snapshot(std::vector< Entry >& out) const
+      {
+        for(const auto& sh : m_Shards)
+        {
+          lock_t lock(sh.mtx);
+          out.insert(out.end(), sh.map.begin(), sh.map.end());
+        }
+      }
+
+      /// take every entry out
+      void
+      Drain(std::vector< Entry >& out)
+      {
+        for(auto& sh : m_Shards)
+        {
+          lock_t lock(sh.mtx);
+          out.insert(out.end(), sh.map.begin(), sh.map.end());
+          sh.map.clear();
+        }
+      }
+
+      size_t
+      Size() const
+      {
+        size_t sz = 0;
+        for(const auto& sh : m_Shards)
+        {
+          lock_t lock(sh.mtx);
+          sz += sh.map.size();
+        }
+        return sz;
+      }
+
+     private:
+      typedef std::mutex mtx_t;
+      typedef std::lock_guard< mtx_t > lock_t;
+
+      struct Shard
+      {
+        mutable mtx_t mtx;
+        std::unordered_map< Key, Val, Hash > map;
+        /// keep shards locked by different threads off each other's cache
+        /// lines
+        char pad[64];
+      };
+
+      Shard&
+      shard(const Key& k)
+      {
+        return m_Shards[Index(k)];
+      }
+
+      const Shard&
+      shard(const Key& k) const
+      {
+        return m_Shards[Index(k)];
+      }
+
+      /// the maps inside use the low bits of the hash, pick the shard with
+      /// the high bits of a fibonacci mix so weak hashes still spread
+      static size_t
+      Index(const Key& k)
+      {
+        uint64_t h = Hash()(k);
+        return ((h * 0x9E3779B97F4A7C15ULL) >> 32) % NumShards;
+      }
+
+      Shard m_Shards[NumShards];
+    };
+  }  // namespace util
+}  // namespace udap
+
+#endif
@@ -1,9 +1,11 @@
 #include "threadpool.hpp"
+#include "affinity.hpp"
 #include <pthread.h>
+#include <algorithm>
 #include <cstring>
+#include <sstream>
 
 #include <udap/time.h>
-#include <queue>
 
 #include "logger.hpp"
 
@@ -15,49 +17,367 @@ namespace udap
 {
   namespace thread
   {
-    Pool::Pool(size_t workers, const char *name)
+    /// how long a job of each class may wait before it runs ahead of higher
+    /// classes, in ns
+    static const uint64_t maxClassWait[UDAP_JOB_NUM_PRIO] = {
+        0, 50 * 1000 * 1000, 250 * 1000 * 1000};
+
+    static int
+    ClampPrio(int prio)
     {
-      stop = false;
-      while(workers--)
+      if(prio < UDAP_JOB_PRIO_HIGH)
+        return UDAP_JOB_PRIO_HIGH;
+      if(prio >= UDAP_JOB_NUM_PRIO)
+        return UDAP_JOB_NUM_PRIO - 1;
+      return prio;
+    }
+
+    bool
+    PriorityJobQueue::empty() const
+    {
+      for(const auto &q : classes)
+        if(!q.empty())
+          return false;
+      return true;
+    }
+
+    size_t
+    PriorityJobQueue::size() const
+    {
+      size_t sz = 0;
+      for(const auto &q : classes)
+        sz += q.size();
+      return sz;
+    }
+
+    void
+    PriorityJobQueue::Push(const udap_thread_job &job, int prio, uint64_t now)
+    {
+      QueuedJob j;
+      j.job    = job;
+      j.prio   = prio;
+      j.queued = now;
+      classes[prio].push_back(j);
+    }
+
+    bool
+    PriorityJobQueue::Pop(QueuedJob &job, uint64_t now)
+    {
+      int pick = -1;
+      // a lower class job that waited too long goes first, lowest class wins
+      for(int prio = UDAP_JOB_NUM_PRIO - 1; prio > UDAP_JOB_PRIO_HIGH; --prio)
+      {
+        auto &q = classes[prio];
+        if(!q.empty() && now - q.front().queued >= maxClassWait[prio])
+        {
+          pick = prio;
+          break;
+        }
+      }
+      // otherwise highest class first
+      for(int prio = UDAP_JOB_PRIO_HIGH; pick == -1 && prio < UDAP_JOB_NUM_PRIO;
+          ++prio)
+      {
+        if(!classes[prio].empty())
+          pick = prio;
+      }
+      if(pick == -1)
+        return false;
+      job = classes[pick].front();
+      classes[pick].pop_front();
+      return true;
+    }
+
+    bool
+    PriorityJobQueue::PopBack(QueuedJob &job)
+    {
+      for(auto &q : classes)
+      {
+        if(q.empty())
+          continue;
+        job = q.back();
+        q.pop_back();
+        return true;
+      }
+      return false;
+    }
+
+    size_t
+    PriorityJobQueue::Allocations() const
+    {
+      size_t allocs = 0;
+      for(const auto &q : classes)
+        allocs += q.allocations;
+      return allocs;
+    }
+
+    Pool::Pool(const char *n) : name(n ? n : ""), started(udap_time_now_ns())
+    {
+      for(auto &js : jobStats)
+        js = nullptr;
+      depth    = 0;
+      maxJobs  = 0;
+      rejected = 0;
+      for(auto &st : classStats)
+      {
+        st.queued      = 0;
+        st.ran         = 0;
+        st.wait_ns     = 0;
+        st.max_wait_ns = 0;
+      }
+    }
+
+    Pool::~Pool()
+    {
+      for(auto &js : jobStats)
+        delete js.load();
+    }
+
+    void
+    Pool::SetThreadName(const char *name)
+    {
+      if(name)
       {
-        threads.emplace_back([this, name] {
-          if(name)
-          {
 #if(__APPLE__ && __MACH__)
-            pthread_setname_np(name);
+        pthread_setname_np(name);
 #elif(__FreeBSD__)
-            pthread_set_name_np(pthread_self(), name);
+        pthread_set_name_np(pthread_self(), name);
 #else
-            pthread_setname_np(pthread_self(), name);
+        pthread_setname_np(pthread_self(), name);
 #endif
-          }
+      }
+    }
+
+    void
+    Pool::CountQueued(int prio, size_t n)
+    {
+      classStats[prio].queued += n;
+    }
+
+    size_t
+    Pool::Reserve(size_t n)
+    {
+      size_t cur = depth;
+      for(;;)
+      {
+        size_t max  = maxJobs;
+        size_t room = n;
+        if(max)
+          room = cur >= max ? 0 : std::min(n, max - cur);
+        if(room == 0 || depth.compare_exchange_weak(cur, cur + room))
+        {
+          rejected += n - room;
+          return room;
+        }
+      }
+    }
+
+    void
+    Pool::Unreserve(size_t n)
+    {
+      depth -= n;
+    }
+
+    void
+    Pool::Run(const QueuedJob &job)
+    {
+      --depth;
+      auto now  = udap_time_now_ns();
+      auto wait = now - job.queued;
+      auto &st  = classStats[job.prio];
+      st.wait_ns += wait;
+      uint64_t max = st.max_wait_ns;
+      while(wait > max && !st.max_wait_ns.compare_exchange_weak(max, wait))
+        ;
+      ++st.ran;
+      // the job may free user but work and label stay valid
+      JobStats *js = GetJobStats(job.job);
+      // do work
+      job.job.work(job.job.user);
+      js->wait.Record(wait);
+      js->run.Record(udap_time_now_ns() - now);
+    }
+
+    static bool
+    SameKind(const JobStats *js, const udap_thread_job &job)
+    {
+      if(job.label)
+        return js->label == job.label;
+      return js->label == nullptr && js->work == job.work;
+    }
+
+    JobStats *
+    Pool::GetJobStats(const udap_thread_job &job)
+    {
+      uintptr_t key = job.label ? uintptr_t(job.label) : uintptr_t(job.work);
+      size_t start  = (key * 0x9E3779B97F4A7C15ULL) >> 58;
+      for(size_t n = 0; n < MaxJobKinds; ++n)
+      {
+        auto &slot   = jobStats[(start + n) % MaxJobKinds];
+        JobStats *js = slot;
+        if(js == nullptr)
+        {
+          // first of its kind, claim the slot
+          JobStats *fresh = new JobStats;
+          fresh->work     = job.work;
+          fresh->label    = job.label;
+          if(slot.compare_exchange_strong(js, fresh))
+            return fresh;
+          // another worker claimed it first
+          delete fresh;
+        }
+        if(SameKind(js, job))
+          return js;
+      }
+      return &otherJobs;
+    }
+
+    void
+    Pool::RecordJob(const udap_thread_job &job, uint64_t wait, uint64_t run)
+    {
+      JobStats *js = GetJobStats(job);
+      js->wait.Record(wait);
+      js->run.Record(run);
+    }
+
+    static void
+    FillJobStats(udap_threadpool_job_stats &out, const JobStats &js,
+                 double elapsed)
+    {
+      out.label        = js.label;
+      out.work         = js.work;
+      out.jobs         = js.run.Count();
+      out.jobs_per_sec = elapsed > 0 ? out.jobs / elapsed : 0;
+      out.run_ns       = js.run.Sum();
+      out.wait_p50_ns  = js.wait.Percentile(50);
+      out.wait_p90_ns  = js.wait.Percentile(90);
+      out.wait_p99_ns  = js.wait.Percentile(99);
+      out.wait_max_ns  = js.wait.Max();
+      out.run_p50_ns   = js.run.Percentile(50);
+      out.run_p90_ns   = js.run.Percentile(90);
+      out.run_p99_ns   = js.run.Percentile(99);
+      out.run_max_ns   = js.run.Max();
+    }
+
+    void
+    Pool::VisitJobStats(void *user, udap_threadpool_job_stats_visitor visit)
+    {
+      double elapsed = (udap_time_now_ns() - started) / 1e9;
+      udap_threadpool_job_stats out;
+      for(auto &slot : jobStats)
+      {
+        JobStats *js = slot;
+        if(js == nullptr)
+          continue;
+        FillJobStats(out, *js, elapsed);
+        visit(user, &out);
+      }
+      if(otherJobs.run.Count())
+      {
+        FillJobStats(out, otherJobs, elapsed);
+        out.label = "other";
+        visit(user, &out);
+      }
+    }
+
+    static void
+    LogJobStats(void *user, const udap_threadpool_job_stats *st)
+    {
+      const std::string *name = static_cast< const std::string * >(user);
+      std::stringstream kind;
+      if(st->label)
+        kind << st->label;
+      else
+        kind << (void *)st->work;
+      udap::Info(*name, " ", kind.str(), " jobs=", st->jobs,
+                 " rate=", st->jobs_per_sec, "/s busy=", st->run_ns / 1000000,
+                 "ms wait p50/p90/p99/max=", st->wait_p50_ns, "/",
+                 st->wait_p90_ns, "/", st->wait_p99_ns, "/", st->wait_max_ns,
+                 "ns run p50/p90/p99/max=", st->run_p50_ns, "/", st->run_p90_ns,
+                 "/", st->run_p99_ns, "/", st->run_max_ns, "ns");
+    }
+
+    void
+    Pool::DumpStats()
+    {
+      VisitJobStats(&name, &LogJobStats);
+    }
+
+    void
+    Pool::GetStats(udap_threadpool_stats *stats)
+    {
+      stats->jobs        = 0;
+      stats->allocations = Allocations();
+      stats->rejected    = rejected;
+      for(int prio = 0; prio < UDAP_JOB_NUM_PRIO; ++prio)
+      {
+        auto &st   = classStats[prio];
+        auto &out  = stats->classes[prio];
+        out.jobs   = st.queued;
+        auto ran   = st.ran.load();
+        out.depth  = out.jobs > ran ? out.jobs - ran : 0;
+        out.wait_ns     = st.wait_ns;
+        out.max_wait_ns = st.max_wait_ns;
+        stats->jobs += out.jobs;
+      }
+    }
+
+    bool
+    Pool::SetAffinity(const std::vector< int > &cpus)
+    {
+      if(cpus.empty())
+        return false;
+      bool ok = true;
+      threadCPUs.clear();
+      for(size_t idx = 0; idx < threads.size(); ++idx)
+      {
+        int cpu = cpus[idx % cpus.size()];
+        ok &= udap::thread::SetAffinity(threads[idx].native_handle(), cpu);
+        threadCPUs.push_back(cpu);
+      }
+      if(!ok)
+        threadCPUs.clear();
+      return ok;
+    }
+
+    void
+    Pool::Join()
+    {
+      for(auto &t : threads)
+        t.join();
+      threads.clear();
+      done.notify_all();
+    }
+
+    SharedPool::SharedPool(size_t workers, const char *name) : Pool(name)
+    {
+      stop = false;
+      idle = 0;
+      while(workers--)
+      {
+        threads.emplace_back([this, name] {
+          SetThreadName(name);
           for(;;)
           {
-            udap_thread_job *job;
+            QueuedJob job;
             {
               lock_t lock(this->queue_mutex);
+              ++this->idle;
               this->condition.wait(
                   lock, [this] { return this->stop || !this->jobs.empty(); });
+              --this->idle;
               if(this->stop && this->jobs.empty())
                 return;
-              job = this->jobs.front();
-              this->jobs.pop_front();
+              this->jobs.Pop(job, udap_time_now_ns());
             }
-            auto now = udap_time_now_ms();
-            // do work
-            job->work(job->user);
-            auto after = udap_time_now_ms();
-            auto dlt   = after - now;
-            if(dlt > 10)
-              udap::Warn("work took ", dlt, " ms");
-            delete job;
+            Run(job);
           }
         });
       }
     }
 
     void
-    Pool::Stop()
+    SharedPool::Stop()
     {
       {
         lock_t lock(queue_mutex);
@@ -66,28 +386,278 @@ namespace udap
       condition.notify_all();
     }
 
-    void
-    Pool::Join()
+    bool
+    SharedPool::QueueJob(const udap_thread_job &job, int prio)
     {
-      for(auto &t : threads)
-        t.join();
-      threads.clear();
-      done.notify_all();
+      if(!Reserve(1))
+        return false;
+      {
+        lock_t lock(queue_mutex);
+
+        // don't allow enqueueing after stopping the pool
+        if(stop)
+        {
+          Unreserve(1);
+          return false;
+        }
+
+        jobs.Push(job, prio, udap_time_now_ns());
+      }
+      CountQueued(prio, 1);
+      condition.notify_one();
+      return true;
     }
 
-    void
-    Pool::QueueJob(const udap_thread_job &job)
+    size_t
+    SharedPool::QueueJobs(const udap_thread_job *batch, size_t n, int prio)
     {
+      n = Reserve(n);
+      if(n == 0)
+        return 0;
+      size_t wake;
       {
         lock_t lock(queue_mutex);
 
         // don't allow enqueueing after stopping the pool
         if(stop)
-          return;
+        {
+          Unreserve(n);
+          return 0;
+        }
 
-        jobs.push_back(new udap_thread_job(job.user, job.work));
+        auto now = udap_time_now_ns();
+        for(size_t idx = 0; idx < n; ++idx)
+          jobs.Push(batch[idx], prio, now);
+        wake = std::min(n, idle);
       }
-      condition.notify_one();
+      CountQueued(prio, n);
+      if(wake >= threads.size())
+        condition.notify_all();
+      else
+        while(wake--)
+          condition.notify_one();
+      return n;
+    }
+
+    size_t
+    SharedPool::Allocations()
+    {
+      lock_t lock(queue_mutex);
+      return jobs.Allocations();
+    }
+
+    /// the work stealing pool the current thread is a worker of, if any
+    static thread_local WorkStealingPool *currentPool = nullptr;
+    /// index of the current thread in currentPool
+    static thread_local size_t currentWorker = 0;
+
+    WorkStealingPool::WorkStealingPool(size_t sz, const char *name)
+        : Pool(name), nextWorker(0), pending(0), idle(0), stop(false)
+    {
+      for(size_t idx = 0; idx < sz; ++idx)
+        workers.emplace_back(new Worker);
+      for(size_t idx = 0; idx < sz; ++idx)
+      {
+        threads.emplace_back([this, name, idx] {
+          SetThreadName(name);
+          currentPool   = this;
+          currentWorker = idx;
+          Work(idx);
+        });
+      }
+    }
+
+    bool
+    WorkStealingPool::PopLocal(size_t idx, QueuedJob &job)
+    {
+      Worker *w = workers[idx].get();
+      lock_t lock(w->mutex);
+      return w->jobs.Pop(job, udap_time_now_ns());
+    }
+
+    bool
+    WorkStealingPool::Steal(size_t idx, QueuedJob &job)
+    {
+      const size_t sz = workers.size();
+      size_t busy     = sz;
+      for(size_t n = 1; n < sz; ++n)
+      {
+        size_t v       = (idx + n) % sz;
+        Worker *victim = workers[v].get();
+        // don't wait on a busy victim, try the next one
+        lock_t lock(victim->mutex, std::try_to_lock);
+        if(!lock.owns_lock())
+        {
+          if(busy == sz)
+            busy = v;
+          continue;
+        }
+        if(victim->jobs.PopBack(job))
+          return true;
+      }
+      if(busy == sz)
+        return false;
+      // every victim that might have work was busy, wait for the first
+      // rather than spin through them all again
+      Worker *victim = workers[busy].get();
+      lock_t lock(victim->mutex);
+      return victim->jobs.PopBack(job);
+    }
+
+    void
+    WorkStealingPool::Work(size_t idx)
+    {
+      for(;;)
+      {
+        QueuedJob job;
+        if(!PopLocal(idx, job) && !Steal(idx, job))
+        {
+          // a job is counted before it is pushed, if one is on its way
+          // give the queueing thread a chance to finish
+          if(pending > 0 && !stop)
+          {
+            std::this_thread::yield();
+            continue;
+          }
+          // nothing to do, sleep until a job is queued
+          lock_t lock(sleep_mutex);
+          ++idle;
+          condition.wait(lock, [this] { return stop || pending > 0; });
+          --idle;
+          if(stop && pending == 0)
+            return;
+          continue;
+        }
+        --pending;
+        Run(job);
+      }
+    }
+
+    void
+    WorkStealingPool::Stop()
+    {
+      {
+        lock_t lock(sleep_mutex);
+        stop = true;
+      }
+      condition.notify_all();
+    }
+
+    size_t
+    WorkStealingPool::PickWorker()
+    {
+      // workers queue follow up jobs locally
+      if(currentPool == this)
+        return currentWorker;
+      if(!cpuWorker.empty())
+      {
+        int cpu = CurrentCPU();
+        if(cpu >= 0 && size_t(cpu) < cpuWorker.size()
+           && cpuWorker[cpu] < workers.size())
+          return cpuWorker[cpu];
+      }
+      return nextWorker++ % workers.size();
+    }
+
+    bool
+    WorkStealingPool::EnableLocality()
+    {
+      if(threadCPUs.size() != workers.size())
+        return false;
+      const size_t none = workers.size();
+      std::vector< size_t > nearest(NumCPUs(), none);
+      for(size_t cpu = 0; cpu < nearest.size(); ++cpu)
+      {
+        // a worker on the same cpu
+        for(size_t idx = 0; idx < none && nearest[cpu] == none; ++idx)
+          if(threadCPUs[idx] == int(cpu))
+            nearest[cpu] = idx;
+        if(nearest[cpu] != none)
+          continue;
+        // otherwise spread over the workers on the same package
+        int pkg = CPUPackage(cpu);
+        if(pkg == -1)
+          continue;
+        std::vector< size_t > local;
+        for(size_t idx = 0; idx < none; ++idx)
+          if(CPUPackage(threadCPUs[idx]) == pkg)
+            local.push_back(idx);
+        if(!local.empty())
+          nearest[cpu] = local[cpu % local.size()];
+      }
+      cpuWorker.swap(nearest);
+      return true;
+    }
+
+    void
+    WorkStealingPool::Wake(size_t n)
+    {
+      // only touch the sleep lock if someone is sleeping
+      if(idle == 0)
+        return;
+      {
+        lock_t lock(sleep_mutex);
+      }
+      if(n >= workers.size())
+        condition.notify_all();
+      else
+        while(n--)
+          condition.notify_one();
+    }
+
+    bool
+    WorkStealingPool::QueueJob(const udap_thread_job &job, int prio)
+    {
+      // don't allow enqueueing after stopping the pool
+      if(stop || !Reserve(1))
+        return false;
+      size_t idx = PickWorker();
+      // count it before it is visible so a thief never sees pending underflow
+      ++pending;
+      {
+        Worker *w = workers[idx].get();
+        lock_t lock(w->mutex);
+        w->jobs.Push(job, prio, udap_time_now_ns());
+      }
+      CountQueued(prio, 1);
+      Wake(1);
+      return true;
+    }
+
+    size_t
+    WorkStealingPool::QueueJobs(const udap_thread_job *batch, size_t n,
+                                int prio)
+    {
+      if(stop)
+        return 0;
+      n = Reserve(n);
+      if(n == 0)
+        return 0;
+      // the whole batch goes to one queue, sleeping workers steal from it
+      size_t idx = PickWorker();
+      pending += n;
+      {
+        Worker *w = workers[idx].get();
+        lock_t lock(w->mutex);
+        auto now = udap_time_now_ns();
+        for(size_t i = 0; i < n; ++i)
+          w->jobs.Push(batch[i], prio, now);
+      }
+      CountQueued(prio, n);
+      Wake(n);
+      return n;
+    }
+
+    size_t
+    WorkStealingPool::Allocations()
+    {
+      size_t allocs = 0;
+      for(auto &w : workers)
+      {
+        lock_t lock(w->mutex);
+        allocs += w->jobs.Allocations();
+      }
+      return allocs;
     }
 
   }  // namespace thread
@@ -97,16 +667,32 @@ struct udap_threadpool
 {
   udap::thread::Pool *impl;
 
-  std::queue< udap_thread_job > jobs;
+  udap::thread::PriorityJobQueue jobs;
+  /// queue limit and rejections in same process mode
+  size_t maxJobs    = 0;
+  uint64_t rejected = 0;
 
-  udap_threadpool(int workers, const char *name)
-      : impl(new udap::thread::Pool(workers, name))
+  udap_threadpool(udap::thread::Pool *pool) : impl(pool)
   {
   }
 
   udap_threadpool() : impl(nullptr)
   {
   }
+
+  /// same process mode, how many of n jobs fit in the queue
+  size_t
+  Room(size_t n)
+  {
+    size_t room = n;
+    if(maxJobs)
+    {
+      size_t sz = jobs.size();
+      room      = sz >= maxJobs ? 0 : std::min(n, maxJobs - sz);
+    }
+    rejected += n - room;
+    return room;
+  }
 };
 
 extern "C" {
@@ -115,7 +701,17 @@ struct udap_threadpool *
 udap_init_threadpool(int workers, const char *name)
 {
   if(workers > 0)
-    return new udap_threadpool(workers, name);
+    return new udap_threadpool(new udap::thread::SharedPool(workers, name));
+  else
+    return nullptr;
+}
+
+struct udap_threadpool *
+udap_init_work_stealing_threadpool(int workers, const char *name)
+{
+  if(workers > 0)
+    return new udap_threadpool(
+        new udap::thread::WorkStealingPool(workers, name));
   else
     return nullptr;
 }
@@ -159,27 +755,132 @@ udap_threadpool_wait(struct udap_threadpool *pool)
   }
 }
 
-void
+bool
 udap_threadpool_queue_job(struct udap_threadpool *pool,
                            struct udap_thread_job job)
+{
+  return udap_threadpool_queue_job_prio(pool, job, UDAP_JOB_PRIO_NORMAL);
+}
+
+bool
+udap_threadpool_queue_job_prio(struct udap_threadpool *pool,
+                                struct udap_thread_job job, int prio)
+{
+  prio = udap::thread::ClampPrio(prio);
+  if(pool->impl)
+    return pool->impl->QueueJob(job, prio);
+  if(!pool->Room(1))
+    return false;
+  pool->jobs.Push(job, prio, 0);
+  return true;
+}
+
+size_t
+udap_threadpool_queue_jobs(struct udap_threadpool *pool,
+                            const struct udap_thread_job *jobs, size_t n)
+{
+  return udap_threadpool_queue_jobs_prio(pool, jobs, n, UDAP_JOB_PRIO_NORMAL);
+}
+
+size_t
+udap_threadpool_queue_jobs_prio(struct udap_threadpool *pool,
+                                 const struct udap_thread_job *jobs, size_t n,
+                                 int prio)
+{
+  if(n == 0)
+    return 0;
+  prio = udap::thread::ClampPrio(prio);
+  if(pool->impl)
+    return pool->impl->QueueJobs(jobs, n, prio);
+  n = pool->Room(n);
+  for(size_t idx = 0; idx < n; ++idx)
+    pool->jobs.Push(jobs[idx], prio, 0);
+  return n;
+}
+
+void
+udap_threadpool_set_max_jobs(struct udap_threadpool *pool, size_t max)
 {
   if(pool->impl)
-    pool->impl->QueueJob(job);
+    pool->impl->maxJobs = max;
   else
-    pool->jobs.push(job);
+    pool->maxJobs = max;
+}
+
+bool
+udap_threadpool_full(struct udap_threadpool *pool)
+{
+  if(pool->impl)
+    return pool->impl->Full();
+  return pool->maxJobs && pool->jobs.size() >= pool->maxJobs;
 }
 
 void
 udap_threadpool_tick(struct udap_threadpool *pool)
 {
-  while(pool->jobs.size())
+  udap::thread::QueuedJob job;
+  // copy out, the job may queue more jobs and grow the ring
+  while(pool->jobs.Pop(job, 0))
+    job.job.work(job.job.user);
+}
+
+void
+udap_threadpool_get_stats(struct udap_threadpool *pool,
+                           struct udap_threadpool_stats *stats)
+{
+  if(pool->impl)
+    pool->impl->GetStats(stats);
+  else
   {
-    auto &job = pool->jobs.front();
-    job.work(job.user);
-    pool->jobs.pop();
+    memset(stats, 0, sizeof(udap_threadpool_stats));
+    stats->allocations = pool->jobs.Allocations();
+    stats->rejected    = pool->rejected;
+    for(int prio = 0; prio < UDAP_JOB_NUM_PRIO; ++prio)
+      stats->classes[prio].depth = pool->jobs.classes[prio].size();
   }
 }
 
+void
+udap_threadpool_visit_job_stats(struct udap_threadpool *pool, void *user,
+                                 udap_threadpool_job_stats_visitor visit)
+{
+  if(pool->impl)
+    pool->impl->VisitJobStats(user, visit);
+}
+
+void
+udap_threadpool_record_job(struct udap_threadpool *pool,
+                           struct udap_thread_job job, uint64_t wait_ns,
+                           uint64_t run_ns)
+{
+  if(pool->impl)
+    pool->impl->RecordJob(job, wait_ns, run_ns);
+}
+
+void
+udap_threadpool_dump_stats(struct udap_threadpool *pool)
+{
+  if(pool->impl)
+    pool->impl->DumpStats();
+}
+
+bool
+udap_threadpool_set_affinity(struct udap_threadpool *pool, const int *cpus,
+                              size_t n)
+{
+  if(!pool->impl)
+    return false;
+  return pool->impl->SetAffinity(std::vector< int >(cpus, cpus + n));
+}
+
+bool
+udap_threadpool_enable_locality(struct udap_threadpool *pool)
+{
+  if(!pool->impl)
+    return false;
+  return pool->impl->EnableLocality();
+}
+
 void
 udap_free_threadpool(struct udap_threadpool **pool)
 {
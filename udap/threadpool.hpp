@@ -2,10 +2,14 @@
 #define UDAP_THREADPOOL_HPP
 
 #include <udap/threadpool.h>
+#include "histogram.hpp"
+#include "ring.hpp"
 
+#include <atomic>
 #include <condition_variable>
-#include <deque>
+#include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
 #include <vector>
 
@@ -15,22 +19,262 @@ namespace udap
   {
     typedef std::mutex mtx_t;
     typedef std::unique_lock< mtx_t > lock_t;
-    struct Pool
+
+    /// a job waiting in a queue
+    struct QueuedJob
+    {
+      udap_thread_job job;
+      /// priority class
+      int prio = UDAP_JOB_PRIO_NORMAL;
+      /// monotonic timestamp in ns of when it was queued
+      uint64_t queued = 0;
+    };
+
+    /// jobs are stored by value so queueing does not allocate
+    typedef udap::util::Ring< QueuedJob > JobQueue_t;
+
+    /// one job queue per priority class
+    /// higher classes run first unless a lower class job has waited past its
+    /// bound, so lower classes can't starve
+    /// not thread safe
+    struct PriorityJobQueue
     {
-      Pool(size_t sz, const char* name);
+      JobQueue_t classes[UDAP_JOB_NUM_PRIO];
+
+      bool
+      empty() const;
+
+      size_t
+      size() const;
+
       void
-      QueueJob(const udap_thread_job& job);
+      Push(const udap_thread_job& job, int prio, uint64_t now);
+
+      /// get the next job to run, return false if empty
+      bool
+      Pop(QueuedJob& job, uint64_t now);
+
+      /// take the newest job of the highest class for another worker, the
+      /// one that would wait longest here, return false if empty
+      bool
+      PopBack(QueuedJob& job);
+
+      size_t
+      Allocations() const;
+    };
+
+    /// latency histograms for one kind of job
+    struct JobStats
+    {
+      udap_thread_work_func work = nullptr;
+      const char* label          = nullptr;
+      /// ns spent in the queue
+      udap::util::Histogram wait;
+      /// ns spent running
+      udap::util::Histogram run;
+    };
+
+    /// base worker pool
+    struct Pool
+    {
+      Pool(const char* name);
+
+      virtual ~Pool();
+
+      /// return false if the job was rejected
+      virtual bool
+      QueueJob(const udap_thread_job& job, int prio) = 0;
+
+      /// queue n jobs under one lock acquisition
+      /// return how many of the first jobs were queued, the rest are rejected
+      virtual size_t
+      QueueJobs(const udap_thread_job* jobs, size_t n, int prio) = 0;
+
+      virtual void
+      Stop() = 0;
+
+      /// total heap allocations made by our job queues
+      virtual size_t
+      Allocations() = 0;
+
       void
       Join();
+
       void
-      Stop();
+      GetStats(udap_threadpool_stats* stats);
+
+      /// pin thread i to cpus[i % cpus.size()]
+      bool
+      SetAffinity(const std::vector< int >& cpus);
+
+      /// queue jobs from other threads on the worker pinned nearest to the
+      /// submitting cpu, return false if the pool can't do that
+      virtual bool
+      EnableLocality()
+      {
+        return false;
+      }
+
       std::vector< std::thread > threads;
-      std::deque< udap_thread_job* > jobs;
+      /// cpu each thread is pinned to, empty if not pinned
+      std::vector< int > threadCPUs;
+      std::condition_variable done;
+
+      struct ClassStats
+      {
+        std::atomic< uint64_t > queued;
+        std::atomic< uint64_t > ran;
+        std::atomic< uint64_t > wait_ns;
+        std::atomic< uint64_t > max_wait_ns;
+      };
+
+      /// per priority class counters
+      ClassStats classStats[UDAP_JOB_NUM_PRIO];
+
+      /// jobs queued and not yet started
+      std::atomic< size_t > depth;
+      /// most jobs allowed in the queue, 0 for no limit
+      std::atomic< size_t > maxJobs;
+      /// jobs rejected because the queue was full
+      std::atomic< uint64_t > rejected;
+
+      bool
+      Full() const
+      {
+        size_t max = maxJobs;
+        return max && depth >= max;
+      }
+
+      void
+      VisitJobStats(void* user, udap_threadpool_job_stats_visitor visit);
+
+      /// record a job that ran inside another one under its own kind
+      void
+      RecordJob(const udap_thread_job& job, uint64_t wait, uint64_t run);
+
+      void
+      DumpStats();
+
+      std::string name;
+      /// when the pool started in ns
+      uint64_t started;
+
+      static const size_t MaxJobKinds = 64;
+      /// stats per label or work function, filled in as jobs run
+      std::atomic< JobStats* > jobStats[MaxJobKinds];
+      /// jobs that did not fit in jobStats
+      JobStats otherJobs;
+
+     protected:
+      static void
+      SetThreadName(const char* name);
+
+      void
+      CountQueued(int prio, size_t n);
+
+      /// make room for up to n jobs, return how many fit
+      size_t
+      Reserve(size_t n);
+
+      /// give back room for n jobs that were not queued after all
+      void
+      Unreserve(size_t n);
+
+      /// run a dequeued job and record how long it waited and ran
+      void
+      Run(const QueuedJob& job);
+
+      /// find or add the stats for this kind of job
+      JobStats*
+      GetJobStats(const udap_thread_job& job);
+    };
+
+    /// all workers pull jobs from one shared queue
+    struct SharedPool : public Pool
+    {
+      SharedPool(size_t sz, const char* name);
+
+      bool
+      QueueJob(const udap_thread_job& job, int prio);
+
+      size_t
+      QueueJobs(const udap_thread_job* jobs, size_t n, int prio);
+
+      void
+      Stop();
+
+      size_t
+      Allocations();
+
+      PriorityJobQueue jobs;
 
       mtx_t queue_mutex;
       std::condition_variable condition;
-      std::condition_variable done;
       bool stop;
+      /// workers blocked on condition, guarded by queue_mutex
+      size_t idle;
+    };
+
+    /// each worker owns a job queue, idle workers steal from the others
+    struct WorkStealingPool : public Pool
+    {
+      WorkStealingPool(size_t sz, const char* name);
+
+      bool
+      QueueJob(const udap_thread_job& job, int prio);
+
+      size_t
+      QueueJobs(const udap_thread_job* jobs, size_t n, int prio);
+
+      void
+      Stop();
+
+      size_t
+      Allocations();
+
+      bool
+      EnableLocality();
+
+      struct Worker
+      {
+        mtx_t mutex;
+        PriorityJobQueue jobs;
+      };
+
+      /// run worker loop for worker at index idx
+      void
+      Work(size_t idx);
+
+      /// pick the queue a new job goes to
+      size_t
+      PickWorker();
+
+      /// wake up to n sleeping workers
+      void
+      Wake(size_t n);
+
+      /// pop a job from our own queue
+      bool
+      PopLocal(size_t idx, QueuedJob& job);
+
+      /// steal a job from another worker's queue
+      bool
+      Steal(size_t idx, QueuedJob& job);
+
+      std::vector< std::unique_ptr< Worker > > workers;
+      /// round robin index for submitters that are not workers
+      std::atomic< size_t > nextWorker;
+      /// worker nearest to each cpu when locality is enabled
+      /// workers.size() if there is none
+      std::vector< size_t > cpuWorker;
+      /// jobs queued but not yet picked up
+      std::atomic< size_t > pending;
+      /// number of workers blocked on condition
+      std::atomic< size_t > idle;
+
+      mtx_t sleep_mutex;
+      std::condition_variable condition;
+      std::atomic< bool > stop;
     };
 
   }  // namespace thread
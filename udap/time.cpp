@@ -27,4 +27,10 @@ udap_time_now_sec()
 {
   return udap::time_since_epoch< std::chrono::seconds, udap_seconds_t >();
 }
+
+udap_time_t
+udap_time_now_ns()
+{
+  return udap::time_since_epoch< std::chrono::nanoseconds, udap_time_t >();
+}
 }
@@ -2,38 +2,52 @@
 #include <udap/timer.h>
 #include <atomic>
 #include <condition_variable>
-#include <list>
-#include <unordered_map>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 #include "logger.hpp"
+#include "timer_wheel.hpp"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
 
 namespace udap
 {
-  struct timer
+  struct timer : public udap::util::TimerWheel::Entry
   {
-    void* user;
-    uint64_t called_at;
-    uint64_t started;
-    uint64_t timeout;
-    udap_timer_handler_func func;
-    bool done;
-    bool canceled;
-
-    timer(uint64_t ms = 0, void* _user = nullptr,
-          udap_timer_handler_func _func = nullptr)
-        : user(_user)
-        , called_at(0)
-        , started(udap_time_now_ms())
-        , timeout(ms)
-        , func(_func)
-        , done(false)
-        , canceled(false)
+    enum State
     {
-    }
+      /// in the free list
+      eFree,
+      /// waiting in the wheel
+      eArmed,
+      /// canceled, will be called on the next tick
+      eCanceled,
+      /// job queued to call it
+      eFiring
+    };
 
-    ~timer()
-    {
-    }
+    void* user                   = nullptr;
+    uint64_t called_at           = 0;
+    uint64_t started             = 0;
+    uint64_t timeout             = 0;
+    udap_timer_handler_func func = nullptr;
+    udap_timer_context* parent   = nullptr;
+    /// id handed out for this use of the node, 0 when free
+    uint32_t id                  = 0;
+    /// generation, bumped each time the node is reused
+    uint32_t gen                 = 0;
+    /// index of this node in the pool
+    uint32_t index               = 0;
+    /// index of the next free node
+    uint32_t nextFree            = 0;
+    State state                  = eFree;
 
     void
     exec();
@@ -43,30 +57,141 @@ namespace udap
     {
       static_cast< timer* >(user)->exec();
     }
-
-    void
-    send_job(udap_threadpool* pool)
-    {
-      udap_threadpool_queue_job(pool, {this, timer::call});
-    }
   };
 };  // namespace udap
 
 struct udap_timer_context
 {
+  /// timer ids are the node index + 1 in the low bits and the node's
+  /// generation in the high bits, so stale ids don't hit reused nodes
+  static const uint32_t IndexBits = 20;
+  static const uint32_t IndexMask = (1 << IndexBits) - 1;
+  /// most timers alive at once
+  static const uint32_t MaxTimers = IndexMask;
+  static const uint32_t ChunkBits = 10;
+  static const uint32_t ChunkSize = 1 << ChunkBits;
+  static const uint32_t NoFree    = UINT32_MAX;
+
   std::mutex timersMutex;
-  std::unordered_map< uint32_t, udap::timer* > timers;
+  udap::util::TimerWheel wheel;
+  /// node pool, allocated in chunks that never move
+  std::vector< std::unique_ptr< udap::timer[] > > chunks;
+  uint32_t numNodes = 0;
+  uint32_t freeList = NoFree;
+  /// canceled timers to call on the next tick
+  std::vector< udap::timer* > canceled;
+
   std::mutex tickerMutex;
   std::condition_variable* ticker       = nullptr;
   std::chrono::milliseconds nextTickLen = std::chrono::milliseconds(100);
 
-  uint32_t ids = 0;
-  bool _run    = true;
+  /// armed for the next deadline
+  int timerfd = -1;
+  /// written to wake up the ticker from other threads
+  int wakefd = -1;
+  /// epoll fd watching both, readable when we should tick
+  int pollfd = -1;
+  /// deadline timerfd is armed for
+  uint64_t armedFor = UINT64_MAX;
+
+  bool _run = true;
+
+  udap_timer_context() : wheel(udap_time_now_ms())
+  {
+#ifdef __linux__
+    timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    wakefd  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    pollfd  = epoll_create1(EPOLL_CLOEXEC);
+    bool ok = timerfd != -1 && wakefd != -1 && pollfd != -1;
+    for(int fd : {timerfd, wakefd})
+    {
+      epoll_event ev;
+      ev.events  = EPOLLIN;
+      ev.data.fd = fd;
+      ok         = ok && epoll_ctl(pollfd, EPOLL_CTL_ADD, fd, &ev) != -1;
+    }
+    if(!ok)
+    {
+      udap::Warn("no timerfd, falling back to polling timers");
+      close_fds();
+    }
+#endif
+  }
 
   ~udap_timer_context()
   {
     if(ticker)
       delete ticker;
+    close_fds();
+  }
+
+  void
+  close_fds()
+  {
+#ifdef __linux__
+    for(int* fd : {&timerfd, &wakefd, &pollfd})
+    {
+      if(*fd != -1)
+        ::close(*fd);
+      *fd = -1;
+    }
+#endif
+  }
+
+  /// arm timerfd for deadline in ms, must hold timersMutex
+  void
+  arm(uint64_t deadline)
+  {
+#ifdef __linux__
+    if(timerfd == -1 || deadline == armedFor)
+      return;
+    itimerspec spec = {{0, 0}, {0, 0}};
+    if(deadline != UINT64_MAX)
+    {
+      // an all zero it_value disarms, already due means fire right away
+      if(deadline == 0)
+        deadline = 1;
+      spec.it_value.tv_sec  = deadline / 1000;
+      spec.it_value.tv_nsec = (deadline % 1000) * 1000000;
+    }
+    if(timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &spec, nullptr) == -1)
+      udap::Warn("timerfd_settime: ", strerror(errno));
+    armedFor = deadline;
+#else
+    (void)deadline;
+#endif
+  }
+
+  /// make the ticker tick soon, from any thread
+  void
+  wake()
+  {
+#ifdef __linux__
+    if(wakefd == -1)
+      return;
+    uint64_t one = 1;
+    auto val     = ::write(wakefd, &one, sizeof(one));
+    (void)val;
+#endif
+  }
+
+  /// clear readiness before ticking
+  void
+  drain()
+  {
+#ifdef __linux__
+    uint64_t val;
+    if(timerfd != -1)
+    {
+      auto r = ::read(timerfd, &val, sizeof(val));
+      (void)r;
+    }
+    if(wakefd != -1)
+    {
+      auto r = ::read(wakefd, &val, sizeof(val));
+      (void)r;
+    }
+#endif
   }
 
   bool
@@ -79,56 +204,188 @@ struct udap_timer_context
   stop()
   {
     _run = false;
+    wake();
+  }
+
+  udap::timer*
+  node(uint32_t index)
+  {
+    return &chunks[index >> ChunkBits][index & (ChunkSize - 1)];
+  }
+
+  udap::timer*
+  alloc()
+  {
+    if(freeList == NoFree)
+    {
+      if(numNodes >= MaxTimers)
+        return nullptr;
+      chunks.emplace_back(new udap::timer[ChunkSize]);
+      // thread the new nodes onto the free list
+      for(uint32_t idx = 0; idx < ChunkSize && numNodes < MaxTimers; ++idx)
+      {
+        udap::timer* t = node(numNodes);
+        t->index       = numNodes;
+        t->parent      = this;
+        t->nextFree    = freeList;
+        freeList       = numNodes++;
+      }
+    }
+    udap::timer* t = node(freeList);
+    freeList       = t->nextFree;
+    if(++t->gen > (UINT32_MAX >> IndexBits))
+      t->gen = 0;
+    t->id = (t->gen << IndexBits) | (t->index + 1);
+    return t;
+  }
+
+  void
+  release(udap::timer* t)
+  {
+    t->state    = udap::timer::eFree;
+    t->id       = 0;
+    t->func     = nullptr;
+    t->user     = nullptr;
+    t->nextFree = freeList;
+    freeList    = t->index;
+  }
+
+  /// find live timer by id
+  udap::timer*
+  find(uint32_t id)
+  {
+    uint32_t index = id & IndexMask;
+    if(index == 0 || index > numNodes)
+      return nullptr;
+    udap::timer* t = node(index - 1);
+    if(t->id != id)
+      return nullptr;
+    return t;
   }
 
   void
   cancel(uint32_t id)
   {
     std::unique_lock< std::mutex > lock(timersMutex);
-    auto itr = timers.find(id);
-    if(itr == timers.end())
+    udap::timer* t = find(id);
+    if(t == nullptr || t->state != udap::timer::eArmed)
       return;
-    itr->second->canceled = true;
+    wheel.Remove(t);
+    t->state = udap::timer::eCanceled;
+    canceled.push_back(t);
+    wake();
   }
 
   void
   remove(uint32_t id)
   {
     std::unique_lock< std::mutex > lock(timersMutex);
-    auto itr = timers.find(id);
-    if(itr == timers.end())
+    udap::timer* t = find(id);
+    if(t == nullptr)
       return;
-    itr->second->func     = nullptr;
-    itr->second->canceled = true;
+    switch(t->state)
+    {
+      case udap::timer::eArmed:
+        wheel.Remove(t);
+        release(t);
+        break;
+      case udap::timer::eCanceled:
+        // released when the tick gets to it
+        t->func = nullptr;
+        break;
+      case udap::timer::eFiring:
+        // the queued job releases it
+        t->func = nullptr;
+        break;
+      default:
+        break;
+    }
   }
 
   uint32_t
   call_later(void* user, udap_timer_handler_func func, uint64_t timeout_ms)
   {
     std::unique_lock< std::mutex > lock(timersMutex);
-    uint32_t id = ++ids;
-    timers[id]  = new udap::timer(timeout_ms, user, func);
-    return id;
+    udap::timer* t = alloc();
+    if(t == nullptr)
+    {
+      udap::Error("too many timers");
+      return 0;
+    }
+    t->user      = user;
+    t->func      = func;
+    t->timeout   = timeout_ms;
+    t->started   = udap_time_now_ms();
+    t->called_at = 0;
+    t->expires   = t->started + timeout_ms;
+    t->state     = udap::timer::eArmed;
+    wheel.Add(t);
+    if(t->expires < armedFor)
+      arm(t->expires);
+    return t->id;
   }
 
-  void
-  cancel_all()
+  /// queue a job to call t, return false if the pool would not take it
+  bool
+  fire(udap::timer* t, uint64_t now, udap_threadpool* pool)
   {
-    std::list< uint32_t > ids;
-
+    if(t->func == nullptr)
     {
-      std::unique_lock< std::mutex > lock(timersMutex);
+      // removed while canceled
+      release(t);
+      return true;
+    }
+    auto state   = t->state;
+    t->called_at = now;
+    t->state     = udap::timer::eFiring;
+    if(udap_threadpool_queue_job(pool, {t, &udap::timer::call}))
+      return true;
+    t->state = state;
+    return false;
+  }
 
-      for(auto& item : timers)
+  /// call everything due, must hold timersMutex
+  void
+  tick(udap_threadpool* pool)
+  {
+    if(!run())
+      return;
+    drain();
+    auto now    = udap_time_now_ms();
+    size_t kept = 0;
+    for(auto t : canceled)
+    {
+      // keep it for the next tick if the pool is full
+      if(!fire(t, now, pool))
+        canceled[kept++] = t;
+    }
+    canceled.resize(kept);
+    wheel.Advance(now, [&](udap::util::TimerWheel::Entry* e) {
+      udap::timer* t = static_cast< udap::timer* >(e);
+      if(!fire(t, now, pool))
       {
-        ids.push_back(item.first);
+        t->expires = now + 1;
+        wheel.Add(t);
       }
-    }
+    });
+    // canceled timers the pool did not take need another tick right away
+    arm(canceled.size() ? 0 : wheel.NextExpiry());
+  }
 
-    for(auto id : ids)
+  /// drop every timer that is not being called right now
+  void
+  clear()
+  {
+    std::unique_lock< std::mutex > lock(timersMutex);
+    for(uint32_t idx = 0; idx < numNodes; ++idx)
     {
-      cancel(id);
+      udap::timer* t = node(idx);
+      if(t->state == udap::timer::eArmed)
+        wheel.Remove(t);
+      if(t->state == udap::timer::eArmed || t->state == udap::timer::eCanceled)
+        release(t);
     }
+    canceled.clear();
   }
 };
 
@@ -140,6 +397,12 @@ udap_init_timer()
   return new udap_timer_context;
 }
 
+int
+udap_timer_fd(struct udap_timer_context* t)
+{
+  return t->pollfd;
+}
+
 uint32_t
 udap_timer_call_later(struct udap_timer_context* t,
                        struct udap_timeout_job job)
@@ -166,7 +429,7 @@ udap_timer_stop(struct udap_timer_context* t)
 {
   // destroy all timers
   // don't call callbacks on timers
-  t->timers.clear();
+  t->clear();
   t->stop();
   if(t->ticker)
     t->ticker->notify_all();
@@ -182,40 +445,31 @@ void
 udap_timer_tick_all(struct udap_timer_context* t,
                      struct udap_threadpool* pool)
 {
-  if(!t->run())
-    return;
-  auto now = udap_time_now_ms();
-  auto itr = t->timers.begin();
-  while(itr != t->timers.end())
+  std::unique_lock< std::mutex > lock(t->timersMutex);
+  t->tick(pool);
+}
+
+void
+udap_timer_run(struct udap_timer_context* t, struct udap_threadpool* pool)
+{
+#ifdef __linux__
+  if(t->pollfd != -1)
   {
-    if(now - itr->second->started >= itr->second->timeout
-       || itr->second->canceled)
+    // sleep until the next deadline or a wakeup
+    while(t->run())
     {
-      if(itr->second->func && itr->second->called_at == 0)
-      {
-        // timer hit
-        itr->second->called_at = now;
-        itr->second->send_job(pool);
-        ++itr;
-      }
-      else if(itr->second->done)
+      epoll_event events[2];
+      if(epoll_wait(t->pollfd, events, 2, -1) == -1 && errno != EINTR)
       {
-        // remove timer
-        udap::timer* timer = itr->second;
-        itr                 = t->timers.erase(itr);
-        delete timer;
+        udap::Error("timer epoll_wait: ", strerror(errno));
+        break;
       }
-      else
-        ++itr;
+      if(t->run())
+        udap_timer_tick_all(t, pool);
     }
-    else  // timer not hit yet
-      ++itr;
+    return;
   }
-}
-
-void
-udap_timer_run(struct udap_timer_context* t, struct udap_threadpool* pool)
-{
+#endif
   t->ticker = new std::condition_variable;
   while(t->run())
   {
@@ -228,7 +482,6 @@ udap_timer_run(struct udap_timer_context* t, struct udap_threadpool* pool)
 
     if(t->run())
     {
-      std::unique_lock< std::mutex > lock(t->timersMutex);
       // we woke up
       udap_timer_tick_all(t, pool);
     }
@@ -241,18 +494,18 @@ namespace udap
   void
   timer::exec()
   {
-    if(func)
+    udap_timer_handler_func call;
+    uint64_t left = 0;
     {
+      std::unique_lock< std::mutex > lock(parent->timersMutex);
+      call     = func;
       auto diff = called_at - started;
-      // zero out function pointer before call to prevent multiple calls being
-      // queued if call takes longer than 1 timer tick
-      auto call = func;
-      func      = nullptr;
-      if(diff >= timeout)
-        call(user, timeout, 0);
-      else
-        call(user, timeout, diff);
+      if(diff < timeout)
+        left = timeout - diff;
     }
-    done = true;
+    if(call)
+      call(user, timeout, left);
+    std::unique_lock< std::mutex > lock(parent->timersMutex);
+    parent->release(this);
   }
 }
@@ -0,0 +1,285 @@
+#ifndef UDAP_TIMER_WHEEL_HPP
+#define UDAP_TIMER_WHEEL_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace udap
+{
+  namespace util
+  {
+    /// hierarchical timing wheel with 1 ms slots
+    /// the root level covers the next 256 ms, each higher level covers 64
+    /// times more, timers further out than ~49 days are clamped
+    /// add, remove and expiry are O(1), timers on higher levels are moved
+    /// down a level when the level below wraps around
+    /// entries are intrusive so the wheel never allocates
+    /// not thread safe
+    struct TimerWheel
+    {
+      struct Entry
+      {
+        Entry* prev = nullptr;
+        Entry* next = nullptr;
+        /// ms timestamp this entry expires at
+        uint64_t expires = 0;
+
+        bool
+        linked() const
+        {
+          return next != nullptr;
+        }
+      };
+
+      static const size_t RootBits  = 8;
+      static const size_t LevelBits = 6;
+      /// levels above root
+      static const size_t Levels    = 4;
+      static const size_t RootSize  = 1 << RootBits;
+      static const size_t LevelSize = 1 << LevelBits;
+      /// furthest out a timer can be, in ms
+      static const uint64_t MaxDelta =
+          (uint64_t(1) << (RootBits + Levels * LevelBits)) - 1;
+
+      TimerWheel(uint64_t now) : m_Now(now), m_Size(0)
+      {
+        m_Due.prev = m_Due.next = &m_Due;
+        for(auto& head : m_Root)
+          head.prev = head.next = &head;
+        for(auto& level : m_Levels)
+          for(auto& head : level)
+            head.prev = head.next = &head;
+      }
+
+      TimerWheel(const TimerWheel&) = delete;
+
+      TimerWheel&
+      operator=(const TimerWheel&) = delete;
+
+      /// number of entries in the wheel
+      size_t
+      size() const
+      {
+        return m_Size;
+      }
+
+      /// the next ms that Advance will process
+      uint64_t
+      now() const
+      {
+        return m_Now;
+      }
+
+      /// earliest ms Advance may expire something, UINT64_MAX if empty
+      uint64_t
+      NextExpiry() const
+      {
+        if(m_Size == 0)
+          return UINT64_MAX;
+        if(m_Due.next != &m_Due)
+          return 0;
+        uint64_t next = LevelsExpiry();
+        for(uint64_t when = m_Now; when < m_Now + RootSize && when < next;
+            ++when)
+        {
+          const Entry& head = m_Root[when & (RootSize - 1)];
+          if(head.next != &head)
+            return when;
+        }
+        return next;
+      }
+
+      /// add e, expiring at e->expires
+      /// entries whose slot already went by expire on the next Advance
+      void
+      Add(Entry* e)
+      {
+        uint64_t expires = e->expires;
+        if(expires < m_Now)
+        {
+          // its slot went by already
+          Link(m_Due, e);
+          return;
+        }
+        uint64_t delta = expires - m_Now;
+        if(delta > MaxDelta)
+        {
+          // it will be put back on a lower level when this slot cascades
+          delta   = MaxDelta;
+          expires = m_Now + MaxDelta;
+        }
+        Entry* head;
+        if(delta < RootSize)
+          head = &m_Root[expires & (RootSize - 1)];
+        else
+        {
+          size_t level = 1;
+          while(delta >= (uint64_t(1) << (RootBits + level * LevelBits)))
+            ++level;
+          size_t shift = RootBits + (level - 1) * LevelBits;
+          head = &m_Levels[level - 1][(expires >> shift) & (LevelSize - 1)];
+          if(!m_LevelsStale && e->expires < m_LevelsMin)
+            m_LevelsMin = e->expires;
+        }
+        Link(*head, e);
+      }
+
+      /// remove e if it is in the wheel
+      void
+      Remove(Entry* e)
+      {
+        if(!e->linked())
+          return;
+        // it may have been the earliest on the higher levels
+        if(e->expires <= m_LevelsMin)
+          m_LevelsStale = true;
+        Unlink(e);
+        --m_Size;
+      }
+
+      /// expire every entry due at or before now
+      /// expire(Entry*) is called with each entry after it is removed, it may
+      /// add and remove entries
+      template < typename Func >
+      void
+      Advance(uint64_t now, Func expire)
+      {
+        Entry due;
+        Splice(m_Due, due);
+        Expire(due, expire);
+        while(m_Now <= now)
+        {
+          if(m_Size == 0)
+          {
+            // nothing to cascade or expire, jump ahead
+            m_Now         = now + 1;
+            m_LevelsMin   = UINT64_MAX;
+            m_LevelsStale = false;
+            return;
+          }
+          size_t idx = m_Now & (RootSize - 1);
+          // root wrapped around, pull down the next level's slot and so on
+          for(size_t level = 0; idx == 0 && level < Levels; ++level)
+          {
+            size_t shift = RootBits + level * LevelBits;
+            idx          = (m_Now >> shift) & (LevelSize - 1);
+            Cascade(m_Levels[level][idx]);
+          }
+          Splice(m_Root[m_Now & (RootSize - 1)], due);
+          // entries added from expire for now go in the next slot
+          ++m_Now;
+          Expire(due, expire);
+        }
+      }
+
+     private:
+      void
+      Link(Entry& head, Entry* e)
+      {
+        e->prev         = head.prev;
+        e->next         = &head;
+        head.prev->next = e;
+        head.prev       = e;
+        ++m_Size;
+      }
+
+      template < typename Func >
+      void
+      Expire(Entry& list, Func& expire)
+      {
+        while(list.next != &list)
+        {
+          Entry* e = list.next;
+          Unlink(e);
+          --m_Size;
+          expire(e);
+        }
+      }
+
+      static void
+      Unlink(Entry* e)
+      {
+        e->prev->next = e->next;
+        e->next->prev = e->prev;
+        e->prev = e->next = nullptr;
+      }
+
+      /// move every entry in from into the empty list to
+      static void
+      Splice(Entry& from, Entry& to)
+      {
+        if(from.next == &from)
+        {
+          to.prev = to.next = &to;
+          return;
+        }
+        to.next       = from.next;
+        to.prev       = from.prev;
+        to.next->prev = &to;
+        to.prev->next = &to;
+        from.prev = from.next = &from;
+      }
+
+      /// earliest expiry on the higher levels, only the next non-empty slot
+      /// of each level can hold it so only those are walked, and only after
+      /// something that may have been it went away
+      uint64_t
+      LevelsExpiry() const
+      {
+        if(!m_LevelsStale)
+          return m_LevelsMin;
+        uint64_t next = UINT64_MAX;
+        for(size_t level = 0; level < Levels; ++level)
+        {
+          size_t shift = RootBits + level * LevelBits;
+          size_t cur   = (m_Now >> shift) & (LevelSize - 1);
+          // the current slot already cascaded, anything in it is a whole
+          // turn of this level away
+          for(size_t n = 1; n <= LevelSize; ++n)
+          {
+            const Entry& head = m_Levels[level][(cur + n) & (LevelSize - 1)];
+            if(head.next == &head)
+              continue;
+            for(const Entry* e = head.next; e != &head; e = e->next)
+              if(e->expires < next)
+                next = e->expires;
+            break;
+          }
+        }
+        m_LevelsMin   = next;
+        m_LevelsStale = false;
+        return next;
+      }
+
+      /// re add entries from a higher level slot so they land lower down
+      void
+      Cascade(Entry& head)
+      {
+        if(head.next == &head)
+          return;
+        m_LevelsStale = true;
+        Entry list;
+        Splice(head, list);
+        while(list.next != &list)
+        {
+          Entry* e = list.next;
+          Unlink(e);
+          --m_Size;
+          Add(e);
+        }
+      }
+
+      uint64_t m_Now;
+      size_t m_Size;
+      /// earliest expiry on the higher levels, unless it is stale
+      mutable uint64_t m_LevelsMin = UINT64_MAX;
+      mutable bool m_LevelsStale   = false;
+      /// added after their slot went by, expire on the next Advance
+      Entry m_Due;
+      Entry m_Root[RootSize];
+      Entry m_Levels[Levels][LevelSize];
+    };
+  }  // namespace util
+}  // namespace udap
+
+#endif